@@ -0,0 +1,471 @@
+// BatchRT : Headless batch renderer, renders camera animations of the CPURT scenes to numbered images.
+//
+
+#include <Core/RayTracing/CPUTracer.hpp>
+#include <Core/RayTracing/ImageOutput.hpp>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+struct Options
+{
+	uint32_t	Width = 1280,
+				Height = 720,
+				Samples = 64,
+				Bounces = 7,
+				Threads = 0,
+				SceneSeed = 0,
+				GridExtent = 11,
+				Triangles = 1 << 20,
+				Instances = 10000;
+	// Per frame time budget, a frame stops at Samples or once it ran this long. 0 renders every frame to Samples
+	double		FrameSeconds = 0.;
+	RTTraceMode	Mode = RTTraceMode::Megakernel;
+	SamplerType	Sampler = SamplerType::Sobol;
+	std::string	Scene = "rtiaw";
+	bool		ToneMap = false;
+	DisplaySettings	Display;
+	// Keyframe file, an orbit around the scene's camera without one
+	std::string	Keys;
+	float		FPS = 24.f;
+	// Renders the first Frames frames only while not 0
+	uint32_t	Frames = 0;
+	// Frame file pattern with one %d or zero padded %04d for the frame number and %% for a %, PNG, EXR or PFM by the extension
+	std::string	Output = "BatchRT_%04d.png";
+	// Output split around the frame number
+	std::string	OutputPrefix,
+				OutputSuffix;
+	uint32_t	OutputDigits = 0;
+};
+
+struct CameraKey
+{
+	float		Time = 0.f;
+	glm::vec3	Position = glm::vec3(0.f),
+				LookAt = glm::vec3(0.f);
+	float		FOV = 20.f,
+				FocalDist = 10.f,
+				DefocusAngle = 0.f;
+};
+
+// Everything a frame needs besides the scene, prepared on the frame thread while the previous frame renders
+struct FrameSetup
+{
+	uint32_t	Frame = 0;
+	float		Time = 0.f;
+	RTCameraSD	Camera;
+	std::string	Path;
+};
+
+static void PrintUsage()
+{
+	printf("Usage: BatchRT [--width N] [--height N] [--spp N] [--frame-seconds S] [--bounces N] [--threads N] [--seed N] [--grid N] [--scene rtiaw|cornell|meshes|instances] [--triangles N] [--instances N] [--mode megakernel|packets|wavefront] [--sampler pcg|sobol|bluenoise] [--tonemap none|aces|agx] [--exposure stops] [--keys file] [--fps N] [--frames N] [--out frame_%%04d.png|exr|pfm]\n");
+	printf("--out takes one %%d, or %%0Nd to zero pad the frame number to N digits, %%%% writes a %%\n");
+	printf("Keyframe files hold one key per line: time px py pz lookx looky lookz [fov [focal distance [defocus angle]]], '#' starts a comment\n");
+}
+
+// Splits a frame file pattern around its one %d or %0Nd, %% stands for a literal %. False for any other use of %
+static bool ParseFramePattern(const std::string& pattern, std::string& prefix, uint32_t& digits, std::string& suffix)
+{
+	bool found = false;
+	prefix.clear();
+	suffix.clear();
+	digits = 0;
+	for (size_t i = 0; i < pattern.size(); ++i)
+	{
+		std::string& part = found ? suffix : prefix;
+		if (pattern[i] != '%')
+		{
+			part += pattern[i];
+			continue;
+		}
+		if (i + 1 < pattern.size() && pattern[i + 1] == '%')
+		{
+			part += '%';
+			++i;
+			continue;
+		}
+
+		// %d, or %0Nd for zero padding to N digits
+		size_t end = i + 1;
+		if (end < pattern.size() && pattern[end] == '0')
+		{
+			++end;
+			while (end < pattern.size() && isdigit(static_cast<unsigned char>(pattern[end])))
+				digits = digits * 10 + (pattern[end++] - '0');
+			if (digits == 0 || digits > 9)
+				return false;
+		}
+		if (found || end >= pattern.size() || pattern[end] != 'd')
+			return false;
+		found = true;
+		i = end;
+	}
+	return found;
+}
+
+static std::string FramePath(const Options& opt, uint32_t frame)
+{
+	std::string number = std::to_string(frame);
+	if (number.size() < opt.OutputDigits)
+		number.insert(0, opt.OutputDigits - number.size(), '0');
+	return opt.OutputPrefix + number + opt.OutputSuffix;
+}
+
+static bool ParseArgs(int argc, char** argv, Options& opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "-h"))
+			return false;
+		if (i + 1 >= argc)
+		{
+			printf("Missing value for %s\n", arg);
+			return false;
+		}
+
+		const char* value = argv[++i];
+		if (!strcmp(arg, "--width"))				opt.Width = std::stoul(value);
+		else if (!strcmp(arg, "--height"))			opt.Height = std::stoul(value);
+		else if (!strcmp(arg, "--spp"))				opt.Samples = std::stoul(value);
+		else if (!strcmp(arg, "--frame-seconds"))	opt.FrameSeconds = std::stod(value);
+		else if (!strcmp(arg, "--bounces"))			opt.Bounces = std::stoul(value);
+		else if (!strcmp(arg, "--threads"))			opt.Threads = std::stoul(value);
+		else if (!strcmp(arg, "--seed"))			opt.SceneSeed = std::stoul(value);
+		else if (!strcmp(arg, "--grid"))			opt.GridExtent = std::stoul(value);
+		else if (!strcmp(arg, "--triangles"))		opt.Triangles = std::stoul(value);
+		else if (!strcmp(arg, "--instances"))		opt.Instances = std::stoul(value);
+		else if (!strcmp(arg, "--keys"))			opt.Keys = value;
+		else if (!strcmp(arg, "--fps"))				opt.FPS = std::stof(value);
+		else if (!strcmp(arg, "--frames"))			opt.Frames = std::stoul(value);
+		else if (!strcmp(arg, "--out"))				opt.Output = value;
+		else if (!strcmp(arg, "--scene"))
+		{
+			if (strcmp(value, "rtiaw") && strcmp(value, "cornell") && strcmp(value, "meshes") && strcmp(value, "instances"))
+			{
+				printf("Unknown scene %s\n", value);
+				return false;
+			}
+			opt.Scene = value;
+		}
+		else if (!strcmp(arg, "--mode"))
+		{
+			if (!strcmp(value, "megakernel"))		opt.Mode = RTTraceMode::Megakernel;
+			else if (!strcmp(value, "packets"))		opt.Mode = RTTraceMode::Packets;
+			else if (!strcmp(value, "wavefront"))	opt.Mode = RTTraceMode::Wavefront;
+			else
+			{
+				printf("Unknown mode %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--sampler"))
+		{
+			if (!strcmp(value, "pcg"))				opt.Sampler = SamplerType::PCG;
+			else if (!strcmp(value, "sobol"))		opt.Sampler = SamplerType::Sobol;
+			else if (!strcmp(value, "bluenoise"))	opt.Sampler = SamplerType::BlueNoise;
+			else
+			{
+				printf("Unknown sampler %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--tonemap"))
+		{
+			opt.ToneMap = true;
+			if (!strcmp(value, "none"))			opt.Display.Curve = ToneCurve::None;
+			else if (!strcmp(value, "aces"))	opt.Display.Curve = ToneCurve::ACES;
+			else if (!strcmp(value, "agx"))		opt.Display.Curve = ToneCurve::AgX;
+			else
+			{
+				printf("Unknown tone curve %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--exposure"))
+		{
+			opt.ToneMap = true;
+			opt.Display.Exposure = std::stof(value);
+		}
+		else
+		{
+			printf("Unknown argument %s\n", arg);
+			return false;
+		}
+	}
+
+	if (!ParseFramePattern(opt.Output, opt.OutputPrefix, opt.OutputDigits, opt.OutputSuffix))
+	{
+		printf("--out needs exactly one %%d or %%0Nd for the frame number, other %% signs written as %%%%: %s\n", opt.Output.c_str());
+		return false;
+	}
+	ImageFormat format;
+	if (!GetImageFormat(opt.Output, format))
+	{
+		printf("Frames are written as PNG, EXR or PFM, not %s\n", opt.Output.c_str());
+		return false;
+	}
+	return opt.Width > 0 && opt.Height > 0 && opt.Samples > 0 && opt.FPS > 0.f;
+}
+
+// Keys sorted by time, false if the file is missing or a line doesn't parse
+static bool LoadKeys(const std::string& path, const CameraKey& defaults, std::vector<CameraKey>& keys)
+{
+	FILE* file = fopen(path.c_str(), "r");
+	if (!file)
+		return false;
+
+	char line[512];
+	uint32_t lineNumber = 0;
+	bool loaded = true;
+	while (loaded && fgets(line, sizeof(line), file))
+	{
+		++lineNumber;
+		if (char* comment = strchr(line, '#'))
+			*comment = '\0';
+		CameraKey key = defaults;
+		const int fields = sscanf(line, "%f %f %f %f %f %f %f %f %f %f", &key.Time, &key.Position.x, &key.Position.y, &key.Position.z,
+			&key.LookAt.x, &key.LookAt.y, &key.LookAt.z, &key.FOV, &key.FocalDist, &key.DefocusAngle);
+		if (fields <= 0)
+			continue;
+		if (fields < 7 || (!keys.empty() && key.Time <= keys.back().Time))
+		{
+			printf("%s:%u: expected time px py pz lookx looky lookz [fov [focal distance [defocus angle]]] after the previous key's time\n", path.c_str(), lineNumber);
+			loaded = false;
+		}
+		keys.push_back(key);
+	}
+	fclose(file);
+	return loaded && !keys.empty();
+}
+
+// Catmull-Rom through the keys, held at the first and last one outside their times
+static CameraKey InterpolateKeys(const std::vector<CameraKey>& keys, float time)
+{
+	if (time <= keys.front().Time)
+		return keys.front();
+	if (time >= keys.back().Time)
+		return keys.back();
+
+	size_t i = 0;
+	while (keys[i + 1].Time < time)
+		++i;
+	const CameraKey& k0 = keys[i > 0 ? i - 1 : 0];
+	const CameraKey& k1 = keys[i];
+	const CameraKey& k2 = keys[i + 1];
+	const CameraKey& k3 = keys[std::min(i + 2, keys.size() - 1)];
+	const float t = (time - k1.Time) / (k2.Time - k1.Time), t2 = t * t, t3 = t2 * t;
+	auto spline = [&](const auto& p0, const auto& p1, const auto& p2, const auto& p3)
+	{
+		return 0.5f * (2.f * p1 + (p2 - p0) * t + (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * t2 + (3.f * p1 - p0 - 3.f * p2 + p3) * t3);
+	};
+
+	CameraKey key;
+	key.Time = time;
+	key.Position = spline(k0.Position, k1.Position, k2.Position, k3.Position);
+	key.LookAt = spline(k0.LookAt, k1.LookAt, k2.LookAt, k3.LookAt);
+	key.FOV = spline(k0.FOV, k1.FOV, k2.FOV, k3.FOV);
+	key.FocalDist = std::max(spline(k0.FocalDist, k1.FocalDist, k2.FocalDist, k3.FocalDist), 1e-3f);
+	key.DefocusAngle = std::max(spline(k0.DefocusAngle, k1.DefocusAngle, k2.DefocusAngle, k3.DefocusAngle), 0.f);
+	return key;
+}
+
+// Resolves a frame's accumulation to the output format and writes it, on the frame thread while the next frame renders.
+// rgba8 is the display transform's and only read with --tonemap, the float formats get the mean radiance
+static bool WriteFrame(const Options& opt, const std::string& path, const std::vector<glm::vec4>& accumulated, const std::vector<uint32_t>& rgba8)
+{
+	ImageDesc desc;
+	GetImageFormat(path, desc.Format);
+	desc.Width = opt.Width;
+	desc.Height = opt.Height;
+
+	ImageOutput image;
+	if (!image.Open(path, desc))
+		return false;
+	const uint32_t bandRows = 32;
+	std::vector<uint8_t> bytes(static_cast<size_t>(opt.Width) * bandRows * 3);
+	std::vector<float> values(bytes.size());
+	for (uint32_t y = 0; y < opt.Height; y += bandRows)
+	{
+		const uint32_t rows = std::min(bandRows, opt.Height - y);
+		const size_t first = static_cast<size_t>(y) * opt.Width;
+		for (size_t i = 0; i < static_cast<size_t>(rows) * opt.Width; ++i)
+		{
+			const glm::vec4& sum = accumulated[first + i];
+			const glm::vec3 radiance = glm::vec3(sum) / std::max(sum.w, 1.f);
+			if (desc.Format != ImageFormat::PNG)
+			{
+				values[i * 3 + 0] = radiance.x;
+				values[i * 3 + 1] = radiance.y;
+				values[i * 3 + 2] = radiance.z;
+			}
+			else if (opt.ToneMap)
+			{
+				const uint32_t rgba = rgba8[first + i];
+				bytes[i * 3 + 0] = static_cast<uint8_t>(rgba & 0xff);
+				bytes[i * 3 + 1] = static_cast<uint8_t>((rgba >> 8) & 0xff);
+				bytes[i * 3 + 2] = static_cast<uint8_t>((rgba >> 16) & 0xff);
+			}
+			else
+			{
+				// Clipped sqrt like the tracer's output
+				const glm::vec3 c = glm::sqrt(radiance);
+				for (int j = 0; j < 3; ++j)
+					bytes[i * 3 + j] = static_cast<uint8_t>(glm::clamp(c[j], 0.f, 1.f) * 255.f);
+			}
+		}
+		if (desc.Format == ImageFormat::PNG)
+			image.SubmitTile(0, y, opt.Width, rows, bytes.data(), 3, static_cast<size_t>(opt.Width) * 3);
+		else
+			image.SubmitTile(0, y, opt.Width, rows, values.data(), 3, static_cast<size_t>(opt.Width) * 3);
+	}
+	return image.Close();
+}
+
+int main(int argc, char** argv)
+{
+	Options opt;
+	if (!ParseArgs(argc, argv, opt))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// The scene's camera is the default of every key, the mesh scenes use the Cornell box's like CPURT
+	const bool cornell = opt.Scene != "rtiaw";
+	CameraKey defaults;
+	if (cornell)
+		defaults = { 0.f, { 50.f, 40.f, 165.f }, { 50.f, 36.f, 0.f }, 45.f, 100.f, 0.f };
+	else
+		defaults = { 0.f, { 13.f, 2.f, 3.f }, { 0.f, 0.f, 0.f }, 20.f, 10.f, 0.6f };
+	std::vector<CameraKey> keys;
+	if (!opt.Keys.empty())
+	{
+		if (!LoadKeys(opt.Keys, defaults, keys))
+		{
+			printf("Failed to load the keyframes of %s\n", opt.Keys.c_str());
+			return 1;
+		}
+	}
+	else
+	{
+		// Two seconds around the look at point, a key every quarter turn
+		const glm::vec3 offset = defaults.Position - defaults.LookAt;
+		for (uint32_t i = 0; i <= 8; ++i)
+		{
+			const float angle = glm::radians(45.f * i), c = std::cos(angle), s = std::sin(angle);
+			CameraKey key = defaults;
+			key.Time = 0.25f * i;
+			key.Position = defaults.LookAt + glm::vec3(c * offset.x + s * offset.z, offset.y, c * offset.z - s * offset.x);
+			keys.push_back(key);
+		}
+	}
+	uint32_t frameCount = static_cast<uint32_t>(std::floor((keys.back().Time - keys.front().Time) * opt.FPS + 1e-3f)) + 1;
+	if (opt.Frames > 0)
+		frameCount = std::min(frameCount, opt.Frames);
+
+	// Built once, every frame traces the same scene and BVH
+	CPUTracer tracer(opt.Width, opt.Height, opt.Threads);
+	auto buildStart = std::chrono::steady_clock::now();
+	RTScene scene = opt.Scene == "meshes" ? RTScene::CreateCornellMeshes(opt.Triangles, &tracer.GetThreadPool()) :
+					opt.Scene == "instances" ? RTScene::CreateCornellInstances(opt.Instances, opt.SceneSeed, &tracer.GetThreadPool()) :
+					cornell ? RTScene::CreateCornellBox() : RTScene::CreateRTIAWFinal(opt.SceneSeed, opt.GridExtent);
+	scene.Build(SphereBVHSettings(), &tracer.GetThreadPool());
+	double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+	printf("Scene built in %.1fms, %zu keys, %u frames of %ux%u at %u spp", buildSeconds * 1e3, keys.size(), frameCount, opt.Width, opt.Height, opt.Samples);
+	if (opt.FrameSeconds > 0.)
+		printf(" or %.2fs", opt.FrameSeconds);
+	printf(" on %u threads\n", tracer.GetThreadCount());
+
+	tracer.SetTraceMode(opt.Mode);
+	if (opt.ToneMap)
+		tracer.SetDisplay(opt.Display);
+	RTConstants constants;
+	constants.AccumlateSamples = true;
+	constants.MaxRayBounces = opt.Bounces;
+	constants.Sampler = opt.Sampler;
+
+	const float aspect = static_cast<float>(opt.Width) / opt.Height;
+	auto prepareFrame = [&](uint32_t frame)
+	{
+		FrameSetup setup;
+		setup.Frame = frame;
+		setup.Time = keys.front().Time + frame / opt.FPS;
+		const CameraKey key = InterpolateKeys(keys, setup.Time);
+		RTCamera camera(key.Position, key.LookAt, { 0.f, 1.f, 0.f }, glm::ivec2(opt.Width, opt.Height), aspect, key.FOV, key.FocalDist, key.DefocusAngle);
+		setup.Camera = camera.GetShaderData();
+		setup.Path = FramePath(opt, frame);
+		return setup;
+	};
+
+	// The main thread renders frame N while the frame thread writes frame N - 1 and prepares frame N + 1.
+	// The finished frame's accumulation is copied out of the tracer before the next one resets it, the display transform's
+	// RGBA8 buffer is swapped
+	FrameSetup current = prepareFrame(0), next;
+	std::vector<glm::vec4> written;
+	std::vector<uint32_t> writtenRGBA8, rgba8;
+	std::string writtenPath;
+	bool writeFailed = false;
+	uint64_t totalSamples = 0;
+	double waitSeconds = 0.;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < frameCount; ++frame)
+	{
+		std::thread frameThread([&]
+		{
+			if (!writtenPath.empty() && !WriteFrame(opt, writtenPath, written, writtenRGBA8))
+			{
+				printf("Failed to write %s\n", writtenPath.c_str());
+				writeFailed = true;
+			}
+			if (frame + 1 < frameCount)
+				next = prepareFrame(frame + 1);
+		});
+
+		auto frameStart = std::chrono::steady_clock::now();
+		uint32_t samples = 0;
+		while (samples < opt.Samples)
+		{
+			constants.ResetOutput = samples == 0;
+			constants.AccumulatedSamples = samples + 1;
+			constants.RandSeed = samples + 1;
+			tracer.Dispatch(scene, current.Camera, constants);
+			++samples;
+			if (opt.FrameSeconds > 0. && std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count() >= opt.FrameSeconds)
+				break;
+		}
+		if (opt.ToneMap)
+			tracer.ResolveDisplay(rgba8);
+		const double frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+
+		auto waitStart = std::chrono::steady_clock::now();
+		frameThread.join();
+		waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+		if (writeFailed)
+			return 1;
+
+		written = tracer.GetAccumulated();
+		writtenRGBA8.swap(rgba8);
+		writtenPath = current.Path;
+		totalSamples += samples;
+		printf("Frame %u of %u, t %.3fs: %u spp in %.3fs -> %s\n", frame + 1, frameCount, current.Time, samples, frameSeconds, current.Path.c_str());
+		current = next;
+	}
+	if (!writtenPath.empty() && !WriteFrame(opt, writtenPath, written, writtenRGBA8))
+	{
+		printf("Failed to write %s\n", writtenPath.c_str());
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Waiting is the time the main thread sat idle for the frame thread to finish writing
+	printf("Rendered %u frames in %.3fs, %.3fs per frame, %.1f spp on average, %llu rays, %.2f MRays/s, %.1fms waiting on image writes\n", frameCount, seconds,
+		seconds / frameCount, static_cast<double>(totalSamples) / frameCount, static_cast<unsigned long long>(tracer.GetRayCount()), tracer.GetRayCount() / seconds * 1e-6,
+		waitSeconds * 1e3);
+	return 0;
+}
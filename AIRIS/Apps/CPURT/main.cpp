@@ -0,0 +1,669 @@
+// CPURT : Headless CPU path tracer, renders the rtiaw.hlsl scenes without a GPU.
+//
+
+#include <Core/RayTracing/CPUTracer.hpp>
+#include <Core/RayTracing/DistributedRender.hpp>
+#include <Core/RayTracing/ImageOutput.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+struct Options
+{
+	uint32_t	Width = 1280,
+				Height = 720,
+				Samples = 64,
+				Bounces = 7,
+				MinBounces = 5,
+				Threads = 0,
+				SceneSeed = 0,
+				GridExtent = 11,
+				Triangles = 1 << 20,
+				Instances = 10000;
+	RTTraceMode	Mode = RTTraceMode::Megakernel;
+	// Wavefront only, bins the bounce rays before tracing them
+	bool		ReorderRays = false;
+	// Megakernel and packets only
+	TileSettings	Tiles;
+	SamplerType	Sampler = SamplerType::Sobol;
+	std::string	Scene = "rtiaw";
+	// 2 or 8, width of the sphere BVH
+	uint32_t	BVHWidth = 2;
+	BVHBuildQuality	BVHBuilder = BVHBuildQuality::SAH;
+	bool		NextEventEstimation = true;
+	// Adaptive sampling is off while the threshold is 0
+	float		AdaptiveThreshold = 0.f;
+	uint32_t	MinSamples = 16;
+	// Filters the output after every pass
+	bool		Denoise = false;
+	// AOVFlags, each one is written next to the output
+	uint32_t	AOVs = AOVNone;
+	// Without --tonemap the output is written like OutputTex, clipped sqrt of the radiance
+	bool		ToneMap = false;
+	DisplaySettings	Display;
+	std::string	Output = "CPURT.ppm";
+	// Distributed rendering: with Workers > 0 this process only merges, the workers connect to Address
+	uint32_t	Workers = 0;
+	std::string	Address;
+	// Start the workers as child processes, off waits for workers started by hand, on other machines too
+	bool		SpawnWorkers = true;
+	// Worker mode, the coordinator's address
+	std::string	Connect;
+	// Samples a worker renders between two partial buffers sent to the coordinator
+	uint32_t	PartialSamples = 8;
+};
+
+static void PrintUsage()
+{
+	printf("Usage: CPURT [--width N] [--height N] [--spp N] [--bounces N] [--min-bounces N] [--nee on|off] [--threads N] [--seed N] [--grid N] [--scene rtiaw|cornell|meshes|instances] [--triangles N] [--instances N] [--bvh binary|wide] [--builder sah|linear|treelets] [--mode megakernel|packets|wavefront] [--reorder on|off] [--tile N] [--tile-order rows|hilbert|spiral] [--steal on|off] [--sampler pcg|sobol|bluenoise] [--adaptive threshold] [--min-spp N] [--denoise on|off] [--aovs albedo,normal,depth,material,samples|all] [--tonemap none|aces|agx] [--exposure stops] [--workers N] [--address unix:path|tcp:host:port] [--spawn on|off] [--connect address] [--partial-spp N] [--out file.ppm|png|exr|pfm]\n");
+}
+
+static bool ParseArgs(int argc, char** argv, Options& opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		if (!strcmp(arg, "--help") || !strcmp(arg, "-h"))
+			return false;
+		if (i + 1 >= argc)
+		{
+			printf("Missing value for %s\n", arg);
+			return false;
+		}
+
+		const char* value = argv[++i];
+		if (!strcmp(arg, "--width"))			opt.Width = std::stoul(value);
+		else if (!strcmp(arg, "--height"))		opt.Height = std::stoul(value);
+		else if (!strcmp(arg, "--spp"))			opt.Samples = std::stoul(value);
+		else if (!strcmp(arg, "--bounces"))		opt.Bounces = std::stoul(value);
+		else if (!strcmp(arg, "--min-bounces"))	opt.MinBounces = std::stoul(value);
+		else if (!strcmp(arg, "--nee"))			opt.NextEventEstimation = strcmp(value, "off") != 0;
+		else if (!strcmp(arg, "--threads"))		opt.Threads = std::stoul(value);
+		else if (!strcmp(arg, "--seed"))		opt.SceneSeed = std::stoul(value);
+		else if (!strcmp(arg, "--grid"))		opt.GridExtent = std::stoul(value);
+		else if (!strcmp(arg, "--triangles"))	opt.Triangles = std::stoul(value);
+		else if (!strcmp(arg, "--instances"))	opt.Instances = std::stoul(value);
+		else if (!strcmp(arg, "--scene"))
+		{
+			if (strcmp(value, "rtiaw") && strcmp(value, "cornell") && strcmp(value, "meshes") && strcmp(value, "instances"))
+			{
+				printf("Unknown scene %s\n", value);
+				return false;
+			}
+			opt.Scene = value;
+		}
+		else if (!strcmp(arg, "--bvh"))
+		{
+			if (!strcmp(value, "binary"))			opt.BVHWidth = 2;
+			else if (!strcmp(value, "wide"))		opt.BVHWidth = 8;
+			else
+			{
+				printf("Unknown BVH layout %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--builder"))
+		{
+			if (!strcmp(value, "sah"))				opt.BVHBuilder = BVHBuildQuality::SAH;
+			else if (!strcmp(value, "linear"))		opt.BVHBuilder = BVHBuildQuality::Linear;
+			else if (!strcmp(value, "treelets"))	opt.BVHBuilder = BVHBuildQuality::LinearTreelets;
+			else
+			{
+				printf("Unknown BVH builder %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--mode"))
+		{
+			if (!strcmp(value, "megakernel"))		opt.Mode = RTTraceMode::Megakernel;
+			else if (!strcmp(value, "packets"))		opt.Mode = RTTraceMode::Packets;
+			else if (!strcmp(value, "wavefront"))	opt.Mode = RTTraceMode::Wavefront;
+			else
+			{
+				printf("Unknown mode %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--reorder"))
+		{
+			if (!strcmp(value, "on"))				opt.ReorderRays = true;
+			else if (!strcmp(value, "off"))			opt.ReorderRays = false;
+			else
+			{
+				printf("Unknown reorder setting %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--tile"))		opt.Tiles.Size = std::stoul(value);
+		else if (!strcmp(arg, "--steal"))		opt.Tiles.WorkStealing = strcmp(value, "off") != 0;
+		else if (!strcmp(arg, "--tile-order"))
+		{
+			if (!strcmp(value, "rows"))				opt.Tiles.Order = TileOrder::Rows;
+			else if (!strcmp(value, "hilbert"))		opt.Tiles.Order = TileOrder::Hilbert;
+			else if (!strcmp(value, "spiral"))		opt.Tiles.Order = TileOrder::Spiral;
+			else
+			{
+				printf("Unknown tile order %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--sampler"))
+		{
+			if (!strcmp(value, "pcg"))				opt.Sampler = SamplerType::PCG;
+			else if (!strcmp(value, "sobol"))		opt.Sampler = SamplerType::Sobol;
+			else if (!strcmp(value, "bluenoise"))	opt.Sampler = SamplerType::BlueNoise;
+			else
+			{
+				printf("Unknown sampler %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--adaptive"))	opt.AdaptiveThreshold = std::stof(value);
+		else if (!strcmp(arg, "--denoise"))		opt.Denoise = strcmp(value, "off") != 0;
+		else if (!strcmp(arg, "--min-spp"))		opt.MinSamples = std::stoul(value);
+		else if (!strcmp(arg, "--aovs"))
+		{
+			std::string list = value;
+			for (size_t begin = 0; begin <= list.size();)
+			{
+				size_t end = std::min(list.find(',', begin), list.size());
+				const std::string name = list.substr(begin, end - begin);
+				if (name == "albedo")			opt.AOVs |= AOVAlbedo;
+				else if (name == "normal")		opt.AOVs |= AOVNormal;
+				else if (name == "depth")		opt.AOVs |= AOVDepth;
+				else if (name == "material")	opt.AOVs |= AOVMaterialID;
+				else if (name == "samples")		opt.AOVs |= AOVSampleCount;
+				else if (name == "all")			opt.AOVs |= AOVAll;
+				else
+				{
+					printf("Unknown AOV %s\n", name.c_str());
+					return false;
+				}
+				begin = end + 1;
+			}
+		}
+		else if (!strcmp(arg, "--tonemap"))
+		{
+			opt.ToneMap = true;
+			if (!strcmp(value, "none"))			opt.Display.Curve = ToneCurve::None;
+			else if (!strcmp(value, "aces"))	opt.Display.Curve = ToneCurve::ACES;
+			else if (!strcmp(value, "agx"))		opt.Display.Curve = ToneCurve::AgX;
+			else
+			{
+				printf("Unknown tone curve %s\n", value);
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--exposure"))
+		{
+			opt.ToneMap = true;
+			opt.Display.Exposure = std::stof(value);
+		}
+		else if (!strcmp(arg, "--out"))			opt.Output = value;
+		else if (!strcmp(arg, "--workers"))		opt.Workers = std::stoul(value);
+		else if (!strcmp(arg, "--address"))		opt.Address = value;
+		else if (!strcmp(arg, "--spawn"))		opt.SpawnWorkers = strcmp(value, "off") != 0;
+		else if (!strcmp(arg, "--connect"))		opt.Connect = value;
+		else if (!strcmp(arg, "--partial-spp"))	opt.PartialSamples = std::stoul(value);
+		else
+		{
+			printf("Unknown argument %s\n", arg);
+			return false;
+		}
+	}
+	return opt.Width > 0 && opt.Height > 0 && opt.Samples > 0 && opt.Tiles.Size > 0 && opt.PartialSamples > 0;
+}
+
+// Binary PPM of pixelColor(pixel) for every pixel, clamped to [0, 1]
+template<typename ColorFunc>
+static bool WritePPM(const std::string& path, uint32_t width, uint32_t height, ColorFunc&& pixelColor)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+	std::vector<uint8_t> row(width * 3);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const glm::vec3 c = pixelColor(static_cast<size_t>(y) * width + x);
+			for (int i = 0; i < 3; ++i)
+				row[x * 3 + i] = static_cast<uint8_t>(glm::clamp(c[i], 0.f, 1.f) * 255.f);
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	fclose(file);
+	return true;
+}
+
+// Rows per tile handed to ImageOutput, the writer thread encodes one band while the next one is filled
+static constexpr uint32_t s_bandRows = 32;
+
+// PNG, PFM or EXR by the extension of path and PPM for anything else, written through ImageOutput a band of rows at a time.
+// The 8 bit formats take pixelColor(pixel) in [0, 1], the float ones the channels values of pixelValues(pixel, values)
+template<typename ColorFunc, typename ValueFunc>
+static bool WriteImage(const std::string& path, uint32_t width, uint32_t height, ColorFunc&& pixelColor, uint32_t channels, ValueFunc&& pixelValues, std::vector<std::string> channelNames = {})
+{
+	ImageDesc desc;
+	if (!GetImageFormat(path, desc.Format))
+		return WritePPM(path, width, height, pixelColor);
+	desc.Width = width;
+	desc.Height = height;
+	desc.Channels = desc.Format == ImageFormat::PNG ? 3 : channels;
+	if (desc.Format == ImageFormat::EXR)
+		desc.ChannelNames = std::move(channelNames);
+
+	ImageOutput image;
+	if (!image.Open(path, desc))
+		return false;
+	std::vector<uint8_t> bytes(static_cast<size_t>(width) * s_bandRows * desc.Channels);
+	std::vector<float> values(bytes.size());
+	for (uint32_t y = 0; y < height; y += s_bandRows)
+	{
+		const uint32_t rows = std::min(s_bandRows, height - y);
+		const size_t first = static_cast<size_t>(y) * width;
+		for (size_t i = 0; i < static_cast<size_t>(rows) * width; ++i)
+		{
+			if (desc.Format != ImageFormat::PNG)
+			{
+				pixelValues(first + i, values.data() + i * desc.Channels);
+				continue;
+			}
+			const glm::vec3 c = pixelColor(first + i);
+			for (int j = 0; j < 3; ++j)
+				bytes[i * 3 + j] = static_cast<uint8_t>(glm::clamp(c[j], 0.f, 1.f) * 255.f);
+		}
+		if (desc.Format == ImageFormat::PNG)
+			image.SubmitTile(0, y, width, rows, bytes.data(), desc.Channels, static_cast<size_t>(width) * desc.Channels);
+		else
+			image.SubmitTile(0, y, width, rows, values.data(), desc.Channels, static_cast<size_t>(width) * desc.Channels);
+	}
+	return image.Close();
+}
+
+// One image per AOV next to the output in the same format, file.png becomes file.albedo.png etc.
+// The 8 bit formats get depth and sample counts scaled by their maximum, the float ones the values as recorded
+static bool WriteAOVs(const std::string& output, uint32_t flags, const CPUTracer& tracer)
+{
+	const AOVBuffer& aovs = tracer.GetAOVBuffer();
+	const uint32_t width = tracer.GetWidth(), height = tracer.GetHeight();
+	const size_t pixels = static_cast<size_t>(width) * height;
+	const size_t extension = output.rfind('.');
+	const std::string stem = output.substr(0, extension == std::string::npos ? output.size() : extension);
+	const std::string suffix = extension == std::string::npos ? ".ppm" : output.substr(extension);
+	auto write = [&](const char* name, auto&& pixelColor, uint32_t channels, auto&& pixelValues, std::vector<std::string> channelNames = {})
+	{
+		const std::string path = stem + "." + name + suffix;
+		if (!WriteImage(path, width, height, pixelColor, channels, pixelValues, std::move(channelNames)))
+		{
+			printf("Failed to write %s\n", path.c_str());
+			return false;
+		}
+		return true;
+	};
+	auto vector = [](const glm::vec3& v, float* values) { values[0] = v.x; values[1] = v.y; values[2] = v.z; };
+
+	bool written = true;
+	if (flags & AOVAlbedo)
+	{
+		written &= write("albedo", [&](size_t pixel) { return glm::sqrt(aovs.GetAlbedo(pixel)); },
+			3, [&](size_t pixel, float* values) { vector(aovs.GetAlbedo(pixel), values); });
+	}
+	if (flags & AOVNormal)
+	{
+		written &= write("normal", [&](size_t pixel) { return aovs.GetNormal(pixel) * 0.5f + 0.5f; },
+			3, [&](size_t pixel, float* values) { vector(aovs.GetNormal(pixel), values); }, { "X", "Y", "Z" });
+	}
+	if (flags & AOVDepth)
+	{
+		float maxDepth = 0.f;
+		for (size_t pixel = 0; pixel < pixels; ++pixel)
+		{
+			if (aovs.GetDepth(pixel) < AOVSample::s_skyDepth)
+				maxDepth = std::max(maxDepth, aovs.GetDepth(pixel));
+		}
+		written &= write("depth", [&](size_t pixel) { return glm::vec3(maxDepth > 0.f ? aovs.GetDepth(pixel) / maxDepth : 0.f); },
+			1, [&](size_t pixel, float* values) { values[0] = aovs.GetDepth(pixel); }, { "Z" });
+	}
+	if (flags & AOVMaterialID)
+	{
+		// A random color per material, the sky stays black
+		written &= write("material", [&](size_t pixel)
+		{
+			const uint32_t id = aovs.GetMaterialID(pixel);
+			const uint32_t hash = PCGHash(id);
+			return id == RT_UINTMAX ? glm::vec3(0.f) : glm::vec3(hash & 0xff, hash >> 8 & 0xff, hash >> 16 & 0xff) / 255.f;
+		}, 1, [&](size_t pixel, float* values)
+		{
+			// -1 for the sky
+			const uint32_t id = aovs.GetMaterialID(pixel);
+			values[0] = id == RT_UINTMAX ? -1.f : static_cast<float>(id);
+		});
+	}
+	if (flags & AOVSampleCount)
+	{
+		uint32_t maxSamples = 1;
+		for (size_t pixel = 0; pixel < pixels; ++pixel)
+			maxSamples = std::max(maxSamples, aovs.GetSampleCount(pixel));
+		written &= write("samples", [&](size_t pixel) { return glm::vec3(static_cast<float>(aovs.GetSampleCount(pixel)) / maxSamples); },
+			1, [&](size_t pixel, float* values) { values[0] = static_cast<float>(aovs.GetSampleCount(pixel)); });
+	}
+	return written;
+}
+
+// The output image of either a single process or the coordinator. output is the gamma corrected tracer output and
+// rgba8 the display transform's, only read with --tonemap
+static bool WriteOutput(const Options& opt, const std::vector<glm::vec4>& output, const std::vector<glm::vec4>& accumulated, const std::vector<uint32_t>& rgba8)
+{
+	auto pixelColor = [&](size_t pixel)
+	{
+		if (!opt.ToneMap)
+			return glm::vec3(output[pixel]);
+		// Centred in the code so the 8 bit writers quantize back to it
+		const uint32_t rgba = rgba8[pixel];
+		return (glm::vec3(static_cast<float>(rgba & 0xff), static_cast<float>((rgba >> 8) & 0xff), static_cast<float>((rgba >> 16) & 0xff)) + 0.5f) / 255.f;
+	};
+	// Mean radiance for the float formats, tone curves and exposure only apply to the 8 bit ones
+	auto pixelValues = [&](size_t pixel, float* values)
+	{
+		const glm::vec3 radiance = opt.Denoise ? glm::vec3(output[pixel]) * glm::vec3(output[pixel]) : glm::vec3(accumulated[pixel]) / accumulated[pixel].w;
+		values[0] = radiance.x;
+		values[1] = radiance.y;
+		values[2] = radiance.z;
+	};
+	if (!WriteImage(opt.Output, opt.Width, opt.Height, pixelColor, 3, pixelValues))
+	{
+		printf("Failed to write %s\n", opt.Output.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Starts a CPURT per worker with the arguments of this one, minus the coordinator's and the features that aren't
+// distributed, plus --connect address. Their output goes to /dev/null, the coordinator prints the totals
+static bool SpawnWorkers(int argc, char** argv, const std::string& address, uint32_t workerCount, std::vector<int>& children)
+{
+#if defined(_WIN32)
+	printf("Spawning workers is not supported on Windows, start them with --connect and use --spawn off\n");
+	return false;
+#else
+	static const char* s_strippedArgs[] = { "--workers", "--address", "--spawn", "--adaptive", "--denoise", "--aovs" };
+	std::vector<std::string> args = { argv[0] };
+	for (int i = 1; i < argc; ++i)
+	{
+		const bool stripped = std::any_of(std::begin(s_strippedArgs), std::end(s_strippedArgs), [&](const char* name) { return !strcmp(argv[i], name); });
+		if (i + 1 < argc && stripped)
+			++i;
+		else
+			args.push_back(argv[i]);
+	}
+	args.push_back("--connect");
+	args.push_back(address);
+	std::vector<char*> childArgv;
+	for (std::string& arg : args)
+		childArgv.push_back(arg.data());
+	childArgv.push_back(nullptr);
+
+	fflush(stdout);
+	for (uint32_t i = 0; i < workerCount; ++i)
+	{
+		const pid_t pid = fork();
+		if (pid < 0)
+			return false;
+		if (pid == 0)
+		{
+			const int null = open("/dev/null", O_WRONLY);
+			if (null >= 0)
+				dup2(null, STDOUT_FILENO);
+			execv("/proc/self/exe", childArgv.data());
+			execvp(argv[0], childArgv.data());
+			_exit(127);
+		}
+		children.push_back(pid);
+	}
+	return true;
+#endif
+}
+
+// Coordinator mode, merges the workers' partial accumulation buffers and writes the output from the sums
+static int RunCoordinator(int argc, char** argv, Options opt)
+{
+	if (opt.AdaptiveThreshold > 0.f || opt.Denoise || opt.AOVs != AOVNone)
+	{
+		printf("Adaptive sampling, denoising and AOVs are not distributed, rendering without them\n");
+		opt.AdaptiveThreshold = 0.f;
+		opt.Denoise = false;
+		opt.AOVs = AOVNone;
+	}
+#if !defined(_WIN32)
+	if (opt.Address.empty())
+		opt.Address = "unix:/tmp/cpurt-" + std::to_string(getpid()) + ".sock";
+#endif
+
+	DistributedCoordinator coordinator;
+	if (!coordinator.Listen(opt.Address))
+	{
+		printf("Failed to listen on %s\n", opt.Address.c_str());
+		return 1;
+	}
+	std::vector<int> children;
+	if (opt.SpawnWorkers && !SpawnWorkers(argc, argv, opt.Address, opt.Workers, children))
+	{
+		printf("Failed to start the workers\n");
+		return 1;
+	}
+	printf("Rendering %ux%u, %u spp on %u workers through %s\n", opt.Width, opt.Height, opt.Samples, opt.Workers, opt.Address.c_str());
+
+	auto start = std::chrono::steady_clock::now();
+	bool merged = coordinator.AcceptWorkers(opt.Workers, opt.Width, opt.Height, opt.Samples);
+	std::vector<glm::vec4> accumulated;
+	uint32_t mergedSamples = 0;
+	merged = merged && coordinator.Merge(accumulated, [&](uint32_t worker, uint32_t samples)
+	{
+		mergedSamples += samples;
+		printf("\rMerged %u of %u samples", mergedSamples, opt.Samples);
+		fflush(stdout);
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("\n");
+#if !defined(_WIN32)
+	for (int child : children)
+	{
+		int status = 0;
+		waitpid(child, &status, 0);
+		merged &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+#endif
+	if (!merged)
+	{
+		printf("Distributed render failed\n");
+		return 1;
+	}
+	for (const DistributedAssignment& assignment : coordinator.GetAssignments())
+		printf("Worker %u: samples %u to %u\n", assignment.Worker, assignment.FirstSample, assignment.FirstSample + assignment.SampleCount - 1);
+	printf("Rendered in %.3fs, received %.1f MB, merged in %.2fms\n", seconds, coordinator.GetReceivedBytes() / (1024. * 1024.), coordinator.GetMergeSeconds() * 1e3);
+
+	// The sums of all workers, resolved like the tracer resolves its own
+	ThreadPool pool(opt.Threads);
+	std::vector<glm::vec4> output(accumulated.size());
+	pool.ParallelFor(opt.Height, [&](uint32_t y, uint32_t)
+	{
+		for (size_t pixel = static_cast<size_t>(y) * opt.Width; pixel < static_cast<size_t>(y + 1) * opt.Width; ++pixel)
+			output[pixel] = glm::sqrt(accumulated[pixel] / accumulated[pixel].w);
+	});
+	std::vector<uint32_t> rgba8;
+	if (opt.ToneMap)
+	{
+		DisplayTransform display;
+		display.SetSettings(opt.Display);
+		rgba8.resize(accumulated.size());
+		display.ResolveAccumulated(pool, accumulated.data(), accumulated.size(), rgba8.data());
+	}
+	return WriteOutput(opt, output, accumulated, rgba8) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	Options opt;
+	if (!ParseArgs(argc, argv, opt))
+	{
+		PrintUsage();
+		return 1;
+	}
+	if (opt.Workers > 0 && opt.Connect.empty())
+		return RunCoordinator(argc, argv, opt);
+	if (!opt.Connect.empty())
+	{
+		// Like the coordinator, only the plain accumulation is distributed
+		opt.AdaptiveThreshold = 0.f;
+		opt.Denoise = false;
+		opt.AOVs = AOVNone;
+	}
+
+	// The mesh scenes are the Cornell box with the spheres swapped for meshes, all of them use its camera
+	const bool cornell = opt.Scene != "rtiaw";
+	// The tracer's threads build the BVH too
+	CPUTracer tracer(opt.Width, opt.Height, opt.Threads);
+	auto buildStart = std::chrono::steady_clock::now();
+	RTScene scene = opt.Scene == "meshes" ? RTScene::CreateCornellMeshes(opt.Triangles, &tracer.GetThreadPool()) :
+					opt.Scene == "instances" ? RTScene::CreateCornellInstances(opt.Instances, opt.SceneSeed, &tracer.GetThreadPool()) :
+					cornell ? RTScene::CreateCornellBox() : RTScene::CreateRTIAWFinal(opt.SceneSeed, opt.GridExtent);
+	BVHBuildSettings bvhSettings = SphereBVHSettings();
+	bvhSettings.Width = opt.BVHWidth;
+	bvhSettings.Quality = opt.BVHBuilder;
+	scene.Build(bvhSettings, &tracer.GetThreadPool());
+	double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+	printf("BVH: %zu nodes (%.1f KB), SAH cost %.2f, built in %.1fms\n", scene.GetBVH().GetNodeCount(), scene.GetBVH().GetNodeBytes() / 1024.0,
+		scene.GetBVH().SAHCost(), buildSeconds * 1e3);
+	for (const TriangleBLAS& mesh : scene.GetMeshes())
+		printf("Mesh BLAS: %u triangles, %zu nodes, SAH cost %.2f\n", mesh.GetTriangleCount(), mesh.GetBVH().GetNodeCount(), mesh.GetBVH().SAHCost());
+	if (!scene.GetTLAS().IsEmpty())
+	{
+		const TLAS& tlas = scene.GetTLAS();
+		uint64_t instancedTriangles = 0;
+		for (const TLASInstance& instance : tlas.GetInstances())
+			instancedTriangles += tlas.GetBLASes()[instance.BLASIndex].GetTriangleCount();
+		printf("TLAS: %zu instances of %zu BLAS, %llu triangles, %zu nodes, SAH cost %.2f\n", tlas.GetInstances().size(), tlas.GetBLASes().size(),
+			static_cast<unsigned long long>(instancedTriangles), tlas.GetBVH().GetNodeCount(), tlas.GetBVH().SAHCost());
+	}
+	const float aspect = static_cast<float>(opt.Width) / opt.Height;
+	RTCamera camera = cornell ?
+		RTCamera({ 50.f, 40.f, 165.f }, { 50.f, 36.f, 0.f }, { 0.f, 1.f, 0.f }, glm::ivec2(opt.Width, opt.Height), aspect, 45.f, 100.f, 0.f) :
+		RTCamera({ 13.f, 2.f, 3.f }, { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, glm::ivec2(opt.Width, opt.Height), aspect, 20.f, 10.f, 0.6f);
+	RTCameraSD cameraData = camera.GetShaderData();
+
+	tracer.SetTraceMode(opt.Mode);
+	tracer.SetRayReordering(opt.ReorderRays);
+	tracer.SetTiles(opt.Tiles);
+	AdaptiveSamplingSettings adaptive;
+	adaptive.Enabled = opt.AdaptiveThreshold > 0.f;
+	adaptive.Threshold = opt.AdaptiveThreshold;
+	adaptive.MinSamples = opt.MinSamples;
+	tracer.SetAdaptiveSampling(adaptive);
+	DenoiserSettings denoiser;
+	denoiser.Enabled = opt.Denoise;
+	tracer.SetDenoiser(denoiser);
+	tracer.SetAOVs(opt.AOVs);
+	printf("Rendering %ux%u, %u spp, %u bounces, %zu spheres, %zu lights on %u threads\n", opt.Width, opt.Height, opt.Samples, opt.Bounces, scene.GetSpheres().size(), scene.GetLights().size(), tracer.GetThreadCount());
+
+	RTConstants constants;
+	constants.AccumlateSamples = true;
+	constants.MaxRayBounces = opt.Bounces;
+	constants.Sampler = opt.Sampler;
+	constants.MinRayBounces = opt.MinBounces;
+	constants.NextEventEstimation = opt.NextEventEstimation;
+
+	if (!opt.Connect.empty())
+	{
+		// Worker mode: the assigned sample indices in batches, each one accumulated from scratch and sent as a partial sum.
+		// The seeds and sample indices are the ones of a single process render
+		DistributedWorker worker;
+		DistributedAssignment assignment;
+		if (!worker.Connect(opt.Connect, opt.Width, opt.Height, assignment))
+		{
+			printf("Failed to connect to %s\n", opt.Connect.c_str());
+			return 1;
+		}
+		const uint32_t end = assignment.FirstSample + assignment.SampleCount;
+		for (uint32_t batch = assignment.FirstSample; batch < end; batch += opt.PartialSamples)
+		{
+			const uint32_t batchEnd = std::min(batch + opt.PartialSamples, end);
+			for (uint32_t s = batch; s < batchEnd; ++s)
+			{
+				constants.ResetOutput = s == batch;
+				constants.AccumulatedSamples = s + 1;
+				constants.RandSeed = s + 1;
+				tracer.Dispatch(scene, cameraData, constants);
+			}
+			if (!worker.SendPartial(tracer.GetAccumulated(), batchEnd - batch))
+			{
+				printf("Lost the connection to %s\n", opt.Connect.c_str());
+				return 1;
+			}
+		}
+		return worker.SendDone() ? 0 : 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t s = 0; s < opt.Samples; ++s)
+	{
+		constants.ResetOutput = s == 0;
+		constants.AccumulatedSamples = s + 1;
+		constants.RandSeed = s + 1;
+		tracer.Dispatch(scene, cameraData, constants);
+
+		// --spp is the per pixel limit with adaptive sampling, stop early once every pixel is below the threshold
+		if (adaptive.Enabled && tracer.IsConverged())
+		{
+			printf("Converged after %u passes\n", s + 1);
+			break;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t rays = tracer.GetRayCount(), samples = 0;
+	for (const PixelStats& stats : tracer.GetPixelStats())
+		samples += stats.Samples;
+	printf("Rendered in %.3fs, %llu rays, %.2f MRays/s, %.2f rays per path\n", seconds, static_cast<unsigned long long>(rays), rays / seconds * 1e-6, static_cast<double>(rays) / samples);
+	if (adaptive.Enabled)
+	{
+		printf("Adaptive sampling: %.2f samples per pixel on average, %u of %u pixels converged\n", static_cast<double>(samples) / (opt.Width * opt.Height), tracer.GetConvergedPixelCount(), opt.Width * opt.Height);
+	}
+	if (opt.Denoise)
+		printf("Denoiser: %.2fms per pass\n", tracer.GetDenoiser().GetFilterSeconds() * 1e3);
+	if (opt.Mode != RTTraceMode::Wavefront)
+	{
+		// Idle is the share of thread time spent waiting for the last tile of the pass
+		const TileStats& stats = tracer.GetTileScheduler().GetStats();
+		printf("Tiles: %u per pass, last pass %.2fms with %u steals and %.1f%% idle\n", stats.Tiles, stats.Seconds * 1e3, stats.Steals,
+			100. * std::max(0., 1. - stats.BusySeconds / (stats.Seconds * tracer.GetThreadCount())));
+	}
+	if (opt.Mode == RTTraceMode::Wavefront)
+	{
+		const WavefrontStats& stats = tracer.GetWavefrontStats();
+		printf("Wavefront stages: generate %.3fs, reorder %.3fs, extend %.3fs, sort %.3fs, miss %.3fs, emit %.3fs, shade %.3fs, connect %.3fs\n", stats.Generate, stats.Reorder, stats.Extend, stats.Sort, stats.Miss, stats.Emit, stats.Shade, stats.Connect);
+	}
+
+	// Already gamma corrected
+	std::vector<uint32_t> rgba8;
+	if (opt.ToneMap)
+	{
+		tracer.SetDisplay(opt.Display);
+		tracer.ResolveDisplay(rgba8);
+		printf("Display transform: %.2fms\n", tracer.GetDisplaySeconds() * 1e3);
+	}
+	if (!WriteOutput(opt, tracer.GetOutput(), tracer.GetAccumulated(), rgba8))
+		return 1;
+	if (!WriteAOVs(opt.Output, opt.AOVs, tracer))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,1826 @@
+// RTBench : Benchmarks for the CPU ray tracer.
+//
+
+#include <Core/RayTracing/CPUTracer.hpp>
+#include <Core/RayTracing/DistributedRender.hpp>
+#include <Core/RayTracing/ImageOutput.hpp>
+#include <Core/RayTracing/RTShading.hpp>
+#include "glm/gtc/matrix_transform.hpp"
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct BenchArgs
+{
+	uint32_t	Width = 640,
+				Height = 360,
+				Samples = 8,
+				Threads = 0,
+				GridExtent = 11;
+};
+
+struct Benchmark
+{
+	const char*	Name;
+	const char*	Description;
+	void		(*Run)(const BenchArgs& args);
+};
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static RTCameraSD RTIAWFinalCamera(uint32_t width, uint32_t height)
+{
+	RTCamera camera({ 13.f, 2.f, 3.f }, { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, glm::ivec2(width, height), static_cast<float>(width) / height, 20.f, 10.f, 0.6f);
+	return camera.GetShaderData();
+}
+
+static RTCameraSD CornellBoxCamera(uint32_t width, uint32_t height)
+{
+	RTCamera camera({ 50.f, 40.f, 165.f }, { 50.f, 36.f, 0.f }, { 0.f, 1.f, 0.f }, glm::ivec2(width, height), static_cast<float>(width) / height, 45.f, 100.f, 0.f);
+	return camera.GetShaderData();
+}
+
+// Renders samples accumulated samples with the given tracer, returns seconds
+static double RenderSamples(CPUTracer& tracer, const RTScene& scene, const RTCameraSD& camera, uint32_t samples, RTConstants constants = RTConstants())
+{
+	constants.AccumlateSamples = true;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t s = 0; s < samples; ++s)
+	{
+		constants.ResetOutput = s == 0;
+		constants.AccumulatedSamples = s + 1;
+		constants.RandSeed = s + 1;
+		tracer.Dispatch(scene, camera, constants);
+	}
+	return Seconds(start);
+}
+
+enum class PerfEvent
+{
+	Instructions,
+	// Loads from the L1 data cache and the ones that missed it
+	L1DLoads,
+	L1DMisses,
+	// Last level cache references and misses
+	CacheReferences,
+	CacheMisses,
+};
+
+// Hardware event count of the calling thread through perf_event_open on Linux, with inheritThreads also of the threads it starts
+// after the counter was created (a CPUTracer's pool). Unavailable on other platforms and when perf events are not permitted
+// (perf_event_paranoid, containers)
+class PerfCounter
+{
+public:
+	explicit PerfCounter(PerfEvent event, bool inheritThreads = false)
+	{
+#ifdef __linux__
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		switch (event)
+		{
+		case PerfEvent::Instructions:		attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case PerfEvent::CacheReferences:	attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+		case PerfEvent::CacheMisses:		attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+		case PerfEvent::L1DLoads:
+		case PerfEvent::L1DMisses:
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+				(event == PerfEvent::L1DLoads ? PERF_COUNT_HW_CACHE_RESULT_ACCESS : PERF_COUNT_HW_CACHE_RESULT_MISS) << 16;
+			break;
+		}
+		attr.disabled = 1;
+		attr.inherit = inheritThreads;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+	}
+
+	~PerfCounter()
+	{
+#ifdef __linux__
+		if (m_fd >= 0)
+			close(m_fd);
+#endif
+	}
+
+	inline bool IsAvailable() const { return m_fd >= 0; }
+
+	void Start()
+	{
+#ifdef __linux__
+		if (!IsAvailable())
+			return;
+		ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+
+	uint64_t Stop()
+	{
+		uint64_t count = 0;
+#ifdef __linux__
+		if (!IsAvailable())
+			return 0;
+		ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+			count = 0;
+#endif
+		return count;
+	}
+
+private:
+	int m_fd = -1;
+};
+
+// Average absolute difference of two outputs, same sample sequence should give (almost) the same image
+static double MeanAbsDiff(const std::vector<glm::vec4>& a, const std::vector<glm::vec4>& b)
+{
+	double diff = 0.;
+	for (size_t i = 0; i < a.size(); ++i)
+		diff += std::abs(a[i].x - b[i].x) + std::abs(a[i].y - b[i].y) + std::abs(a[i].z - b[i].z);
+	return diff / (3. * a.size());
+}
+
+////////////////////////
+//                    //
+//  PACKET TRAVERSAL  //
+//                    //
+////////////////////////
+
+static void BenchPackets(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+
+	// CAMERA RAYS ONLY, single rays against 8x8 packets of the same rays
+	const uint32_t	tilesX = (args.Width + RT_PACKET_DIM - 1) / RT_PACKET_DIM,
+					tilesY = (args.Height + RT_PACKET_DIM - 1) / RT_PACKET_DIM;
+	std::vector<RayPacket> packets(tilesX * tilesY);
+	RTConstants constants;
+	for (uint32_t tile = 0; tile < packets.size(); ++tile)
+	{
+		RayPacket& packet = packets[tile];
+		for (uint32_t y = (tile / tilesX) * RT_PACKET_DIM; y < std::min((tile / tilesX + 1) * RT_PACKET_DIM, args.Height); ++y)
+		{
+			for (uint32_t x = (tile % tilesX) * RT_PACKET_DIM; x < std::min((tile % tilesX + 1) * RT_PACKET_DIM, args.Width); ++x)
+			{
+				PathSampler sampler(constants, x, y, args.Width);
+				Ray r = GetRay(static_cast<float>(x), static_cast<float>(y), camera, sampler);
+				packet.Add(r);
+			}
+		}
+		packet.Finalize();
+	}
+
+	size_t coherentPackets = 0, rays = 0;
+	for (const RayPacket& packet : packets)
+	{
+		coherentPackets += packet.SameOctant;
+		rays += packet.Count;
+	}
+
+	HitRecord recs[RT_PACKET_SIZE];
+	uint64_t singleHits = 0, packetHits = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t s = 0; s < args.Samples; ++s)
+	{
+		for (const RayPacket& packet : packets)
+			for (uint32_t i = 0; i < packet.Count; ++i)
+				singleHits += scene.Hit(packet.GetRay(i), packet.TMin, RT_FLOATMAX, recs[i]);
+	}
+	double singleSeconds = Seconds(start);
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t s = 0; s < args.Samples; ++s)
+	{
+		for (RayPacket packet : packets)
+			packetHits += std::popcount(scene.HitPacket(packet, recs));
+	}
+	double packetSeconds = Seconds(start);
+
+	double totalRays = static_cast<double>(rays) * args.Samples;
+	printf("Camera rays, %zu rays, %.1f%% of packets share an octant\n", rays, 100. * coherentPackets / packets.size());
+	printf("  single : %8.2f MRays/s  (%llu hits)\n", totalRays / singleSeconds * 1e-6, static_cast<unsigned long long>(singleHits));
+	printf("  packet : %8.2f MRays/s  (%llu hits)  %.2fx\n", totalRays / packetSeconds * 1e-6, static_cast<unsigned long long>(packetHits), singleSeconds / packetSeconds);
+
+	// FULL PATHS, packets for camera rays and the first bounce
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	double rowSeconds = RenderSamples(tracer, scene, camera, args.Samples);
+	uint64_t rowRays = tracer.GetRayCount();
+	std::vector<glm::vec4> rowOutput = tracer.GetOutput();
+
+	tracer.ResetStats();
+	tracer.SetTraceMode(RTTraceMode::Packets);
+	double packetRenderSeconds = RenderSamples(tracer, scene, camera, args.Samples);
+	uint64_t packetRays = tracer.GetRayCount();
+
+	printf("Full paths, %u spp, %u threads\n", args.Samples, tracer.GetThreadCount());
+	printf("  single : %8.2f MRays/s  %.3fs\n", rowRays / rowSeconds * 1e-6, rowSeconds);
+	printf("  packet : %8.2f MRays/s  %.3fs  %.2fx  (mean abs diff %.2e)\n", packetRays / packetRenderSeconds * 1e-6, packetRenderSeconds, rowSeconds / packetRenderSeconds, MeanAbsDiff(rowOutput, tracer.GetOutput()));
+}
+
+////////////////////////
+//                    //
+//  WAVEFRONT STAGES  //
+//                    //
+////////////////////////
+
+static void BenchWavefront(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	double megakernelSeconds = RenderSamples(tracer, scene, camera, args.Samples);
+	uint64_t megakernelRays = tracer.GetRayCount();
+	std::vector<glm::vec4> megakernelOutput = tracer.GetOutput();
+
+	tracer.ResetStats();
+	tracer.SetTraceMode(RTTraceMode::Wavefront);
+	double wavefrontSeconds = RenderSamples(tracer, scene, camera, args.Samples);
+	uint64_t wavefrontRays = tracer.GetRayCount();
+	const WavefrontStats& stats = tracer.GetWavefrontStats();
+
+	printf("%u spp, %u threads, %u paths in flight\n", args.Samples, tracer.GetThreadCount(), args.Width * args.Height);
+	printf("  megakernel : %8.2f MRays/s  %.3fs\n", megakernelRays / megakernelSeconds * 1e-6, megakernelSeconds);
+	printf("  wavefront  : %8.2f MRays/s  %.3fs  %.2fx  (mean abs diff %.2e)\n", wavefrontRays / wavefrontSeconds * 1e-6, wavefrontSeconds, megakernelSeconds / wavefrontSeconds, MeanAbsDiff(megakernelOutput, tracer.GetOutput()));
+	printf("  stages     : generate %.3fs  reorder %.3fs  extend %.3fs  sort %.3fs  miss %.3fs  shade %.3fs\n", stats.Generate, stats.Reorder, stats.Extend, stats.Sort, stats.Miss, stats.Shade);
+}
+
+////////////////////////
+//                    //
+//    RAY REORDER     //
+//                    //
+////////////////////////
+
+static void BenchReorder(const BenchArgs& args)
+{
+	// Counters first, so they inherit into the tracer's threads
+	PerfCounter l1dLoads(PerfEvent::L1DLoads, true), l1dMisses(PerfEvent::L1DMisses, true);
+	PerfCounter cacheReferences(PerfEvent::CacheReferences, true), cacheMisses(PerfEvent::CacheMisses, true);
+	const bool countersAvailable = l1dLoads.IsAvailable() && l1dMisses.IsAvailable() && cacheReferences.IsAvailable() && cacheMisses.IsAvailable();
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	tracer.SetTraceMode(RTTraceMode::Wavefront);
+
+	printf("Wavefront paths with and without binning the bounce rays by origin cell and direction octant, %u spp, %u threads, %ux%u\n", args.Samples, tracer.GetThreadCount(),
+		args.Width, args.Height);
+	printf("Cache hit rates over the whole render %s\n", countersAvailable ? "from perf events" : "unavailable (no perf event access)");
+	printf("  %-10s %-8s %10s %10s %10s %10s %10s %10s %10s\n", "scene", "reorder", "MRays/s", "extend s", "reorder s", "speedup", "L1D hit", "LLC hit", "same");
+
+	// The RTIAW final scene at its own size and with the grid of --grid, which is larger than the caches by default
+	for (int gridExtent : { 11, static_cast<int>(std::max(args.GridExtent, 40u)) })
+	{
+		RTScene scene = RTScene::CreateRTIAWFinal(0, gridExtent);
+		scene.Build();
+		RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+
+		double offSeconds = 0.;
+		std::vector<glm::vec4> offOutput;
+		for (bool reorder : { false, true })
+		{
+			tracer.SetRayReordering(reorder);
+			tracer.ResetStats();
+			l1dLoads.Start(); l1dMisses.Start(); cacheReferences.Start(); cacheMisses.Start();
+			double seconds = RenderSamples(tracer, scene, camera, args.Samples);
+			const double loads = static_cast<double>(l1dLoads.Stop()), loadMisses = static_cast<double>(l1dMisses.Stop());
+			const double references = static_cast<double>(cacheReferences.Stop()), misses = static_cast<double>(cacheMisses.Stop());
+			const WavefrontStats& stats = tracer.GetWavefrontStats();
+			if (!reorder)
+			{
+				offSeconds = seconds;
+				offOutput = tracer.GetOutput();
+			}
+
+			char name[32];
+			snprintf(name, sizeof(name), "grid %d", gridExtent);
+			printf("  %-10s %-8s %10.2f %10.3f %10.3f %10.2f ", name, reorder ? "on" : "off", tracer.GetRayCount() / seconds * 1e-6, stats.Extend, stats.Reorder, offSeconds / seconds);
+			if (countersAvailable && loads > 0. && references > 0.)
+				printf("%9.2f%% %9.2f%% ", 100. * (1. - loadMisses / loads), 100. * (1. - misses / references));
+			else
+				printf("%10s %10s ", "-", "-");
+			// Bitwise, the RTIAW scenes have a few NaN pixels
+			const bool same = !memcmp(offOutput.data(), tracer.GetOutput().data(), offOutput.size() * sizeof(glm::vec4));
+			printf("%10s\n", !reorder ? "" : same ? "yes" : "NO");
+		}
+	}
+}
+
+//////////////////
+//              //
+//   SAMPLERS   //
+//              //
+//////////////////
+
+// Root mean square error against a reference, on the linear accumulated radiance
+static double RMSE(const std::vector<glm::vec4>& accumulated, uint32_t samples, const std::vector<glm::vec4>& reference, uint32_t referenceSamples)
+{
+	double error = 0.;
+	for (size_t i = 0; i < accumulated.size(); ++i)
+	{
+		glm::vec4 diff = accumulated[i] / static_cast<float>(samples) - reference[i] / static_cast<float>(referenceSamples);
+		error += diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+	}
+	return std::sqrt(error / (3. * accumulated.size()));
+}
+
+static void BenchSamplers(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+
+	// Independent samples for the reference, so it favours none of the low discrepancy samplers
+	const uint32_t referenceSamples = args.Samples * 32;
+	RTConstants referenceConstants;
+	referenceConstants.Sampler = SamplerType::PCG;
+	RenderSamples(tracer, scene, camera, referenceSamples, referenceConstants);
+	std::vector<glm::vec4> reference = tracer.GetAccumulated();
+	printf("Reference: %u spp PCG, %ux%u\n", referenceSamples, args.Width, args.Height);
+
+	const struct { const char* Name; SamplerType Type; } samplers[] =
+	{
+		{ "pcg", SamplerType::PCG },
+		{ "sobol", SamplerType::Sobol },
+		{ "bluenoise", SamplerType::BlueNoise },
+	};
+
+	printf("  %-10s", "spp");
+	for (uint32_t spp = 1; spp <= args.Samples; spp *= 2)
+		printf("%10u", spp);
+	printf("\n");
+
+	for (const auto& sampler : samplers)
+	{
+		RTConstants constants;
+		constants.AccumlateSamples = true;
+		constants.Sampler = sampler.Type;
+
+		printf("  %-10s", sampler.Name);
+		for (uint32_t s = 0; s < args.Samples; ++s)
+		{
+			constants.ResetOutput = s == 0;
+			constants.AccumulatedSamples = s + 1;
+			constants.RandSeed = s + 1;
+			tracer.Dispatch(scene, camera, constants);
+			if (std::has_single_bit(s + 1))
+				printf("%10.5f", RMSE(tracer.GetAccumulated(), s + 1, reference, referenceSamples));
+		}
+		printf("\n");
+	}
+}
+
+///////////////
+//           //
+//   WARPS   //
+//           //
+///////////////
+
+static volatile float s_sink;
+
+// PCG stream that counts its draws
+struct CountingRandom
+{
+	PCGRandom	Rng;
+	uint64_t	Calls = 0;
+
+	inline float GetFloat()		{ ++Calls; return Rng.GetFloat(); }
+	inline float GetSFloat()	{ return (GetFloat() - 0.5f) * 2; }
+	inline glm::vec2 Get2D()	{ float u = GetFloat(); return { u, GetFloat() }; }
+};
+
+// The rejection loops RT.hlsl used before the warps, for comparison
+static glm::vec3 RejectionUnitBall(CountingRandom& rng, uint64_t& fallbacks)
+{
+	for (uint32_t i = 0; i < 50; i++)
+	{
+		glm::vec3 p(rng.GetSFloat(), rng.GetSFloat(), rng.GetSFloat());
+		if (glm::dot(p, p) < 1)
+			return p;
+	}
+	++fallbacks;
+	return glm::normalize(glm::vec3(rng.GetSFloat(), rng.GetSFloat(), rng.GetSFloat()));
+}
+
+static glm::vec3 RejectionUnitDisk(CountingRandom& rng, uint64_t& fallbacks)
+{
+	for (uint32_t i = 0; i < 50; i++)
+	{
+		glm::vec3 p(rng.GetSFloat(), rng.GetSFloat(), 0);
+		if (glm::dot(p, p) < 1)
+			return p;
+	}
+	++fallbacks;
+	return glm::vec3(0.f);
+}
+
+static void BenchWarps(const BenchArgs& args)
+{
+	const uint32_t count = args.Width * args.Height * args.Samples;
+
+	// Hit normals to build the diffuse bounces around
+	std::vector<glm::vec3> normals(1024);
+	PCGRandom normalRng(1);
+	for (glm::vec3& n : normals)
+		n = SampleUniformSphere({ normalRng.GetFloat(), normalRng.GetFloat() });
+
+	PerfCounter instructions(PerfEvent::Instructions);
+	printf("%u samples per warp, instruction counts %s\n", count, instructions.IsAvailable() ? "from perf events" : "unavailable (no perf event access)");
+	printf("  %-28s %10s %12s %14s %10s\n", "warp", "ns/sample", "draws/sample", "instr/sample", "fallbacks");
+
+	auto measure = [&](const char* name, auto warp)
+	{
+		CountingRandom rng;
+		rng.Rng = PCGRandom(0x9e3779b9u);
+		uint64_t fallbacks = 0;
+		glm::vec3 sum(0.f);
+
+		auto start = std::chrono::steady_clock::now();
+		instructions.Start();
+		for (uint32_t i = 0; i < count; ++i)
+			sum += warp(rng, normals[i & 1023], fallbacks);
+		uint64_t instructionCount = instructions.Stop();
+		double seconds = Seconds(start);
+
+		printf("  %-28s %10.2f %12.3f ", name, seconds / count * 1e9, static_cast<double>(rng.Calls) / count);
+		if (instructions.IsAvailable())
+			printf("%14.1f", static_cast<double>(instructionCount) / count);
+		else
+			printf("%14s", "-");
+		printf(" %10llu\n", static_cast<unsigned long long>(fallbacks));
+		// Keeps the compiler from dropping the loop
+		s_sink = sum.x + sum.y + sum.z;
+	};
+
+	measure("unit ball (rejection)", [](CountingRandom& rng, const glm::vec3&, uint64_t& fallbacks) { return RejectionUnitBall(rng, fallbacks); });
+	measure("uniform sphere", [](CountingRandom& rng, const glm::vec3&, uint64_t&) { return SampleUniformSphere(rng.Get2D()); });
+	measure("unit disk (rejection)", [](CountingRandom& rng, const glm::vec3&, uint64_t& fallbacks) { return RejectionUnitDisk(rng, fallbacks); });
+	measure("concentric disk", [](CountingRandom& rng, const glm::vec3&, uint64_t&) { glm::vec2 d = SampleConcentricDisk(rng.Get2D()); return glm::vec3(d.x, d.y, 0.f); });
+
+	// A whole diffuse bounce: the old normal + point in the unit ball against the cosine hemisphere warp
+	measure("diffuse bounce (rejection)", [](CountingRandom& rng, const glm::vec3& n, uint64_t& fallbacks) { return glm::normalize(n + RejectionUnitBall(rng, fallbacks)); });
+	measure("diffuse bounce (cosine)", [](CountingRandom& rng, const glm::vec3& n, uint64_t&) { return SampleCosineHemisphere(rng.Get2D(), n); });
+}
+
+//////////////////////////
+//                      //
+//  RUSSIAN ROULETTE    //
+//                      //
+//////////////////////////
+
+static void BenchRoulette(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	const double paths = static_cast<double>(args.Width) * args.Height * args.Samples;
+
+	// Without roulette, the estimate every roulette setting converges to
+	RTConstants constants;
+	constants.MinRayBounces = constants.MaxRayBounces + 1;
+	const uint32_t referenceSamples = args.Samples * 32;
+	RenderSamples(tracer, scene, camera, referenceSamples, constants);
+	std::vector<glm::vec4> reference = tracer.GetAccumulated();
+	printf("Reference: %u spp without roulette, %ux%u, %u bounces\n", referenceSamples, args.Width, args.Height, constants.MaxRayBounces);
+	printf("  %-12s %10s %12s %10s %12s\n", "min bounces", "seconds", "rays/path", "RMSE", "efficiency");
+
+	// Efficiency is 1 / (MSE * time), relative to rendering without roulette
+	double baseEfficiency = 0.;
+	for (uint32_t minBounces : { constants.MaxRayBounces + 1, 5u, 3u, 2u, 1u })
+	{
+		constants.MinRayBounces = minBounces;
+		tracer.ResetStats();
+		double seconds = RenderSamples(tracer, scene, camera, args.Samples, constants);
+		double error = RMSE(tracer.GetAccumulated(), args.Samples, reference, referenceSamples);
+		double efficiency = 1. / (error * error * seconds);
+		if (baseEfficiency == 0.)
+			baseEfficiency = efficiency;
+
+		char name[16];
+		snprintf(name, sizeof(name), minBounces > constants.MaxRayBounces ? "off" : "%u", minBounces);
+		printf("  %-12s %10.3f %12.3f %10.5f %11.2fx\n", name, seconds, tracer.GetRayCount() / paths, error, efficiency / baseEfficiency);
+	}
+}
+
+////////////////////////
+//                    //
+//   LIGHT SAMPLING   //
+//                    //
+////////////////////////
+
+static void BenchLights(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateCornellBox();
+	scene.Build();
+	RTCameraSD camera = CornellBoxCamera(args.Width, args.Height);
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	const double paths = static_cast<double>(args.Width) * args.Height * args.Samples;
+
+	RTConstants constants;
+	const uint32_t referenceSamples = args.Samples * 32;
+	RenderSamples(tracer, scene, camera, referenceSamples, constants);
+	std::vector<glm::vec4> reference = tracer.GetAccumulated();
+	printf("Reference: %u spp with next event estimation, %ux%u, Cornell box with %zu light\n", referenceSamples, args.Width, args.Height, scene.GetLights().size());
+	printf("  %-12s %10s %12s %10s %12s\n", "light paths", "seconds", "rays/path", "RMSE", "efficiency");
+
+	// Efficiency is 1 / (MSE * time), relative to BSDF sampling alone
+	double baseEfficiency = 0.;
+	for (bool nee : { false, true })
+	{
+		constants.NextEventEstimation = nee;
+		tracer.ResetStats();
+		double seconds = RenderSamples(tracer, scene, camera, args.Samples, constants);
+		double error = RMSE(tracer.GetAccumulated(), args.Samples, reference, referenceSamples);
+		double efficiency = 1. / (error * error * seconds);
+		if (baseEfficiency == 0.)
+			baseEfficiency = efficiency;
+		printf("  %-12s %10.3f %12.3f %10.5f %11.2fx\n", nee ? "nee + mis" : "bsdf", seconds, tracer.GetRayCount() / paths, error, efficiency / baseEfficiency);
+	}
+}
+
+//////////////////
+//              //
+//   DENOISER   //
+//              //
+//////////////////
+
+// RMSE of the linear radiance of an OutputTex like output (squared back) against an accumulated reference.
+// Pixels that aren't finite on either side are left out, the RTIAW scenes have a few NaN samples
+static double OutputRMSE(const std::vector<glm::vec4>& output, const std::vector<glm::vec4>& reference, uint32_t referenceSamples)
+{
+	double error = 0.;
+	size_t count = 0;
+	for (size_t i = 0; i < output.size(); ++i)
+	{
+		glm::vec3 diff = glm::vec3(output[i]) * glm::vec3(output[i]) - glm::vec3(reference[i]) / static_cast<float>(referenceSamples);
+		double pixelError = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+		if (!std::isfinite(pixelError))
+			continue;
+		error += pixelError;
+		++count;
+	}
+	return std::sqrt(error / (3. * std::max<size_t>(count, 1)));
+}
+
+static void BenchDenoise(const BenchArgs& args)
+{
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	const uint32_t referenceSamples = args.Samples * 32;
+	printf("Denoised low sample counts against the noisy image, %ux%u on %u threads, RMSE against %u spp.\n", args.Width, args.Height, tracer.GetThreadCount(), referenceSamples);
+	printf("'same RMSE' is the sample count the noisy image needs to get as close to the reference, 'sooner' how much faster the denoised one got there\n");
+	printf("  %-10s %6s %12s %12s %12s %10s %10s\n", "scene", "spp", "noisy RMSE", "denoised", "denoise ms", "same RMSE", "sooner");
+
+	struct Scene
+	{
+		const char*	Name;
+		RTScene		Scene;
+		RTCameraSD	Camera;
+	};
+	Scene scenes[] =
+	{
+		{ "rtiaw", RTScene::CreateRTIAWFinal(0, args.GridExtent), RTIAWFinalCamera(args.Width, args.Height) },
+		{ "cornell", RTScene::CreateCornellBox(), CornellBoxCamera(args.Width, args.Height) },
+	};
+	for (Scene& scene : scenes)
+	{
+		scene.Scene.Build();
+		tracer.SetDenoiser({});
+		RenderSamples(tracer, scene.Scene, scene.Camera, referenceSamples);
+		std::vector<glm::vec4> reference = tracer.GetAccumulated();
+
+		// Noisy error and time up to 8x the largest denoised sample count
+		std::vector<std::pair<uint32_t, double>> noisyErrors;
+		std::vector<double> noisySeconds;
+		for (uint32_t spp = 1; spp <= args.Samples * 8 && spp < referenceSamples; spp *= 2)
+		{
+			double seconds = RenderSamples(tracer, scene.Scene, scene.Camera, spp);
+			noisyErrors.push_back({ spp, OutputRMSE(tracer.GetOutput(), reference, referenceSamples) });
+			noisySeconds.push_back(seconds);
+		}
+
+		DenoiserSettings settings;
+		settings.Enabled = true;
+		tracer.SetDenoiser(settings);
+		for (uint32_t i = 0; (1u << i) <= args.Samples; ++i)
+		{
+			const uint32_t spp = 1u << i;
+			double seconds = RenderSamples(tracer, scene.Scene, scene.Camera, spp);
+			double error = OutputRMSE(tracer.GetOutput(), reference, referenceSamples);
+
+			// First noisy sample count at least as close to the reference
+			size_t match = 0;
+			while (match < noisyErrors.size() && noisyErrors[match].second > error)
+				++match;
+			printf("  %-10s %6u %12.5f %12.5f %12.2f ", scene.Name, spp, noisyErrors[i].second, error, tracer.GetDenoiser().GetFilterSeconds() * 1e3);
+			if (match < noisyErrors.size())
+				printf("%10u %9.1fx\n", noisyErrors[match].first, noisySeconds[match] / seconds);
+			else
+				printf("%9s%u %9s%.1fx\n", ">", noisyErrors.back().first, ">", noisySeconds.back() / seconds);
+		}
+	}
+}
+
+////////////////////////
+//                    //
+//        AOVS        //
+//                    //
+////////////////////////
+
+static void BenchAOVs(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+
+	printf("Render time with AOVs written in the same pass, RTIAW final scene, %ux%u, %u spp on %u threads\n", args.Width, args.Height, args.Samples, tracer.GetThreadCount());
+	printf("  %-12s %-14s %10s %10s %10s %10s %12s\n", "mode", "AOVs", "bytes/px", "seconds", "overhead", "same image", "same AOVs");
+
+	struct Mode
+	{
+		const char*	Name;
+		RTTraceMode	Mode;
+	};
+	const Mode modes[] = { { "megakernel", RTTraceMode::Megakernel }, { "packets", RTTraceMode::Packets }, { "wavefront", RTTraceMode::Wavefront } };
+	struct AOVSet
+	{
+		const char*	Name;
+		uint32_t	Flags;
+	};
+	const AOVSet sets[] = { { "none", AOVNone }, { "sample count", AOVSampleCount }, { "depth", AOVDepth }, { "all", AOVAll } };
+
+	// Every mode has to write the same AOVs as the megakernel loop
+	std::vector<uint32_t> referenceAOVs;
+	for (const Mode& mode : modes)
+	{
+		tracer.SetTraceMode(mode.Mode);
+		double noneSeconds = 0.;
+		std::vector<glm::vec4> noneOutput;
+		for (const AOVSet& set : sets)
+		{
+			tracer.SetAOVs(set.Flags);
+			double seconds = RenderSamples(tracer, scene, camera, args.Samples);
+			if (set.Flags == AOVNone)
+			{
+				noneSeconds = seconds;
+				noneOutput = tracer.GetOutput();
+			}
+			if (set.Flags == AOVAll && referenceAOVs.empty())
+				referenceAOVs = tracer.GetAOVBuffer().GetData();
+
+			// Bitwise, the RTIAW scenes have a few NaN pixels
+			const bool same = !memcmp(noneOutput.data(), tracer.GetOutput().data(), noneOutput.size() * sizeof(glm::vec4));
+			printf("  %-12s %-14s %10u %10.3f %9.1f%% %10s ", mode.Name, set.Name, tracer.GetAOVBuffer().GetStride() * 4, seconds, 100. * (seconds / noneSeconds - 1.), same ? "yes" : "NO");
+			if (set.Flags == AOVAll)
+			{
+				// Packets may disagree with single rays on a grazing hit now and then
+				const std::vector<uint32_t>& aovs = tracer.GetAOVBuffer().GetData();
+				size_t differing = 0;
+				for (size_t pixel = 0; pixel < aovs.size() / tracer.GetAOVBuffer().GetStride(); ++pixel)
+				{
+					const size_t offset = pixel * tracer.GetAOVBuffer().GetStride();
+					differing += memcmp(&aovs[offset], &referenceAOVs[offset], tracer.GetAOVBuffer().GetStride() * sizeof(uint32_t)) != 0;
+				}
+				if (differing == 0)
+					printf("%12s\n", "yes");
+				else
+					printf("%8zu px\n", differing);
+			}
+			else
+				printf("\n");
+		}
+	}
+	tracer.SetAOVs(AOVNone);
+}
+
+////////////////////////
+//                    //
+//    REPROJECTION    //
+//                    //
+////////////////////////
+
+static void BenchReprojection(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	// One sample per frame while the camera orbits the RTIAW look at point, compared on the last frame
+	const uint32_t frames = 32, referenceSamples = args.Samples * 32;
+	auto orbitCamera = [&](float degrees)
+	{
+		const float angle = glm::radians(degrees);
+		const glm::vec3 position(13.f * cosf(angle) - 3.f * sinf(angle), 2.f, 13.f * sinf(angle) + 3.f * cosf(angle));
+		RTCamera camera(position, { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, glm::ivec2(args.Width, args.Height), static_cast<float>(args.Width) / args.Height, 20.f, 10.f, 0.6f);
+		return camera.GetShaderData();
+	};
+
+	printf("%u frames of 1 spp orbiting the RTIAW final scene, %ux%u on %u threads, RMSE of the last frame against %u spp\n", frames, args.Width, args.Height, tracer.GetThreadCount(), referenceSamples);
+	printf("  %-14s %-8s %10s %12s %12s %14s\n", "degrees/frame", "history", "RMSE", "mean spp", "reprojected", "reproject ms");
+	for (float speed : { 0.05f, 0.25f, 1.f })
+	{
+		const RTCameraSD lastCamera = orbitCamera(speed * (frames - 1));
+		tracer.SetTemporalReprojection({});
+		RenderSamples(tracer, scene, lastCamera, referenceSamples);
+		std::vector<glm::vec4> reference = tracer.GetAccumulated();
+
+		for (bool reproject : { false, true })
+		{
+			TemporalReprojectionSettings settings;
+			settings.Enabled = reproject;
+			tracer.SetTemporalReprojection(settings);
+
+			RTConstants constants;
+			constants.AccumlateSamples = true;
+			constants.ResetOutput = true;
+			double reprojectSeconds = 0., reprojectedFraction = 0.;
+			for (uint32_t frame = 0; frame < frames; ++frame)
+			{
+				// Every frame is a reset, the tracer continues the sample index when it reprojects
+				constants.AccumulatedSamples = 1;
+				constants.RandSeed = frame + 1;
+				tracer.Dispatch(scene, orbitCamera(speed * frame), constants);
+				if (frame > 0)
+				{
+					reprojectSeconds += tracer.GetReprojectionSeconds();
+					reprojectedFraction += tracer.GetReprojectedFraction();
+				}
+			}
+			uint64_t samples = 0;
+			for (const PixelStats& stats : tracer.GetPixelStats())
+				samples += stats.Samples;
+
+			printf("  %-14.2f %-8s %10.5f %12.2f ", speed, reproject ? "on" : "off", OutputRMSE(tracer.GetOutput(), reference, referenceSamples),
+				static_cast<double>(samples) / tracer.GetPixelStats().size());
+			if (reproject)
+				printf("%11.1f%% %14.2f\n", 100. * reprojectedFraction / (frames - 1), reprojectSeconds * 1e3 / (frames - 1));
+			else
+				printf("%12s %14s\n", "-", "-");
+		}
+	}
+	tracer.SetTemporalReprojection({});
+}
+
+////////////////////////
+//                    //
+//  DISPLAY TRANSFORM //
+//                    //
+////////////////////////
+
+static void BenchDisplay(const BenchArgs& args)
+{
+	ThreadPool pool(args.Threads);
+	// 4K accumulation of 16 samples per pixel, radiance spread over ~20 stops with some NaN and negative pixels
+	const uint32_t width = 3840, height = 2160, samples = 16;
+	const size_t pixelCount = static_cast<size_t>(width) * height;
+	std::vector<glm::vec4> accumulated(pixelCount);
+	uint32_t state = 1;
+	auto random = [&]()
+	{
+		state = state * 747796405u + 2891336453u;
+		const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return static_cast<float>((word >> 22u) ^ word) * 0x1p-32f;
+	};
+	for (glm::vec4& pixel : accumulated)
+	{
+		for (int c = 0; c < 3; ++c)
+			pixel[c] = std::exp2(random() * 20.f - 14.f) * samples;
+		pixel.w = static_cast<float>(samples);
+	}
+	accumulated[1] = glm::vec4(NAN, -1.f, INFINITY, samples);
+
+	printf("Resolve of a %ux%u accumulation to RGBA8 on %u threads, best of 5\n", width, height, pool.GetThreadCount());
+	printf("  %-6s %12s %12s %10s %16s\n", "curve", "SIMD ms", "scalar ms", "speedup", "pixels differing");
+	DisplayTransform display;
+	std::vector<uint32_t> simd(pixelCount), scalar(pixelCount);
+	const std::pair<const char*, ToneCurve> curves[] = { { "none", ToneCurve::None }, { "aces", ToneCurve::ACES }, { "agx", ToneCurve::AgX } };
+	for (const auto& [name, curve] : curves)
+	{
+		display.SetSettings({ 0.f, curve });
+		double simdSeconds = 1e9, scalarSeconds = 1e9;
+		for (int run = 0; run < 5; ++run)
+		{
+			auto start = std::chrono::steady_clock::now();
+			display.ResolveAccumulated(pool, accumulated.data(), pixelCount, simd.data());
+			simdSeconds = std::min(simdSeconds, Seconds(start));
+
+			start = std::chrono::steady_clock::now();
+			pool.ParallelFor(height, [&](uint32_t y, uint32_t threadIndex)
+			{
+				for (size_t pixel = static_cast<size_t>(y) * width; pixel < static_cast<size_t>(y + 1) * width; ++pixel)
+					scalar[pixel] = display.ResolvePixel(glm::vec3(accumulated[pixel]) / accumulated[pixel].w);
+			});
+			scalarSeconds = std::min(scalarSeconds, Seconds(start));
+		}
+
+		size_t differing = 0;
+		for (size_t pixel = 0; pixel < pixelCount; ++pixel)
+			differing += simd[pixel] != scalar[pixel];
+		printf("  %-6s %12.2f %12.2f %9.2fx %16zu\n", name, simdSeconds * 1e3, scalarSeconds * 1e3, scalarSeconds / simdSeconds, differing);
+	}
+
+	// The table against the exact encode, at values spread evenly over [0, 1]
+	display.SetSettings({ 0.f, ToneCurve::None });
+	const uint32_t values = 1 << 24;
+	uint32_t mismatches = 0, maxError = 0;
+	for (uint32_t i = 0; i <= values; ++i)
+	{
+		const float linear = static_cast<float>(i) / values;
+		const int32_t error = static_cast<int32_t>(display.ResolvePixel(glm::vec3(linear)) & 0xff) - DisplayTransform::EncodeSRGB(linear);
+		mismatches += error != 0;
+		maxError = std::max(maxError, static_cast<uint32_t>(std::abs(error)));
+	}
+	printf("sRGB table: %u of %u values encode differently from the exact sRGB encode, by at most %u\n", mismatches, values + 1, maxError);
+}
+
+////////////////////////
+//                    //
+//    IMAGE OUTPUT    //
+//                    //
+////////////////////////
+
+static void BenchImageOutput(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	RenderSamples(tracer, scene, RTIAWFinalCamera(args.Width, args.Height), args.Samples);
+	const std::vector<glm::vec4>& output = tracer.GetOutput();
+	const uint32_t width = args.Width, height = args.Height, tileSize = 64;
+
+	// Tiles in row order, and shuffled like a scheduler handing them out of order would
+	struct Tile { uint32_t X, Y, Width, Height; };
+	std::vector<Tile> tiles;
+	for (uint32_t y = 0; y < height; y += tileSize)
+	{
+		for (uint32_t x = 0; x < width; x += tileSize)
+			tiles.push_back({ x, y, std::min(tileSize, width - x), std::min(tileSize, height - y) });
+	}
+	std::vector<Tile> shuffled = tiles;
+	uint32_t state = 1;
+	for (size_t i = shuffled.size() - 1; i > 0; --i)
+	{
+		state = state * 747796405u + 2891336453u;
+		std::swap(shuffled[i], shuffled[(state >> 8) % (i + 1)]);
+	}
+
+	// Display values for PNG, mean radiance for the float formats
+	std::vector<uint8_t> bytes(static_cast<size_t>(width) * height * 3);
+	std::vector<float> radiance(bytes.size());
+	for (size_t pixel = 0; pixel < output.size(); ++pixel)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			bytes[pixel * 3 + c] = static_cast<uint8_t>(glm::clamp(output[pixel][c], 0.f, 1.f) * 255.f);
+			radiance[pixel * 3 + c] = output[pixel][c] * output[pixel][c];
+		}
+	}
+
+	printf("%ux%u image in %ux%u tiles, submitted from the calling thread and written on the ImageOutput thread\n", width, height, tileSize, tileSize);
+	printf("  %-6s %-10s %12s %12s %12s %10s\n", "format", "order", "submit ms", "total ms", "size KB", "written");
+	const std::pair<const char*, ImageFormat> formats[] = { { "png", ImageFormat::PNG }, { "pfm", ImageFormat::PFM }, { "exr", ImageFormat::EXR } };
+	for (const auto& [name, format] : formats)
+	{
+		for (const std::vector<Tile>* order : { &tiles, &shuffled })
+		{
+			const std::string path = std::string("RTBench_image.") + name;
+			ImageDesc desc;
+			desc.Width = width;
+			desc.Height = height;
+			desc.Format = format;
+			ImageOutput image;
+			auto start = std::chrono::steady_clock::now();
+			bool written = image.Open(path, desc);
+			for (const Tile& tile : *order)
+			{
+				const size_t first = (static_cast<size_t>(tile.Y) * width + tile.X) * 3;
+				if (format == ImageFormat::PNG)
+					image.SubmitTile(tile.X, tile.Y, tile.Width, tile.Height, bytes.data() + first, 3, static_cast<size_t>(width) * 3);
+				else
+					image.SubmitTile(tile.X, tile.Y, tile.Width, tile.Height, radiance.data() + first, 3, static_cast<size_t>(width) * 3);
+			}
+			const double submitSeconds = Seconds(start);
+			written &= image.Close();
+			const double totalSeconds = Seconds(start);
+
+			long size = 0;
+			if (FILE* file = fopen(path.c_str(), "rb"))
+			{
+				fseek(file, 0, SEEK_END);
+				size = ftell(file);
+				fclose(file);
+			}
+			remove(path.c_str());
+			printf("  %-6s %-10s %12.2f %12.2f %12.1f %10s\n", name, order == &tiles ? "rows" : "shuffled", submitSeconds * 1e3, totalSeconds * 1e3, size / 1024., written ? "yes" : "FAILED");
+		}
+	}
+	printf("  raw 8 bit RGB is %.1f KB, raw float RGB %.1f KB\n", bytes.size() / 1024., radiance.size() * sizeof(float) / 1024.);
+}
+
+////////////////////////
+//                    //
+//   TILE SCHEDULING  //
+//                    //
+////////////////////////
+
+static void BenchTiles(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+	const RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+
+	printf("%u spp of the RTIAW final scene at %ux%u on %u threads, megakernel. Idle is thread time spent waiting for the last tile of a pass\n",
+		args.Samples, args.Width, args.Height, tracer.GetThreadCount());
+	printf("  %-8s %6s %6s %10s %10s %10s %8s %14s\n", "order", "tile", "steal", "ms/pass", "MRays/s", "steals", "idle", "centre tile at");
+	const std::pair<const char*, TileOrder> orders[] = { { "rows", TileOrder::Rows }, { "hilbert", TileOrder::Hilbert }, { "spiral", TileOrder::Spiral } };
+	for (const auto& [name, order] : orders)
+	{
+		for (uint32_t size : { 8u, 16u, 64u })
+		{
+			for (bool stealing : { true, false })
+			{
+				// Static shares only at the default size, to see what stealing buys
+				if (!stealing && size != 16)
+					continue;
+				TileSettings settings;
+				settings.Size = size;
+				settings.Order = order;
+				settings.WorkStealing = stealing;
+				tracer.SetTiles(settings);
+				tracer.ResetStats();
+
+				RTConstants constants;
+				constants.AccumlateSamples = true;
+				double seconds = 0., busySeconds = 0.;
+				uint64_t steals = 0;
+				for (uint32_t s = 0; s < args.Samples; ++s)
+				{
+					constants.ResetOutput = s == 0;
+					constants.AccumulatedSamples = s + 1;
+					constants.RandSeed = s + 1;
+					tracer.Dispatch(scene, camera, constants);
+					const TileStats& stats = tracer.GetTileScheduler().GetStats();
+					seconds += stats.Seconds;
+					busySeconds += stats.BusySeconds;
+					steals += stats.Steals;
+				}
+
+				// How far into the hand out order the tile under the image centre comes
+				const std::vector<Tile>& tiles = tracer.GetTileScheduler().GetTiles();
+				size_t centre = 0;
+				while (centre < tiles.size() && !(args.Width / 2 - tiles[centre].X < tiles[centre].Width && args.Height / 2 - tiles[centre].Y < tiles[centre].Height))
+					++centre;
+
+				printf("  %-8s %6u %6s %10.2f %10.2f %10.1f %7.1f%% %13.1f%%\n", name, size, stealing ? "on" : "off", seconds * 1e3 / args.Samples,
+					tracer.GetRayCount() / seconds * 1e-6, static_cast<double>(steals) / args.Samples,
+					100. * std::max(0., 1. - busySeconds / (seconds * tracer.GetThreadCount())), 100. * centre / tiles.size());
+			}
+		}
+	}
+	tracer.SetTiles({});
+}
+
+////////////////////////
+//                    //
+// DISTRIBUTED RENDER //
+//                    //
+////////////////////////
+
+static void BenchDistributed(const BenchArgs& args)
+{
+	RTScene scene = RTScene::CreateRTIAWFinal(0, args.GridExtent);
+	scene.Build();
+	const RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+	CPUTracer reference(args.Width, args.Height, args.Threads);
+	const double singleSeconds = RenderSamples(reference, scene, camera, args.Samples);
+	const std::vector<glm::vec4>& expected = reference.GetAccumulated();
+
+	// Workers are threads of this process with their own tracer, sharing the machine's threads, but talk through real sockets
+	printf("%u spp of the RTIAW final scene at %ux%u, workers on threads of this process sharing %u threads. Single process: %.1fms\n",
+		args.Samples, args.Width, args.Height, reference.GetThreadCount(), singleSeconds * 1e3);
+	printf("  %-6s %8s %8s %10s %10s %10s %12s\n", "socket", "workers", "batch", "total ms", "MB", "merge ms", "max rel err");
+	const std::string addresses[] = { "unix:/tmp/rtbench-" + std::to_string(getpid()) + ".sock", "tcp:127.0.0.1:0" };
+	for (const std::string& address : addresses)
+	{
+		for (uint32_t workers : { 1u, 2u, 4u })
+		{
+			for (uint32_t batch : { 1u, args.Samples })
+			{
+				// Port 0 can't be connected to, pick one per run
+				const std::string listen = address == "tcp:127.0.0.1:0" ? "tcp:127.0.0.1:" + std::to_string(40000 + getpid() % 20000) : address;
+				DistributedCoordinator coordinator;
+				if (!coordinator.Listen(listen))
+				{
+					printf("  %-6s failed to listen on %s\n", address.substr(0, address.find(':')).c_str(), listen.c_str());
+					break;
+				}
+
+				auto start = std::chrono::steady_clock::now();
+				std::vector<std::thread> threads;
+				for (uint32_t i = 0; i < workers; ++i)
+				{
+					threads.emplace_back([&]
+					{
+						CPUTracer tracer(args.Width, args.Height, std::max(reference.GetThreadCount() / workers, 1u));
+						DistributedWorker worker;
+						DistributedAssignment assignment;
+						if (!worker.Connect(listen, args.Width, args.Height, assignment))
+							return;
+						RTConstants constants;
+						constants.AccumlateSamples = true;
+						const uint32_t end = assignment.FirstSample + assignment.SampleCount;
+						for (uint32_t first = assignment.FirstSample; first < end; first += batch)
+						{
+							const uint32_t batchEnd = std::min(first + batch, end);
+							for (uint32_t s = first; s < batchEnd; ++s)
+							{
+								constants.ResetOutput = s == first;
+								constants.AccumulatedSamples = s + 1;
+								constants.RandSeed = s + 1;
+								tracer.Dispatch(scene, camera, constants);
+							}
+							worker.SendPartial(tracer.GetAccumulated(), batchEnd - first);
+						}
+						worker.SendDone();
+					});
+				}
+				std::vector<glm::vec4> merged;
+				const bool done = coordinator.AcceptWorkers(workers, args.Width, args.Height, args.Samples) && coordinator.Merge(merged);
+				for (std::thread& thread : threads)
+					thread.join();
+				const double seconds = Seconds(start);
+				if (!done)
+				{
+					printf("  %-6s %8u %8u failed\n", address.substr(0, address.find(':')).c_str(), workers, batch);
+					continue;
+				}
+
+				// Same samples as the single process, only summed in another order
+				float maxError = 0.f;
+				for (size_t pixel = 0; pixel < merged.size(); ++pixel)
+				{
+					const glm::vec3 difference = glm::abs(glm::vec3(merged[pixel]) - glm::vec3(expected[pixel])), scale = glm::max(glm::vec3(expected[pixel]), glm::vec3(1e-6f));
+					maxError = std::max(maxError, std::max(std::max(difference.x / scale.x, difference.y / scale.y), difference.z / scale.z));
+				}
+				printf("  %-6s %8u %8u %10.1f %10.1f %10.2f %12.2e\n", address.substr(0, address.find(':')).c_str(), workers, batch, seconds * 1e3,
+					coordinator.GetReceivedBytes() / (1024. * 1024.), coordinator.GetMergeSeconds() * 1e3, maxError);
+			}
+		}
+	}
+}
+
+////////////////////////
+//                    //
+//   TRIANGLE MESHES  //
+//                    //
+////////////////////////
+
+static void BenchTriangles(const BenchArgs& args)
+{
+	ThreadPool pool(args.Threads);
+	const uint32_t rayCount = args.Width * args.Height * args.Samples;
+	printf("%u rays per mesh from inside the closed torus tube on %u threads, every closest hit and shadow ray has to hit\n", rayCount, pool.GetThreadCount());
+	printf("  %-10s %10s %10s %10s %10s %10s %10s\n", "triangles", "build ms", "nodes", "SAH cost", "MRays/s", "shadow", "leaks");
+
+	for (uint32_t rings : { 16u, 64u, 160u, 512u })
+	{
+		const float majorRadius = 3.f, minorRadius = 1.f;
+		TriangleMeshData torus = TriangleMeshData::CreateTorus(majorRadius, minorRadius, 4 * rings, rings);
+		auto start = std::chrono::steady_clock::now();
+		TriangleBLAS blas;
+		blas.Build(torus.GetView(), 0, glm::mat4(1.f), {}, &pool);
+		double buildSeconds = Seconds(start);
+
+		// Origins on the core circle of the tube, so every direction leaves through the surface. A ray that misses went through a crack
+		auto makeRay = [&](uint32_t i)
+		{
+			PCGRandom rng(PCGHash(i));
+			float phi = 2.f * RT_PI * rng.GetFloat();
+			return Ray{ { majorRadius * cosf(phi), 0.f, majorRadius * sinf(phi) }, SampleUniformSphere({ rng.GetFloat(), rng.GetFloat() }) };
+		};
+
+		std::vector<uint64_t> leaks(pool.GetThreadCount(), 0);
+		start = std::chrono::steady_clock::now();
+		pool.ParallelFor((rayCount + 1023) / 1024, [&](uint32_t chunk, uint32_t threadIndex)
+		{
+			HitRecord rec;
+			for (uint32_t i = chunk * 1024; i < std::min(rayCount, (chunk + 1) * 1024); ++i)
+			{
+				if (!blas.Hit(makeRay(i), 0.f, RT_FLOATMAX, rec))
+					++leaks[threadIndex];
+			}
+		});
+		double closestSeconds = Seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		pool.ParallelFor((rayCount + 1023) / 1024, [&](uint32_t chunk, uint32_t threadIndex)
+		{
+			for (uint32_t i = chunk * 1024; i < std::min(rayCount, (chunk + 1) * 1024); ++i)
+			{
+				if (!blas.Occluded(makeRay(i), 0.f, RT_FLOATMAX))
+					++leaks[threadIndex];
+			}
+		});
+		double shadowSeconds = Seconds(start);
+
+		uint64_t totalLeaks = 0;
+		for (uint64_t l : leaks)
+			totalLeaks += l;
+		printf("  %-10u %10.1f %10zu %10.2f %10.2f %10.2f %10llu\n", blas.GetTriangleCount(), buildSeconds * 1e3, blas.GetBVH().GetNodeCount(), blas.GetBVH().SAHCost(),
+			rayCount / closestSeconds * 1e-6, rayCount / shadowSeconds * 1e-6, static_cast<unsigned long long>(totalLeaks));
+	}
+}
+
+////////////////////////
+//                    //
+//     INSTANCING     //
+//                    //
+////////////////////////
+
+static void BenchInstances(const BenchArgs& args)
+{
+	ThreadPool pool(args.Threads);
+	const uint32_t rayCount = args.Width * args.Height * args.Samples;
+
+	TriangleMeshData torus = TriangleMeshData::CreateTorus(0.7f, 0.3f, 64, 16);
+	TriangleBLAS blas;
+	blas.Build(torus.GetView(), 0, glm::mat4(1.f), {}, &pool);
+	const size_t blasBytes = blas.GetTriangleCount() * sizeof(RTTriangle) + blas.GetBVH().GetNodeBytes();
+	printf("One %u triangle torus BLAS (%.2f MB) instanced on a grid, %u rays from above on %u threads.\n", blas.GetTriangleCount(), blasBytes / 1e6, rayCount, pool.GetThreadCount());
+	printf("Moving 1%% of the instances only refits the TLAS. Up to 1k instances the copies are also baked into one BLAS, hits have to match it\n");
+	printf("  %-10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "instances", "MB", "flat MB", "TLAS ms", "move ms", "MRays/s", "flat ms", "flat MR/s", "mismatch");
+
+	for (uint32_t instanceCount : { 100u, 1000u, 10000u, 100000u })
+	{
+		// Square grid with spacing 2.5 in the xz plane, random orientations
+		const uint32_t side = static_cast<uint32_t>(ceilf(sqrtf(static_cast<float>(instanceCount))));
+		const float extent = 2.5f * side;
+		PCGRandom rng(instanceCount);
+		auto placement = [&](uint32_t i)
+		{
+			glm::mat4 transform = glm::translate(glm::mat4(1.f), glm::vec3(2.5f * (i % side) + 1.25f, 0.f, 2.5f * (i / side) + 1.25f));
+			transform = glm::rotate(transform, 2.f * RT_PI * rng.GetFloat(), glm::vec3(0.f, 1.f, 0.f));
+			return glm::rotate(transform, RT_PI * rng.GetFloat(), glm::vec3(1.f, 0.f, 0.f));
+		};
+
+		TLAS tlas;
+		const uint32_t blasIndex = tlas.AddBLAS(blas);
+		for (uint32_t i = 0; i < instanceCount; ++i)
+			tlas.AddInstance(blasIndex, placement(i));
+		auto start = std::chrono::steady_clock::now();
+		tlas.Update(InstanceBVHSettings(), 1.3f, &pool);
+		double tlasSeconds = Seconds(start);
+		const size_t bytes = blasBytes + instanceCount * sizeof(TLASInstance) + tlas.GetBVH().GetNodeBytes();
+
+		// Rays from above the grid toward random points on it
+		auto makeRay = [&](uint32_t i)
+		{
+			PCGRandom rayRng(PCGHash(i));
+			glm::vec3	origin(extent * rayRng.GetFloat(), 10.f, extent * rayRng.GetFloat()),
+						target(extent * rayRng.GetFloat(), 0.f, extent * rayRng.GetFloat());
+			return Ray{ origin, glm::normalize(target - origin) };
+		};
+		auto traceAll = [&](auto&& hit)
+		{
+			auto traceStart = std::chrono::steady_clock::now();
+			pool.ParallelFor((rayCount + 1023) / 1024, [&](uint32_t chunk, uint32_t threadIndex)
+			{
+				HitRecord rec;
+				for (uint32_t i = chunk * 1024; i < std::min(rayCount, (chunk + 1) * 1024); ++i)
+					hit(i, makeRay(i), rec, threadIndex);
+			});
+			return Seconds(traceStart);
+		};
+
+		// Move 1% of the instances, one per hundred
+		const uint32_t moved = std::max(instanceCount / 100, 1u);
+		start = std::chrono::steady_clock::now();
+		for (uint32_t m = 0; m < moved; ++m)
+			tlas.SetTransform(m * (instanceCount / moved), placement(m * (instanceCount / moved)));
+		tlas.Update(InstanceBVHSettings(), 1.3f, &pool);
+		double moveSeconds = Seconds(start);
+
+		std::vector<float> tlasT(rayCount, RT_FLOATMAX);
+		double traceSeconds = traceAll([&](uint32_t i, const Ray& ray, HitRecord& rec, uint32_t threadIndex)
+		{
+			if (tlas.Hit(ray, 0.f, RT_FLOATMAX, rec))
+				tlasT[i] = rec.T;
+		});
+
+		if (instanceCount > 1000)
+		{
+			printf("  %-10u %10.2f %10.2f %10.2f %10.3f %10.2f %10s %10s %10s\n", instanceCount, bytes / 1e6, blasBytes * static_cast<double>(instanceCount) / 1e6,
+				tlasSeconds * 1e3, moveSeconds * 1e3, rayCount / traceSeconds * 1e-6, "-", "-", "-");
+			continue;
+		}
+
+		// Same triangles baked into one BLAS, what every move would cost without instancing
+		TriangleMeshData flat;
+		for (const TLASInstance& instance : tlas.GetInstances())
+		{
+			const uint32_t base = static_cast<uint32_t>(flat.Positions.size());
+			for (const glm::vec3& p : torus.Positions)
+				flat.Positions.push_back(glm::vec3(instance.ObjectToWorld * glm::vec4(p, 1.f)));
+			for (uint32_t index : torus.Indices)
+				flat.Indices.push_back(base + index);
+		}
+		start = std::chrono::steady_clock::now();
+		TriangleBLAS flatBLAS;
+		flatBLAS.Build(flat.GetView(), 0, glm::mat4(1.f), {}, &pool);
+		double flatSeconds = Seconds(start);
+
+		std::vector<uint64_t> mismatches(pool.GetThreadCount(), 0);
+		double flatTraceSeconds = traceAll([&](uint32_t i, const Ray& ray, HitRecord& rec, uint32_t threadIndex)
+		{
+			float t = flatBLAS.Hit(ray, 0.f, RT_FLOATMAX, rec) ? rec.T : RT_FLOATMAX;
+			if (std::fabs(t - tlasT[i]) > 1e-3f * std::min(t, tlasT[i]))
+				++mismatches[threadIndex];
+		});
+		uint64_t totalMismatches = 0;
+		for (uint64_t m : mismatches)
+			totalMismatches += m;
+
+		printf("  %-10u %10.2f %10.2f %10.2f %10.3f %10.2f %10.1f %10.2f %10llu\n", instanceCount, bytes / 1e6, blasBytes * static_cast<double>(instanceCount) / 1e6,
+			tlasSeconds * 1e3, moveSeconds * 1e3, rayCount / traceSeconds * 1e-6, flatSeconds * 1e3, rayCount / flatTraceSeconds * 1e-6, static_cast<unsigned long long>(totalMismatches));
+	}
+}
+
+////////////////////////
+//                    //
+//     ANIMATION      //
+//                    //
+////////////////////////
+
+static void BenchAnimation(const BenchArgs& args)
+{
+	const uint32_t	frames = 60,
+					sphereCount = 4 * args.GridExtent * args.GridExtent * 25;
+	const float		extent = 5.f;
+	const RTCameraSD camera = RTIAWFinalCamera(args.Width, args.Height);
+	CPUTracer tracer(args.Width, args.Height, args.Threads);
+
+	// Spheres flying through a box at their own speed and bouncing off its walls
+	struct Motion
+	{
+		glm::vec3 Start, Velocity;
+	};
+	std::vector<Motion> motions(sphereCount);
+	PCGRandom rng(1);
+	for (Motion& motion : motions)
+	{
+		motion.Start = extent * (2.f * glm::vec3(rng.GetFloat(), rng.GetFloat(), rng.GetFloat()) - 1.f);
+		motion.Velocity = 0.1f * (2.f * glm::vec3(rng.GetFloat(), rng.GetFloat(), rng.GetFloat()) - 1.f);
+	}
+	auto position = [&](const Motion& motion, uint32_t frame)
+	{
+		// Triangle wave over [-extent, extent]
+		glm::vec3 p = (motion.Start + motion.Velocity * static_cast<float>(frame) + extent) / (2.f * extent);
+		p = glm::abs(p - 2.f * glm::floor(p * 0.5f + 0.5f));
+		return extent * (2.f * p - 1.f);
+	};
+	auto createScene = [&](uint32_t frame, BVHBuildQuality quality)
+	{
+		RTScene scene;
+		const uint32_t materials[] =
+		{
+			scene.AddMaterial({ {0.7f, 0.3f, 0.3f}, MTType::Diffuse, 0.f }),
+			scene.AddMaterial({ {0.8f, 0.8f, 0.8f}, MTType::Metal, 0.f }),
+			scene.AddMaterial({ glm::vec3(1.f), MTType::Dielectric, 0.f }),
+		};
+		for (uint32_t id = 0; id < sphereCount; ++id)
+			scene.AddSphere({ position(motions[id], frame), 0.1f, materials[id % 3] });
+		BVHBuildSettings settings = SphereBVHSettings();
+		settings.Quality = quality;
+		scene.Build(settings);
+		return scene;
+	};
+	printf("%u frames of %u spheres moving through a box, one %ux%u sample per frame\n", frames, sphereCount, args.Width, args.Height);
+	printf("  %-22s %10s %10s %10s %10s %10s %10s %10s\n", "policy", "update ms", "max ms", "trace ms", "max ms", "SAH", "rebuilds", "diff");
+
+	struct Policy
+	{
+		const char*		Name;
+		BVHUpdatePolicy	Update;
+		BVHBuildQuality	Quality;
+	};
+	const Policy policies[] =
+	{
+		{ "rebuild every frame", { 0.f, false }, BVHBuildQuality::SAH },
+		{ "linear every frame", { 0.f, false }, BVHBuildQuality::Linear },
+		{ "treelets every frame", { 0.f, false }, BVHBuildQuality::LinearTreelets },
+		{ "refit only", { RT_FLOATMAX, false }, BVHBuildQuality::SAH },
+		{ "refit + rebuild", { 1.3f, false }, BVHBuildQuality::SAH },
+		{ "refit + background", { 1.3f, true }, BVHBuildQuality::SAH },
+	};
+	for (const Policy& policy : policies)
+	{
+		RTScene scene = createScene(0, policy.Quality);
+		double updateSum = 0., updateMax = 0., traceSum = 0., traceMax = 0.;
+		uint32_t rebuilds = 0;
+		BVHUpdateStats stats;
+		for (uint32_t frame = 1; frame <= frames; ++frame)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (uint32_t id = 0; id < sphereCount; ++id)
+				scene.MoveSphere(id, position(motions[id], frame));
+			stats = scene.UpdateSpheres(policy.Update);
+			double updateSeconds = Seconds(start);
+			rebuilds += stats.Rebuilt;
+
+			double traceSeconds = RenderSamples(tracer, scene, camera, 1);
+			updateSum += updateSeconds;
+			updateMax = std::max(updateMax, updateSeconds);
+			traceSum += traceSeconds;
+			traceMax = std::max(traceMax, traceSeconds);
+		}
+
+		// The last frame built from scratch has to give the same image
+		std::vector<glm::vec4> animated = tracer.GetAccumulated();
+		RenderSamples(tracer, createScene(frames, BVHBuildQuality::SAH), camera, 1);
+
+		printf("  %-22s %10.3f %10.3f %10.2f %10.2f %10.2f %10u %10.2g\n", policy.Name, updateSum / frames * 1e3, updateMax * 1e3, traceSum / frames * 1e3, traceMax * 1e3,
+			stats.SAHCost, rebuilds, MeanAbsDiff(animated, tracer.GetAccumulated()));
+	}
+}
+
+////////////////////////
+//                    //
+//   WIDE BVH (BVH8)  //
+//                    //
+////////////////////////
+
+static void BenchWideBVH(const BenchArgs& args)
+{
+	ThreadPool pool(args.Threads);
+	const uint32_t rayCount = args.Width * args.Height * args.Samples;
+	printf("Binary BVH against the collapsed 8 wide one with quantized children, %u closest hit and shadow rays per scene on %u threads.\n", rayCount, pool.GetThreadCount());
+	printf("Hit distances of both layouts have to match\n");
+	printf("  %-16s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "scene", "prims", "nodes", "KB", "wide nodes", "wide KB", "MRays/s", "wide MR/s", "shadow x", "mismatch");
+
+	// Runs the same rays through both layouts, hit(wide, ray, t) returns the hit distance or RT_FLOATMAX, occluded(wide, ray) the shadow test
+	auto compare = [&](const char* name, uint32_t primCount, const BVH& binary, const BVH& wide, auto&& makeRay, auto&& hit, auto&& occluded)
+	{
+		std::vector<float> binaryT(rayCount);
+		std::vector<uint64_t> mismatches(pool.GetThreadCount(), 0);
+		auto traceAll = [&](auto&& trace)
+		{
+			auto start = std::chrono::steady_clock::now();
+			pool.ParallelFor((rayCount + 1023) / 1024, [&](uint32_t chunk, uint32_t threadIndex)
+			{
+				for (uint32_t i = chunk * 1024; i < std::min(rayCount, (chunk + 1) * 1024); ++i)
+					trace(i, makeRay(i), threadIndex);
+			});
+			return Seconds(start);
+		};
+
+		double binarySeconds = traceAll([&](uint32_t i, const Ray& ray, uint32_t) { binaryT[i] = hit(false, ray); });
+		double wideSeconds = traceAll([&](uint32_t i, const Ray& ray, uint32_t threadIndex)
+		{
+			if (hit(true, ray) != binaryT[i])
+				++mismatches[threadIndex];
+		});
+		double binaryShadowSeconds = traceAll([&](uint32_t, const Ray& ray, uint32_t) { occluded(false, ray); });
+		double wideShadowSeconds = traceAll([&](uint32_t i, const Ray& ray, uint32_t threadIndex)
+		{
+			if (occluded(true, ray) != (binaryT[i] != RT_FLOATMAX))
+				++mismatches[threadIndex];
+		});
+
+		uint64_t totalMismatches = 0;
+		for (uint64_t m : mismatches)
+			totalMismatches += m;
+		printf("  %-16s %10u %10zu %10.1f %10zu %10.1f %10.2f %10.2f %10.2f %10llu\n", name, primCount, binary.GetNodeCount(), binary.GetNodeBytes() / 1024.0,
+			wide.GetNodeCount(), wide.GetNodeBytes() / 1024.0, rayCount / binarySeconds * 1e-6, rayCount / wideSeconds * 1e-6, binaryShadowSeconds / wideShadowSeconds,
+			static_cast<unsigned long long>(totalMismatches));
+	};
+
+	BVHBuildSettings wideSettings;
+	wideSettings.Width = 8;
+
+	// Tori, rays from the core circle of the tube like the triangles bench
+	for (uint32_t rings : { 64u, 512u })
+	{
+		const float majorRadius = 3.f, minorRadius = 1.f;
+		TriangleMeshData torus = TriangleMeshData::CreateTorus(majorRadius, minorRadius, 4 * rings, rings);
+		TriangleBLAS blases[2];
+		blases[0].Build(torus.GetView(), 0, glm::mat4(1.f), {}, &pool);
+		blases[1].Build(torus.GetView(), 0, glm::mat4(1.f), wideSettings, &pool);
+
+		auto makeRay = [&](uint32_t i)
+		{
+			PCGRandom rng(PCGHash(i));
+			float phi = 2.f * RT_PI * rng.GetFloat();
+			return Ray{ { majorRadius * cosf(phi), 0.f, majorRadius * sinf(phi) }, SampleUniformSphere({ rng.GetFloat(), rng.GetFloat() }) };
+		};
+		char name[32];
+		snprintf(name, sizeof(name), "torus %u", rings);
+		compare(name, blases[0].GetTriangleCount(), blases[0].GetBVH(), blases[1].GetBVH(), makeRay,
+			[&](bool wide, const Ray& ray)
+			{
+				HitRecord rec;
+				return blases[wide].Hit(ray, 0.f, RT_FLOATMAX, rec) ? rec.T : RT_FLOATMAX;
+			},
+			[&](bool wide, const Ray& ray) { return blases[wide].Occluded(ray, 0.f, RT_FLOATMAX); });
+	}
+
+	// Random small spheres in a box, rays between random points of it
+	for (uint32_t sphereCount : { 10000u, 1000000u })
+	{
+		const float extent = 10.f;
+		RTScene scenes[2];
+		PCGRandom rng(sphereCount);
+		for (RTScene& scene : scenes)
+		{
+			rng = PCGRandom(sphereCount);
+			const uint32_t material = scene.AddMaterial({ {0.7f, 0.3f, 0.3f}, MTType::Diffuse, 0.f });
+			for (uint32_t i = 0; i < sphereCount; ++i)
+			{
+				glm::vec3 center = extent * (2.f * glm::vec3(rng.GetFloat(), rng.GetFloat(), rng.GetFloat()) - 1.f);
+				scene.AddSphere({ center, 0.2f * extent / std::cbrt(static_cast<float>(sphereCount)) * rng.GetFloat(), material });
+			}
+		}
+		BVHBuildSettings sphereSettings = SphereBVHSettings();
+		scenes[0].Build(sphereSettings);
+		sphereSettings.Width = 8;
+		scenes[1].Build(sphereSettings);
+
+		auto makeRay = [&](uint32_t i)
+		{
+			PCGRandom rayRng(PCGHash(i));
+			glm::vec3	origin = extent * (2.f * glm::vec3(rayRng.GetFloat(), rayRng.GetFloat(), rayRng.GetFloat()) - 1.f),
+						target = extent * (2.f * glm::vec3(rayRng.GetFloat(), rayRng.GetFloat(), rayRng.GetFloat()) - 1.f);
+			return Ray{ origin, glm::normalize(target - origin) };
+		};
+		char name[32];
+		snprintf(name, sizeof(name), "spheres %uk", sphereCount / 1000);
+		compare(name, sphereCount, scenes[0].GetBVH(), scenes[1].GetBVH(), makeRay,
+			[&](bool wide, const Ray& ray)
+			{
+				HitRecord rec;
+				return scenes[wide].Hit(ray, 0.001f, RT_FLOATMAX, rec) ? rec.T : RT_FLOATMAX;
+			},
+			[&](bool wide, const Ray& ray) { return scenes[wide].Occluded(ray, 0.001f, RT_FLOATMAX); });
+	}
+}
+
+////////////////////////
+//                    //
+//    PARALLEL BUILD  //
+//                    //
+////////////////////////
+
+static void BenchBuild(const BenchArgs& args)
+{
+	ThreadPool pool(args.Threads);
+	const uint32_t rayCount = args.Width * args.Height * args.Samples;
+	printf("Sphere BVH builds on one thread against the pool (%u threads) at different bin counts, %u closest hit rays between random points of the box\n", pool.GetThreadCount(), rayCount);
+	printf("Builds with the same bin count have to give the same tree\n");
+	printf("  %-10s %-16s %10s %10s %10s %10s %10s\n", "spheres", "build", "ms", "speedup", "SAH cost", "MRays/s", "same tree");
+
+	for (uint32_t sphereCount : { 100000u, 1000000u, 10000000u })
+	{
+		const float extent = 10.f;
+		std::vector<RTSphere> spheres(sphereCount);
+		std::vector<AABB> bounds(sphereCount);
+		PCGRandom rng(sphereCount);
+		for (uint32_t i = 0; i < sphereCount; ++i)
+		{
+			spheres[i].Posiition = extent * (2.f * glm::vec3(rng.GetFloat(), rng.GetFloat(), rng.GetFloat()) - 1.f);
+			spheres[i].Radius = 0.2f * extent / std::cbrt(static_cast<float>(sphereCount)) * rng.GetFloat();
+			spheres[i].MaterialIndex = 0;
+			bounds[i] = { spheres[i].Posiition - spheres[i].Radius, spheres[i].Posiition + spheres[i].Radius };
+		}
+
+		struct Config
+		{
+			const char*	Name;
+			uint32_t	BinCount;
+			bool		Parallel;
+		};
+		const Config configs[] =
+		{
+			{ "serial, 16 bins", 16, false },
+			{ "pool, 16 bins", 16, true },
+			{ "pool, 8 bins", 8, true },
+			{ "pool, 32 bins", 32, true },
+		};
+		double serialSeconds = 0.;
+		std::vector<uint32_t> serialOrder;
+		for (const Config& config : configs)
+		{
+			BVHBuildSettings settings = SphereBVHSettings();
+			settings.BinCount = config.BinCount;
+			BVH bvh;
+			auto start = std::chrono::steady_clock::now();
+			bvh.Build(bounds, settings, config.Parallel ? &pool : nullptr);
+			double buildSeconds = Seconds(start);
+			if (!config.Parallel)
+			{
+				serialSeconds = buildSeconds;
+				serialOrder = bvh.GetPrimIndices();
+			}
+
+			// Spheres stay in input order, leaves go through the primitive indices
+			const std::vector<uint32_t>& primIndices = bvh.GetPrimIndices();
+			start = std::chrono::steady_clock::now();
+			pool.ParallelFor((rayCount + 1023) / 1024, [&](uint32_t chunk, uint32_t)
+			{
+				HitRecord rec;
+				for (uint32_t i = chunk * 1024; i < std::min(rayCount, (chunk + 1) * 1024); ++i)
+				{
+					PCGRandom rayRng(PCGHash(i));
+					glm::vec3	origin = extent * (2.f * glm::vec3(rayRng.GetFloat(), rayRng.GetFloat(), rayRng.GetFloat()) - 1.f),
+								target = extent * (2.f * glm::vec3(rayRng.GetFloat(), rayRng.GetFloat(), rayRng.GetFloat()) - 1.f);
+					const Ray ray{ origin, glm::normalize(target - origin) };
+					float tMax = RT_FLOATMAX;
+					bvh.Traverse(ray, 0.001f, tMax, [&](uint32_t first, uint32_t count, float& closest)
+					{
+						bool hit = false;
+						for (uint32_t prim = first; prim < first + count; ++prim)
+						{
+							if (HitSphere(spheres[primIndices[prim]], ray, 0.001f, closest, rec))
+							{
+								closest = rec.T;
+								hit = true;
+							}
+						}
+						return hit;
+					});
+				}
+			});
+			double traceSeconds = Seconds(start);
+
+			const char* same = config.BinCount != 16 ? "" : primIndices == serialOrder ? "yes" : "NO";
+			printf("  %-10u %-16s %10.1f %10.2f %10.2f %10.2f %10s\n", sphereCount, config.Name, buildSeconds * 1e3, serialSeconds / buildSeconds, bvh.SAHCost(),
+				rayCount / traceSeconds * 1e-6, same);
+		}
+	}
+}
+
+////////////////////////
+//                    //
+//    LINEAR BUILD    //
+//                    //
+////////////////////////
+
+static void BenchLinearBuild(const BenchArgs& args)
+{
+	ThreadPool pool(args.Threads);
+	const uint32_t rayCount = args.Width * args.Height * args.Samples;
+	printf("Binned SAH against Morton code (LBVH) sphere BVH builds on the pool (%u threads), %u closest hit rays between random points of the box\n", pool.GetThreadCount(), rayCount);
+	printf("  %-10s %-18s %10s %10s %10s %10s\n", "spheres", "build", "ms", "speedup", "SAH cost", "MRays/s");
+
+	for (uint32_t sphereCount : { 100000u, 1000000u, 10000000u })
+	{
+		const float extent = 10.f;
+		std::vector<RTSphere> spheres(sphereCount);
+		std::vector<AABB> bounds(sphereCount);
+		PCGRandom rng(sphereCount);
+		for (uint32_t i = 0; i < sphereCount; ++i)
+		{
+			spheres[i].Posiition = extent * (2.f * glm::vec3(rng.GetFloat(), rng.GetFloat(), rng.GetFloat()) - 1.f);
+			spheres[i].Radius = 0.2f * extent / std::cbrt(static_cast<float>(sphereCount)) * rng.GetFloat();
+			spheres[i].MaterialIndex = 0;
+			bounds[i] = { spheres[i].Posiition - spheres[i].Radius, spheres[i].Posiition + spheres[i].Radius };
+		}
+
+		struct Config
+		{
+			const char*		Name;
+			BVHBuildQuality	Quality;
+			uint32_t		MortonBits;
+		};
+		const Config configs[] =
+		{
+			{ "SAH, 16 bins", BVHBuildQuality::SAH, 30 },
+			{ "linear, 30 bits", BVHBuildQuality::Linear, 30 },
+			{ "linear, 63 bits", BVHBuildQuality::Linear, 63 },
+			{ "treelets, 30 bits", BVHBuildQuality::LinearTreelets, 30 },
+			{ "treelets, 63 bits", BVHBuildQuality::LinearTreelets, 63 },
+		};
+		double sahSeconds = 0.;
+		for (const Config& config : configs)
+		{
+			BVHBuildSettings settings = SphereBVHSettings();
+			settings.Quality = config.Quality;
+			settings.MortonBits = config.MortonBits;
+			BVH bvh;
+			auto start = std::chrono::steady_clock::now();
+			bvh.Build(bounds, settings, &pool);
+			double buildSeconds = Seconds(start);
+			if (config.Quality == BVHBuildQuality::SAH)
+				sahSeconds = buildSeconds;
+
+			const std::vector<uint32_t>& primIndices = bvh.GetPrimIndices();
+			start = std::chrono::steady_clock::now();
+			pool.ParallelFor((rayCount + 1023) / 1024, [&](uint32_t chunk, uint32_t)
+			{
+				HitRecord rec;
+				for (uint32_t i = chunk * 1024; i < std::min(rayCount, (chunk + 1) * 1024); ++i)
+				{
+					PCGRandom rayRng(PCGHash(i));
+					glm::vec3	origin = extent * (2.f * glm::vec3(rayRng.GetFloat(), rayRng.GetFloat(), rayRng.GetFloat()) - 1.f),
+								target = extent * (2.f * glm::vec3(rayRng.GetFloat(), rayRng.GetFloat(), rayRng.GetFloat()) - 1.f);
+					const Ray ray{ origin, glm::normalize(target - origin) };
+					float tMax = RT_FLOATMAX;
+					bvh.Traverse(ray, 0.001f, tMax, [&](uint32_t first, uint32_t count, float& closest)
+					{
+						bool hit = false;
+						for (uint32_t prim = first; prim < first + count; ++prim)
+						{
+							if (HitSphere(spheres[primIndices[prim]], ray, 0.001f, closest, rec))
+							{
+								closest = rec.T;
+								hit = true;
+							}
+						}
+						return hit;
+					});
+				}
+			});
+			double traceSeconds = Seconds(start);
+
+			printf("  %-10u %-18s %10.1f %10.2f %10.2f %10.2f\n", sphereCount, config.Name, buildSeconds * 1e3, sahSeconds / buildSeconds, bvh.SAHCost(),
+				rayCount / traceSeconds * 1e-6);
+		}
+	}
+
+	// Every builder feeding the binary and the wide layout, against brute force on rays aimed at the spheres
+	const uint32_t checkCount = 20000, checkRays = 2000;
+	const float extent = 10.f;
+	std::vector<RTSphere> spheres(checkCount);
+	std::vector<AABB> bounds(checkCount);
+	PCGRandom rng(checkCount);
+	for (uint32_t i = 0; i < checkCount; ++i)
+	{
+		spheres[i].Posiition = extent * (2.f * glm::vec3(rng.GetFloat(), rng.GetFloat(), rng.GetFloat()) - 1.f);
+		spheres[i].Radius = 0.2f * extent / std::cbrt(static_cast<float>(checkCount)) * rng.GetFloat();
+		spheres[i].MaterialIndex = 0;
+		bounds[i] = { spheres[i].Posiition - spheres[i].Radius, spheres[i].Posiition + spheres[i].Radius };
+	}
+	auto checkRay = [&](uint32_t i)
+	{
+		PCGRandom rayRng(PCGHash(i));
+		const glm::vec3 origin = 2.f * extent * (2.f * glm::vec3(rayRng.GetFloat(), rayRng.GetFloat(), rayRng.GetFloat()) - 1.f);
+		return Ray{ origin, glm::normalize(spheres[i * (checkCount / checkRays)].Posiition - origin) };
+	};
+	std::vector<uint32_t> expected(checkRays, RT_UINTMAX);
+	pool.ParallelFor(checkRays, [&](uint32_t i, uint32_t)
+	{
+		const Ray ray = checkRay(i);
+		HitRecord rec;
+		float closest = RT_FLOATMAX;
+		for (uint32_t prim = 0; prim < checkCount; ++prim)
+		{
+			if (HitSphere(spheres[prim], ray, 0.001f, closest, rec))
+			{
+				closest = rec.T;
+				expected[i] = prim;
+			}
+		}
+	});
+
+	printf("%u spheres, %u rays aimed at them against brute force, and whether every sphere is in the BVH once\n", checkCount, checkRays);
+	printf("  %-10s %-8s %10s %10s\n", "build", "layout", "wrong hits", "bad prims");
+	const std::pair<const char*, BVHBuildQuality> builders[] = { { "SAH", BVHBuildQuality::SAH }, { "linear", BVHBuildQuality::Linear }, { "treelets", BVHBuildQuality::LinearTreelets } };
+	for (const auto& [name, quality] : builders)
+	{
+		for (uint32_t width : { 2u, 8u })
+		{
+			BVHBuildSettings settings = SphereBVHSettings();
+			settings.Quality = quality;
+			settings.Width = width;
+			BVH bvh;
+			bvh.Build(bounds, settings, &pool);
+
+			const std::vector<uint32_t>& primIndices = bvh.GetPrimIndices();
+			std::vector<uint32_t> seen(checkCount, 0);
+			for (uint32_t prim : primIndices)
+				seen[prim] += prim < checkCount;
+			uint32_t badPrims = static_cast<uint32_t>(primIndices.size() > checkCount ? primIndices.size() - checkCount : 0);
+			for (uint32_t count : seen)
+				badPrims += count != 1;
+
+			std::vector<uint32_t> wrong(pool.GetThreadCount(), 0);
+			pool.ParallelFor(checkRays, [&](uint32_t i, uint32_t threadIndex)
+			{
+				const Ray ray = checkRay(i);
+				HitRecord rec;
+				uint32_t hitPrim = RT_UINTMAX;
+				float tMax = RT_FLOATMAX;
+				bvh.Traverse(ray, 0.001f, tMax, [&](uint32_t first, uint32_t count, float& closest)
+				{
+					bool hit = false;
+					for (uint32_t prim = first; prim < first + count; ++prim)
+					{
+						if (HitSphere(spheres[primIndices[prim]], ray, 0.001f, closest, rec))
+						{
+							closest = rec.T;
+							hitPrim = primIndices[prim];
+							hit = true;
+						}
+					}
+					return hit;
+				});
+				wrong[threadIndex] += hitPrim != expected[i];
+			});
+			uint32_t wrongHits = 0;
+			for (uint32_t count : wrong)
+				wrongHits += count;
+			printf("  %-10s %-8s %10u %10u\n", name, width == 8 ? "wide" : "binary", wrongHits, badPrims);
+		}
+	}
+}
+
+static const Benchmark s_benchmarks[] =
+{
+	{ "packets", "8x8 packet traversal against single rays on the RTIAW final scene", BenchPackets },
+	{ "wavefront", "Wavefront stages against the megakernel loop, with per stage timings", BenchWavefront },
+	{ "reorder", "Wavefront paths with and without binning bounce rays by origin cell and direction octant on the RTIAW scenes: MRays/s, cache hit rates", BenchReorder },
+	{ "warps", "Rejection sampling against the closed form warps: time, random draws and instructions per sample", BenchWarps },
+	{ "roulette", "Russian roulette minimum bounces against full length paths: path length, error and efficiency", BenchRoulette },
+	{ "samplers", "RMSE against a high sample count reference for every sampler, at power of two sample counts", BenchSamplers },
+	{ "lights", "Next event estimation with MIS against BSDF sampling alone on the Cornell box: error and efficiency", BenchLights },
+	{ "denoise", "A-trous denoised 1 to --spp samples against the noisy image on the RTIAW scene and the Cornell box: RMSE, filter time and the noisy spp with the same error", BenchDenoise },
+	{ "aov", "Render time with no, some and all AOVs written for every trace mode, checks the image is unchanged and the modes write the same AOVs", BenchAOVs },
+	{ "reproject", "Orbiting camera at 1 spp per frame with the accumulation reset or reprojected on every move: RMSE of the last frame, history kept and reprojection time", BenchReprojection },
+	{ "display", "4K resolve to RGBA8 with each tone curve, AVX2 against scalar: time, pixels differing, and sRGB table against the exact encode", BenchDisplay },
+	{ "image", "PNG, PFM and EXR written from 64x64 tiles in row and shuffled order: time on the submitting thread, total time and file size", BenchImageOutput },
+	{ "tiles", "Tile orders and sizes with and without work stealing on the RTIAW scene: time per pass, MRays/s, steals, idle threads and how early the centre tile comes", BenchTiles },
+	{ "distributed", "Samples split over 1 to 4 workers streaming partial accumulation buffers over Unix and TCP loopback sockets: total time, bytes sent, merge time and difference to one process", BenchDistributed },
+	{ "triangles", "Triangle BLAS build time and closest hit/shadow MRays/s from 2k to 2M triangles, counts rays leaking through the closed mesh", BenchTriangles },
+	{ "instances", "TLAS over 100 to 100k instances of one BLAS: memory, TLAS build and move time, MRays/s against the same triangles baked into one BLAS", BenchInstances },
+	{ "animation", "Spheres moving through a box: SAH or linear BVH rebuild every frame against refit only and refit with a rebuild once the SAH cost degraded, inline or on a background thread", BenchAnimation },
+	{ "bvh8", "Binary BVH against the 8 wide BVH with quantized child boxes: node memory, closest hit and shadow MRays/s on tori and random spheres", BenchWideBVH },
+	{ "build", "Serial against parallel sphere BVH builds at 8 to 32 bins for 100k, 1M and 10M spheres: build time, SAH cost and MRays/s", BenchBuild },
+	{ "lbvh", "Binned SAH against Morton code builds with 30/63 bit codes and treelet optimization for 100k, 1M and 10M spheres: build time, SAH cost and MRays/s, then every builder in binary and wide layout against brute force", BenchLinearBuild },
+};
+
+static void PrintUsage()
+{
+	printf("Usage: RTBench <benchmark|all> [--width N] [--height N] [--spp N] [--threads N] [--grid N]\n\nBenchmarks:\n");
+	for (const Benchmark& bench : s_benchmarks)
+		printf("  %-12s %s\n", bench.Name, bench.Description);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	BenchArgs args;
+	for (int i = 2; i + 1 < argc; i += 2)
+	{
+		const char* arg = argv[i];
+		uint32_t value = std::stoul(argv[i + 1]);
+		if (!strcmp(arg, "--width"))			args.Width = value;
+		else if (!strcmp(arg, "--height"))		args.Height = value;
+		else if (!strcmp(arg, "--spp"))			args.Samples = value;
+		else if (!strcmp(arg, "--threads"))		args.Threads = value;
+		else if (!strcmp(arg, "--grid"))		args.GridExtent = value;
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	bool ran = false;
+	for (const Benchmark& bench : s_benchmarks)
+	{
+		if (strcmp(argv[1], "all") && strcmp(argv[1], bench.Name))
+			continue;
+		printf("== %s ==\n", bench.Name);
+		bench.Run(args);
+		ran = true;
+	}
+
+	if (!ran)
+	{
+		PrintUsage();
+		return 1;
+	}
+	return 0;
+}
@@ -31,37 +31,176 @@ float3 GetRandomSFloat3()
 	return float3(GetRandomSFloat(), GetRandomSFloat(), GetRandomSFloat());
 }
 
-float3 GetRandomUnitFloat3()
+////////////////
+//            //
+//  SAMPLERS  //
+//            //
+////////////////
+
+// Same hashes, sequences and dimension layout as PathSampler in Core/RayTracing/Sampler.hpp, keep both in sync
+#define SAMPLER_PCG 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUENOISE 2
+
+// The camera ray takes the first dimensions, every bounce starts at a fixed offset after them
+#define CAMERA_DIMENSIONS 4
+#define BOUNCE_DIMENSIONS 8
+// Fixed offsets inside a bounce, scattering starts at 0
+#define ROULETTE_DIMENSION 3
+// Light choice, then the 2D direction sample toward it
+#define LIGHT_DIMENSION 4
+
+#define PI 3.14159265358979f
+
+static uint sampler_type;
+static uint2 sampler_pixel;
+static uint sampler_index;
+static uint sampler_dimension;
+static uint sampler_pixel_seed;
+
+uint pcg_hash(uint x)
 {
-	for (uint i = 0; i < 50; i++)
-	{
-		float3 p = GetRandomSFloat3();
-		if (dot(p,p) < 1)
-			return p;
-	}
-	return normalize(GetRandomSFloat3());
+	uint state = x * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
 }
 
-float3 RandomNormalHemisphereFloat3(float3 normal)
+uint hash_combine(uint seed, uint value)
 {
-	float3 on_unit_sphere = GetRandomUnitFloat3();
-	if (dot(on_unit_sphere, normal) > 0.0)				// In the same hemisphere as the normal
-		return on_unit_sphere;
-	else
-		return -on_unit_sphere;
-	
-    float3x3 a;
+	return pcg_hash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
 }
 
-float3 RandomInUnitDisk()
+uint owen_scramble(uint x, uint seed)
 {
-	for (uint i = 0; i < 50; i++)
+	x = reversebits(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return reversebits(x);
+}
+
+uint2 sobol_2d(uint index)
+{
+	uint x = reversebits(index);
+	index ^= (index >> 1) & 0x55555555u;
+	index ^= (index >> 2) & 0x33333333u;
+	index ^= (index >> 4) & 0x0f0f0f0fu;
+	index ^= (index >> 8) & 0x00ff00ffu;
+	index ^= (index >> 16) & 0x0000ffffu;
+	return uint2(x, reversebits(index));
+}
+
+float to_unit_float(uint x)
+{
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// R2 dither mask
+uint dither_mask(uint x, uint y)
+{
+	return x * 0xc13fa9a9u + y * 0x91e10da5u;
+}
+
+void InitSampler(uint type, uint2 pixel, uint width, uint sampleIndex, uint seed)
+{
+	uint pixelIndex = pixel.y * width + pixel.x;
+	sampler_type = type;
+	sampler_pixel = pixel;
+	sampler_index = sampleIndex;
+	sampler_dimension = 0;
+	sampler_pixel_seed = pcg_hash(pixelIndex);
+	rng_state = pcg_hash(pixelIndex + pcg_hash(seed));
+}
+
+void SamplerStartBounce(uint bounce, uint offset)
+{
+	sampler_dimension = CAMERA_DIMENSIONS + bounce * BOUNCE_DIMENSIONS + offset;
+}
+
+float Sample1D()
+{
+	uint dimension = sampler_dimension++;
+	if (sampler_type == SAMPLER_SOBOL)
 	{
-		float3 p = float3(GetRandomSFloat(), GetRandomSFloat(), 0);
-		if (dot(p,p) < 1)
-			return p;
+		uint seed = hash_combine(sampler_pixel_seed, dimension);
+		return to_unit_float(owen_scramble(reversebits(owen_scramble(sampler_index, seed)), hash_combine(seed, 1)));
 	}
-	return float3(0, 0, 0);
+	if (sampler_type == SAMPLER_BLUENOISE)
+		return to_unit_float(sampler_index * 0x9e3779b9u + dither_mask(sampler_pixel.x, sampler_pixel.y) + pcg_hash(dimension));
+	return to_unit_float(rand_pcg());
+}
+
+float2 Sample2D()
+{
+	uint dimension = sampler_dimension;
+	sampler_dimension += 2;
+	if (sampler_type == SAMPLER_SOBOL)
+	{
+		uint seed = hash_combine(sampler_pixel_seed, dimension);
+		uint2 p = sobol_2d(owen_scramble(sampler_index, seed));
+		return float2(to_unit_float(owen_scramble(p.x, hash_combine(seed, 1))), to_unit_float(owen_scramble(p.y, hash_combine(seed, 2))));
+	}
+	if (sampler_type == SAMPLER_BLUENOISE)
+	{
+		return float2(to_unit_float(sampler_index * 0xc13fa9a9u + dither_mask(sampler_pixel.x, sampler_pixel.y) + pcg_hash(dimension)),
+					  to_unit_float(sampler_index * 0x91e10da5u + dither_mask(sampler_pixel.y, sampler_pixel.x) + pcg_hash(dimension + 1)));
+	}
+	float u = to_unit_float(rand_pcg());
+	return float2(u, to_unit_float(rand_pcg()));
+}
+
+// WARPS, closed form and branch free (conditionals are selects), same math as Core/RayTracing/Warp.hpp
+float3 SampleUniformSphere(float2 u)
+{
+	float z = 1 - 2 * u.x;
+	float r = sqrt(max(0, 1 - z * z));
+	float phi = 2 * PI * u.y;
+	return float3(r * cos(phi), r * sin(phi), z);
+}
+
+// Shirley-Chiu concentric mapping
+float2 SampleConcentricDisk(float2 u)
+{
+	float a = 2 * u.x - 1;
+	float b = 2 * u.y - 1;
+	bool xMajor = abs(a) > abs(b);
+	float r = xMajor ? a : b;
+	float denominator = r != 0 ? r : 1;
+	float phi = xMajor ? (PI / 4) * (b / denominator) : (PI / 2) - (PI / 4) * (a / denominator);
+	return float2(r * cos(phi), r * sin(phi));
+}
+
+// Orthonormal basis around a unit vector without branching on its direction (Duff et al. 2017)
+void BuildONB(float3 n, out float3 tangent, out float3 bitangent)
+{
+	float signZ = n.z >= 0 ? 1.0f : -1.0f;
+	float a = -1 / (signZ + n.z);
+	float b = n.x * n.y * a;
+	tangent = float3(1 + signZ * n.x * n.x * a, signZ * b, -signZ * n.x);
+	bitangent = float3(b, signZ + n.y * n.y * a, -n.y);
+}
+
+// Cosine weighted direction around normal, a concentric disk sample lifted onto the hemisphere
+float3 SampleCosineHemisphere(float2 u, float3 normal)
+{
+	float2 d = SampleConcentricDisk(u);
+	float z = sqrt(max(0, 1 - dot(d, d)));
+	float3 tangent, bitangent;
+	BuildONB(normal, tangent, bitangent);
+	return d.x * tangent + d.y * bitangent + z * normal;
+}
+
+// Uniform direction in a cone around axis, pdf = 1 / (2 * PI * oneMinusCosMax)
+float3 SampleUniformCone(float2 u, float3 axis, float oneMinusCosMax)
+{
+	float oneMinusCos = u.x * oneMinusCosMax;
+	float sinTheta = sqrt(max(0, oneMinusCos * (2 - oneMinusCos)));
+	float phi = 2 * PI * u.y;
+	float3 tangent, bitangent;
+	BuildONB(axis, tangent, bitangent);
+	return (sinTheta * cos(phi)) * tangent + (sinTheta * sin(phi)) * bitangent + (1 - oneMinusCos) * axis;
 }
 
 uint3 FloatTo8BitColor(float3 color)
@@ -98,6 +237,7 @@ class HitRecord
 	float t;
 	bool frontFace;
 	uint materialIndex;
+	uint primIndex;
 
 	void SetFaceNormal(const Ray r, const float3 outwardNormal)
 	{
@@ -115,6 +255,95 @@ struct RTSphere
 };
 
 
+// Flattened BVH node, 32 bytes, same layout as BVHNode in Core/RayTracing/BVH.hpp
+// Interior nodes: leftFirst is the left child and the right child is leftFirst + 1
+// Leaves (primCount > 0): leftFirst is the first sphere of the leaf, spheres are stored in leaf order
+struct BVHNode
+{
+	float3 aabbMin;
+	uint leftFirst;
+	float3 aabbMax;
+	uint primCount;
+};
+
+float IntersectAABB(float3 aabbMin, float3 aabbMax, float3 origin, float3 invDir, float tMin, float tMax)
+{
+	float3 t1 = (aabbMin - origin) * invDir;
+	float3 t2 = (aabbMax - origin) * invDir;
+	float3 tSmall = min(t1, t2);
+	float3 tBig = max(t1, t2);
+	float tNear = max(max(tSmall.x, tSmall.y), max(tSmall.z, tMin));
+	float tFar = min(min(tBig.x, tBig.y), min(tBig.z, tMax));
+	return tNear <= tFar ? tNear : FLOATMAX;
+}
+
+// Same layout as RTTriangle in Core/Graphics/RTHelper.hpp
+struct RTTriangle
+{
+	float3 v0;
+	float3 v1;
+	float3 v2;
+	uint matIndex;
+};
+
+// Same layout as RTInstance in Core/Graphics/RTHelper.hpp
+struct RTInstance
+{
+	float4x4 worldToObject;
+	uint nodeOffset;
+	uint triangleOffset;
+	uint matIndex;
+	uint padding;
+};
+
+// Watertight ray/triangle test (Woop, Benthin and Wald 2013), same as IntersectTriangle in Core/RayTracing/TriangleBLAS.cpp.
+// kxyz and shear come from SetupWatertightRay, returns the hit distance in (tMin, tMax) or FLOATMAX
+void SetupWatertightRay(float3 direction, out uint3 kxyz, out float3 shear)
+{
+	float3 absDir = abs(direction);
+	uint kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+	uint kx = (kz + 1) % 3;
+	uint ky = (kx + 1) % 3;
+	if (direction[kz] < 0)
+	{
+		uint temp = kx; kx = ky; ky = temp;
+	}
+	kxyz = uint3(kx, ky, kz);
+	shear.z = 1 / direction[kz];
+	shear.x = direction[kx] * shear.z;
+	shear.y = direction[ky] * shear.z;
+}
+
+float IntersectTriangle(float3 origin, uint3 k, float3 shear, RTTriangle tri, float tMin, float tMax)
+{
+	float3 a = tri.v0 - origin;
+	float3 b = tri.v1 - origin;
+	float3 c = tri.v2 - origin;
+	float ax = a[k.x] - shear.x * a[k.z], ay = a[k.y] - shear.y * a[k.z];
+	float bx = b[k.x] - shear.x * b[k.z], by = b[k.y] - shear.y * b[k.z];
+	float cx = c[k.x] - shear.x * c[k.z], cy = c[k.y] - shear.y * c[k.z];
+	
+	float e0 = cx * by - cy * bx;
+	float e1 = ax * cy - ay * cx;
+	float e2 = bx * ay - by * ax;
+	// Double precision fallback on the edges
+	if (e0 == 0 || e1 == 0 || e2 == 0)
+	{
+		e0 = float((double)cx * by - (double)cy * bx);
+		e1 = float((double)ax * cy - (double)ay * cx);
+		e2 = float((double)bx * ay - (double)by * ax);
+	}
+	
+	if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+		return FLOATMAX;
+	float det = e0 + e1 + e2;
+	if (det == 0)
+		return FLOATMAX;
+	
+	float t = shear.z * (e0 * a[k.z] + e1 * b[k.z] + e2 * c[k.z]) / det;
+	return t > tMin && t < tMax ? t : FLOATMAX;
+}
+
 struct RTMaterial
 {
 	float3  Albedo;
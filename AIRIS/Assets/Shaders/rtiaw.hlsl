@@ -2,9 +2,17 @@
 
 // Function Declarations
 float3 TraceRay(Ray ray);
-bool HitHittableList(Ray r, out HitRecord hitRec);
+bool HitHittableList(Ray r, float tMax, bool anyHit, out HitRecord hitRec);
+bool HitSphereBVH(Ray r, bool anyHit, inout float closestHitT, inout HitRecord hitRec);
+uint HitTriangleBVH(Ray r, uint nodeOffset, uint triangleOffset, bool anyHit, inout float closestHitT);
+bool HitInstanceBVH(Ray r, bool anyHit, inout float closestHitT, inout HitRecord hitRec);
 Ray GetRay(float u, float v, Camera cam);
 float3 Scatter(inout Ray ray, HitRecord hitRec);
+float3 SampleDirectLight(HitRecord hitRec, float3 albedo);
+float LightPdf(uint sphere, float3 pos);
+
+// MTType::Emissive, Albedo is the emitted radiance
+#define MATERIAL_EMISSIVE 4
 
 cbuffer RTConstants : register(b0)
 {
@@ -12,8 +20,11 @@ cbuffer RTConstants : register(b0)
 	bool ResetSamples;
     uint AccumulatedSamples,
 		 MaxRayBounces,
-		 InitalRandomSeed;
-	
+		 InitalRandomSeed,
+		 SamplerType,
+		 MinRayBounces;
+	bool NextEventEstimation;
+
 }
 
 // CAMERA FRAME CONSTANTS
@@ -31,6 +42,16 @@ cbuffer RTCameraSD : register(b1)
 // GEOMETRY AND MATERIAL BUFFERS
 StructuredBuffer<RTSphere> spheres : register(t0);
 StructuredBuffer<RTMaterial> materials : register(t1);
+StructuredBuffer<BVHNode> bvhNodes : register(t2);
+// Indices of the emissive spheres, bind a null descriptor when there are none
+StructuredBuffer<uint> lights : register(t3);
+// Triangle BLAS, triangles in leaf order and their BVH. Null descriptors when there is no mesh.
+// With instances bound these hold every BLAS of the TLAS back to back, and meshes are only reached through instances
+StructuredBuffer<RTTriangle> triangles : register(t4);
+StructuredBuffer<BVHNode> triangleNodes : register(t5);
+// TLAS, instances in leaf order and their BVH. Null descriptors when there are no instances
+StructuredBuffer<RTInstance> instances : register(t6);
+StructuredBuffer<BVHNode> instanceNodes : register(t7);
 // OUTPUT TEXTURES
 RWTexture2D<float4> OutputTex : register(u0);
 RWTexture2D<float4> AccumulatedTex : register(u1);
@@ -49,8 +70,9 @@ void CS( uint3 dispatchThreadID : SV_DispatchThreadID, uint3 dispatchGroupID : S
 	if (dispatchThreadID.x > w - 1 || dispatchThreadID.y > h-1)
 		return;
 	
-	// Initilize RNG by setting the inital seed and calling a RN function once
-	rng_state = InitalRandomSeed * (dispatchThreadID.x * w + dispatchThreadID.y);
+	// Accumulated samples walk along the sampler's sequence, otherwise the seed picks the sample
+	uint sampleIndex = Accumulate ? AccumulatedSamples - 1 : InitalRandomSeed;
+	InitSampler(SamplerType, dispatchThreadID.xy, w, sampleIndex, InitalRandomSeed);
 	
 	Camera cam;
 	cam.origin = CamPosition;
@@ -72,10 +94,11 @@ void CS( uint3 dispatchThreadID : SV_DispatchThreadID, uint3 dispatchGroupID : S
 Ray GetRay(float u, float v, Camera cam)
 {
 	//				TL Pixel Center		Move to pixel for this thread		RANDOM OFFSET WITHIN THE PIXEL/NOT INTRUDING ON SURROUNDING PIXELS
-    float3 pixelLoc = Pixel00Center + (u * PixelDeltaX + v * PixelDeltaY) + (PixelDeltaX * (GetRandomFloat() - 0.5f) + PixelDeltaY * (GetRandomFloat() - 0.5f));
+    float2 jitter = Sample2D() - 0.5f;
+    float3 pixelLoc = Pixel00Center + (u * PixelDeltaX + v * PixelDeltaY) + (PixelDeltaX * jitter.x + PixelDeltaY * jitter.y);
 	
 	Ray r;
-    float3 randOffset = RandomInUnitDisk();
+    float2 randOffset = SampleConcentricDisk(Sample2D());
     r.origin = cam.origin + (LensDefocusX * randOffset.x) + (LensDefocusY * randOffset.y);
 	r.direction = normalize(pixelLoc - r.origin);
 	
@@ -84,51 +107,373 @@ Ray GetRay(float u, float v, Camera cam)
 
 float3 TraceRay(Ray ray)
 {
-	float3 color = 1.0f;
+	float3 radiance = float3(0, 0, 0);
     float3 currentAttenuation = float3(1.f, 1.f, 1.f);
+	// Pdf the current ray was scattered with, 0 for the camera ray and specular bounces
+	float scatterPdf = 0;
 	HitRecord hitRec;
 	
 	for (uint i = 0; i < MaxRayBounces+1; ++i)
 	{   
-		if (HitHittableList(ray, hitRec))
+		if (HitHittableList(ray, FLOATMAX, false, hitRec))
 		{
+			RTMaterial material = materials[hitRec.materialIndex];
+			
+			// LIGHT HIT, weighted against light sampling after a diffuse bounce
+			if (material.Type == MATERIAL_EMISSIVE)
+			{
+				if (hitRec.frontFace)
+				{
+					float weight = 1;
+					// Emissive triangles aren't in the light list, only scattered rays find them
+					if (scatterPdf > 0 && hitRec.primIndex != UINTMAX)
+					{
+						float lightPdf = LightPdf(hitRec.primIndex, ray.origin);
+						weight = scatterPdf * scatterPdf / (scatterPdf * scatterPdf + lightPdf * lightPdf);
+					}
+					radiance += currentAttenuation * material.Albedo * weight;
+				}
+				break;
+			}
+			if (i == MaxRayBounces)
+				break;
+			
+			// NEXT EVENT ESTIMATION
+			if (material.Type == 0)
+			{
+				SamplerStartBounce(i, LIGHT_DIMENSION);
+				radiance += currentAttenuation * SampleDirectLight(hitRec, material.Albedo);
+			}
+			
 			ray.origin = hitRec.pos;
+			SamplerStartBounce(i, 0);
             currentAttenuation *= Scatter(ray, hitRec);
+			scatterPdf = material.Type == 0 ? max(dot(ray.direction, hitRec.normal), 0) / PI : 0;
+			
+			// RUSSIAN ROULETTE, surviving paths are reweighted so the estimate stays unbiased
+			if (i + 1 >= MinRayBounces)
+			{
+				float survival = min(max(currentAttenuation.x, max(currentAttenuation.y, currentAttenuation.z)), 0.95f);
+				SamplerStartBounce(i, ROULETTE_DIMENSION);
+				if (Sample1D() >= survival)
+					break;
+				currentAttenuation /= survival;
+			}
 			continue;
 		}
 		float a = 0.5 * (ray.direction.y + 1.0);
-		return currentAttenuation * ((1.0 - a) * float3(1.0, 1.0, 1.0) + a * float3(0.5, 0.7, 1.0));
+		radiance += currentAttenuation * ((1.0 - a) * float3(1.0, 1.0, 1.0) + a * float3(0.5, 0.7, 1.0));
+		break;
 	}
 	
-	return float3(0, 0, 0);
+	return radiance;
+}
+
+// 1 - cos of the half angle of the cone a light sphere covers from pos, 0 from inside it
+float LightConeOneMinusCos(RTSphere light, float3 pos)
+{
+	float3 toLight = light.position - pos;
+	float sinThetaMax2 = light.radius * light.radius / dot(toLight, toLight);
+	return sinThetaMax2 < 1 ? sinThetaMax2 / (1 + sqrt(1 - sinThetaMax2)) : 0;
 }
 
+// Solid angle pdf of light sampling reaching this sphere from pos, including the light choice
+float LightPdf(uint sphere, float3 pos)
+{
+	if (!NextEventEstimation)
+		return 0;
+	uint lightCount, stride;
+	lights.GetDimensions(lightCount, stride);
+	float oneMinusCosMax = LightConeOneMinusCos(spheres[sphere], pos);
+	return oneMinusCosMax > 0 ? 1 / (2 * PI * oneMinusCosMax * lightCount) : 0;
+}
 
-bool HitHittableList(Ray r, out HitRecord hitRec)
+// Picks a light and a direction inside the cone it covers, traces the shadow ray and returns the MIS weighted light reaching a diffuse surface
+float3 SampleDirectLight(HitRecord hitRec, float3 albedo)
 {
-	uint numOfSpheres, sphereStride;
-	spheres.GetDimensions(numOfSpheres, sphereStride);
+	uint lightCount, stride;
+	lights.GetDimensions(lightCount, stride);
+	if (!NextEventEstimation || lightCount == 0)
+		return float3(0, 0, 0);
 	
+	RTSphere light = spheres[lights[min(uint(Sample1D() * lightCount), lightCount - 1)]];
+	float oneMinusCosMax = LightConeOneMinusCos(light, hitRec.pos);
+	if (oneMinusCosMax <= 0)
+		return float3(0, 0, 0);
+	
+	Ray shadowRay;
+	shadowRay.origin = hitRec.pos;
+	shadowRay.direction = SampleUniformCone(Sample2D(), normalize(light.position - hitRec.pos), oneMinusCosMax);
+	float cosTheta = dot(shadowRay.direction, hitRec.normal);
+	
+	Sphere lightSphere;
+	lightSphere.position = light.position;
+	lightSphere.radius = light.radius;
+	HitRecord lightRec;
+	if (cosTheta <= 0 || !lightSphere.Hit(shadowRay, lightRec, 0, FLOATMAX))
+		return float3(0, 0, 0);
+	
+	// Stop short of the light so it doesn't occlude itself
+	HitRecord occluder;
+	if (HitHittableList(shadowRay, lightRec.t * 0.999, true, occluder))
+		return float3(0, 0, 0);
+	
+	float lightPdf = 1 / (2 * PI * oneMinusCosMax * lightCount);
+	float bsdfPdf = cosTheta / PI;
+	float weight = lightPdf * lightPdf / (lightPdf * lightPdf + bsdfPdf * bsdfPdf);
+	return albedo * (cosTheta / (PI * lightPdf) * weight) * materials[light.matIndex].Albedo;
+}
+
+// Closest hit in (0.01, tMax), anyHit returns on the first hit for shadow rays
+bool HitHittableList(Ray r, float tMax, bool anyHit, out HitRecord hitRec)
+{
+	float closestHitT = tMax;
+	hitRec.primIndex = UINTMAX;
+	bool hitSomething = HitSphereBVH(r, anyHit, closestHitT, hitRec);
+	if (hitSomething && anyHit)
+		return true;
+	uint instanceCount, triangleCount, stride;
+	instances.GetDimensions(instanceCount, stride);
+	triangles.GetDimensions(triangleCount, stride);
+	if (instanceCount > 0)
+	{
+		if (HitInstanceBVH(r, anyHit, closestHitT, hitRec))
+			hitSomething = true;
+	}
+	else if (triangleCount > 0)
+	{
+		uint closestTriangle = HitTriangleBVH(r, 0, 0, anyHit, closestHitT);
+		if (closestTriangle != UINTMAX)
+		{
+			RTTriangle tri = triangles[closestTriangle];
+			hitRec.t = closestHitT;
+			hitRec.pos = r.at(closestHitT);
+			hitRec.SetFaceNormal(r, normalize(cross(tri.v1 - tri.v0, tri.v2 - tri.v0)));
+			hitRec.materialIndex = tri.matIndex;
+			hitRec.primIndex = UINTMAX;
+			hitSomething = true;
+		}
+	}
+	return hitSomething;
+}
+
+bool HitSphereBVH(Ray r, bool anyHit, inout float closestHitT, inout HitRecord hitRec)
+{
 	HitRecord tempRec;
-	float closestHitT = FLOATMAX;
 	bool hitSomething = false;
 	Sphere tempSphere;
-	for (uint i = 0; i < numOfSpheres; ++i)
+	
+	// BVH TRAVERSAL, closer child first, the farther one goes on the stack with its entry distance
+	float3 invDir = 1.0 / r.direction;
+	uint stack[64];
+	float stackDist[64];
+	uint stackSize = 0;
+	uint nodeIndex = 0;
+	bool visit = IntersectAABB(bvhNodes[0].aabbMin, bvhNodes[0].aabbMax, r.origin, invDir, 0.01, closestHitT) < FLOATMAX;
+	while (visit)
 	{
-		tempSphere.position = spheres[i].position;
-		tempSphere.radius = spheres[i].radius;
-		if (tempSphere.Hit(r, tempRec, 0.01, FLOATMAX) && tempRec.t < closestHitT)
+		BVHNode node = bvhNodes[nodeIndex];
+		if (node.primCount > 0)
 		{
-			hitSomething = true;
-			hitRec = tempRec;
-            hitRec.materialIndex = spheres[i].matIndex;
-			closestHitT = tempRec.t;
+			for (uint i = node.leftFirst; i < node.leftFirst + node.primCount; ++i)
+			{
+				tempSphere.position = spheres[i].position;
+				tempSphere.radius = spheres[i].radius;
+				if (tempSphere.Hit(r, tempRec, 0.01, closestHitT))
+				{
+					hitSomething = true;
+					hitRec = tempRec;
+					hitRec.materialIndex = spheres[i].matIndex;
+					hitRec.primIndex = i;
+					closestHitT = tempRec.t;
+					if (anyHit)
+						return true;
+				}
+			}
+		}
+		else
+		{
+			uint left = node.leftFirst;
+			uint right = left + 1;
+			float tLeft = IntersectAABB(bvhNodes[left].aabbMin, bvhNodes[left].aabbMax, r.origin, invDir, 0.01, closestHitT);
+			float tRight = IntersectAABB(bvhNodes[right].aabbMin, bvhNodes[right].aabbMax, r.origin, invDir, 0.01, closestHitT);
+			if (tLeft > tRight)
+			{
+				uint tempIndex = left; left = right; right = tempIndex;
+				float tempDist = tLeft; tLeft = tRight; tRight = tempDist;
+			}
+			if (tLeft < FLOATMAX)
+			{
+				if (tRight < FLOATMAX)
+				{
+					stack[stackSize] = right;
+					stackDist[stackSize++] = tRight;
+				}
+				nodeIndex = left;
+				continue;
+			}
+		}
+		
+		// Pop the next node that is still closer than the closest hit
+		visit = false;
+		while (stackSize > 0 && !visit)
+		{
+			--stackSize;
+			visit = stackDist[stackSize] < closestHitT;
+			nodeIndex = stack[stackSize];
 		}
 	}
 	
 	return hitSomething;
 }
 
+// Same traversal over the triangle BLAS whose nodes and triangles start at the given offsets, hits are tested with the watertight triangle test.
+// Returns the closest triangle, UINTMAX on a miss
+uint HitTriangleBVH(Ray r, uint nodeOffset, uint triangleOffset, bool anyHit, inout float closestHitT)
+{
+	uint3 k;
+	float3 shear;
+	SetupWatertightRay(r.direction, k, shear);
+	uint closestTriangle = UINTMAX;
+	
+	float3 invDir = 1.0 / r.direction;
+	uint stack[64];
+	float stackDist[64];
+	uint stackSize = 0;
+	uint nodeIndex = 0;
+	bool visit = IntersectAABB(triangleNodes[nodeOffset].aabbMin, triangleNodes[nodeOffset].aabbMax, r.origin, invDir, 0.01, closestHitT) < FLOATMAX;
+	while (visit)
+	{
+		BVHNode node = triangleNodes[nodeOffset + nodeIndex];
+		if (node.primCount > 0)
+		{
+			for (uint i = triangleOffset + node.leftFirst; i < triangleOffset + node.leftFirst + node.primCount; ++i)
+			{
+				float t = IntersectTriangle(r.origin, k, shear, triangles[i], 0.01, closestHitT);
+				if (t < FLOATMAX)
+				{
+					closestHitT = t;
+					closestTriangle = i;
+					if (anyHit)
+						return closestTriangle;
+				}
+			}
+		}
+		else
+		{
+			uint left = node.leftFirst;
+			uint right = left + 1;
+			float tLeft = IntersectAABB(triangleNodes[nodeOffset + left].aabbMin, triangleNodes[nodeOffset + left].aabbMax, r.origin, invDir, 0.01, closestHitT);
+			float tRight = IntersectAABB(triangleNodes[nodeOffset + right].aabbMin, triangleNodes[nodeOffset + right].aabbMax, r.origin, invDir, 0.01, closestHitT);
+			if (tLeft > tRight)
+			{
+				uint tempIndex = left; left = right; right = tempIndex;
+				float tempDist = tLeft; tLeft = tRight; tRight = tempDist;
+			}
+			if (tLeft < FLOATMAX)
+			{
+				if (tRight < FLOATMAX)
+				{
+					stack[stackSize] = right;
+					stackDist[stackSize++] = tRight;
+				}
+				nodeIndex = left;
+				continue;
+			}
+		}
+		
+		visit = false;
+		while (stackSize > 0 && !visit)
+		{
+			--stackSize;
+			visit = stackDist[stackSize] < closestHitT;
+			nodeIndex = stack[stackSize];
+		}
+	}
+	
+	return closestTriangle;
+}
+
+// Traversal of the TLAS, every instance traverses its BLAS with the ray moved into object space.
+// The object space direction isn't normalized so hit distances are the same in both spaces
+bool HitInstanceBVH(Ray r, bool anyHit, inout float closestHitT, inout HitRecord hitRec)
+{
+	uint closestInstance = UINTMAX;
+	uint closestTriangle = UINTMAX;
+	
+	float3 invDir = 1.0 / r.direction;
+	uint stack[64];
+	float stackDist[64];
+	uint stackSize = 0;
+	uint nodeIndex = 0;
+	bool visit = IntersectAABB(instanceNodes[0].aabbMin, instanceNodes[0].aabbMax, r.origin, invDir, 0.01, closestHitT) < FLOATMAX;
+	while (visit)
+	{
+		BVHNode node = instanceNodes[nodeIndex];
+		if (node.primCount > 0)
+		{
+			for (uint i = node.leftFirst; i < node.leftFirst + node.primCount; ++i)
+			{
+				RTInstance instance = instances[i];
+				Ray objectRay;
+				objectRay.origin = mul(instance.worldToObject, float4(r.origin, 1)).xyz;
+				objectRay.direction = mul(instance.worldToObject, float4(r.direction, 0)).xyz;
+				uint tri = HitTriangleBVH(objectRay, instance.nodeOffset, instance.triangleOffset, anyHit, closestHitT);
+				if (tri != UINTMAX)
+				{
+					closestInstance = i;
+					closestTriangle = tri;
+					if (anyHit)
+						return true;
+				}
+			}
+		}
+		else
+		{
+			uint left = node.leftFirst;
+			uint right = left + 1;
+			float tLeft = IntersectAABB(instanceNodes[left].aabbMin, instanceNodes[left].aabbMax, r.origin, invDir, 0.01, closestHitT);
+			float tRight = IntersectAABB(instanceNodes[right].aabbMin, instanceNodes[right].aabbMax, r.origin, invDir, 0.01, closestHitT);
+			if (tLeft > tRight)
+			{
+				uint tempIndex = left; left = right; right = tempIndex;
+				float tempDist = tLeft; tLeft = tRight; tRight = tempDist;
+			}
+			if (tLeft < FLOATMAX)
+			{
+				if (tRight < FLOATMAX)
+				{
+					stack[stackSize] = right;
+					stackDist[stackSize++] = tRight;
+				}
+				nodeIndex = left;
+				continue;
+			}
+		}
+		
+		visit = false;
+		while (stackSize > 0 && !visit)
+		{
+			--stackSize;
+			visit = stackDist[stackSize] < closestHitT;
+			nodeIndex = stack[stackSize];
+		}
+	}
+	
+	if (closestInstance == UINTMAX)
+		return false;
+	// Normals go to world space with the inverse transpose
+	RTInstance instance = instances[closestInstance];
+	RTTriangle tri = triangles[closestTriangle];
+	float3 objectNormal = cross(tri.v1 - tri.v0, tri.v2 - tri.v0);
+	hitRec.t = closestHitT;
+	hitRec.pos = r.at(closestHitT);
+	hitRec.SetFaceNormal(r, normalize(mul(transpose(instance.worldToObject), float4(objectNormal, 0)).xyz));
+	hitRec.materialIndex = instance.matIndex == UINTMAX ? tri.matIndex : instance.matIndex;
+	hitRec.primIndex = UINTMAX;
+	return true;
+}
+
 float reflectance(float cosine, float ref_idx)
 {
         // Use Schlick's approximation for reflectance.
@@ -142,7 +487,7 @@ float3 Scatter(inout Ray ray, HitRecord hitRec)
     float3 color = materials[hitRec.materialIndex].Albedo;
     if(materials[hitRec.materialIndex].Type == 0)
     {
-		ray.direction = normalize(hitRec.normal + GetRandomUnitFloat3());
+		ray.direction = SampleCosineHemisphere(Sample2D(), hitRec.normal);
     }
 	else if(materials[hitRec.materialIndex].Type == 1)
     {
@@ -160,7 +505,7 @@ float3 Scatter(inout Ray ray, HitRecord hitRec)
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         float3 direction;
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > GetRandomFloat())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > Sample1D())
             direction = reflect(ray.direction, hitRec.normal);
         else
             direction = refract(ray.direction, hitRec.normal, refraction_ratio);
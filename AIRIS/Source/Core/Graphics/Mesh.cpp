@@ -38,3 +38,24 @@ D3D12_INDEX_BUFFER_VIEW Mesh::IndexBufferView() const
 	return ibv;
 }
 
+
+TriangleMeshView Mesh::GetTriangleView(const SubMesh& subMesh) const
+{
+	TriangleMeshView view;
+	view.Vertices = m_vertexBufferCPU->GetBufferPointer();
+	view.VertexStride = m_vertexStride;
+	view.VertexCount = m_vertexBufferSize / m_vertexStride;
+	view.Indices = m_indexBufferCPU->GetBufferPointer();
+	view.IndexSize = IndexFormat == DXGI_FORMAT_R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+	view.IndexCount = subMesh.IndexCount;
+	view.StartIndexLocation = subMesh.StartIndexLocation;
+	view.BaseVertexLocation = static_cast<int32_t>(subMesh.BaseVertexLocation);
+	return view;
+}
+
+TriangleBLAS Mesh::BuildBLAS(const SubMesh& subMesh, uint32_t materialIndex, const glm::mat4& transform) const
+{
+	TriangleBLAS blas;
+	blas.Build(GetTriangleView(subMesh), materialIndex, transform);
+	return blas;
+}
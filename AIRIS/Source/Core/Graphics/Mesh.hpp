@@ -4,6 +4,7 @@
 #include "Core/API/RendererAPI.hpp"
 #include "Core/API/D3D12/Buffer.h"
 #include "ShaderData.hpp"
+#include "Core/RayTracing/TriangleBLAS.hpp"
 
 
 struct SubMesh
@@ -22,6 +23,11 @@ public:
 	D3D12_VERTEX_BUFFER_VIEW VertexBufferView()const;
 	D3D12_INDEX_BUFFER_VIEW IndexBufferView()const;
 
+	// CPU copies of the buffers, as the ray tracer reads them
+	TriangleMeshView GetTriangleView(const SubMesh& subMesh)const;
+	// Triangle BLAS of one submesh for the CPU ray tracer, transform places it in the scene
+	TriangleBLAS BuildBLAS(const SubMesh& subMesh, uint32_t materialIndex, const glm::mat4& transform = glm::mat4(1.f))const;
+
 public:
 	std::string m_name;
 	std::unordered_map<std::string, SubMesh> m_subMeshes;
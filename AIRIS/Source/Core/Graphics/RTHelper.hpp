@@ -8,17 +8,67 @@ struct RTSphere
 	uint32_t	MaterialIndex;
 };
 
+// 80 bytes, a TLAS instance as the shader reads it. The BLASes are packed into one triangle and one node buffer,
+// the offsets locate the instance's BLAS in them and its node indices are relative to them
+struct RTInstance
+{
+	glm::mat4	WorldToObject;
+	uint32_t	NodeOffset,
+				TriangleOffset,
+				// RT_UINTMAX keeps the materials of the triangles
+				MaterialIndex,
+				Padding = 0;
+};
+
+// 40 bytes, vertices are stored directly so a triangle test needs one load and no index indirection
+struct RTTriangle
+{
+	glm::vec3	V0,
+				V1,
+				V2;
+	uint32_t	MaterialIndex;
+};
+
 enum MTType : uint32_t
 {
 	Diffuse,
 	Metal,
 	Dielectric,
 	HollowGlass,
+	// Light source, ends the path
+	Emissive,
 };
 
 struct RTMaterial
 {
+	// Emitted radiance for Emissive materials, can go above 1
 	glm::vec3	Albedo;
 	MTType		Type;
 	float		Roughness;
+};
+
+// Sample generator of the path tracers, PathSampler on the CPU and the sampler in RT.hlsl
+enum class SamplerType : uint32_t
+{
+	// Independent PCG stream per pixel and frame
+	PCG,
+	// Owen scrambled Sobol (0,2) points, padded with a shuffle per dimension pair
+	Sobol,
+	// Rank-1 (R2) sequence, shifted per pixel by an R2 dither mask so the error is spread as blue noise
+	BlueNoise,
+};
+
+struct RTConstants
+{
+	// Booleans are 32BIT(4 Bytes) in HLSL 
+	uint32_t	AccumlateSamples	= false, // bool
+				ResetOutput			= false, // bool
+				AccumulatedSamples	= 0,
+				MaxRayBounces		= 7,
+				RandSeed			= 0;
+	SamplerType	Sampler				= SamplerType::Sobol;
+	// Russian roulette on the path throughput starts after this many bounces, MaxRayBounces + 1 turns it off
+	uint32_t	MinRayBounces		= 5;
+	// Shadow rays toward sampled points on the emissive spheres, MIS weighted against BSDF sampling. Off, lights are only found by scattered rays
+	uint32_t	NextEventEstimation	= true; // bool
 };
\ No newline at end of file
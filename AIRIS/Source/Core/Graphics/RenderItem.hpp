@@ -16,6 +16,8 @@ struct RenderItem
 	int DirtyFRCount = 3;
 	// Constant Buffer location offset
 	unsigned int ConstantBufferIndex = 0xffffffff;
+	// Instance of the item in the ray tracing TLAS, see RenderItemInstances
+	unsigned int RTInstanceIndex = 0xffffffff;
 	// Primitive vertex data count and locations
 	unsigned int IndexCount = 0;
 	unsigned int StartIndexLocation = 0;
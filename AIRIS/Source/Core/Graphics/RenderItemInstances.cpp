@@ -0,0 +1,39 @@
+#include "RenderItemInstances.hpp"
+
+RenderItemInstances::RenderItemInstances(TLAS& tlas, uint32_t materialIndex)
+	:m_tlas(tlas), m_materialIndex(materialIndex)
+{
+}
+
+bool RenderItemInstances::Sync(const std::vector<RenderItem*>& items)
+{
+	for (RenderItem* item : items)
+	{
+		if (item->RTInstanceIndex == 0xffffffff)
+		{
+			item->RTInstanceIndex = m_tlas.AddInstance(GetBLAS(*item), item->ModelMatrix);
+			continue;
+		}
+
+		// DirtyFRCount stays up for every frame resource, the transform only has to be compared once per change
+		if (item->DirtyFRCount > 0 && m_tlas.GetInstances()[item->RTInstanceIndex].ObjectToWorld != item->ModelMatrix)
+			m_tlas.SetTransform(item->RTInstanceIndex, item->ModelMatrix);
+	}
+	return m_tlas.Update();
+}
+
+uint32_t RenderItemInstances::GetBLAS(const RenderItem& item)
+{
+	const SubMeshKey key(item.Mesh, item.IndexCount, item.StartIndexLocation, item.BaseVertexLocation);
+	auto it = m_blases.find(key);
+	if (it != m_blases.end())
+		return it->second;
+
+	SubMesh subMesh;
+	subMesh.IndexCount = item.IndexCount;
+	subMesh.StartIndexLocation = item.StartIndexLocation;
+	subMesh.BaseVertexLocation = item.BaseVertexLocation;
+	const uint32_t blas = m_tlas.AddBLAS(item.Mesh->BuildBLAS(subMesh, m_materialIndex));
+	m_blases.emplace(key, blas);
+	return blas;
+}
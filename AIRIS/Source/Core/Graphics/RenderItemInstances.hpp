@@ -0,0 +1,31 @@
+#pragma once
+#include "RenderItem.hpp"
+#include "Mesh.hpp"
+#include "Core/RayTracing/TLAS.hpp"
+#include <map>
+#include <tuple>
+#include <vector>
+
+// Mirrors render items into a TLAS for the CPU ray tracer.
+// Every submesh drawn by the items gets one BLAS in object space, shared by all the items that draw it, and every item one instance.
+// Items whose transform is dirty only move their instance, the BLASes are never rebuilt.
+class RenderItemInstances
+{
+public:
+	RenderItemInstances(TLAS& tlas, uint32_t materialIndex);
+
+	// Adds instances for new items, moves the ones with a dirty transform and updates the TLAS.
+	// Call before UpdateConstantBuffers counts DirtyFRCount down. Returns true if the TLAS was rebuilt.
+	bool Sync(const std::vector<RenderItem*>& items);
+
+private:
+	uint32_t GetBLAS(const RenderItem& item);
+
+private:
+	// Mesh and draw range of a submesh
+	using SubMeshKey = std::tuple<const Mesh*, uint32_t, uint32_t, uint32_t>;
+
+	TLAS&							m_tlas;
+	uint32_t						m_materialIndex;
+	std::map<SubMeshKey, uint32_t>	m_blases;
+};
@@ -24,16 +24,6 @@ private:
 	virtual void Init() = 0;
 };
 
-struct RTConstants
-{
-	// Booleans are 32BIT(4 Bytes) in HLSL 
-	uint32_t	AccumlateSamples	= false, // bool
-				ResetOutput			= false, // bool
-				AccumulatedSamples	= 0,
-				MaxRayBounces		= 7,
-				RandSeed			= 0;
-};
-
 class RRenderer : public Renderer
 {
 public:
@@ -0,0 +1,27 @@
+#include "AOV.hpp"
+
+void AOVBuffer::Configure(uint32_t flags, uint32_t width, uint32_t height)
+{
+	flags &= AOVAll;
+	if (flags == m_flags && width == m_width && height == m_height)
+		return;
+
+	m_flags = flags;
+	m_width = width;
+	m_height = height;
+	m_stride = 0;
+	for (uint32_t aov = 0; aov < std::size(s_aovWords); ++aov)
+	{
+		m_offsets[aov] = m_stride;
+		if (flags & (1u << aov))
+			m_stride += s_aovWords[aov];
+	}
+
+	// Sky values until the first sample lands
+	m_data.assign(static_cast<size_t>(width) * height * m_stride, 0);
+	if (m_stride == 0)
+		return;
+	const AOVSample sky;
+	for (size_t pixel = 0; pixel < static_cast<size_t>(width) * height; ++pixel)
+		Accumulate(pixel, sky, 0, true);
+}
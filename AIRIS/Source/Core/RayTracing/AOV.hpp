@@ -0,0 +1,122 @@
+#pragma once
+#include "Core/Graphics/RTHelper.hpp"
+#include "RTCommon.hpp"
+#include "Util.hpp"
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <vector>
+
+// Arbitrary output variables of the CPU tracer, combined as flags
+enum AOVFlags : uint32_t
+{
+	AOVNone = 0,
+	// Albedo of the scattering materials at the first hit, 1 for the other materials and the sky
+	AOVAlbedo = BIT(0),
+	// First hit normal, facing the camera ray. 0 for the sky
+	AOVNormal = BIT(1),
+	// Distance from the lens to the first hit along the camera ray, AOVSample::s_skyDepth for the sky
+	AOVDepth = BIT(2),
+	// HitRecord::MaterialIndex of the first hit of the first sample, RT_UINTMAX for the sky
+	AOVMaterialID = BIT(3),
+	// Samples accumulated into the pixel so far
+	AOVSampleCount = BIT(4),
+
+	AOVAll = AOVAlbedo | AOVNormal | AOVDepth | AOVMaterialID | AOVSampleCount,
+	// The AOVs that come from the first hit, the others need nothing from the traced path
+	AOVFirstHit = AOVAlbedo | AOVNormal | AOVDepth | AOVMaterialID,
+};
+
+// First hit of one camera ray, recorded by the trace loops while they shade it. The defaults are what a ray that missed leaves
+struct AOVSample
+{
+	// Far enough that no surface blends with the sky, and still finite so the running means stay finite
+	static constexpr float s_skyDepth = 1e6f;
+
+	glm::vec3	Albedo = glm::vec3(1.f);
+	glm::vec3	Normal = glm::vec3(0.f);
+	float		Depth = s_skyDepth;
+	uint32_t	MaterialIndex = RT_UINTMAX;
+};
+
+inline AOVSample MakeAOVSample(const HitRecord& hit, const std::vector<RTMaterial>& materials)
+{
+	// Specular and emissive surfaces show what they reflect or emit, only the scattering materials have an albedo to speak of
+	const RTMaterial& material = materials[hit.MaterialIndex];
+	AOVSample sample;
+	sample.Albedo = material.Type == MTType::Diffuse || material.Type == MTType::Metal ? material.Albedo : glm::vec3(1.f);
+	sample.Normal = hit.Normal;
+	sample.Depth = hit.T;
+	sample.MaterialIndex = hit.MaterialIndex;
+	return sample;
+}
+
+// The enabled AOVs of a pixel interleaved in one record of 32 bit words, disabled ones take no space and are never written.
+// Albedo, normal and depth are running means over the samples of the pixel, the normal is not renormalized
+class AOVBuffer
+{
+public:
+	// Reallocates and clears the buffer when the flags or the size changed
+	void Configure(uint32_t flags, uint32_t width, uint32_t height);
+
+	inline uint32_t							GetFlags() const				{ return m_flags; }
+	inline bool								IsEnabled(AOVFlags aov) const	{ return (m_flags & aov) != 0; }
+	// 32 bit words per pixel, and where an enabled AOV starts within them
+	inline uint32_t							GetStride() const				{ return m_stride; }
+	inline uint32_t							GetOffset(AOVFlags aov) const	{ return m_offsets[std::countr_zero(static_cast<uint32_t>(aov))]; }
+	inline const std::vector<uint32_t>&		GetData() const					{ return m_data; }
+
+	// Folds one sample into the pixel, sampleCount includes it. A reset sample replaces what was there
+	inline void Accumulate(size_t pixel, const AOVSample& sample, uint32_t sampleCount, bool reset);
+
+	// Only valid for enabled AOVs
+	inline glm::vec3	GetAlbedo(size_t pixel) const		{ return ReadVec3(pixel, AOVAlbedo); }
+	inline glm::vec3	GetNormal(size_t pixel) const		{ return ReadVec3(pixel, AOVNormal); }
+	inline float		GetDepth(size_t pixel) const		{ return std::bit_cast<float>(m_data[pixel * m_stride + GetOffset(AOVDepth)]); }
+	inline uint32_t		GetMaterialID(size_t pixel) const	{ return m_data[pixel * m_stride + GetOffset(AOVMaterialID)]; }
+	inline uint32_t		GetSampleCount(size_t pixel) const	{ return m_data[pixel * m_stride + GetOffset(AOVSampleCount)]; }
+
+private:
+	inline glm::vec3 ReadVec3(size_t pixel, AOVFlags aov) const
+	{
+		const uint32_t* words = &m_data[pixel * m_stride + GetOffset(aov)];
+		return glm::vec3(std::bit_cast<float>(words[0]), std::bit_cast<float>(words[1]), std::bit_cast<float>(words[2]));
+	}
+
+	static inline void UpdateMean(uint32_t* words, const float* values, uint32_t count, float weight)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const float mean = std::bit_cast<float>(words[i]);
+			words[i] = std::bit_cast<uint32_t>(mean + (values[i] - mean) * weight);
+		}
+	}
+
+	// Words of each AOV, in flag bit order
+	static constexpr uint32_t s_aovWords[] = { 3, 3, 1, 1, 1 };
+
+private:
+	uint32_t				m_flags = AOVNone,
+							m_width = 0,
+							m_height = 0,
+							m_stride = 0;
+	uint32_t				m_offsets[std::size(s_aovWords)] = {};
+	std::vector<uint32_t>	m_data;
+};
+
+inline void AOVBuffer::Accumulate(size_t pixel, const AOVSample& sample, uint32_t sampleCount, bool reset)
+{
+	uint32_t* record = m_data.data() + pixel * m_stride;
+	const float weight = reset ? 1.f : 1.f / static_cast<float>(std::max(sampleCount, 1u));
+	if (m_flags & AOVAlbedo)
+		UpdateMean(record + GetOffset(AOVAlbedo), &sample.Albedo.x, 3, weight);
+	if (m_flags & AOVNormal)
+		UpdateMean(record + GetOffset(AOVNormal), &sample.Normal.x, 3, weight);
+	if (m_flags & AOVDepth)
+		UpdateMean(record + GetOffset(AOVDepth), &sample.Depth, 1, weight);
+	// A mean of material indices means nothing, the first sample decides
+	if ((m_flags & AOVMaterialID) && reset)
+		record[GetOffset(AOVMaterialID)] = sample.MaterialIndex;
+	if (m_flags & AOVSampleCount)
+		record[GetOffset(AOVSampleCount)] = sampleCount;
+}
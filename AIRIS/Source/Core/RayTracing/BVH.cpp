@@ -0,0 +1,1168 @@
+#include "BVH.hpp"
+#include <bit>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+	// Traversal stacks are fixed size, nodes deeper than this become leaves no matter their size
+	constexpr uint32_t s_maxDepth = 60;
+	constexpr uint32_t s_maxBins = 64;
+
+	struct Bin
+	{
+		AABB		Bounds;
+		uint32_t	Count = 0;
+	};
+
+	struct BuildTask
+	{
+		uint32_t NodeIndex;
+		uint32_t Depth;
+	};
+
+	// Ranges at least this big are binned and partitioned in chunks, on the pool if there is one.
+	// The partition is stable there, so the tree doesn't depend on the thread count.
+	constexpr uint32_t s_chunkedRangeSize = 1 << 16;
+	constexpr uint32_t s_chunkSize = 1 << 14;
+
+	struct BuildContext
+	{
+		const std::vector<AABB>&		PrimBounds;
+		const std::vector<glm::vec3>&	Centroids;
+		std::vector<uint32_t>&			PrimIndices;
+		// Scratch for the stable partition, as big as PrimIndices
+		std::vector<uint32_t>&			Scratch;
+		const BVHBuildSettings&			Settings;
+		ThreadPool*						Pool;
+	};
+
+	inline uint32_t ChunkCount(uint32_t count)
+	{
+		return count >= s_chunkedRangeSize ? (count + s_chunkSize - 1) / s_chunkSize : 1;
+	}
+
+	// Runs func(chunk, begin, end) over the chunks of [first, first + count), on the pool for chunked ranges
+	template<typename Func>
+	void ForChunks(ThreadPool* pool, uint32_t first, uint32_t count, Func&& func)
+	{
+		const uint32_t chunkCount = ChunkCount(count);
+		auto run = [&](uint32_t chunk, uint32_t)
+		{
+			const uint32_t chunkFirst = first + chunk * (count / chunkCount) + std::min(chunk, count % chunkCount);
+			const uint32_t chunkEnd = first + (chunk + 1) * (count / chunkCount) + std::min(chunk + 1, count % chunkCount);
+			func(chunk, chunkFirst, chunkEnd);
+		};
+		if (pool && chunkCount > 1)
+			pool->ParallelFor(chunkCount, run);
+		else
+		{
+			for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+				run(chunk, 0);
+		}
+	}
+
+	// Finds the split of the node's range with binned SAH. Returns false if the node stays a leaf, bounds gets the node bounds either way
+	bool SplitNode(const BuildContext& ctx, uint32_t first, uint32_t count, uint32_t depth, AABB& bounds, uint32_t& mid)
+	{
+		const BVHBuildSettings& settings = ctx.Settings;
+		const uint32_t chunkCount = ChunkCount(count);
+
+		// Node and centroid bounds. Small ranges are a single chunk and stay off the heap
+		AABB localBounds[2];
+		std::vector<AABB> chunkBoundsStorage(chunkCount > 1 ? 2 * chunkCount : 0);
+		AABB* chunkBounds = chunkCount > 1 ? chunkBoundsStorage.data() : localBounds;
+		AABB* chunkCentroidBounds = chunkBounds + chunkCount;
+		ForChunks(ctx.Pool, first, count, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				chunkBounds[chunk].Grow(ctx.PrimBounds[ctx.PrimIndices[i]]);
+				chunkCentroidBounds[chunk].Grow(ctx.Centroids[ctx.PrimIndices[i]]);
+			}
+		});
+		AABB centroidBounds;
+		bounds = {};
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			bounds.Grow(chunkBounds[chunk]);
+			centroidBounds.Grow(chunkCentroidBounds[chunk]);
+		}
+
+		if (count <= 1 || depth >= s_maxDepth)
+			return false;
+
+		// BINNED SAH, every chunk bins all three axes, bins are merged afterwards
+		const uint32_t binCount = settings.BinCount;
+		glm::vec3 binScale;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = centroidBounds.Max[axis] - centroidBounds.Min[axis];
+			binScale[axis] = extent > 0.f ? binCount / extent : 0.f;
+		}
+		auto binOf = [&](uint32_t prim, int axis)
+		{
+			return std::min(binCount - 1, static_cast<uint32_t>((ctx.Centroids[prim][axis] - centroidBounds.Min[axis]) * binScale[axis]));
+		};
+
+		Bin localBins[3 * s_maxBins];
+		std::vector<Bin> chunkBinStorage(chunkCount > 1 ? static_cast<size_t>(chunkCount) * 3 * binCount : 0);
+		Bin* chunkBins = chunkCount > 1 ? chunkBinStorage.data() : localBins;
+		ForChunks(ctx.Pool, first, count, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+		{
+			Bin* bins = chunkBins + static_cast<size_t>(chunk) * 3 * binCount;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				const uint32_t prim = ctx.PrimIndices[i];
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					Bin& bin = bins[axis * binCount + binOf(prim, axis)];
+					bin.Count++;
+					bin.Bounds.Grow(ctx.PrimBounds[prim]);
+				}
+			}
+		});
+
+		float		bestCost = RT_FLOATMAX;
+		int			bestAxis = -1;
+		uint32_t	bestSplit = 0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (binScale[axis] == 0.f)
+				continue;
+
+			Bin bins[s_maxBins];
+			for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+			{
+				const Bin* chunkAxisBins = chunkBins + (static_cast<size_t>(chunk) * 3 + axis) * binCount;
+				for (uint32_t b = 0; b < binCount; ++b)
+				{
+					bins[b].Count += chunkAxisBins[b].Count;
+					bins[b].Bounds.Grow(chunkAxisBins[b].Bounds);
+				}
+			}
+
+			// Sweep from both sides, plane i splits bins [0, i] and [i + 1, binCount)
+			float		leftArea[s_maxBins], rightArea[s_maxBins];
+			uint32_t	leftCount[s_maxBins], rightCount[s_maxBins];
+			AABB		leftBox, rightBox;
+			uint32_t	leftSum = 0, rightSum = 0;
+			for (uint32_t i = 0; i < binCount - 1; ++i)
+			{
+				leftSum += bins[i].Count;
+				leftCount[i] = leftSum;
+				leftBox.Grow(bins[i].Bounds);
+				leftArea[i] = leftBox.HalfArea();
+
+				rightSum += bins[binCount - 1 - i].Count;
+				rightCount[binCount - 2 - i] = rightSum;
+				rightBox.Grow(bins[binCount - 1 - i].Bounds);
+				rightArea[binCount - 2 - i] = rightBox.HalfArea();
+			}
+
+			for (uint32_t i = 0; i < binCount - 1; ++i)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+				float cost = settings.LeafCost(leftCount[i]) * leftArea[i] + settings.LeafCost(rightCount[i]) * rightArea[i];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i;
+				}
+			}
+		}
+
+		// Compare against not splitting at all, costs are relative to this node's area
+		const float nodeArea = bounds.HalfArea();
+		const float leafCost = settings.LeafCost(count);
+		const float splitCost = nodeArea > 0.f ? settings.TraversalCost + bestCost / nodeArea : RT_FLOATMAX;
+
+		if (bestAxis >= 0 && (splitCost < leafCost || count > settings.MaxLeafSize))
+		{
+			auto goesLeft = [&](uint32_t prim) { return binOf(prim, bestAxis) <= bestSplit; };
+			uint32_t* begin = ctx.PrimIndices.data() + first;
+			if (chunkCount == 1)
+			{
+				mid = static_cast<uint32_t>(std::partition(begin, begin + count, goesLeft) - ctx.PrimIndices.data());
+				return true;
+			}
+
+			// Stable partition in chunks: count the left side per chunk, then every chunk scatters to its offsets
+			std::vector<uint32_t> leftCounts(chunkCount + 1, 0);
+			ForChunks(ctx.Pool, first, count, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd)
+			{
+				uint32_t left = 0;
+				for (uint32_t i = chunkBegin; i < chunkEnd; ++i)
+					left += goesLeft(ctx.PrimIndices[i]);
+				leftCounts[chunk + 1] = left;
+			});
+			for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+				leftCounts[chunk + 1] += leftCounts[chunk];
+			const uint32_t leftTotal = leftCounts[chunkCount];
+			ForChunks(ctx.Pool, first, count, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd)
+			{
+				uint32_t	left = first + leftCounts[chunk],
+							right = first + leftTotal + (chunkBegin - first - leftCounts[chunk]);
+				for (uint32_t i = chunkBegin; i < chunkEnd; ++i)
+				{
+					const uint32_t prim = ctx.PrimIndices[i];
+					ctx.Scratch[goesLeft(prim) ? left++ : right++] = prim;
+				}
+			});
+			ForChunks(ctx.Pool, first, count, [&](uint32_t, uint32_t chunkBegin, uint32_t chunkEnd)
+			{
+				std::copy(ctx.Scratch.begin() + chunkBegin, ctx.Scratch.begin() + chunkEnd, ctx.PrimIndices.begin() + chunkBegin);
+			});
+			mid = first + leftTotal;
+			return true;
+		}
+		if (count > settings.MaxLeafSize)
+		{
+			// All centroids in the same spot, the SAH can't separate them so split the range in half
+			mid = first + count / 2;
+			return true;
+		}
+		return false;
+	}
+
+	// Spreads the bits of v over every third bit, 10 bits for 30 bit codes and 21 for 63 bit ones
+	inline uint64_t ExpandBits10(uint32_t v)
+	{
+		uint64_t x = v & 0x3ff;
+		x = (x | x << 16) & 0x30000ff;
+		x = (x | x << 8) & 0x300f00f;
+		x = (x | x << 4) & 0x30c30c3;
+		x = (x | x << 2) & 0x9249249;
+		return x;
+	}
+
+	inline uint64_t ExpandBits21(uint32_t v)
+	{
+		uint64_t x = v & 0x1fffff;
+		x = (x | x << 32) & 0x1f00000000ffffull;
+		x = (x | x << 16) & 0x1f0000ff0000ffull;
+		x = (x | x << 8) & 0x100f00f00f00f00full;
+		x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+		x = (x | x << 2) & 0x1249249249249249ull;
+		return x;
+	}
+
+	// Builds the subtree below nodes[root.NodeIndex], whose LeftFirst/PrimCount hold its range. New nodes are appended to nodes
+	void BuildSubtree(const BuildContext& ctx, std::vector<BVHNode>& nodes, BuildTask root)
+	{
+		std::vector<BuildTask> tasks;
+		tasks.push_back(root);
+		while (!tasks.empty())
+		{
+			BuildTask task = tasks.back();
+			tasks.pop_back();
+
+			const uint32_t	first = nodes[task.NodeIndex].LeftFirst,
+							count = nodes[task.NodeIndex].PrimCount;
+			AABB bounds;
+			uint32_t mid = 0;
+			const bool split = SplitNode(ctx, first, count, task.Depth, bounds, mid);
+			nodes[task.NodeIndex].Min = bounds.Min;
+			nodes[task.NodeIndex].Max = bounds.Max;
+			if (!split)
+				continue;
+
+			uint32_t left = static_cast<uint32_t>(nodes.size());
+			nodes.push_back({ glm::vec3(0.f), first, glm::vec3(0.f), mid - first });
+			nodes.push_back({ glm::vec3(0.f), mid, glm::vec3(0.f), first + count - mid });
+			nodes[task.NodeIndex].LeftFirst = left;
+			nodes[task.NodeIndex].PrimCount = 0;
+
+			tasks.push_back({ left + 1, task.Depth + 1 });
+			tasks.push_back({ left, task.Depth + 1 });
+		}
+	}
+
+	// Child of a wide node during the collapse: a binary node, or a range of binary leaf order primitives
+	// for leaves too big for the 8 bit primitive count
+	struct WideChild
+	{
+		uint32_t	Node = RT_UINTMAX;
+		uint32_t	First = 0,
+					Count = 0;
+		AABB		Bounds;
+		bool		Inner = false;
+	};
+
+	constexpr uint32_t s_maxWideLeafSize = 255;
+
+	inline float Pow2(int exponent)
+	{
+		return std::bit_cast<float>(static_cast<uint32_t>(exponent + 127) << 23);
+	}
+
+	// Quantizes the used slots [0, childCount) of the node against the union of their boxes
+	AABB EncodeChildren(BVH8Node& node, const AABB* childBounds, uint32_t childCount)
+	{
+		AABB bounds;
+		for (uint32_t slot = 0; slot < childCount; ++slot)
+			bounds.Grow(childBounds[slot]);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			// Smallest power of two step that spans the node in 255 steps
+			const float lo = bounds.Min[axis], extent = bounds.Max[axis] - lo;
+			int exponent = extent > 0.f ? static_cast<int>(std::ceil(std::log2(extent / 255.f))) : -126;
+			exponent = std::clamp(exponent, -126, 127);
+			while (exponent < 127 && lo + 255.f * Pow2(exponent) < bounds.Max[axis])
+				++exponent;
+			const float scale = Pow2(exponent);
+
+			node.Origin[axis] = lo;
+			node.Exponent[axis] = static_cast<int8_t>(exponent);
+			for (uint32_t slot = 0; slot < 8; ++slot)
+			{
+				if (slot >= childCount)
+				{
+					node.QMin[axis][slot] = node.QMax[axis][slot] = 0;
+					continue;
+				}
+
+				// Round outwards, then step until the float planes really contain the child
+				int qMin = std::clamp(static_cast<int>(std::floor((childBounds[slot].Min[axis] - lo) / scale)), 0, 255);
+				int qMax = std::clamp(static_cast<int>(std::ceil((childBounds[slot].Max[axis] - lo) / scale)), 0, 255);
+				while (qMin > 0 && lo + qMin * scale > childBounds[slot].Min[axis])
+					--qMin;
+				while (qMax < 255 && lo + qMax * scale < childBounds[slot].Max[axis])
+					++qMax;
+				node.QMin[axis][slot] = static_cast<uint8_t>(qMin);
+				node.QMax[axis][slot] = static_cast<uint8_t>(qMax);
+			}
+		}
+		return bounds;
+	}
+
+	inline AABB DecodeChild(const BVH8Node& node, uint32_t slot)
+	{
+		AABB box;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float scale = Pow2(node.Exponent[axis]);
+			box.Min[axis] = node.Origin[axis] + node.QMin[axis][slot] * scale;
+			box.Max[axis] = node.Origin[axis] + node.QMax[axis][slot] * scale;
+		}
+		return box;
+	}
+
+	inline uint32_t UsedSlots(const BVH8Node& node)
+	{
+		uint32_t count = 0;
+		while (count < 8 && ((node.InnerMask >> count & 1) || node.PrimCount[count] > 0))
+			++count;
+		return count;
+	}
+}
+
+void BVH::Build(const std::vector<AABB>& primBounds, const BVHBuildSettings& settings, ThreadPool* pool)
+{
+	Clear();
+	m_settings = settings;
+	m_settings.BinCount = std::clamp(m_settings.BinCount, 2u, s_maxBins);
+	m_settings.MaxLeafSize = std::max(m_settings.MaxLeafSize, 1u);
+	m_settings.LeafBatchSize = std::max(m_settings.LeafBatchSize, 1u);
+
+	const uint32_t primCount = static_cast<uint32_t>(primBounds.size());
+	if (primCount == 0)
+		return;
+
+	std::vector<glm::vec3> centroids(primCount);
+	m_primIndices.resize(primCount);
+	auto init = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			centroids[i] = primBounds[i].Centroid();
+			m_primIndices[i] = i;
+		}
+	};
+	if (pool && primCount >= s_chunkedRangeSize)
+	{
+		pool->ParallelFor((primCount + s_chunkSize - 1) / s_chunkSize, [&](uint32_t chunk, uint32_t)
+		{
+			init(chunk * s_chunkSize, std::min(primCount, (chunk + 1) * s_chunkSize));
+		});
+	}
+	else
+		init(0, primCount);
+
+	// A binary tree with N leaves has 2N - 1 nodes
+	m_nodes.reserve(2 * static_cast<size_t>(primCount) - 1);
+	if (m_settings.Quality == BVHBuildQuality::SAH)
+		BuildSAH(primBounds, centroids, pool);
+	else
+		BuildLinear(primBounds, centroids, pool);
+
+	if (m_settings.Width == 8)
+		Collapse(primBounds);
+}
+
+void BVH::BuildSAH(const std::vector<AABB>& primBounds, const std::vector<glm::vec3>& centroids, ThreadPool* pool)
+{
+	const uint32_t primCount = static_cast<uint32_t>(primBounds.size());
+	std::vector<uint32_t> scratch(primCount >= s_chunkedRangeSize ? primCount : 0);
+	m_nodes.push_back({ glm::vec3(0.f), 0, glm::vec3(0.f), primCount });
+
+	const BuildContext ctx{ primBounds, centroids, m_primIndices, scratch, m_settings, pool };
+	if (!pool || pool->GetThreadCount() == 1)
+	{
+		BuildSubtree(ctx, m_nodes, { 0, 0 });
+	}
+	else
+	{
+		// TOP LEVELS, split one node at a time with the binning and partition spread over the pool,
+		// until the remaining ranges are small enough to hand out as whole subtrees
+		const uint32_t subtreeSize = std::max(primCount / (8 * pool->GetThreadCount()), 1024u);
+		std::vector<BuildTask> tasks, subtrees;
+		tasks.push_back({ 0, 0 });
+		while (!tasks.empty())
+		{
+			BuildTask task = tasks.back();
+			tasks.pop_back();
+
+			const uint32_t	first = m_nodes[task.NodeIndex].LeftFirst,
+							count = m_nodes[task.NodeIndex].PrimCount;
+			if (count <= subtreeSize)
+			{
+				subtrees.push_back(task);
+				continue;
+			}
+
+			AABB bounds;
+			uint32_t mid = 0;
+			const bool split = SplitNode(ctx, first, count, task.Depth, bounds, mid);
+			m_nodes[task.NodeIndex].Min = bounds.Min;
+			m_nodes[task.NodeIndex].Max = bounds.Max;
+			if (!split)
+				continue;
+
+			uint32_t left = static_cast<uint32_t>(m_nodes.size());
+			m_nodes.push_back({ glm::vec3(0.f), first, glm::vec3(0.f), mid - first });
+			m_nodes.push_back({ glm::vec3(0.f), mid, glm::vec3(0.f), first + count - mid });
+			m_nodes[task.NodeIndex].LeftFirst = left;
+			m_nodes[task.NodeIndex].PrimCount = 0;
+
+			tasks.push_back({ left + 1, task.Depth + 1 });
+			tasks.push_back({ left, task.Depth + 1 });
+		}
+
+		// SUBTREES, one task each, biggest first. Every task builds into nodes of its own that are appended afterwards
+		std::sort(subtrees.begin(), subtrees.end(), [&](const BuildTask& a, const BuildTask& b) { return m_nodes[a.NodeIndex].PrimCount > m_nodes[b.NodeIndex].PrimCount; });
+		std::vector<std::vector<BVHNode>> subtreeNodes(subtrees.size());
+		const BuildContext subtreeCtx{ primBounds, centroids, m_primIndices, scratch, m_settings, nullptr };
+		pool->ParallelFor(static_cast<uint32_t>(subtrees.size()), [&](uint32_t index, uint32_t)
+		{
+			std::vector<BVHNode>& nodes = subtreeNodes[index];
+			nodes.push_back(m_nodes[subtrees[index].NodeIndex]);
+			BuildSubtree(subtreeCtx, nodes, { 0, subtrees[index].Depth });
+		});
+
+		// Local node i > 0 lands at base + i - 1, the local root replaces its placeholder
+		for (size_t index = 0; index < subtrees.size(); ++index)
+		{
+			std::vector<BVHNode>& nodes = subtreeNodes[index];
+			const uint32_t base = static_cast<uint32_t>(m_nodes.size());
+			for (BVHNode& node : nodes)
+			{
+				if (!node.IsLeaf())
+					node.LeftFirst += base - 1;
+			}
+			m_nodes[subtrees[index].NodeIndex] = nodes[0];
+			m_nodes.insert(m_nodes.end(), nodes.begin() + 1, nodes.end());
+			std::vector<BVHNode>().swap(nodes);
+		}
+	}
+}
+
+void BVH::BuildLinear(const std::vector<AABB>& primBounds, const std::vector<glm::vec3>& centroids, ThreadPool* pool)
+{
+	const uint32_t primCount = static_cast<uint32_t>(primBounds.size());
+	const uint32_t chunkCount = ChunkCount(primCount);
+	const bool wideCodes = m_settings.MortonBits > 32;
+
+	// MORTON CODES of the centroids on a 2^10 or 2^21 grid over the centroid bounds
+	std::vector<AABB> chunkBounds(chunkCount);
+	ForChunks(pool, 0, primCount, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+			chunkBounds[chunk].Grow(centroids[i]);
+	});
+	AABB centroidBounds;
+	for (const AABB& bounds : chunkBounds)
+		centroidBounds.Grow(bounds);
+
+	const float cells = wideCodes ? static_cast<float>((1u << 21) - 1) : static_cast<float>((1u << 10) - 1);
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float extent = centroidBounds.Max[axis] - centroidBounds.Min[axis];
+		scale[axis] = extent > 0.f ? cells / extent : 0.f;
+	}
+	std::vector<uint64_t> keys(primCount), sortedKeys(primCount);
+	ForChunks(pool, 0, primCount, [&](uint32_t, uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			glm::vec3 cell = glm::clamp((centroids[i] - centroidBounds.Min) * scale, glm::vec3(0.f), glm::vec3(cells));
+			uint32_t	x = static_cast<uint32_t>(cell.x),
+						y = static_cast<uint32_t>(cell.y),
+						z = static_cast<uint32_t>(cell.z);
+			keys[i] = wideCodes ?
+				ExpandBits21(x) << 2 | ExpandBits21(y) << 1 | ExpandBits21(z) :
+				ExpandBits10(x) << 2 | ExpandBits10(y) << 1 | ExpandBits10(z);
+		}
+	});
+
+	// LSD RADIX SORT of (code, primitive) pairs, 8 bits per pass. Every chunk counts its digits,
+	// then scatters them stably behind the same digit of the chunks before it
+	std::vector<uint32_t> sortedIndices(primCount);
+	std::vector<uint32_t> histograms(static_cast<size_t>(chunkCount) * 256);
+	const uint32_t passes = wideCodes ? 8 : 4;
+	for (uint32_t pass = 0; pass < passes; ++pass)
+	{
+		const uint32_t shift = pass * 8;
+		std::fill(histograms.begin(), histograms.end(), 0u);
+		ForChunks(pool, 0, primCount, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+		{
+			uint32_t* histogram = histograms.data() + static_cast<size_t>(chunk) * 256;
+			for (uint32_t i = begin; i < end; ++i)
+				++histogram[keys[i] >> shift & 0xff];
+		});
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; ++digit)
+		{
+			for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+			{
+				uint32_t& count = histograms[static_cast<size_t>(chunk) * 256 + digit];
+				const uint32_t digitCount = count;
+				count = offset;
+				offset += digitCount;
+			}
+		}
+		ForChunks(pool, 0, primCount, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+		{
+			uint32_t* offsets = histograms.data() + static_cast<size_t>(chunk) * 256;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				const uint32_t dst = offsets[keys[i] >> shift & 0xff]++;
+				sortedKeys[dst] = keys[i];
+				sortedIndices[dst] = m_primIndices[i];
+			}
+		});
+		keys.swap(sortedKeys);
+		m_primIndices.swap(sortedIndices);
+	}
+	std::vector<uint64_t>().swap(sortedKeys);
+	std::vector<uint32_t>().swap(sortedIndices);
+
+	// KARRAS HIERARCHY, internal node i covers the sorted range that starts or ends at i and splits it at the highest differing bit.
+	// Equal codes are told apart by their position. Every node is found on its own, so they are built in parallel
+	m_nodes.push_back({ glm::vec3(0.f), 0, glm::vec3(0.f), primCount });
+	if (primCount > 1)
+	{
+		struct RadixNode
+		{
+			uint32_t First, Last;
+			// Bit 31 marks a single primitive
+			uint32_t Left, Right;
+		};
+		constexpr uint32_t leafBit = 1u << 31;
+		std::vector<RadixNode> radixNodes(primCount - 1);
+		auto delta = [&](int64_t i, int64_t j) -> int
+		{
+			if (j < 0 || j >= primCount)
+				return -1;
+			if (keys[i] != keys[j])
+				return std::countl_zero(keys[i] ^ keys[j]);
+			return 64 + std::countl_zero(static_cast<uint32_t>(i ^ j));
+		};
+		ForChunks(pool, 0, primCount - 1, [&](uint32_t, uint32_t begin, uint32_t end)
+		{
+			for (uint32_t node = begin; node < end; ++node)
+			{
+				const int64_t i = node;
+				const int64_t d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+
+				// Other end of the range, grow exponentially then binary search
+				const int deltaMin = delta(i, i - d);
+				int64_t lengthMax = 2;
+				while (delta(i, i + lengthMax * d) > deltaMin)
+					lengthMax *= 2;
+				int64_t length = 0;
+				for (int64_t step = lengthMax / 2; step >= 1; step /= 2)
+				{
+					if (delta(i, i + (length + step) * d) > deltaMin)
+						length += step;
+				}
+				const int64_t j = i + length * d;
+
+				// Split, the last position that shares more than the whole range does
+				const int deltaNode = delta(i, j);
+				int64_t split = 0;
+				for (int64_t step = (length + 1) / 2;; step = (step + 1) / 2)
+				{
+					if (split + step < length + 1 && delta(i, i + (split + step) * d) > deltaNode)
+						split += step;
+					if (step == 1)
+						break;
+				}
+				const int64_t gamma = i + split * d + std::min<int64_t>(d, 0);
+
+				RadixNode& radixNode = radixNodes[node];
+				radixNode.First = static_cast<uint32_t>(std::min(i, j));
+				radixNode.Last = static_cast<uint32_t>(std::max(i, j));
+				radixNode.Left = static_cast<uint32_t>(gamma) | (radixNode.First == gamma ? leafBit : 0);
+				radixNode.Right = static_cast<uint32_t>(gamma + 1) | (radixNode.Last == gamma + 1 ? leafBit : 0);
+			}
+		});
+
+		// Emission into the node layout, ranges small enough (or deep enough for the traversal stacks) become leaves
+		struct EmitTask
+		{
+			uint32_t NodeIndex;
+			uint32_t RadixNode;
+			uint32_t Depth;
+		};
+		std::vector<EmitTask> tasks;
+		tasks.push_back({ 0, 0, 0 });
+		while (!tasks.empty())
+		{
+			EmitTask task = tasks.back();
+			tasks.pop_back();
+
+			const RadixNode& radixNode = radixNodes[task.RadixNode];
+			const uint32_t count = radixNode.Last - radixNode.First + 1;
+			if (count <= m_settings.MaxLeafSize || task.Depth >= s_maxDepth)
+			{
+				m_nodes[task.NodeIndex] = { glm::vec3(0.f), radixNode.First, glm::vec3(0.f), count };
+				continue;
+			}
+
+			const uint32_t left = static_cast<uint32_t>(m_nodes.size());
+			m_nodes[task.NodeIndex] = { glm::vec3(0.f), left, glm::vec3(0.f), 0 };
+			const uint32_t children[2] = { radixNode.Left, radixNode.Right };
+			for (uint32_t c = 0; c < 2; ++c)
+			{
+				m_nodes.push_back({ glm::vec3(0.f), children[c] & ~leafBit, glm::vec3(0.f), 1 });
+				if (!(children[c] & leafBit))
+					tasks.push_back({ left + c, children[c], task.Depth + 1 });
+			}
+		}
+	}
+	std::vector<uint64_t>().swap(keys);
+
+	// BOUNDS, leaves in parallel, then one backwards pass since children are stored after their parents
+	const uint32_t nodeCount = static_cast<uint32_t>(m_nodes.size());
+	ForChunks(pool, 0, nodeCount, [&](uint32_t, uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			BVHNode& node = m_nodes[i];
+			if (!node.IsLeaf())
+				continue;
+			AABB bounds;
+			for (uint32_t prim = node.LeftFirst; prim < node.LeftFirst + node.PrimCount; ++prim)
+				bounds.Grow(primBounds[m_primIndices[prim]]);
+			node.Min = bounds.Min;
+			node.Max = bounds.Max;
+		}
+	});
+	for (uint32_t i = nodeCount; i-- > 0;)
+	{
+		BVHNode& node = m_nodes[i];
+		if (node.IsLeaf())
+			continue;
+		node.Min = glm::min(m_nodes[node.LeftFirst].Min, m_nodes[node.LeftFirst + 1].Min);
+		node.Max = glm::max(m_nodes[node.LeftFirst].Max, m_nodes[node.LeftFirst + 1].Max);
+	}
+
+	if (m_settings.Quality == BVHBuildQuality::LinearTreelets)
+		OptimizeTreelets();
+}
+
+void BVH::OptimizeTreelets()
+{
+	constexpr uint32_t maxLeaves = 7;
+	constexpr uint32_t maxSubsets = 1 << maxLeaves;
+
+	// SAH cost of every subtree in area units, filled bottom up as the nodes are restructured
+	std::vector<float> costs(m_nodes.size());
+	for (size_t r = m_nodes.size(); r-- > 0;)
+	{
+		const BVHNode root = m_nodes[r];
+		const float rootArea = AABB{ root.Min, root.Max }.HalfArea();
+		if (root.IsLeaf())
+		{
+			costs[r] = m_settings.LeafCost(root.PrimCount) * rootArea;
+			continue;
+		}
+
+		// Treelet: open the interior leaf with the largest area until there are 7 leaves.
+		// Every interior node of the treelet brings the pair of slots its children live in
+		uint32_t	leaves[maxLeaves],
+					pairs[maxLeaves - 1];
+		uint32_t	leafCount = 2,
+					pairCount = 1;
+		leaves[0] = root.LeftFirst;
+		leaves[1] = root.LeftFirst + 1;
+		pairs[0] = root.LeftFirst;
+		while (leafCount < maxLeaves)
+		{
+			int best = -1;
+			float bestArea = -1.f;
+			for (uint32_t i = 0; i < leafCount; ++i)
+			{
+				const BVHNode& node = m_nodes[leaves[i]];
+				const float area = AABB{ node.Min, node.Max }.HalfArea();
+				if (!node.IsLeaf() && area > bestArea)
+				{
+					best = static_cast<int>(i);
+					bestArea = area;
+				}
+			}
+			if (best < 0)
+				break;
+			const uint32_t open = m_nodes[leaves[best]].LeftFirst;
+			pairs[pairCount++] = open;
+			leaves[best] = open;
+			leaves[leafCount++] = open + 1;
+		}
+
+		const float currentCost = m_settings.TraversalCost * rootArea + costs[root.LeftFirst] + costs[root.LeftFirst + 1];
+		if (leafCount < 3)
+		{
+			costs[r] = currentCost;
+			continue;
+		}
+
+		// Best binary tree over every subset of the leaves, subsets only have smaller subsets so increasing order works
+		AABB	subsetBounds[maxSubsets];
+		float	subsetCost[maxSubsets];
+		uint8_t	subsetSplit[maxSubsets];
+		const uint32_t fullSet = (1u << leafCount) - 1;
+		for (uint32_t set = 1; set <= fullSet; ++set)
+		{
+			const uint32_t lowest = set & (~set + 1);
+			if (set == lowest)
+			{
+				const uint32_t leaf = std::countr_zero(set);
+				subsetBounds[set] = { m_nodes[leaves[leaf]].Min, m_nodes[leaves[leaf]].Max };
+				subsetCost[set] = costs[leaves[leaf]];
+				continue;
+			}
+
+			subsetBounds[set] = subsetBounds[set ^ lowest];
+			subsetBounds[set].Grow(subsetBounds[lowest]);
+			float bestCost = RT_FLOATMAX;
+			// Partitions are visited once, by the half that holds the lowest leaf
+			for (uint32_t part = (set - 1) & set; part != 0; part = (part - 1) & set)
+			{
+				if (!(part & lowest))
+					continue;
+				const float cost = subsetCost[part] + subsetCost[set ^ part];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					subsetSplit[set] = static_cast<uint8_t>(part);
+				}
+			}
+			subsetCost[set] = m_settings.TraversalCost * subsetBounds[set].HalfArea() + bestCost;
+		}
+
+		if (!(subsetCost[fullSet] < currentCost * (1.f - 1e-5f)))
+		{
+			costs[r] = currentCost;
+			continue;
+		}
+
+		// Rebuild the treelet in its own slots: the root stays, the new interior nodes take the pairs in order
+		BVHNode leafNodes[maxLeaves];
+		float leafCosts[maxLeaves];
+		for (uint32_t i = 0; i < leafCount; ++i)
+		{
+			leafNodes[i] = m_nodes[leaves[i]];
+			leafCosts[i] = costs[leaves[i]];
+		}
+		std::pair<uint32_t, uint32_t> stack[2 * maxLeaves];
+		uint32_t stackSize = 0, nextPair = 0;
+		stack[stackSize++] = { fullSet, static_cast<uint32_t>(r) };
+		while (stackSize > 0)
+		{
+			auto [set, slot] = stack[--stackSize];
+			if (std::has_single_bit(set))
+			{
+				const uint32_t leaf = std::countr_zero(set);
+				m_nodes[slot] = leafNodes[leaf];
+				costs[slot] = leafCosts[leaf];
+				continue;
+			}
+			const uint32_t pair = pairs[nextPair++];
+			m_nodes[slot] = { subsetBounds[set].Min, pair, subsetBounds[set].Max, 0 };
+			costs[slot] = subsetCost[set];
+			stack[stackSize++] = { set ^ subsetSplit[set], pair + 1 };
+			stack[stackSize++] = { subsetSplit[set], pair };
+		}
+	}
+
+	// Treelets moved subtrees between slots, lay the nodes out depth first again so children follow their parents.
+	// Leaves moved too, their primitives are put back in leaf order so every subtree owns one contiguous range again
+	std::vector<BVHNode> nodes;
+	nodes.reserve(m_nodes.size());
+	nodes.push_back(m_nodes[0]);
+	std::vector<uint32_t> primOrder;
+	primOrder.reserve(m_primIndices.size());
+	std::vector<std::pair<uint32_t, uint32_t>> tasks;
+	tasks.push_back({ 0, 0 });
+	while (!tasks.empty())
+	{
+		auto [index, oldIndex] = tasks.back();
+		tasks.pop_back();
+		if (nodes[index].IsLeaf())
+		{
+			const uint32_t first = nodes[index].LeftFirst;
+			nodes[index].LeftFirst = static_cast<uint32_t>(primOrder.size());
+			primOrder.insert(primOrder.end(), m_primIndices.begin() + first, m_primIndices.begin() + first + nodes[index].PrimCount);
+			continue;
+		}
+		const uint32_t left = static_cast<uint32_t>(nodes.size());
+		const uint32_t oldLeft = nodes[index].LeftFirst;
+		nodes[index].LeftFirst = left;
+		nodes.push_back(m_nodes[oldLeft]);
+		nodes.push_back(m_nodes[oldLeft + 1]);
+		tasks.push_back({ left + 1, oldLeft + 1 });
+		tasks.push_back({ left, oldLeft });
+	}
+	m_nodes = std::move(nodes);
+	m_primIndices = std::move(primOrder);
+}
+
+void BVH::Collapse(const std::vector<AABB>& primBounds)
+{
+	auto rangeBounds = [&](uint32_t first, uint32_t count)
+	{
+		AABB bounds;
+		for (uint32_t i = first; i < first + count; ++i)
+			bounds.Grow(primBounds[m_primIndices[i]]);
+		return bounds;
+	};
+
+	// SAH optimal collapse (Ylitie et al. 2017), bottom up over the binary nodes.
+	// Cost[i] is the cheapest way to spread the subtree over at most i + 1 slots of the parent: a single slot holds the subtree
+	// as one leaf or one wide node, more slots split it between the two children. Subtrees keep their primitives together
+	// in binary leaf order, so small ones can become a single leaf too.
+	struct CollapseCost
+	{
+		float		Cost[8];
+		// Slots the left child gets when the subtree is split over i + 1 slots
+		uint8_t		Split[8];
+		// Bit i: Cost[i] is Cost[i - 1], the extra slot doesn't help
+		uint8_t		FewerSlots;
+		// Slot count of the cheapest split when the subtree becomes a wide node
+		uint8_t		NodeSlots;
+		bool		Leaf;
+		uint32_t	First,
+					Count;
+	};
+	std::vector<CollapseCost> costs(m_nodes.size());
+	for (size_t n = m_nodes.size(); n-- > 0;)
+	{
+		const BVHNode& node = m_nodes[n];
+		const float area = AABB{ node.Min, node.Max }.HalfArea();
+		CollapseCost& c = costs[n];
+		if (node.IsLeaf())
+		{
+			c.First = node.LeftFirst;
+			c.Count = node.PrimCount;
+			c.Leaf = true;
+			c.FewerSlots = 0xfe;
+			std::fill(c.Cost, c.Cost + 8, m_settings.LeafCost(node.PrimCount) * area);
+			continue;
+		}
+
+		const CollapseCost& l = costs[node.LeftFirst];
+		const CollapseCost& r = costs[node.LeftFirst + 1];
+		c.First = l.First;
+		c.Count = l.Count + r.Count;
+
+		float split[8];
+		float nodeCost = RT_FLOATMAX;
+		for (uint32_t slots = 2; slots <= 8; ++slots)
+		{
+			split[slots - 1] = RT_FLOATMAX;
+			for (uint32_t k = 1; k < slots; ++k)
+			{
+				const float cost = l.Cost[k - 1] + r.Cost[slots - k - 1];
+				if (cost < split[slots - 1])
+				{
+					split[slots - 1] = cost;
+					c.Split[slots - 1] = static_cast<uint8_t>(k);
+				}
+			}
+			if (split[slots - 1] < nodeCost)
+			{
+				nodeCost = split[slots - 1];
+				c.NodeSlots = static_cast<uint8_t>(slots);
+			}
+		}
+
+		nodeCost += m_settings.TraversalCost * area;
+		const float leafCost = c.Count <= m_settings.MaxLeafSize ? m_settings.LeafCost(c.Count) * area : RT_FLOATMAX;
+		c.Leaf = leafCost <= nodeCost;
+		c.Cost[0] = std::min(leafCost, nodeCost);
+		c.FewerSlots = 0;
+		for (uint32_t i = 1; i < 8; ++i)
+		{
+			c.Cost[i] = std::min(c.Cost[i - 1], split[i]);
+			c.FewerSlots |= (c.Cost[i - 1] <= split[i]) << i;
+		}
+	}
+
+	// Children of the subtree spread over at most slots slots
+	auto gather = [&](uint32_t binaryNode, uint32_t slots, WideChild* children, uint32_t& childCount)
+	{
+		std::pair<uint32_t, uint32_t> stack[16];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = { binaryNode, slots };
+		while (stackSize > 0)
+		{
+			auto [n, i] = stack[--stackSize];
+			const CollapseCost& c = costs[n];
+			while (i > 1 && (c.FewerSlots >> (i - 1) & 1))
+				--i;
+			if (i > 1)
+			{
+				// Right first so the children stay in binary leaf order
+				stack[stackSize++] = { m_nodes[n].LeftFirst + 1, i - c.Split[i - 1] };
+				stack[stackSize++] = { m_nodes[n].LeftFirst, c.Split[i - 1] };
+				continue;
+			}
+
+			WideChild& child = children[childCount++];
+			child.Bounds = { m_nodes[n].Min, m_nodes[n].Max };
+			if (c.Leaf)
+			{
+				child.First = c.First;
+				child.Count = c.Count;
+				child.Inner = child.Count > s_maxWideLeafSize;
+			}
+			else
+			{
+				child.Node = n;
+				child.Inner = true;
+			}
+		}
+	};
+
+	// Each wide node is created from a binary node or an oversized leaf range, children are created with their parent
+	std::vector<uint32_t> primOrder;
+	primOrder.reserve(m_primIndices.size());
+	m_wideNodes.reserve(m_nodes.size() / 4 + 1);
+	m_wideNodes.push_back({});
+
+	// A tree that is a single leaf still gets a wide root, as a leaf range
+	std::vector<std::pair<uint32_t, WideChild>> tasks;
+	WideChild root;
+	uint32_t rootCount = 0;
+	gather(0, 1, &root, rootCount);
+	root.Inner = true;
+	tasks.push_back({ 0, root });
+	while (!tasks.empty())
+	{
+		auto [wideIndex, source] = tasks.back();
+		tasks.pop_back();
+
+		WideChild children[8];
+		uint32_t childCount = 0;
+		if (source.Node != RT_UINTMAX)
+		{
+			const BVHNode& node = m_nodes[source.Node];
+			const CollapseCost& c = costs[source.Node];
+			gather(node.LeftFirst, c.Split[c.NodeSlots - 1], children, childCount);
+			gather(node.LeftFirst + 1, c.NodeSlots - c.Split[c.NodeSlots - 1], children, childCount);
+		}
+		else
+		{
+			// Leaf range: slots of up to 255 primitives, or 8 smaller ranges if it doesn't fit in 8 slots
+			const uint32_t chunk = source.Count <= 8 * s_maxWideLeafSize ? s_maxWideLeafSize : (source.Count + 7) / 8;
+			for (uint32_t first = source.First; first < source.First + source.Count; first += chunk)
+			{
+				WideChild& child = children[childCount++];
+				child.First = first;
+				child.Count = std::min(chunk, source.First + source.Count - first);
+				child.Bounds = rangeBounds(child.First, child.Count);
+				child.Inner = child.Count > s_maxWideLeafSize;
+			}
+		}
+
+		BVH8Node node = {};
+		node.ChildBase = static_cast<uint32_t>(m_wideNodes.size());
+		node.PrimBase = static_cast<uint32_t>(primOrder.size());
+		AABB childBounds[8];
+		for (uint32_t slot = 0; slot < childCount; ++slot)
+		{
+			const WideChild& child = children[slot];
+			childBounds[slot] = child.Bounds;
+			if (child.Inner)
+			{
+				node.InnerMask |= 1 << slot;
+				tasks.push_back({ static_cast<uint32_t>(m_wideNodes.size()), child });
+				m_wideNodes.push_back({});
+			}
+			else
+			{
+				node.PrimCount[slot] = static_cast<uint8_t>(child.Count);
+				primOrder.insert(primOrder.end(), m_primIndices.begin() + child.First, m_primIndices.begin() + child.First + child.Count);
+			}
+		}
+		AABB bounds = EncodeChildren(node, childBounds, childCount);
+		if (wideIndex == 0)
+			m_wideBounds = bounds;
+		m_wideNodes[wideIndex] = node;
+	}
+
+	m_primIndices = std::move(primOrder);
+	m_nodes.clear();
+	m_nodes.shrink_to_fit();
+}
+
+void BVH::Clear()
+{
+	m_nodes.clear();
+	m_wideNodes.clear();
+	m_wideBounds = {};
+	m_primIndices.clear();
+}
+
+float BVH::SAHCost() const
+{
+	if (IsWide())
+	{
+		// Same model on the decoded boxes, the nodes are charged once for all 8 children
+		const float rootArea = m_wideBounds.HalfArea();
+		float cost = 0.f;
+		for (const BVH8Node& node : m_wideNodes)
+		{
+			AABB bounds;
+			for (uint32_t slot = 0, count = UsedSlots(node); slot < count; ++slot)
+			{
+				const AABB box = DecodeChild(node, slot);
+				bounds.Grow(box);
+				if (node.PrimCount[slot] > 0)
+					cost += m_settings.LeafCost(node.PrimCount[slot]) * box.HalfArea();
+			}
+			cost += m_settings.TraversalCost * bounds.HalfArea();
+		}
+		return rootArea > 0.f ? cost / rootArea : m_settings.LeafCost(static_cast<uint32_t>(m_primIndices.size()));
+	}
+	if (m_nodes.empty())
+		return 0.f;
+
+	const float rootArea = AABB{ m_nodes[0].Min, m_nodes[0].Max }.HalfArea();
+	if (rootArea <= 0.f)
+		return m_settings.LeafCost(m_nodes[0].PrimCount);
+
+	float cost = 0.f;
+	for (const BVHNode& node : m_nodes)
+	{
+		float area = AABB{ node.Min, node.Max }.HalfArea();
+		cost += node.IsLeaf() ? m_settings.LeafCost(node.PrimCount) * area : m_settings.TraversalCost * area;
+	}
+	return cost / rootArea;
+}
+
+float BVH::Refit(const std::vector<AABB>& slotBounds)
+{
+	if (IsWide())
+		return RefitWide(slotBounds);
+	if (m_nodes.empty())
+		return 0.f;
+
+	// Children are always stored after their parent, walking the nodes backwards visits them first
+	float cost = 0.f;
+	for (size_t i = m_nodes.size(); i-- > 0;)
+	{
+		BVHNode& node = m_nodes[i];
+		AABB bounds;
+		if (node.IsLeaf())
+		{
+			for (uint32_t prim = node.LeftFirst; prim < node.LeftFirst + node.PrimCount; ++prim)
+				bounds.Grow(slotBounds[prim]);
+			cost += m_settings.LeafCost(node.PrimCount) * bounds.HalfArea();
+		}
+		else
+		{
+			const BVHNode& left = m_nodes[node.LeftFirst];
+			const BVHNode& right = m_nodes[node.LeftFirst + 1];
+			bounds.Grow(AABB{ left.Min, left.Max });
+			bounds.Grow(AABB{ right.Min, right.Max });
+			cost += m_settings.TraversalCost * bounds.HalfArea();
+		}
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+	}
+
+	const float rootArea = AABB{ m_nodes[0].Min, m_nodes[0].Max }.HalfArea();
+	return rootArea > 0.f ? cost / rootArea : m_settings.LeafCost(m_nodes[0].PrimCount);
+}
+
+float BVH::RefitWide(const std::vector<AABB>& slotBounds)
+{
+	// Interior children are created after their parent as well, so the same backwards pass works.
+	// The exact node boxes are kept aside for the parents, the nodes themselves only hold the quantized ones.
+	std::vector<AABB> nodeBounds(m_wideNodes.size());
+	for (size_t i = m_wideNodes.size(); i-- > 0;)
+	{
+		BVH8Node& node = m_wideNodes[i];
+		AABB childBounds[8];
+		uint32_t	childIndex = node.ChildBase,
+					primIndex = node.PrimBase;
+		const uint32_t childCount = UsedSlots(node);
+		for (uint32_t slot = 0; slot < childCount; ++slot)
+		{
+			if (node.InnerMask >> slot & 1)
+			{
+				childBounds[slot] = nodeBounds[childIndex++];
+				continue;
+			}
+			for (uint32_t prim = primIndex; prim < primIndex + node.PrimCount[slot]; ++prim)
+				childBounds[slot].Grow(slotBounds[prim]);
+			primIndex += node.PrimCount[slot];
+		}
+		nodeBounds[i] = EncodeChildren(node, childBounds, childCount);
+	}
+	m_wideBounds = nodeBounds[0];
+	return SAHCost();
+}
+
+BVHBuildJob::~BVHBuildJob()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void BVHBuildJob::Start(std::vector<AABB> primBounds, const BVHBuildSettings& settings)
+{
+	if (m_thread.joinable())
+		m_thread.join();
+	m_done.store(false, std::memory_order_relaxed);
+	m_thread = std::thread([this, bounds = std::move(primBounds), settings]()
+	{
+		m_result.Build(bounds, settings);
+		m_sahCost = m_result.SAHCost();
+		m_done.store(true, std::memory_order_release);
+	});
+}
+
+BVH BVHBuildJob::Take()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+	m_done.store(false, std::memory_order_relaxed);
+	return std::move(m_result);
+}
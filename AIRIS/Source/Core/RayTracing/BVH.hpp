@@ -0,0 +1,433 @@
+#pragma once
+#include "RTCommon.hpp"
+#include "RayPacket.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+struct AABB
+{
+	glm::vec3 Min = glm::vec3(RT_FLOATMAX);
+	glm::vec3 Max = glm::vec3(-RT_FLOATMAX);
+
+	inline void Grow(const glm::vec3& p)	{ Min = glm::min(Min, p); Max = glm::max(Max, p); }
+	inline void Grow(const AABB& b)			{ Min = glm::min(Min, b.Min); Max = glm::max(Max, b.Max); }
+	inline glm::vec3 Centroid() const		{ return (Min + Max) * 0.5f; }
+	inline bool IsValid() const				{ return Min.x <= Max.x && Min.y <= Max.y && Min.z <= Max.z; }
+
+	// Half of the surface area, the SAH only needs ratios of areas
+	inline float HalfArea() const
+	{
+		if (!IsValid())
+			return 0.f;
+		glm::vec3 e = Max - Min;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+// 32 bytes, matches BVHNode in RT.hlsl so the node array can be uploaded as a StructuredBuffer as is
+struct BVHNode
+{
+	glm::vec3	Min;
+	// Interior nodes: index of the left child, the right child is always LeftFirst + 1
+	// Leaves: index of the first primitive
+	uint32_t	LeftFirst;
+	glm::vec3	Max;
+	// 0 for interior nodes
+	uint32_t	PrimCount;
+
+	inline bool IsLeaf() const { return PrimCount > 0; }
+};
+static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes, it is shared with the shaders");
+
+// 80 bytes, node of the 8 wide BVH (Ylitie et al. 2017). Child boxes are stored with 8 bits per plane on a grid spanning
+// the node, plane = Origin + q * 2^Exponent, rounded outwards so the decoded boxes always contain the exact ones.
+// Used slots are always the first ones.
+struct BVH8Node
+{
+	glm::vec3	Origin;
+	int8_t		Exponent[3];
+	// Bit per slot, set for interior children
+	uint8_t		InnerMask;
+	// Interior children are stored back to back from ChildBase in slot order
+	uint32_t	ChildBase;
+	// Primitives of the leaf children follow each other from PrimBase in slot order
+	uint32_t	PrimBase;
+	// Leaf children: primitive count, 0 for interior children and unused slots
+	uint8_t		PrimCount[8];
+	uint8_t		QMin[3][8],
+				QMax[3][8];
+};
+static_assert(sizeof(BVH8Node) == 80, "BVH8Node is meant to stay 80 bytes");
+
+enum class BVHBuildQuality
+{
+	// Morton code order cut into a binary radix tree (Karras 2012), linear time for per frame rebuilds
+	Linear,
+	// Linear, then every node restructures the treelet of up to 7 subtrees below it for the lowest SAH cost (Karras and Aila 2013)
+	LinearTreelets,
+	// Top down binned SAH
+	SAH,
+};
+
+struct BVHBuildSettings
+{
+	// Builder, BinCount only applies to SAH builds
+	BVHBuildQuality	Quality		= BVHBuildQuality::SAH;
+	uint32_t	BinCount			= 16;
+	uint32_t	MaxLeafSize			= 4;
+	float		TraversalCost		= 1.f;
+	float		IntersectionCost	= 1.f;
+	// Primitives a leaf tests at once (SIMD width), leaves are charged per started batch
+	uint32_t	LeafBatchSize		= 1;
+	// Linear builds: 30 or 63 bit Morton codes, 63 bits keep more order in big scenes at twice the sort passes
+	uint32_t	MortonBits			= 30;
+	// 2 keeps the binary nodes, 8 collapses them into BVH8Nodes after the build. The wide layout is CPU only,
+	// it has no GetNodes and no TraversePacket.
+	uint32_t	Width				= 2;
+
+	inline float LeafCost(uint32_t primCount) const { return IntersectionCost * ((primCount + LeafBatchSize - 1) / LeafBatchSize); }
+};
+
+// Ray/AABB slab test, returns the entry distance or RT_FLOATMAX on a miss
+inline float IntersectAABB(const glm::vec3& bMin, const glm::vec3& bMax, const glm::vec3& origin, const glm::vec3& invDir, float tMin, float tMax)
+{
+	glm::vec3	t1 = (bMin - origin) * invDir,
+				t2 = (bMax - origin) * invDir;
+	float		tNear = std::max(std::max(std::min(t1.x, t2.x), std::min(t1.y, t2.y)), std::max(std::min(t1.z, t2.z), tMin)),
+				tFar = std::min(std::min(std::max(t1.x, t2.x), std::max(t1.y, t2.y)), std::min(std::max(t1.z, t2.z), tMax));
+	return tNear <= tFar ? tNear : RT_FLOATMAX;
+}
+
+// Slab test of the ray against the 8 child boxes of a wide node, on the quantized planes directly:
+// t = (Origin + q * scale - origin) * invDir = q * (scale * invDir) + (Origin - origin) * invDir.
+// Returns a bit per child that is hit, tEntry gets the entry distances.
+inline uint32_t IntersectBVH8Children(const BVH8Node& node, const glm::vec3& origin, const glm::vec3& invDir, float tMin, float tMax, float* tEntry)
+{
+	uint32_t usedMask = node.InnerMask;
+	for (uint32_t slot = 0; slot < 8; ++slot)
+		usedMask |= (node.PrimCount[slot] != 0) << slot;
+
+#if defined(__AVX2__)
+	__m256	tNear = _mm256_set1_ps(tMin),
+			tFar = _mm256_set1_ps(tMax);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float scale = std::bit_cast<float>(static_cast<uint32_t>(node.Exponent[axis] + 127) << 23);
+		const __m256	a = _mm256_set1_ps(scale * invDir[axis]),
+						b = _mm256_set1_ps((node.Origin[axis] - origin[axis]) * invDir[axis]);
+		const __m256	qMin = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.QMin[axis])))),
+						qMax = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.QMax[axis]))));
+		const __m256	t1 = _mm256_add_ps(_mm256_mul_ps(qMin, a), b),
+						t2 = _mm256_add_ps(_mm256_mul_ps(qMax, a), b);
+		tNear = _mm256_max_ps(tNear, _mm256_min_ps(t1, t2));
+		tFar = _mm256_min_ps(tFar, _mm256_max_ps(t1, t2));
+	}
+	_mm256_storeu_ps(tEntry, tNear);
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ))) & usedMask;
+#else
+	float a[3], b[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float scale = std::bit_cast<float>(static_cast<uint32_t>(node.Exponent[axis] + 127) << 23);
+		a[axis] = scale * invDir[axis];
+		b[axis] = (node.Origin[axis] - origin[axis]) * invDir[axis];
+	}
+	uint32_t hitMask = 0;
+	for (uint32_t slot = 0; slot < 8; ++slot)
+	{
+		float tNear = tMin, tFar = tMax;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float	t1 = node.QMin[axis][slot] * a[axis] + b[axis],
+						t2 = node.QMax[axis][slot] * a[axis] + b[axis];
+			tNear = std::max(tNear, std::min(t1, t2));
+			tFar = std::min(tFar, std::max(t1, t2));
+		}
+		tEntry[slot] = tNear;
+		hitMask |= (tNear <= tFar) << slot;
+	}
+	return hitMask & usedMask;
+#endif
+}
+
+// Binary BVH over primitive bounds, built top down with binned SAH or linearly from Morton codes (settings.Quality), optionally collapsed into an 8 wide one (settings.Width).
+// The BVH never touches the primitives themselves, GetPrimIndices maps leaf ranges back to the input order
+// and callers are expected to reorder their primitives with it so leaves index them directly.
+class BVH
+{
+public:
+	// With a pool the top levels are binned and partitioned in parallel and the subtrees below them are built as tasks of their own.
+	// The tree is the same with or without one, only the node order differs.
+	void Build(const std::vector<AABB>& primBounds, const BVHBuildSettings& settings = {}, ThreadPool* pool = nullptr);
+	void Clear();
+
+	inline bool								IsEmpty() const			{ return m_nodes.empty() && m_wideNodes.empty(); }
+	inline bool								IsWide() const			{ return !m_wideNodes.empty(); }
+	// Binary nodes, empty for wide BVHs
+	inline const std::vector<BVHNode>&		GetNodes() const		{ return m_nodes; }
+	inline const std::vector<BVH8Node>&		GetWideNodes() const	{ return m_wideNodes; }
+	inline const std::vector<uint32_t>&		GetPrimIndices() const	{ return m_primIndices; }
+	inline const BVHBuildSettings&			GetSettings() const		{ return m_settings; }
+	inline size_t							GetNodeCount() const	{ return IsWide() ? m_wideNodes.size() : m_nodes.size(); }
+	inline size_t							GetNodeBytes() const	{ return IsWide() ? m_wideNodes.size() * sizeof(BVH8Node) : m_nodes.size() * sizeof(BVHNode); }
+	inline AABB								GetBounds() const
+	{
+		if (IsWide())
+			return m_wideBounds;
+		return m_nodes.empty() ? AABB() : AABB{ m_nodes[0].Min, m_nodes[0].Max };
+	}
+
+	// Expected cost of a random ray relative to the root, in units of one intersection test
+	float SAHCost() const;
+
+	// Refits the node bounds to moved primitives in one bottom up pass over the nodes, the tree itself stays the same.
+	// slotBounds are in leaf order, slot i holds the input primitive GetPrimIndices()[i]. Returns the SAHCost of the refit tree.
+	// Refitting doesn't move primitives between nodes, so the cost grows as they drift away from where the tree was built for.
+	float Refit(const std::vector<AABB>& slotBounds);
+
+	// Closest hit traversal, leafFunc(firstPrim, primCount, tMax) tests a leaf range and shrinks tMax on a hit
+	template<typename LeafFunc>
+	bool Traverse(const Ray& ray, float tMin, float& tMax, LeafFunc&& leafFunc) const;
+
+	// Ranged packet traversal for packets whose rays share an octant (packet.SameOctant).
+	// Nodes are culled for the whole packet with the interval bounds, then only rays from the first one that
+	// hits the node are considered further down. leafFunc(leaf, firstRay) tests rays [firstRay, packet.Count)
+	// against the leaf node and updates packet.TMax/packet.Prim. Binary BVHs only.
+	template<typename LeafFunc>
+	void TraversePacket(RayPacket& packet, LeafFunc&& leafFunc) const;
+
+private:
+	void BuildSAH(const std::vector<AABB>& primBounds, const std::vector<glm::vec3>& centroids, ThreadPool* pool);
+	void BuildLinear(const std::vector<AABB>& primBounds, const std::vector<glm::vec3>& centroids, ThreadPool* pool);
+	// Bottom up treelet restructuring of the bounded binary nodes, lays the nodes out depth first again afterwards
+	void OptimizeTreelets();
+
+	// Turns the binary nodes into BVH8Nodes, opening the child with the largest area until 8 slots are taken.
+	// Leaves keep their primitives but get re-laid out so the leaf children of a wide node are contiguous.
+	void Collapse(const std::vector<AABB>& primBounds);
+	float RefitWide(const std::vector<AABB>& slotBounds);
+
+	template<typename LeafFunc>
+	bool TraverseWide(const Ray& ray, float tMin, float& tMax, LeafFunc&& leafFunc) const;
+
+private:
+	std::vector<BVHNode>	m_nodes;
+	std::vector<BVH8Node>	m_wideNodes;
+	AABB					m_wideBounds;
+	std::vector<uint32_t>	m_primIndices;
+	BVHBuildSettings		m_settings;
+};
+
+// Full build on a thread of its own, so the caller keeps tracing with its current BVH meanwhile.
+// The finished BVH is published through an atomic flag and taken over with Take.
+class BVHBuildJob
+{
+public:
+	BVHBuildJob() = default;
+	~BVHBuildJob();
+
+	BVHBuildJob(const BVHBuildJob&) = delete;
+	BVHBuildJob& operator=(const BVHBuildJob&) = delete;
+
+	void Start(std::vector<AABB> primBounds, const BVHBuildSettings& settings);
+
+	inline bool IsRunning() const	{ return m_thread.joinable(); }
+	inline bool IsDone() const		{ return m_done.load(std::memory_order_acquire); }
+	// SAH cost of the finished BVH, valid once IsDone
+	inline float GetSAHCost() const	{ return m_sahCost; }
+
+	// Waits for the build and hands the BVH over
+	BVH Take();
+
+private:
+	std::thread			m_thread;
+	std::atomic<bool>	m_done = false;
+	BVH					m_result;
+	float				m_sahCost = 0.f;
+};
+
+template<typename LeafFunc>
+bool BVH::Traverse(const Ray& ray, float tMin, float& tMax, LeafFunc&& leafFunc) const
+{
+	if (IsWide())
+		return TraverseWide(ray, tMin, tMax, leafFunc);
+	if (m_nodes.empty())
+		return false;
+
+	const glm::vec3 invDir = 1.f / ray.Direction;
+	const BVHNode* nodes = m_nodes.data();
+	if (IntersectAABB(nodes[0].Min, nodes[0].Max, ray.Origin, invDir, tMin, tMax) == RT_FLOATMAX)
+		return false;
+
+	bool hit = false;
+	uint32_t	stack[64];
+	float		stackDist[64];
+	uint32_t	stackSize = 0;
+	const BVHNode* node = nodes;
+	while (true)
+	{
+		if (node->IsLeaf())
+		{
+			hit |= leafFunc(node->LeftFirst, node->PrimCount, tMax);
+		}
+		else
+		{
+			// Visit the closer child first, push the other one if it was hit too
+			uint32_t	left = node->LeftFirst,
+						right = left + 1;
+			float		tLeft = IntersectAABB(nodes[left].Min, nodes[left].Max, ray.Origin, invDir, tMin, tMax),
+						tRight = IntersectAABB(nodes[right].Min, nodes[right].Max, ray.Origin, invDir, tMin, tMax);
+			if (tLeft > tRight)
+			{
+				std::swap(tLeft, tRight);
+				std::swap(left, right);
+			}
+			if (tLeft != RT_FLOATMAX)
+			{
+				if (tRight != RT_FLOATMAX)
+				{
+					stack[stackSize] = right;
+					stackDist[stackSize++] = tRight;
+				}
+				node = nodes + left;
+				continue;
+			}
+		}
+
+		// Pop until a node that is still closer than the closest hit shows up
+		node = nullptr;
+		while (stackSize > 0)
+		{
+			--stackSize;
+			if (stackDist[stackSize] < tMax)
+			{
+				node = nodes + stack[stackSize];
+				break;
+			}
+		}
+		if (!node)
+			break;
+	}
+	return hit;
+}
+
+template<typename LeafFunc>
+bool BVH::TraverseWide(const Ray& ray, float tMin, float& tMax, LeafFunc&& leafFunc) const
+{
+	const glm::vec3 invDir = 1.f / ray.Direction;
+	if (IntersectAABB(m_wideBounds.Min, m_wideBounds.Max, ray.Origin, invDir, tMin, tMax) == RT_FLOATMAX)
+		return false;
+
+	// Leaf children go on the stack too, so they are tested in distance order with the nodes
+	struct StackEntry
+	{
+		uint32_t	Index;
+		// 0 for wide nodes, otherwise Index is the first primitive of a leaf
+		uint32_t	PrimCount;
+		float		Dist;
+	};
+
+	const BVH8Node* nodes = m_wideNodes.data();
+	StackEntry stack[8 * 64];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0, tMin };
+
+	bool hit = false;
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		if (!(entry.Dist < tMax))
+			continue;
+		if (entry.PrimCount > 0)
+		{
+			hit |= leafFunc(entry.Index, entry.PrimCount, tMax);
+			continue;
+		}
+
+		const BVH8Node& node = nodes[entry.Index];
+		float tEntry[8];
+		uint32_t hitMask = IntersectBVH8Children(node, ray.Origin, invDir, tMin, tMax, tEntry);
+		if (!hitMask)
+			continue;
+
+		// Push far to near so the closest child is popped first
+		uint32_t	childIndex = node.ChildBase,
+					primIndex = node.PrimBase;
+		const uint32_t firstPushed = stackSize;
+		for (uint32_t slot = 0; slot < 8; ++slot)
+		{
+			const bool inner = node.InnerMask >> slot & 1;
+			if (hitMask >> slot & 1)
+			{
+				StackEntry child = inner ? StackEntry{ childIndex, 0, tEntry[slot] } : StackEntry{ primIndex, node.PrimCount[slot], tEntry[slot] };
+				uint32_t i = stackSize++;
+				for (; i > firstPushed && stack[i - 1].Dist < child.Dist; --i)
+					stack[i] = stack[i - 1];
+				stack[i] = child;
+			}
+			childIndex += inner;
+			primIndex += node.PrimCount[slot];
+		}
+	}
+	return hit;
+}
+
+template<typename LeafFunc>
+void BVH::TraversePacket(RayPacket& packet, LeafFunc&& leafFunc) const
+{
+	if (m_nodes.empty() || packet.Count == 0)
+		return;
+
+	struct StackEntry
+	{
+		uint32_t Node;
+		uint32_t FirstRay;
+	};
+
+	const BVHNode* nodes = m_nodes.data();
+	StackEntry stack[128];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0 };
+
+	// Packet direction, used to order children front to back
+	const glm::vec3 packetDir(packet.DX[0], packet.DY[0], packet.DZ[0]);
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		const BVHNode& node = nodes[entry.Node];
+
+		if (!packet.IntervalHitsAABB(node.Min, node.Max, packet.MaxTMax()))
+			continue;
+
+		// First ray that actually hits the node, rays before it can skip the whole subtree
+		uint32_t firstRay = entry.FirstRay;
+		while (firstRay < packet.Count && !packet.RayHitsAABB(firstRay, node.Min, node.Max))
+			++firstRay;
+		if (firstRay == packet.Count)
+			continue;
+
+		if (node.IsLeaf())
+		{
+			leafFunc(node, firstRay);
+			continue;
+		}
+
+		uint32_t	nearChild = node.LeftFirst,
+					farChild = nearChild + 1;
+		const BVHNode& l = nodes[nearChild];
+		const BVHNode& r = nodes[farChild];
+		if (glm::dot((r.Min + r.Max) - (l.Min + l.Max), packetDir) < 0.f)
+			std::swap(nearChild, farChild);
+
+		stack[stackSize++] = { farChild, firstRay };
+		stack[stackSize++] = { nearChild, firstRay };
+	}
+}
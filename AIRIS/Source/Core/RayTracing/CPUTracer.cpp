@@ -0,0 +1,450 @@
+#include "CPUTracer.hpp"
+#include "RTShading.hpp"
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	// Relative error of pixels darker than this is measured against it, near black pixels would never converge otherwise
+	constexpr float s_errorLuminanceFloor = 0.01f;
+	// Samples a pixel needs before its own variance steers the denoiser
+	constexpr uint32_t s_denoiserMinSamples = 4;
+	// Bilinear weight of the valid history pixels below which a pixel counts as disoccluded
+	constexpr float s_minHistoryWeight = 0.05f;
+
+	// Bounces [firstBounce, MaxRayBounces], a fresh camera ray starts at bounce 0 with an empty path
+	// firstHit, when given, gets the AOVSample of the camera ray
+	glm::vec3 TraceRay(Ray ray, const RTScene& scene, const RTConstants& constants, PathSampler& sampler, uint64_t& rayCount, uint32_t firstBounce = 0, PathState path = PathState(), AOVSample* firstHit = nullptr)
+	{
+		HitRecord hitRec;
+		for (uint32_t i = firstBounce; i < constants.MaxRayBounces + 1; ++i)
+		{
+			++rayCount;
+			if (!scene.Hit(ray, 0.01f, RT_FLOATMAX, hitRec))
+			{
+				path.Radiance += path.Throughput * SkyColor(ray);
+				break;
+			}
+			if (firstHit && i == 0)
+				*firstHit = MakeAOVSample(hitRec, scene.GetMaterials());
+			if (!ShadeHit(scene, constants, i, hitRec, ray, path, sampler, rayCount))
+				break;
+		}
+		return path.Radiance;
+	}
+
+	// Per pixel path state of a packet
+	struct PacketLane
+	{
+		PathSampler	Sampler;
+		Ray			PathRay;
+		PathState	Path;
+		AOVSample	FirstHit;
+		size_t		Pixel = 0;
+		bool		Alive = true;
+	};
+}
+
+CPUTracer::CPUTracer(uint32_t width, uint32_t height, uint32_t threadCount)
+	:m_width(0), m_height(0), m_threadPool(threadCount)
+{
+	m_threadStats.resize(m_threadPool.GetThreadCount());
+	Resize(width, height);
+}
+
+void CPUTracer::Resize(uint32_t width, uint32_t height)
+{
+	m_width = width;
+	m_height = height;
+	m_output.assign(static_cast<size_t>(width) * height, glm::vec4(0.f));
+	m_accumulated.assign(static_cast<size_t>(width) * height, glm::vec4(0.f));
+	m_pixelStats.assign(static_cast<size_t>(width) * height, PixelStats());
+	m_convergedPixels = 0;
+	m_hasHistory = false;
+	m_denoiser.Resize(width, height);
+	ConfigureAOVs();
+}
+
+void CPUTracer::SetDenoiser(const DenoiserSettings& settings)
+{
+	m_denoiser.SetSettings(settings);
+	ConfigureAOVs();
+}
+
+void CPUTracer::ResolveDisplay(std::vector<uint32_t>& rgba8)
+{
+	auto start = std::chrono::steady_clock::now();
+	rgba8.resize(m_accumulated.size());
+	if (m_denoiser.GetSettings().Enabled)
+		m_display.ResolveOutput(m_threadPool, m_output.data(), m_output.size(), rgba8.data());
+	else
+		m_display.ResolveAccumulated(m_threadPool, m_accumulated.data(), m_accumulated.size(), rgba8.data());
+	m_displaySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CPUTracer::SetAOVs(uint32_t flags)
+{
+	m_aovFlags = flags & AOVAll;
+	ConfigureAOVs();
+}
+
+void CPUTracer::SetTemporalReprojection(const TemporalReprojectionSettings& settings)
+{
+	m_temporal = settings;
+	ConfigureAOVs();
+}
+
+void CPUTracer::ConfigureAOVs()
+{
+	uint32_t flags = m_aovFlags | (m_denoiser.GetSettings().Enabled ? AOVAlbedo | AOVNormal | AOVDepth : AOVNone);
+	if (m_temporal.Enabled)
+		flags |= AOVDepth;
+	if (flags != m_aovs.GetFlags())
+		m_hasHistory = false;
+	m_aovs.Configure(flags, m_width, m_height);
+	m_wavefront.SetFirstHitRecording((flags & AOVFirstHit) != 0);
+}
+
+void CPUTracer::Dispatch(const RTScene& scene, const RTCameraSD& camera, const RTConstants& frameConstants)
+{
+	// A reset with a camera move reprojects the history, the sample index continues after it
+	const bool reproject = m_temporal.Enabled && m_hasHistory && frameConstants.ResetOutput && memcmp(&camera, &m_previousCamera, sizeof(RTCameraSD)) != 0;
+	if (frameConstants.ResetOutput)
+		m_sampleOffset = reproject ? m_lastSampleIndex : 0;
+	RTConstants constants = frameConstants;
+	constants.AccumulatedSamples += m_sampleOffset;
+	m_lastSampleIndex = constants.AccumulatedSamples;
+
+	m_skipConverged = m_adaptive.Enabled && constants.AccumlateSamples && !constants.ResetOutput;
+	m_activePixelCount = m_width * m_height - (m_skipConverged ? GetConvergedPixelCount() : 0);
+
+	// The history has to be put aside before the reset overwrites it
+	if (reproject)
+	{
+		m_historyAccumulated = m_accumulated;
+		m_historyStats = m_pixelStats;
+		m_historyDepth.resize(m_accumulated.size());
+		for (size_t pixel = 0; pixel < m_historyDepth.size(); ++pixel)
+			m_historyDepth[pixel] = m_aovs.GetDepth(pixel);
+	}
+
+	switch (m_traceMode)
+	{
+	case RTTraceMode::Packets:		DispatchPackets(scene, camera, constants); break;
+	case RTTraceMode::Wavefront:	DispatchWavefront(scene, camera, constants); break;
+	default:						DispatchTiles(scene, camera, constants); break;
+	}
+
+	if (reproject)
+		Reproject(m_previousCamera, camera);
+	m_previousCamera = camera;
+	m_hasHistory = m_temporal.Enabled;
+
+	if (m_denoiser.GetSettings().Enabled)
+	{
+		m_denoiser.Denoise(m_threadPool, [&](size_t pixel)
+		{
+			// Few samples give a variance too noisy to steer the filter, the denoiser estimates it from the neighbours then
+			const PixelStats& stats = m_pixelStats[pixel];
+			const float variance = stats.Samples >= s_denoiserMinSamples ? stats.M2 / static_cast<float>((stats.Samples - 1) * stats.Samples) : -1.f;
+			return DenoiserInput{ glm::vec3(m_accumulated[pixel]) / static_cast<float>(GetSampleCount(pixel, constants)), variance,
+				m_aovs.GetAlbedo(pixel), m_aovs.GetNormal(pixel), m_aovs.GetDepth(pixel) };
+		}, m_output);
+	}
+}
+
+void CPUTracer::AccumulateSample(size_t pixel, const glm::vec4& rayColor, const AOVSample& firstHit, const RTConstants& constants)
+{
+	PixelStats& stats = m_pixelStats[pixel];
+	if (constants.ResetOutput)
+	{
+		m_accumulated[pixel] = rayColor;
+		stats.Mean = stats.M2 = 0.f;
+		stats.Samples = 0;
+		UpdatePixelStats(stats, glm::vec3(rayColor));
+	}
+	else if (constants.AccumlateSamples)
+	{
+		m_accumulated[pixel] += rayColor;
+		UpdatePixelStats(stats, glm::vec3(rayColor));
+	}
+
+	m_output[pixel] = glm::sqrt(m_accumulated[pixel] / static_cast<float>(GetSampleCount(pixel, constants)));
+	if (m_aovs.GetFlags() != AOVNone && (constants.ResetOutput || constants.AccumlateSamples))
+		m_aovs.Accumulate(pixel, firstHit, GetSampleCount(pixel, constants), constants.ResetOutput);
+}
+
+void CPUTracer::Reproject(const RTCameraSD& previous, const RTCameraSD& current)
+{
+	auto start = std::chrono::steady_clock::now();
+	const uint32_t w = m_width, h = m_height;
+
+	// The previous image plane, pixel centres sit at whole multiples of the deltas from Pixel00Center
+	const glm::vec3 planeNormal = glm::cross(previous.PixelDeltaX, previous.PixelDeltaY);
+	const glm::vec3 toPlane = previous.Pixel00Center - previous.Position;
+	const float planeDistance = glm::dot(toPlane, planeNormal);
+	const glm::vec3 invDeltaX = previous.PixelDeltaX / glm::dot(previous.PixelDeltaX, previous.PixelDeltaX),
+					invDeltaY = previous.PixelDeltaY / glm::dot(previous.PixelDeltaY, previous.PixelDeltaY);
+
+	// m_output holds the new accumulation until it is swapped in, the clamp still reads the traced samples around each pixel
+	std::atomic<uint32_t> reprojected = 0;
+	m_threadPool.ParallelFor(h, [&](uint32_t y, uint32_t threadIndex)
+	{
+		uint32_t rowReprojected = 0;
+		for (uint32_t x = 0; x < w; ++x)
+		{
+			const size_t pixel = static_cast<size_t>(y) * w + x;
+			const glm::vec4 sample = m_accumulated[pixel];
+			m_output[pixel] = sample;
+
+			// Surface seen through the pixel centre at the depth just traced, and where the previous camera saw it
+			const glm::vec3 direction = glm::normalize(current.Pixel00Center + static_cast<float>(x) * current.PixelDeltaX + static_cast<float>(y) * current.PixelDeltaY - current.Position);
+			const glm::vec3 toSurface = direction * m_aovs.GetDepth(pixel) + current.Position - previous.Position;
+			const float along = glm::dot(toSurface, planeNormal);
+			if (!(along * planeDistance > 0.f))
+				continue;
+			const glm::vec3 onPlane = toSurface * (planeDistance / along) - toPlane;
+			const float u = glm::dot(onPlane, invDeltaX), v = glm::dot(onPlane, invDeltaY);
+			if (!(u > -1.f && v > -1.f && u < static_cast<float>(w) && v < static_cast<float>(h)))
+				continue;
+
+			// Bilinear over the history pixels that saw the same surface, the others are disoccluded
+			const float distance = glm::length(toSurface);
+			const int32_t x0 = static_cast<int32_t>(std::floor(u)), y0 = static_cast<int32_t>(std::floor(v));
+			const float fx = u - static_cast<float>(x0), fy = v - static_cast<float>(y0);
+			glm::vec3 historyMean(0.f);
+			float historyCount = 0.f, historyVariance = 0.f, weightSum = 0.f;
+			for (int32_t tap = 0; tap < 4; ++tap)
+			{
+				const int32_t tx = x0 + (tap & 1), ty = y0 + (tap >> 1);
+				const float weight = (tap & 1 ? fx : 1.f - fx) * (tap >> 1 ? fy : 1.f - fy);
+				if (tx < 0 || ty < 0 || tx >= static_cast<int32_t>(w) || ty >= static_cast<int32_t>(h) || weight <= 0.f)
+					continue;
+				const size_t tapPixel = static_cast<size_t>(ty) * w + tx;
+				if (std::abs(m_historyDepth[tapPixel] - distance) > m_temporal.DepthTolerance * distance)
+					continue;
+				const PixelStats& stats = m_historyStats[tapPixel];
+				const float samples = static_cast<float>(std::max(stats.Samples, 1u));
+				const glm::vec3 mean = glm::vec3(m_historyAccumulated[tapPixel]) / samples;
+				if (!std::isfinite(mean.x + mean.y + mean.z))
+					continue;
+				historyMean += weight * mean;
+				historyCount += weight * samples;
+				historyVariance += weight * (stats.Samples > 1 ? stats.M2 / (samples - 1.f) : 0.f);
+				weightSum += weight;
+			}
+			if (weightSum < s_minHistoryWeight)
+				continue;
+			historyMean /= weightSum;
+			const uint32_t historySamples = std::min(static_cast<uint32_t>(historyCount / weightSum + 0.5f), m_temporal.MaxHistorySamples);
+			if (historySamples == 0)
+				continue;
+
+			// Keeps lighting that changed with the view, like reflections, from ghosting
+			glm::vec3 sum(0.f), sumSq(0.f);
+			float count = 0.f;
+			for (uint32_t ty = y > 0 ? y - 1 : 0; ty <= std::min(y + 1, h - 1); ++ty)
+			{
+				for (uint32_t tx = x > 0 ? x - 1 : 0; tx <= std::min(x + 1, w - 1); ++tx)
+				{
+					const glm::vec3 neighbour(m_accumulated[static_cast<size_t>(ty) * w + tx]);
+					if (!std::isfinite(neighbour.x + neighbour.y + neighbour.z))
+						continue;
+					sum += neighbour;
+					sumSq += neighbour * neighbour;
+					count += 1.f;
+				}
+			}
+			if (count > 0.f)
+			{
+				const glm::vec3 mean = sum / count;
+				const glm::vec3 sigma = glm::sqrt(glm::max(sumSq / count - mean * mean, glm::vec3(0.f)));
+				historyMean = glm::clamp(historyMean, mean - m_temporal.ClampSigma * sigma, mean + m_temporal.ClampSigma * sigma);
+			}
+
+			const glm::vec4 accumulated = sample + glm::vec4(historyMean, 1.f) * static_cast<float>(historySamples);
+			PixelStats& stats = m_pixelStats[pixel];
+			stats.Samples = historySamples + 1;
+			stats.Mean = glm::dot(glm::vec3(accumulated) / static_cast<float>(stats.Samples), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+			stats.M2 = historyVariance / weightSum * static_cast<float>(historySamples);
+			m_output[pixel] = accumulated;
+			++rowReprojected;
+		}
+		reprojected += rowReprojected;
+	});
+
+	std::swap(m_accumulated, m_output);
+	m_threadPool.ParallelFor(h, [&](uint32_t y, uint32_t threadIndex)
+	{
+		for (size_t pixel = static_cast<size_t>(y) * w; pixel < static_cast<size_t>(y + 1) * w; ++pixel)
+			m_output[pixel] = glm::sqrt(m_accumulated[pixel] / static_cast<float>(std::max(m_pixelStats[pixel].Samples, 1u)));
+	});
+
+	m_reprojectedFraction = static_cast<float>(reprojected.load()) / static_cast<float>(static_cast<size_t>(w) * h);
+	m_reprojectionSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CPUTracer::UpdatePixelStats(PixelStats& stats, const glm::vec3& color)
+{
+	const float luminance = glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	++stats.Samples;
+	float delta = luminance - stats.Mean;
+	stats.Mean += delta / stats.Samples;
+	stats.M2 += delta * (luminance - stats.Mean);
+
+	bool converged = false;
+	if (m_adaptive.Enabled && stats.Samples >= std::max(m_adaptive.MinSamples, 2u))
+	{
+		float standardError = sqrtf(stats.M2 / ((stats.Samples - 1) * stats.Samples));
+		converged = standardError <= m_adaptive.Threshold * std::max(stats.Mean, s_errorLuminanceFloor);
+	}
+
+	if (converged != static_cast<bool>(stats.Converged))
+	{
+		stats.Converged = converged;
+		if (converged)
+			++m_convergedPixels;
+		else
+			--m_convergedPixels;
+	}
+}
+
+void CPUTracer::DispatchTiles(const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants)
+{
+	const uint32_t w = m_width;
+	const bool recordFirstHit = (m_aovs.GetFlags() & AOVFirstHit) != 0;
+
+	m_tiles.Run(m_threadPool, m_width, m_height, m_tiles.GetSettings().Size, [&](const Tile& tile, uint32_t threadIndex)
+	{
+		uint64_t rayCount = 0;
+		for (uint32_t y = tile.Y; y < tile.Y + tile.Height; ++y)
+		{
+			for (uint32_t x = tile.X; x < tile.X + tile.Width; ++x)
+			{
+				if (SkipPixel(static_cast<size_t>(y) * w + x))
+					continue;
+
+				// Initilize the sampler the same way the shader does
+				PathSampler sampler(constants, x, y, w);
+
+				Ray r = GetRay(static_cast<float>(x), static_cast<float>(y), camera, sampler);
+				AOVSample firstHit;
+				glm::vec4 rayColor(TraceRay(r, scene, constants, sampler, rayCount, 0, PathState(), recordFirstHit ? &firstHit : nullptr), 1.f);
+				AccumulateSample(static_cast<size_t>(y) * w + x, rayColor, firstHit, constants);
+			}
+		}
+		m_threadStats[threadIndex].Rays += rayCount;
+	});
+}
+
+void CPUTracer::DispatchPackets(const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants)
+{
+	const uint32_t	w = m_width,
+					tileSize = (std::max(m_tiles.GetSettings().Size, 1u) + RT_PACKET_DIM - 1) / RT_PACKET_DIM * RT_PACKET_DIM;
+	// Camera rays and the first bounce are coherent enough for packets
+	const uint32_t	packetBounces = std::min(2u, constants.MaxRayBounces + 1);
+	const bool		recordFirstHit = (m_aovs.GetFlags() & AOVFirstHit) != 0;
+
+	// Scheduler tiles are whole packets, traced one packet at a time
+	m_tiles.Run(m_threadPool, m_width, m_height, tileSize, [&](const Tile& tile, uint32_t threadIndex)
+	{
+		uint64_t rayCount = 0;
+		for (uint32_t y0 = tile.Y; y0 < tile.Y + tile.Height; y0 += RT_PACKET_DIM)
+		{
+			for (uint32_t x0 = tile.X; x0 < tile.X + tile.Width; x0 += RT_PACKET_DIM)
+			{
+				PacketLane lanes[RT_PACKET_SIZE];
+				uint32_t laneCount = 0;
+				for (uint32_t y = y0; y < std::min(y0 + RT_PACKET_DIM, tile.Y + tile.Height); ++y)
+				{
+					for (uint32_t x = x0; x < std::min(x0 + RT_PACKET_DIM, tile.X + tile.Width); ++x)
+					{
+						if (SkipPixel(static_cast<size_t>(y) * w + x))
+							continue;
+
+						PacketLane& lane = lanes[laneCount++];
+						lane.Sampler = PathSampler(constants, x, y, w);
+						lane.PathRay = GetRay(static_cast<float>(x), static_cast<float>(y), camera, lane.Sampler);
+						lane.Pixel = static_cast<size_t>(y) * w + x;
+					}
+				}
+
+				RayPacket packet;
+				HitRecord recs[RT_PACKET_SIZE];
+				uint32_t packetLanes[RT_PACKET_SIZE];
+				for (uint32_t bounce = 0; bounce < packetBounces; ++bounce)
+				{
+					// Compact the paths that are still going into the packet
+					packet.Clear();
+					for (uint32_t i = 0; i < laneCount; ++i)
+					{
+						if (!lanes[i].Alive)
+							continue;
+						packetLanes[packet.Count] = i;
+						packet.Add(lanes[i].PathRay);
+					}
+					if (packet.Count == 0)
+						break;
+					packet.Finalize();
+					rayCount += packet.Count;
+
+					uint64_t hitMask = scene.HitPacket(packet, recs);
+					for (uint32_t i = 0; i < packet.Count; ++i)
+					{
+						PacketLane& lane = lanes[packetLanes[i]];
+						if (hitMask & (1ull << i))
+						{
+							if (bounce == 0 && recordFirstHit)
+								lane.FirstHit = MakeAOVSample(recs[i], scene.GetMaterials());
+							lane.Alive = ShadeHit(scene, constants, bounce, recs[i], lane.PathRay, lane.Path, lane.Sampler, rayCount);
+							continue;
+						}
+						lane.Path.Radiance += lane.Path.Throughput * SkyColor(lane.PathRay);
+						lane.Alive = false;
+					}
+				}
+
+				// Diverged, finish the remaining bounces one ray at a time
+				for (uint32_t i = 0; i < laneCount; ++i)
+				{
+					PacketLane& lane = lanes[i];
+					glm::vec3 color = lane.Alive ? TraceRay(lane.PathRay, scene, constants, lane.Sampler, rayCount, packetBounces, lane.Path) : lane.Path.Radiance;
+					AccumulateSample(lane.Pixel, glm::vec4(color, 1.f), lane.FirstHit, constants);
+				}
+			}
+		}
+		m_threadStats[threadIndex].Rays += rayCount;
+	});
+}
+
+void CPUTracer::DispatchWavefront(const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants)
+{
+	// The pipeline generates paths from a pixel list, adaptive sampling leaves the converged pixels out of it
+	m_activePixels.resize(static_cast<size_t>(m_width) * m_height);
+	uint32_t activeCount = 0;
+	for (uint32_t pixel = 0; pixel < m_width * m_height; ++pixel)
+	{
+		if (!SkipPixel(pixel))
+			m_activePixels[activeCount++] = pixel;
+	}
+
+	m_wavefront.Trace(m_threadPool, scene, camera, constants, m_width, m_activePixels.data(), activeCount, [&](uint32_t pixel, const glm::vec3& color, const AOVSample& firstHit)
+	{
+		AccumulateSample(pixel, glm::vec4(color, 1.f), firstHit, constants);
+	});
+}
+
+uint64_t CPUTracer::GetRayCount() const
+{
+	uint64_t rays = m_wavefront.GetStats().Rays;
+	for (const ThreadStats& stats : m_threadStats)
+		rays += stats.Rays;
+	return rays;
+}
+
+void CPUTracer::ResetStats()
+{
+	for (ThreadStats& stats : m_threadStats)
+		stats.Rays = 0;
+	m_wavefront.ResetStats();
+}
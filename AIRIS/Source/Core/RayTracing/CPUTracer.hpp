@@ -0,0 +1,190 @@
+#pragma once
+#include "Core/Graphics/Camera.hpp"
+#include "Core/Graphics/RTHelper.hpp"
+#include "AOV.hpp"
+#include "RTCommon.hpp"
+#include "Denoiser.hpp"
+#include "DisplayTransform.hpp"
+#include "RTScene.hpp"
+#include "Sampler.hpp"
+#include "ThreadPool.hpp"
+#include "TileScheduler.hpp"
+#include "Wavefront.hpp"
+#include "Util.hpp"
+
+enum class RTTraceMode
+{
+	// One path per pixel at a time, the loop of the shader
+	Megakernel,
+	// Camera rays and first bounces as 8x8 packets, paths continue one ray at a time afterwards
+	Packets,
+	// Batched stages over every path of the frame with per material shading queues, see WavefrontPipeline
+	Wavefront,
+};
+
+// Running statistics of one pixel, Welford's online mean and variance of the sample luminance
+struct PixelStats
+{
+	float		Mean = 0.f,
+				M2 = 0.f;
+	uint32_t	Samples = 0,
+				Converged = false; // bool
+};
+
+struct AdaptiveSamplingSettings
+{
+	bool		Enabled = false;
+	// A pixel stops receiving samples once the standard error of its mean, relative to the mean, drops below this
+	float		Threshold = 0.01f;
+	// Samples a pixel needs before its error estimate is trusted
+	uint32_t	MinSamples = 16;
+};
+
+// Carries the accumulated samples over camera moves instead of starting from noise.
+// A dispatch that resets the output with a camera other than the last one traces its sample into the new view,
+// then adds the previous accumulation found at the same surface. The sample index carries on past the history, so the sampler does not
+// repeat the samples it is blended with. Resets with an unchanged camera still drop the history
+struct TemporalReprojectionSettings
+{
+	bool		Enabled = false;
+	// A history pixel only counts while its depth is within this fraction of the distance to the reprojected surface
+	float		DepthTolerance = 0.05f;
+	// The history mean is clamped to the mean of the new samples around the pixel, give or take this many standard deviations
+	float		ClampSigma = 1.f;
+	// Reprojected samples count at most this many, so lighting that changed with the view keeps fading in during long moves
+	uint32_t	MaxHistorySamples = 64;
+};
+
+// Multithreaded CPU port of the CS entry point in rtiaw.hlsl.
+// Every Dispatch traces one sample per pixel, and applies the same accumulate/reset rules as the shader,
+// so the output converges to the same image as the compute shader does.
+// Pixels are traced in tiles handed out by a work stealing TileScheduler instead of the 256 wide thread groups of rows.
+// With adaptive sampling on, accumulating dispatches skip converged pixels and each pixel is resolved with its own sample count.
+// With the denoiser on, the output is the filtered mean radiance instead.
+// AOVs are recorded from the first hit the trace loops already compute, no ray is traced for them.
+// With temporal reprojection on, pixels keep their own sample counts like with adaptive sampling.
+class CPUTracer
+{
+public:
+	CPUTracer(uint32_t width, uint32_t height, uint32_t threadCount = 0);
+
+	void Resize(uint32_t width, uint32_t height);
+
+	// One compute dispatch worth of work, constants.AccumulatedSamples must already include this sample
+	void Dispatch(const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants);
+
+	inline void					SetTraceMode(RTTraceMode mode)	{ m_traceMode = mode; }
+	inline RTTraceMode			GetTraceMode() const			{ return m_traceMode; }
+	// Per stage timings of RTTraceMode::Wavefront
+	inline const WavefrontStats&	GetWavefrontStats() const	{ return m_wavefront.GetStats(); }
+	// Bins secondary rays before each bounce of RTTraceMode::Wavefront, see WavefrontPipeline::Reorder
+	inline void						SetRayReordering(bool enabled)	{ m_wavefront.SetRayReordering(enabled); }
+	// Tiles of RTTraceMode::Megakernel and RTTraceMode::Packets, the wavefront stages split their queues by themselves
+	inline void						SetTiles(const TileSettings& settings)	{ m_tiles.SetSettings(settings); }
+	inline const TileScheduler&		GetTileScheduler() const				{ return m_tiles; }
+
+	inline void								SetAdaptiveSampling(const AdaptiveSamplingSettings& settings)	{ m_adaptive = settings; }
+	inline const AdaptiveSamplingSettings&	GetAdaptiveSampling() const										{ return m_adaptive; }
+	inline const std::vector<PixelStats>&	GetPixelStats() const											{ return m_pixelStats; }
+	// Pixels the last Dispatch traced
+	inline uint32_t							GetActivePixelCount() const										{ return m_activePixelCount; }
+	inline uint32_t							GetConvergedPixelCount() const									{ return m_convergedPixels.load(); }
+	inline bool								IsConverged() const												{ return GetConvergedPixelCount() == m_width * m_height; }
+
+	// Takes effect on the next camera move, needs the depth AOV which it turns on
+	void										SetTemporalReprojection(const TemporalReprojectionSettings& settings);
+	inline const TemporalReprojectionSettings&	GetTemporalReprojection() const	{ return m_temporal; }
+	// Share of the pixels the last reprojection found history for, and the seconds it took
+	inline float								GetReprojectedFraction() const	{ return m_reprojectedFraction; }
+	inline double								GetReprojectionSeconds() const	{ return m_reprojectionSeconds; }
+
+	// Filters the output of every Dispatch, guided by the albedo, normal and depth AOVs it turns on
+	void									SetDenoiser(const DenoiserSettings& settings);
+	inline const Denoiser&					GetDenoiser() const												{ return m_denoiser; }
+
+	// AOVFlags written next to the output, they fill in from the next dispatch that resets the output
+	void									SetAOVs(uint32_t flags);
+	inline uint32_t							GetAOVs() const													{ return m_aovFlags; }
+	// May hold more AOVs than were asked for, the denoiser's
+	inline const AOVBuffer&					GetAOVBuffer() const											{ return m_aovs; }
+
+	inline uint32_t							GetWidth() const		{ return m_width; }
+	inline uint32_t							GetHeight() const		{ return m_height; }
+	inline uint32_t							GetThreadCount() const	{ return m_threadPool.GetThreadCount(); }
+	// For other parallel work between dispatches, like BVH builds
+	inline ThreadPool&						GetThreadPool()			{ return m_threadPool; }
+	// sqrt(Accumulated / AccumulatedSamples), same as OutputTex
+	inline const std::vector<glm::vec4>&	GetOutput() const		{ return m_output; }
+	inline const std::vector<glm::vec4>&	GetAccumulated() const	{ return m_accumulated; }
+
+	inline void								SetDisplay(const DisplaySettings& settings)	{ m_display.SetSettings(settings); }
+	inline const DisplayTransform&			GetDisplay() const							{ return m_display; }
+	// Exposure, tone curve and sRGB encode of the current image to RGBA8, from the denoised output when the denoiser is on
+	void									ResolveDisplay(std::vector<uint32_t>& rgba8);
+	inline double							GetDisplaySeconds() const	{ return m_displaySeconds; }
+
+	// Rays cast (camera and bounce rays) since the last ResetStats
+	uint64_t GetRayCount() const;
+	void ResetStats();
+
+private:
+	void DispatchTiles(const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants);
+	void DispatchPackets(const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants);
+	void DispatchWavefront(const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants);
+	void AccumulateSample(size_t pixel, const glm::vec4& rayColor, const AOVSample& firstHit, const RTConstants& constants);
+	void ConfigureAOVs();
+	// Adds the history buffers, seen from previous, to the samples the reset dispatch just traced from current
+	void Reproject(const RTCameraSD& previous, const RTCameraSD& current);
+	// Samples m_accumulated[pixel] is the sum of
+	inline uint32_t GetSampleCount(size_t pixel, const RTConstants& constants) const { return m_adaptive.Enabled || m_temporal.Enabled ? std::max(m_pixelStats[pixel].Samples, 1u) : constants.AccumulatedSamples; }
+	// Converged pixels are only skipped while samples keep accumulating
+	inline bool SkipPixel(size_t pixel) const { return m_skipConverged && m_pixelStats[pixel].Converged; }
+	void UpdatePixelStats(PixelStats& stats, const glm::vec3& color);
+
+private:
+	// Per thread counter, padded so threads don't share cache lines
+	struct alignas(64) ThreadStats
+	{
+		uint64_t Rays = 0;
+	};
+
+	uint32_t					m_width,
+								m_height;
+	RTTraceMode					m_traceMode = RTTraceMode::Megakernel;
+
+	// ADAPTIVE SAMPLING
+	AdaptiveSamplingSettings	m_adaptive;
+	bool						m_skipConverged = false;
+	uint32_t					m_activePixelCount = 0;
+	std::atomic<uint32_t>		m_convergedPixels = 0;
+	std::vector<uint32_t>		m_activePixels;
+
+	ThreadPool					m_threadPool;
+	std::vector<ThreadStats>	m_threadStats;
+	TileScheduler				m_tiles;
+	WavefrontPipeline			m_wavefront;
+
+	Denoiser					m_denoiser;
+	DisplayTransform			m_display;
+	double						m_displaySeconds = 0.;
+
+	// TEMPORAL REPROJECTION
+	TemporalReprojectionSettings	m_temporal;
+	RTCameraSD					m_previousCamera = {};
+	bool						m_hasHistory = false;
+	// Added to RTConstants::AccumulatedSamples, samples taken in the views before the last reset
+	uint32_t					m_sampleOffset = 0,
+								m_lastSampleIndex = 0;
+	float						m_reprojectedFraction = 0.f;
+	double						m_reprojectionSeconds = 0.;
+	std::vector<glm::vec4>		m_historyAccumulated;
+	std::vector<PixelStats>		m_historyStats;
+	std::vector<float>			m_historyDepth;
+
+	// OUTPUT TEXTURES
+	std::vector<glm::vec4>		m_output;
+	std::vector<glm::vec4>		m_accumulated;
+	std::vector<PixelStats>		m_pixelStats;
+	uint32_t					m_aovFlags = AOVNone;
+	AOVBuffer					m_aovs;
+};
@@ -0,0 +1,255 @@
+#include "Denoiser.hpp"
+#include "FastMath.hpp"
+
+namespace
+{
+	// Keeps a noiseless pixel from rejecting its neighbours over rounding differences
+	constexpr float s_minLuminanceSigma = 1e-4f;
+	constexpr float s_luminance[3] = { 0.2126f, 0.7152f, 0.0722f };
+
+	// B3 spline, the 1D à-trous kernel
+	constexpr float s_kernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+	// exp(x) for the weights, 0 below 2^-60 keeps the sums from going denormal
+	inline float FastExp(float x)
+	{
+		return FastExp2(x * 1.44269504f);
+	}
+
+#if defined(__AVX2__)
+	inline __m256 FastExp(__m256 x)
+	{
+		return FastExp2(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)));
+	}
+
+	// Squared length of the difference between 8 centre values held in registers and the 3 plane values at tap
+	inline __m256 DistanceSq8(const __m256* center, const float* const* planes, size_t tap)
+	{
+		__m256 d = _mm256_sub_ps(center[0], _mm256_loadu_ps(planes[0] + tap));
+		__m256 sum = _mm256_mul_ps(d, d);
+		d = _mm256_sub_ps(center[1], _mm256_loadu_ps(planes[1] + tap));
+		sum = MulAdd8(d, d, sum);
+		d = _mm256_sub_ps(center[2], _mm256_loadu_ps(planes[2] + tap));
+		return MulAdd8(d, d, sum);
+	}
+
+	inline __m256 Luminance8(const float* const* planes, size_t pixel)
+	{
+		__m256 luminance = _mm256_mul_ps(_mm256_loadu_ps(planes[0] + pixel), _mm256_set1_ps(s_luminance[0]));
+		luminance = MulAdd8(_mm256_loadu_ps(planes[1] + pixel), _mm256_set1_ps(s_luminance[1]), luminance);
+		return MulAdd8(_mm256_loadu_ps(planes[2] + pixel), _mm256_set1_ps(s_luminance[2]), luminance);
+	}
+#endif
+
+	inline float DistanceSq(const float* const* planes, size_t a, size_t b)
+	{
+		float	dx = planes[0][a] - planes[0][b],
+				dy = planes[1][a] - planes[1][b],
+				dz = planes[2][a] - planes[2][b];
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	inline float Luminance(const float* const* planes, size_t pixel)
+	{
+		return planes[0][pixel] * s_luminance[0] + planes[1][pixel] * s_luminance[1] + planes[2][pixel] * s_luminance[2];
+	}
+}
+
+void Denoiser::Resize(uint32_t width, uint32_t height)
+{
+	m_width = width;
+	m_height = height;
+	const size_t pixels = static_cast<size_t>(width) * height;
+	for (int c = 0; c < 3; ++c)
+	{
+		m_color[0][c].assign(pixels, 0.f);
+		m_color[1][c].assign(pixels, 0.f);
+		m_albedo[c].assign(pixels, 1.f);
+		m_normal[c].assign(pixels, 0.f);
+	}
+	m_variance[0].assign(pixels, 0.f);
+	m_variance[1].assign(pixels, 0.f);
+	m_depth.assign(pixels, 0.f);
+}
+
+void Denoiser::Filter(ThreadPool& pool, std::vector<glm::vec4>& output)
+{
+	const uint32_t items = (m_height + s_rowsPerItem - 1) / s_rowsPerItem;
+	pool.ParallelFor(items, [&](uint32_t item, uint32_t threadIndex)
+	{
+		for (uint32_t y = item * s_rowsPerItem; y < std::min(m_height, (item + 1) * s_rowsPerItem); ++y)
+			EstimateVarianceRow(y, m_variance[0].data(), m_variance[1].data());
+	});
+	std::swap(m_variance[0], m_variance[1]);
+
+	for (uint32_t iteration = 0; iteration < m_settings.Iterations; ++iteration)
+	{
+		const float* src[3];
+		float* dst[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			src[c] = m_color[iteration & 1][c].data();
+			dst[c] = m_color[(iteration + 1) & 1][c].data();
+		}
+		const float* srcVariance = m_variance[iteration & 1].data();
+		float* dstVariance = m_variance[(iteration + 1) & 1].data();
+		pool.ParallelFor(items, [&](uint32_t item, uint32_t threadIndex)
+		{
+			for (uint32_t y = item * s_rowsPerItem; y < std::min(m_height, (item + 1) * s_rowsPerItem); ++y)
+				FilterRow(iteration, y, src, srcVariance, dst, dstVariance);
+		});
+	}
+
+	// Back to radiance, then the gamma 2 encoding of OutputTex
+	const std::vector<float>* result = m_color[m_settings.Iterations & 1];
+	pool.ParallelFor(items, [&](uint32_t item, uint32_t threadIndex)
+	{
+		for (uint32_t y = item * s_rowsPerItem; y < std::min(m_height, (item + 1) * s_rowsPerItem); ++y)
+		{
+			for (size_t pixel = static_cast<size_t>(y) * m_width; pixel < static_cast<size_t>(y + 1) * m_width; ++pixel)
+			{
+				glm::vec3 radiance(result[0][pixel] * m_albedo[0][pixel], result[1][pixel] * m_albedo[1][pixel], result[2][pixel] * m_albedo[2][pixel]);
+				output[pixel] = glm::vec4(glm::sqrt(glm::max(radiance, glm::vec3(0.f))), output[pixel].w);
+			}
+		}
+	});
+}
+
+void Denoiser::EstimateVarianceRow(uint32_t y, const float* src, float* dst) const
+{
+	const float* const color[3] = { m_color[0][0].data(), m_color[0][1].data(), m_color[0][2].data() };
+	for (uint32_t x = 0; x < m_width; ++x)
+	{
+		const size_t pixel = static_cast<size_t>(y) * m_width + x;
+		if (src[pixel] >= 0.f)
+		{
+			dst[pixel] = src[pixel];
+			continue;
+		}
+		// Neighbouring means vary as much as the mean of one pixel would, detail in the window only overestimates it
+		float sum = 0.f, sumSq = 0.f, count = 0.f;
+		for (uint32_t ty = y > 0 ? y - 1 : 0; ty <= std::min(y + 1, m_height - 1); ++ty)
+		{
+			for (uint32_t tx = x > 0 ? x - 1 : 0; tx <= std::min(x + 1, m_width - 1); ++tx)
+			{
+				const float luminance = Luminance(color, static_cast<size_t>(ty) * m_width + tx);
+				sum += luminance;
+				sumSq += luminance * luminance;
+				count += 1.f;
+			}
+		}
+		const float mean = sum / count;
+		dst[pixel] = std::max(sumSq / count - mean * mean, 0.f);
+	}
+}
+
+void Denoiser::FilterRow(uint32_t iteration, uint32_t y, const float* const* src, const float* srcVariance, float* const* dst, float* dstVariance) const
+{
+	const int32_t	width = static_cast<int32_t>(m_width),
+					height = static_cast<int32_t>(m_height),
+					step = 1 << iteration;
+	const float		normalScale = 1.f / (m_settings.NormalSigma * m_settings.NormalSigma),
+					albedoScale = 1.f / (m_settings.AlbedoSigma * m_settings.AlbedoSigma);
+	const float* const albedo[3] = { m_albedo[0].data(), m_albedo[1].data(), m_albedo[2].data() };
+	const float* const normal[3] = { m_normal[0].data(), m_normal[1].data(), m_normal[2].data() };
+	const float* const depth = m_depth.data();
+
+	// Depth falls off with the distance to the tap, a slanted surface changes depth along it
+	float depthScale[5][5];
+	for (int dy = -2; dy <= 2; ++dy)
+	{
+		for (int dx = -2; dx <= 2; ++dx)
+			depthScale[dy + 2][dx + 2] = dx == 0 && dy == 0 ? 0.f : 1.f / (m_settings.DepthSigma * step * std::sqrt(static_cast<float>(dx * dx + dy * dy)));
+	}
+
+	auto filterPixel = [&](int32_t x)
+	{
+		const size_t center = static_cast<size_t>(y) * width + x;
+		const float invDepth = 1.f / depth[center];
+		const float centerLuminance = Luminance(src, center);
+		const float luminanceScale = 1.f / (m_settings.LuminanceSigma * std::sqrt(srcVariance[center]) + s_minLuminanceSigma);
+		float sum[3] = {}, variance = 0.f, weightSum = 0.f;
+		for (int dy = -2; dy <= 2; ++dy)
+		{
+			const int32_t ty = static_cast<int32_t>(y) + dy * step;
+			if (ty < 0 || ty >= height)
+				continue;
+			for (int dx = -2; dx <= 2; ++dx)
+			{
+				const int32_t tx = x + dx * step;
+				if (tx < 0 || tx >= width)
+					continue;
+				const size_t tap = static_cast<size_t>(ty) * width + tx;
+				const float exponent =
+					std::abs(centerLuminance - Luminance(src, tap)) * luminanceScale +
+					DistanceSq(normal, center, tap) * normalScale +
+					DistanceSq(albedo, center, tap) * albedoScale +
+					std::abs(depth[center] - depth[tap]) * invDepth * depthScale[dy + 2][dx + 2];
+				const float weight = s_kernel[dy + 2] * s_kernel[dx + 2] * FastExp(-exponent);
+				for (int c = 0; c < 3; ++c)
+					sum[c] += weight * src[c][tap];
+				variance += weight * weight * srcVariance[tap];
+				weightSum += weight;
+			}
+		}
+		// The centre tap has a weight of at least 9/64
+		for (int c = 0; c < 3; ++c)
+			dst[c][center] = sum[c] / weightSum;
+		dstVariance[center] = variance / (weightSum * weightSum);
+	};
+
+	int32_t x = 0;
+#if defined(__AVX2__)
+	// Pixels whose taps all lie inside the row, 8 at a time
+	const int32_t border = 2 * step;
+	for (; x < std::min(border, width); ++x)
+		filterPixel(x);
+	for (; x + 8 + border <= width; x += 8)
+	{
+		const size_t center = static_cast<size_t>(y) * width + x;
+		__m256 centerNormal[3], centerAlbedo[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			centerNormal[c] = _mm256_loadu_ps(normal[c] + center);
+			centerAlbedo[c] = _mm256_loadu_ps(albedo[c] + center);
+		}
+		const __m256 centerLuminance = Luminance8(src, center);
+		const __m256 luminanceScale = _mm256_div_ps(_mm256_set1_ps(-1.f),
+			MulAdd8(_mm256_set1_ps(m_settings.LuminanceSigma), _mm256_sqrt_ps(_mm256_loadu_ps(srcVariance + center)), _mm256_set1_ps(s_minLuminanceSigma)));
+		const __m256 centerDepth = _mm256_loadu_ps(depth + center);
+		const __m256 invDepth = _mm256_div_ps(_mm256_set1_ps(-1.f), centerDepth);
+		const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		__m256 sum[3] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() }, variance = _mm256_setzero_ps(), weightSum = _mm256_setzero_ps();
+		for (int dy = -2; dy <= 2; ++dy)
+		{
+			const int32_t ty = static_cast<int32_t>(y) + dy * step;
+			if (ty < 0 || ty >= height)
+				continue;
+			for (int dx = -2; dx <= 2; ++dx)
+			{
+				// Exponent built negated, luminanceScale and invDepth carry the sign
+				const size_t tap = static_cast<size_t>(ty) * width + x + dx * step;
+				const __m256 color[3] = { _mm256_loadu_ps(src[0] + tap), _mm256_loadu_ps(src[1] + tap), _mm256_loadu_ps(src[2] + tap) };
+				__m256 luminance = _mm256_mul_ps(color[0], _mm256_set1_ps(s_luminance[0]));
+				luminance = MulAdd8(color[1], _mm256_set1_ps(s_luminance[1]), luminance);
+				luminance = MulAdd8(color[2], _mm256_set1_ps(s_luminance[2]), luminance);
+				__m256 exponent = _mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(centerLuminance, luminance), absMask), luminanceScale);
+				exponent = MulAdd8(DistanceSq8(centerNormal, normal, tap), _mm256_set1_ps(-normalScale), exponent);
+				exponent = MulAdd8(DistanceSq8(centerAlbedo, albedo, tap), _mm256_set1_ps(-albedoScale), exponent);
+				const __m256 depthDiff = _mm256_and_ps(_mm256_sub_ps(centerDepth, _mm256_loadu_ps(depth + tap)), absMask);
+				exponent = MulAdd8(_mm256_mul_ps(depthDiff, invDepth), _mm256_set1_ps(depthScale[dy + 2][dx + 2]), exponent);
+				const __m256 weight = _mm256_mul_ps(_mm256_set1_ps(s_kernel[dy + 2] * s_kernel[dx + 2]), FastExp(exponent));
+				for (int c = 0; c < 3; ++c)
+					sum[c] = MulAdd8(weight, color[c], sum[c]);
+				variance = MulAdd8(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(srcVariance + tap), variance);
+				weightSum = _mm256_add_ps(weightSum, weight);
+			}
+		}
+		for (int c = 0; c < 3; ++c)
+			_mm256_storeu_ps(dst[c] + center, _mm256_div_ps(sum[c], weightSum));
+		_mm256_storeu_ps(dstVariance + center, _mm256_div_ps(variance, _mm256_mul_ps(weightSum, weightSum)));
+	}
+#endif
+	for (; x < width; ++x)
+		filterPixel(x);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "RTCommon.hpp"
+#include "ThreadPool.hpp"
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+struct DenoiserSettings
+{
+	bool		Enabled = false;
+	// À-trous passes, the 5x5 kernel is spread 2^i pixels apart in pass i so 3 passes reach 14 pixels out
+	uint32_t	Iterations = 3;
+	// Edge stopping, a neighbour's weight falls off with exp(-difference^2 / sigma^2) per feature.
+	// The luminance one instead with exp(-difference / (sigma * standard deviation)), so it is in units of the centre pixel's noise
+	// and the filter backs off as the samples converge
+	float		LuminanceSigma = 4.f,
+				NormalSigma = 0.3f,
+				AlbedoSigma = 0.1f,
+	// Relative to the depth of the centre pixel and the tap distance in pixels
+				DepthSigma = 0.05f;
+};
+
+// What the tracer hands the denoiser for every pixel
+struct DenoiserInput
+{
+	glm::vec3	Radiance;
+	// Variance of the mean luminance, negative while there are too few samples to tell
+	float		Variance;
+	// Mean first hit features, like the AOVs of the same name
+	glm::vec3	Albedo;
+	glm::vec3	Normal;
+	float		Depth;
+};
+
+// Edge avoiding à-trous wavelet filter (Dammertz et al. 2010) over the mean radiance of every pixel.
+// The radiance is divided by the first hit albedo, filtered, and multiplied back so textures and material edges stay sharp,
+// neighbours only blend while their albedo, normal and depth are close. Like SVGF (Schied et al. 2017) the luminance term is scaled by
+// the noise of the pixel, the variance is filtered along with the color so it shrinks pass by pass.
+// Rows are filtered on the thread pool, 8 pixels at a time with AVX2.
+class Denoiser
+{
+public:
+	void Resize(uint32_t width, uint32_t height);
+
+	inline void						SetSettings(const DenoiserSettings& settings)	{ m_settings = settings; }
+	inline const DenoiserSettings&	GetSettings() const								{ return m_settings; }
+
+	// Filters the DenoiserInput pixelInput(pixel) returns for every pixel and writes sqrt of the result to output, same encoding as OutputTex
+	template<typename InputFunc>
+	void Denoise(ThreadPool& pool, InputFunc&& pixelInput, std::vector<glm::vec4>& output);
+
+	// Seconds the last Denoise call took
+	inline double GetFilterSeconds() const	{ return m_filterSeconds; }
+
+private:
+	// Demodulated input in m_color[0] and m_variance[0], the passes ping-pong between the two buffers
+	void Filter(ThreadPool& pool, std::vector<glm::vec4>& output);
+	// Variance of the pixels that do not know theirs yet, from the luminance of their 3x3 neighbourhood
+	void EstimateVarianceRow(uint32_t y, const float* src, float* dst) const;
+	void FilterRow(uint32_t iteration, uint32_t y, const float* const* src, const float* srcVariance, float* const* dst, float* dstVariance) const;
+
+	// Rows per ParallelFor item
+	static constexpr uint32_t s_rowsPerItem = 4;
+	// Keeps black materials from dividing the radiance by 0
+	static constexpr float s_minAlbedo = 1e-3f;
+
+private:
+	uint32_t			m_width = 0,
+						m_height = 0;
+	DenoiserSettings	m_settings;
+	double				m_filterSeconds = 0.;
+
+	// One plane per channel so a register holds the same channel of 8 neighbouring pixels
+	std::vector<float>	m_color[2][3];
+	std::vector<float>	m_variance[2];
+	std::vector<float>	m_albedo[3];
+	std::vector<float>	m_normal[3];
+	std::vector<float>	m_depth;
+};
+
+template<typename InputFunc>
+void Denoiser::Denoise(ThreadPool& pool, InputFunc&& pixelInput, std::vector<glm::vec4>& output)
+{
+	auto start = std::chrono::steady_clock::now();
+	const uint32_t width = m_width;
+	pool.ParallelFor((m_height + s_rowsPerItem - 1) / s_rowsPerItem, [&](uint32_t item, uint32_t threadIndex)
+	{
+		for (uint32_t y = item * s_rowsPerItem; y < std::min(m_height, (item + 1) * s_rowsPerItem); ++y)
+		{
+			for (size_t pixel = static_cast<size_t>(y) * width; pixel < static_cast<size_t>(y + 1) * width; ++pixel)
+			{
+				// A NaN sample would spread over the whole kernel footprint
+				const DenoiserInput input = pixelInput(pixel);
+				for (int c = 0; c < 3; ++c)
+				{
+					m_albedo[c][pixel] = std::max(input.Albedo[c], s_minAlbedo);
+					m_normal[c][pixel] = input.Normal[c];
+					m_color[0][c][pixel] = std::isfinite(input.Radiance[c]) ? input.Radiance[c] / m_albedo[c][pixel] : 0.f;
+				}
+				m_depth[pixel] = input.Depth;
+				const float albedoLuminance = m_albedo[0][pixel] * 0.2126f + m_albedo[1][pixel] * 0.7152f + m_albedo[2][pixel] * 0.0722f;
+				m_variance[0][pixel] = input.Variance >= 0.f && std::isfinite(input.Variance) ? input.Variance / (albedoLuminance * albedoLuminance) : -1.f;
+			}
+		}
+	});
+	Filter(pool, output);
+	m_filterSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
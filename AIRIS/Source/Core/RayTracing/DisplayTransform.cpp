@@ -0,0 +1,231 @@
+#include "DisplayTransform.hpp"
+#include "FastMath.hpp"
+#include <algorithm>
+
+namespace
+{
+	// Row major, out[i] is the sum of m[i][j] * in[j]. sRGB primaries in and out
+	constexpr float s_acesInput[3][3] =
+	{
+		{ 0.59719f, 0.35458f, 0.04823f },
+		{ 0.07600f, 0.90834f, 0.01566f },
+		{ 0.02840f, 0.13383f, 0.83777f },
+	};
+	constexpr float s_acesOutput[3][3] =
+	{
+		{ 1.60475f, -0.53108f, -0.07367f },
+		{ -0.10208f, 1.10813f, -0.00605f },
+		{ -0.00327f, -0.07276f, 1.07602f },
+	};
+	constexpr float s_agxInset[3][3] =
+	{
+		{ 0.842479062253094f, 0.0784335999999992f, 0.0792237451477643f },
+		{ 0.0423282422610123f, 0.878468636469772f, 0.0791661274605434f },
+		{ 0.0423756549057051f, 0.0784336f, 0.879142973793104f },
+	};
+	constexpr float s_agxOutset[3][3] =
+	{
+		{ 1.19687900512017f, -0.0980208811401368f, -0.0990297440797205f },
+		{ -0.0528968517574562f, 1.15190312990417f, -0.0989611768448433f },
+		{ -0.0529716355144438f, -0.0980434501171241f, 1.15107367264116f },
+	};
+	// Exposure range the AgX log encoding covers, around middle grey
+	constexpr float s_agxMinEV = -12.47393f, s_agxMaxEV = 4.026069f;
+	// AgX ends in a 2.2 display gamma, undone before the sRGB encode
+	constexpr float s_agxGamma = 2.2f;
+
+	inline glm::vec3 Transform(const float (&m)[3][3], const glm::vec3& v)
+	{
+		return glm::vec3(
+			m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+			m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+			m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+	}
+
+	// NaN goes to 0 like _mm256_max_ps(x, 0) does
+	inline float Positive(float x)	{ return x > 0.f ? x : 0.f; }
+	inline float Saturate(float x)	{ return x > 0.f ? (x < 1.f ? x : 1.f) : 0.f; }
+
+	inline float ACESFit(float v)
+	{
+		return (v * (v + 0.0245786f) - 0.000090537f) / (v * (0.983729f * v + 0.4329510f) + 0.238081f);
+	}
+
+	inline float AgXContrast(float x)
+	{
+		const float x2 = x * x, x4 = x2 * x2;
+		return 15.5f * x4 * x2 - 40.14f * x4 * x + 31.96f * x4 - 6.868f * x2 * x + 0.4298f * x2 + 0.1191f * x - 0.00232f;
+	}
+
+	glm::vec3 ApplyCurve(glm::vec3 v, ToneCurve curve)
+	{
+		switch (curve)
+		{
+		case ToneCurve::ACES:
+			v = Transform(s_acesInput, v);
+			v = glm::vec3(ACESFit(v.x), ACESFit(v.y), ACESFit(v.z));
+			return Transform(s_acesOutput, v);
+		case ToneCurve::AgX:
+			v = Transform(s_agxInset, v);
+			for (int c = 0; c < 3; ++c)
+			{
+				const float ev = std::clamp(FastLog2(std::max(v[c], 1e-10f)), s_agxMinEV, s_agxMaxEV);
+				v[c] = AgXContrast((ev - s_agxMinEV) / (s_agxMaxEV - s_agxMinEV));
+			}
+			v = Transform(s_agxOutset, v);
+			for (int c = 0; c < 3; ++c)
+				v[c] = FastExp2(s_agxGamma * FastLog2(Positive(v[c])));
+			return v;
+		default:
+			return v;
+		}
+	}
+
+#if defined(__AVX2__)
+	inline void Transform8(const float (&m)[3][3], __m256* v)
+	{
+		__m256 out[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			out[i] = _mm256_mul_ps(_mm256_set1_ps(m[i][0]), v[0]);
+			out[i] = MulAdd8(_mm256_set1_ps(m[i][1]), v[1], out[i]);
+			out[i] = MulAdd8(_mm256_set1_ps(m[i][2]), v[2], out[i]);
+		}
+		v[0] = out[0];
+		v[1] = out[1];
+		v[2] = out[2];
+	}
+
+	inline __m256 ACESFit8(__m256 v)
+	{
+		const __m256 numerator = MulAdd8(v, _mm256_add_ps(v, _mm256_set1_ps(0.0245786f)), _mm256_set1_ps(-0.000090537f));
+		const __m256 denominator = MulAdd8(v, MulAdd8(v, _mm256_set1_ps(0.983729f), _mm256_set1_ps(0.4329510f)), _mm256_set1_ps(0.238081f));
+		return _mm256_div_ps(numerator, denominator);
+	}
+
+	inline __m256 AgXContrast8(__m256 x)
+	{
+		__m256 p = MulAdd8(x, _mm256_set1_ps(15.5f), _mm256_set1_ps(-40.14f));
+		p = MulAdd8(x, p, _mm256_set1_ps(31.96f));
+		p = MulAdd8(x, p, _mm256_set1_ps(-6.868f));
+		p = MulAdd8(x, p, _mm256_set1_ps(0.4298f));
+		p = MulAdd8(x, p, _mm256_set1_ps(0.1191f));
+		return MulAdd8(x, p, _mm256_set1_ps(-0.00232f));
+	}
+
+	inline void ApplyCurve8(__m256* v, ToneCurve curve)
+	{
+		switch (curve)
+		{
+		case ToneCurve::ACES:
+			Transform8(s_acesInput, v);
+			for (int c = 0; c < 3; ++c)
+				v[c] = ACESFit8(v[c]);
+			Transform8(s_acesOutput, v);
+			break;
+		case ToneCurve::AgX:
+			Transform8(s_agxInset, v);
+			for (int c = 0; c < 3; ++c)
+			{
+				__m256 ev = FastLog2(_mm256_max_ps(v[c], _mm256_set1_ps(1e-10f)));
+				ev = _mm256_min_ps(_mm256_max_ps(ev, _mm256_set1_ps(s_agxMinEV)), _mm256_set1_ps(s_agxMaxEV));
+				v[c] = AgXContrast8(_mm256_mul_ps(_mm256_sub_ps(ev, _mm256_set1_ps(s_agxMinEV)), _mm256_set1_ps(1.f / (s_agxMaxEV - s_agxMinEV))));
+			}
+			Transform8(s_agxOutset, v);
+			for (int c = 0; c < 3; ++c)
+				v[c] = FastExp2(_mm256_mul_ps(_mm256_set1_ps(s_agxGamma), FastLog2(_mm256_max_ps(v[c], _mm256_setzero_ps()))));
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+}
+
+DisplayTransform::DisplayTransform()
+{
+	constexpr uint32_t entries = 1u << s_lutBits;
+	m_lut.assign(entries + 3, 0);
+	for (uint32_t i = 0; i < entries; ++i)
+		m_lut[i] = EncodeSRGB(static_cast<float>(i) / static_cast<float>(entries - 1));
+}
+
+uint8_t DisplayTransform::EncodeSRGB(float linear)
+{
+	const double x = std::clamp(static_cast<double>(linear), 0., 1.);
+	const double encoded = x <= 0.0031308 ? 12.92 * x : 1.055 * std::pow(x, 1. / 2.4) - 0.055;
+	return static_cast<uint8_t>(encoded * 255. + 0.5);
+}
+
+uint32_t DisplayTransform::ResolvePixel(const glm::vec3& radiance) const
+{
+	glm::vec3 v = radiance * m_exposureScale;
+	v = ApplyCurve(glm::vec3(Positive(v.x), Positive(v.y), Positive(v.z)), m_settings.Curve);
+	constexpr float scale = static_cast<float>((1u << s_lutBits) - 1);
+	uint32_t rgba = 0xff000000u;
+	for (int c = 0; c < 3; ++c)
+		rgba |= static_cast<uint32_t>(m_lut[static_cast<uint32_t>(Saturate(v[c]) * scale + 0.5f)]) << (8 * c);
+	return rgba;
+}
+
+void DisplayTransform::ResolveAccumulated(ThreadPool& pool, const glm::vec4* accumulated, size_t pixelCount, uint32_t* rgba8) const
+{
+	Resolve(pool, accumulated, pixelCount, rgba8, Input::Accumulated);
+}
+
+void DisplayTransform::ResolveOutput(ThreadPool& pool, const glm::vec4* output, size_t pixelCount, uint32_t* rgba8) const
+{
+	Resolve(pool, output, pixelCount, rgba8, Input::Output);
+}
+
+void DisplayTransform::Resolve(ThreadPool& pool, const glm::vec4* pixels, size_t pixelCount, uint32_t* rgba8, Input input) const
+{
+	const uint32_t items = static_cast<uint32_t>((pixelCount + s_pixelsPerItem - 1) / s_pixelsPerItem);
+	pool.ParallelFor(items, [&](uint32_t item, uint32_t threadIndex)
+	{
+		size_t i = static_cast<size_t>(item) * s_pixelsPerItem;
+		const size_t end = std::min(pixelCount, i + s_pixelsPerItem);
+#if defined(__AVX2__)
+		const __m256 exposure = _mm256_set1_ps(m_exposureScale);
+		const __m256 scale = _mm256_set1_ps(static_cast<float>((1u << s_lutBits) - 1));
+		const __m256i byteMask = _mm256_set1_epi32(0xff);
+		// Undoes the lane order of the transpose below
+		const __m256i pixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		const int* lut = reinterpret_cast<const int*>(m_lut.data());
+		for (; i + 8 <= end; i += 8)
+		{
+			// 8 RGBA pixels to one register per channel, pixels 0 2 4 6 in the low lane and 1 3 5 7 in the high one
+			const float* p = &pixels[i].x;
+			const __m256	a0 = _mm256_loadu_ps(p), a1 = _mm256_loadu_ps(p + 8), a2 = _mm256_loadu_ps(p + 16), a3 = _mm256_loadu_ps(p + 24);
+			const __m256	t0 = _mm256_unpacklo_ps(a0, a1), t1 = _mm256_unpackhi_ps(a0, a1),
+							t2 = _mm256_unpacklo_ps(a2, a3), t3 = _mm256_unpackhi_ps(a2, a3);
+			__m256 v[3] = { _mm256_shuffle_ps(t0, t2, 0x44), _mm256_shuffle_ps(t0, t2, 0xee), _mm256_shuffle_ps(t1, t3, 0x44) };
+			const __m256 w = _mm256_shuffle_ps(t1, t3, 0xee);
+
+			const __m256 pixelScale = input == Input::Accumulated ? _mm256_div_ps(exposure, w) : exposure;
+			for (int c = 0; c < 3; ++c)
+			{
+				if (input == Input::Output)
+					v[c] = _mm256_mul_ps(v[c], v[c]);
+				v[c] = _mm256_max_ps(_mm256_mul_ps(v[c], pixelScale), _mm256_setzero_ps());
+			}
+			ApplyCurve8(v, m_settings.Curve);
+
+			__m256i rgba = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+			for (int c = 0; c < 3; ++c)
+			{
+				const __m256 saturated = _mm256_min_ps(_mm256_max_ps(v[c], _mm256_setzero_ps()), _mm256_set1_ps(1.f));
+				const __m256i index = _mm256_cvttps_epi32(MulAdd8(saturated, scale, _mm256_set1_ps(0.5f)));
+				const __m256i code = _mm256_and_si256(_mm256_i32gather_epi32(lut, index, 1), byteMask);
+				rgba = _mm256_or_si256(rgba, _mm256_slli_epi32(code, 8 * c));
+			}
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba8 + i), _mm256_permutevar8x32_epi32(rgba, pixelOrder));
+		}
+#endif
+		for (; i < end; ++i)
+		{
+			const glm::vec4& pixel = pixels[i];
+			rgba8[i] = ResolvePixel(input == Input::Accumulated ? glm::vec3(pixel) / pixel.w : glm::vec3(pixel) * glm::vec3(pixel));
+		}
+	});
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "glm/glm.hpp"
+#include "ThreadPool.hpp"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+enum class ToneCurve
+{
+	// Exposure and the sRGB encode only, everything above 1 clips
+	None,
+	// Stephen Hill's fit of the ACES reference rendering and sRGB output transforms
+	ACES,
+	// AgX base look, with the polynomial fit of its contrast curve
+	AgX,
+};
+
+struct DisplaySettings
+{
+	// In stops, the radiance is scaled by 2^Exposure before the curve
+	float		Exposure = 0.f;
+	ToneCurve	Curve = ToneCurve::ACES;
+};
+
+// Display transform of the CPU tracer: resolve, exposure, tone curve and sRGB encode straight to the RGBA8 of R8G8B8A8_UNORM back buffers.
+// The encode looks the curve output up in a table of 2^16 entries, it only disagrees with the exact sRGB encode
+// where a rounding step falls within half an entry of the value. Pixels go 8 at a time with AVX2, on the thread pool.
+class DisplayTransform
+{
+public:
+	DisplayTransform();
+
+	inline void						SetSettings(const DisplaySettings& settings)	{ m_settings = settings; m_exposureScale = std::exp2(settings.Exposure); }
+	inline const DisplaySettings&	GetSettings() const								{ return m_settings; }
+
+	// Sums of samples with the sample count in w, the accumulation of CPUTracer
+	void ResolveAccumulated(ThreadPool& pool, const glm::vec4* accumulated, size_t pixelCount, uint32_t* rgba8) const;
+	// sqrt of the radiance, the OutputTex encoding
+	void ResolveOutput(ThreadPool& pool, const glm::vec4* output, size_t pixelCount, uint32_t* rgba8) const;
+
+	// One pixel without SIMD, what the tails of the SIMD ranges go through
+	uint32_t ResolvePixel(const glm::vec3& radiance) const;
+
+	// Correctly rounded sRGB encode of a linear value, what the table is built from
+	static uint8_t EncodeSRGB(float linear);
+
+private:
+	enum class Input
+	{
+		Accumulated,
+		Output,
+	};
+	void Resolve(ThreadPool& pool, const glm::vec4* pixels, size_t pixelCount, uint32_t* rgba8, Input input) const;
+
+	static constexpr uint32_t s_lutBits = 16;
+	// Pixels per ParallelFor item
+	static constexpr uint32_t s_pixelsPerItem = 1 << 14;
+
+private:
+	DisplaySettings			m_settings;
+	float					m_exposureScale = 1.f;
+	// 2^s_lutBits codes, padded so a 32 bit gather at the last entry stays inside
+	std::vector<uint8_t>	m_lut;
+};
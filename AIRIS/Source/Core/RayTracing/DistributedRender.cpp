@@ -0,0 +1,341 @@
+#include "DistributedRender.hpp"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#if defined(_WIN32)
+
+// Not ported to Winsock yet, every call fails
+DistributedWorker::~DistributedWorker() = default;
+bool DistributedWorker::Connect(const std::string&, uint32_t, uint32_t, DistributedAssignment&, double) { return false; }
+bool DistributedWorker::SendPartial(const std::vector<glm::vec4>&, uint32_t) { return false; }
+bool DistributedWorker::SendDone() { return false; }
+
+DistributedCoordinator::~DistributedCoordinator() = default;
+bool DistributedCoordinator::Listen(const std::string&) { return false; }
+bool DistributedCoordinator::AcceptWorkers(uint32_t, uint32_t, uint32_t, uint32_t, double) { return false; }
+bool DistributedCoordinator::Merge(std::vector<glm::vec4>&, const PartialFunc&) { return false; }
+void DistributedCoordinator::Close() {}
+
+#else
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace
+{
+#if defined(MSG_NOSIGNAL)
+	constexpr int s_sendFlags = MSG_NOSIGNAL;
+#else
+	constexpr int s_sendFlags = 0;
+#endif
+
+	// unix:/path or tcp:host:port, -1 if the address doesn't parse or the socket can't be bound or connected
+	int OpenSocket(const std::string& address, bool listening, std::string& unixPath)
+	{
+		if (address.rfind("unix:", 0) == 0)
+		{
+			const std::string path = address.substr(5);
+			sockaddr_un addr = {};
+			addr.sun_family = AF_UNIX;
+			if (path.empty() || path.size() >= sizeof(addr.sun_path))
+				return -1;
+			memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+			const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0)
+				return -1;
+			if (listening)
+			{
+				unlink(path.c_str());
+				if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0 && listen(fd, SOMAXCONN) == 0)
+				{
+					unixPath = path;
+					return fd;
+				}
+			}
+			else if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0)
+				return fd;
+			close(fd);
+			return -1;
+		}
+
+		if (address.rfind("tcp:", 0) != 0)
+			return -1;
+		const size_t colon = address.rfind(':');
+		if (colon <= 3)
+			return -1;
+		const std::string host = address.substr(4, colon - 4), port = address.substr(colon + 1);
+
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = listening ? AI_PASSIVE : 0;
+		addrinfo* results = nullptr;
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results) != 0)
+			return -1;
+		int fd = -1;
+		for (addrinfo* info = results; info && fd < 0; info = info->ai_next)
+		{
+			fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (fd < 0)
+				continue;
+			if (listening)
+			{
+				const int reuse = 1;
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+				if (bind(fd, info->ai_addr, info->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+					break;
+			}
+			else if (connect(fd, info->ai_addr, info->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(results);
+		return fd;
+	}
+
+	bool SendAll(int fd, const void* data, size_t size)
+	{
+		const char* bytes = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			const ssize_t sent = send(fd, bytes, size, s_sendFlags);
+			if (sent <= 0)
+				return false;
+			bytes += sent;
+			size -= static_cast<size_t>(sent);
+		}
+		return true;
+	}
+
+	bool ReceiveAll(int fd, void* data, size_t size)
+	{
+		char* bytes = static_cast<char*>(data);
+		while (size > 0)
+		{
+			const ssize_t received = recv(fd, bytes, size, 0);
+			if (received <= 0)
+				return false;
+			bytes += received;
+			size -= static_cast<size_t>(received);
+		}
+		return true;
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+////////////////////////
+//                    //
+//       WORKER       //
+//                    //
+////////////////////////
+
+DistributedWorker::~DistributedWorker()
+{
+	if (m_socket >= 0)
+		close(m_socket);
+}
+
+bool DistributedWorker::Connect(const std::string& address, uint32_t width, uint32_t height, DistributedAssignment& assignment, double timeoutSeconds)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::string unixPath;
+	while ((m_socket = OpenSocket(address, false, unixPath)) < 0)
+	{
+		if (SecondsSince(start) > timeoutSeconds)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	// The coordinator's image has to be ours, the command lines differ otherwise
+	DistributedMessage message;
+	if (!ReceiveAll(m_socket, &message, sizeof(message)) || message.Magic != DistributedMessage::s_magic || message.Type != DistributedMessageType::Assign ||
+		message.Width != width || message.Height != height)
+		return false;
+	m_width = width;
+	m_height = height;
+	m_assignment = { message.Worker, message.FirstSample, message.SampleCount };
+	assignment = m_assignment;
+	return true;
+}
+
+bool DistributedWorker::SendPartial(const std::vector<glm::vec4>& accumulated, uint32_t samples)
+{
+	if (m_socket < 0 || accumulated.size() != static_cast<size_t>(m_width) * m_height)
+		return false;
+	for (uint32_t y = 0; y < m_height; y += s_bandRows)
+	{
+		DistributedMessage message;
+		message.Type = DistributedMessageType::Band;
+		message.Worker = m_assignment.Worker;
+		message.Width = m_width;
+		message.Height = m_height;
+		message.SampleCount = samples;
+		message.Y = y;
+		message.Rows = std::min(s_bandRows, m_height - y);
+		if (!SendAll(m_socket, &message, sizeof(message)) ||
+			!SendAll(m_socket, accumulated.data() + static_cast<size_t>(y) * m_width, static_cast<size_t>(message.Rows) * m_width * sizeof(glm::vec4)))
+			return false;
+	}
+	return true;
+}
+
+bool DistributedWorker::SendDone()
+{
+	DistributedMessage message;
+	message.Type = DistributedMessageType::Done;
+	message.Worker = m_assignment.Worker;
+	message.Width = m_width;
+	message.Height = m_height;
+	return m_socket >= 0 && SendAll(m_socket, &message, sizeof(message));
+}
+
+////////////////////////
+//                    //
+//    COORDINATOR     //
+//                    //
+////////////////////////
+
+DistributedCoordinator::~DistributedCoordinator()
+{
+	Close();
+}
+
+void DistributedCoordinator::Close()
+{
+	for (int fd : m_workers)
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+	m_workers.clear();
+	if (m_listener >= 0)
+		close(m_listener);
+	m_listener = -1;
+	if (!m_unixPath.empty())
+		unlink(m_unixPath.c_str());
+	m_unixPath.clear();
+}
+
+bool DistributedCoordinator::Listen(const std::string& address)
+{
+	Close();
+	m_listener = OpenSocket(address, true, m_unixPath);
+	return m_listener >= 0;
+}
+
+bool DistributedCoordinator::AcceptWorkers(uint32_t workerCount, uint32_t width, uint32_t height, uint32_t sampleCount, double timeoutSeconds)
+{
+	if (m_listener < 0 || workerCount == 0)
+		return false;
+	m_width = width;
+	m_height = height;
+	m_assignments.clear();
+
+	auto start = std::chrono::steady_clock::now();
+	while (m_workers.size() < workerCount)
+	{
+		pollfd listener = { m_listener, POLLIN, 0 };
+		const int timeout = static_cast<int>(std::max(0., timeoutSeconds - SecondsSince(start)) * 1e3);
+		if (poll(&listener, 1, timeout) <= 0)
+			return false;
+		const int fd = accept(m_listener, nullptr, nullptr);
+		if (fd < 0)
+			return false;
+
+		// Workers get their sample indices in the order they connect
+		const uint32_t worker = static_cast<uint32_t>(m_workers.size());
+		DistributedMessage message;
+		message.Type = DistributedMessageType::Assign;
+		message.Worker = worker;
+		message.Width = width;
+		message.Height = height;
+		message.FirstSample = static_cast<uint32_t>(static_cast<uint64_t>(sampleCount) * worker / workerCount);
+		message.SampleCount = static_cast<uint32_t>(static_cast<uint64_t>(sampleCount) * (worker + 1) / workerCount) - message.FirstSample;
+		m_workers.push_back(fd);
+		m_assignments.push_back({ worker, message.FirstSample, message.SampleCount });
+		if (!SendAll(fd, &message, sizeof(message)))
+			return false;
+	}
+	return true;
+}
+
+bool DistributedCoordinator::Merge(std::vector<glm::vec4>& merged, const PartialFunc& onPartial)
+{
+	const size_t pixelCount = static_cast<size_t>(m_width) * m_height;
+	merged.assign(pixelCount, glm::vec4(0.f));
+	m_receivedBytes = 0;
+	m_mergeSeconds = 0.;
+
+	const uint32_t workerCount = static_cast<uint32_t>(m_workers.size());
+	// Rows of the batch each worker is sending, and the samples it sent in whole batches
+	std::vector<uint32_t> batchRows(workerCount, 0), samplesSent(workerCount, 0);
+	std::vector<pollfd> fds(workerCount);
+	for (uint32_t worker = 0; worker < workerCount; ++worker)
+		fds[worker] = { m_workers[worker], POLLIN, 0 };
+	std::vector<glm::vec4> band;
+
+	uint32_t working = workerCount;
+	while (working > 0)
+	{
+		if (poll(fds.data(), fds.size(), -1) < 0)
+			return false;
+		for (uint32_t worker = 0; worker < workerCount; ++worker)
+		{
+			if (fds[worker].fd < 0 || fds[worker].revents == 0)
+				continue;
+
+			// A whole message at a time, workers send them back to back
+			DistributedMessage message;
+			if (!ReceiveAll(fds[worker].fd, &message, sizeof(message)) || message.Magic != DistributedMessage::s_magic || message.Worker != worker)
+				return false;
+			m_receivedBytes += sizeof(message);
+
+			if (message.Type == DistributedMessageType::Done)
+			{
+				if (batchRows[worker] != 0 || samplesSent[worker] != m_assignments[worker].SampleCount)
+					return false;
+				fds[worker].fd = -1;
+				--working;
+				continue;
+			}
+			if (message.Type != DistributedMessageType::Band || message.Width != m_width || message.Height != m_height ||
+				message.Y != batchRows[worker] || message.Rows > m_height - message.Y)
+				return false;
+
+			const size_t count = static_cast<size_t>(message.Rows) * m_width;
+			band.resize(count);
+			if (!ReceiveAll(fds[worker].fd, band.data(), count * sizeof(glm::vec4)))
+				return false;
+			m_receivedBytes += count * sizeof(glm::vec4);
+
+			auto start = std::chrono::steady_clock::now();
+			glm::vec4* dest = merged.data() + static_cast<size_t>(message.Y) * m_width;
+			for (size_t i = 0; i < count; ++i)
+				dest[i] += band[i];
+			m_mergeSeconds += SecondsSince(start);
+
+			batchRows[worker] += message.Rows;
+			if (batchRows[worker] == m_height)
+			{
+				batchRows[worker] = 0;
+				samplesSent[worker] += message.SampleCount;
+				if (onPartial)
+					onPartial(worker, message.SampleCount);
+			}
+		}
+	}
+	return true;
+}
+
+#endif
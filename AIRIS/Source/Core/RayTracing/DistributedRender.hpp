@@ -0,0 +1,110 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Splitting a frame's samples over worker processes, on this machine or others.
+// Workers connect to the coordinator, get a range of sample indices and render it in batches. After each batch they send the
+// tracer's accumulation, sums of samples with the sample count in w, back a band of rows per message. Sums merge by adding them,
+// which is the AccumulatedSamples weighted mean of the partial images. The samples are the ones a single process would take,
+// only the order of the float additions differs.
+// Addresses are unix:/path/to/socket or tcp:host:port. Buffers go over the wire in the byte order of the machines, POSIX only.
+
+enum class DistributedMessageType : uint32_t
+{
+	// Coordinator to worker, the samples to render
+	Assign,
+	// Worker to coordinator, followed by Rows * Width glm::vec4 of one batch
+	Band,
+	// Worker to coordinator, every sample of the assignment was sent
+	Done,
+};
+
+struct DistributedMessage
+{
+	static constexpr uint32_t s_magic = 0x44525452;		// "RTRD"
+
+	uint32_t				Magic = s_magic;
+	DistributedMessageType	Type = DistributedMessageType::Assign;
+	uint32_t				Worker = 0,
+							Width = 0,
+							Height = 0,
+							// Assign: the range of sample indices. Band: samples in the batch
+							FirstSample = 0,
+							SampleCount = 0,
+							// Band only
+							Y = 0,
+							Rows = 0;
+};
+
+struct DistributedAssignment
+{
+	uint32_t	Worker = 0,
+				FirstSample = 0,
+				SampleCount = 0;
+};
+
+class DistributedWorker
+{
+public:
+	DistributedWorker() = default;
+	~DistributedWorker();
+
+	DistributedWorker(const DistributedWorker&) = delete;
+	DistributedWorker& operator=(const DistributedWorker&) = delete;
+
+	// Connects and waits for the assignment, retries for timeoutSeconds while nobody listens yet
+	bool Connect(const std::string& address, uint32_t width, uint32_t height, DistributedAssignment& assignment, double timeoutSeconds = 10.);
+	// accumulated holds the sums of the samples samples of one batch
+	bool SendPartial(const std::vector<glm::vec4>& accumulated, uint32_t samples);
+	bool SendDone();
+
+	// Rows per Band message
+	static constexpr uint32_t s_bandRows = 64;
+
+private:
+	int						m_socket = -1;
+	DistributedAssignment	m_assignment;
+	uint32_t				m_width = 0,
+							m_height = 0;
+};
+
+class DistributedCoordinator
+{
+public:
+	using PartialFunc = std::function<void(uint32_t worker, uint32_t samples)>;
+
+	DistributedCoordinator() = default;
+	~DistributedCoordinator();
+
+	DistributedCoordinator(const DistributedCoordinator&) = delete;
+	DistributedCoordinator& operator=(const DistributedCoordinator&) = delete;
+
+	bool Listen(const std::string& address);
+	// Waits for workerCount workers and splits sample indices [0, sampleCount) evenly between them
+	bool AcceptWorkers(uint32_t workerCount, uint32_t width, uint32_t height, uint32_t sampleCount, double timeoutSeconds = 30.);
+	// Adds the bands into merged as they arrive until every worker is done, onPartial runs after each complete batch.
+	// False if a worker hung up early or sent something that doesn't fit the image
+	bool Merge(std::vector<glm::vec4>& merged, const PartialFunc& onPartial = nullptr);
+
+	inline const std::vector<DistributedAssignment>&	GetAssignments() const		{ return m_assignments; }
+	inline uint64_t										GetReceivedBytes() const	{ return m_receivedBytes; }
+	// Time Merge spent adding bands, the rest of it is waiting for workers
+	inline double										GetMergeSeconds() const		{ return m_mergeSeconds; }
+
+private:
+	void Close();
+
+private:
+	int									m_listener = -1;
+	// Removed again when the coordinator closes
+	std::string							m_unixPath;
+	std::vector<int>					m_workers;
+	std::vector<DistributedAssignment>	m_assignments;
+	uint32_t							m_width = 0,
+										m_height = 0;
+	uint64_t							m_receivedBytes = 0;
+	double								m_mergeSeconds = 0.;
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// exp2 and log2 for the per pixel passes over the image, scalar and AVX2 versions of the same polynomials
+// so the SIMD pixels of a row and its scalar tail get the same results up to rounding.
+
+// FastExp2 returns 0 below 2^-60, results that small would only make sums denormal and slow
+constexpr float s_fastExp2Min = -60.f;
+
+// 2^x from 2^floor(x) and a polynomial for 2^fraction, ~1e-6 relative error
+inline float FastExp2(float x)
+{
+	if (!(x > s_fastExp2Min))
+		return 0.f;
+	float i = std::floor(x), f = x - i;
+	float p = 1.f + f * (0.693147182f + f * (0.240226507f + f * (0.0555041087f + f * (0.00961812911f + f * 0.00133335581f))));
+	return p * std::bit_cast<float>((static_cast<int32_t>(i) + 127) << 23);
+}
+
+// log2(x) for x > 0 from the exponent and the atanh series of the mantissa folded into [sqrt(1/2), sqrt(2)), ~1e-7 absolute error.
+// 0 gives -127 instead of -infinity
+inline float FastLog2(float x)
+{
+	const uint32_t bits = std::bit_cast<uint32_t>(x);
+	float exponent = static_cast<float>(static_cast<int32_t>(bits >> 23) - 127);
+	float m = std::bit_cast<float>((bits & 0x7fffff) | 0x3f800000);
+	if (m > 1.41421356f)
+	{
+		m *= 0.5f;
+		exponent += 1.f;
+	}
+	const float s = (m - 1.f) / (m + 1.f), s2 = s * s;
+	return exponent + s * (2.88539008f + s2 * (0.961796694f + s2 * (0.577078017f + s2 * (0.412198583f + s2 * 0.320598898f))));
+}
+
+#if defined(__AVX2__)
+// a * b + c, AVX2 doesn't imply FMA and gcc/clang only get -mavx2 from the project
+inline __m256 MulAdd8(__m256 a, __m256 b, __m256 c)
+{
+#if defined(__FMA__)
+	return _mm256_fmadd_ps(a, b, c);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+inline __m256 FastExp2(__m256 x)
+{
+	const __m256 inRange = _mm256_cmp_ps(x, _mm256_set1_ps(s_fastExp2Min), _CMP_GT_OQ);
+	x = _mm256_max_ps(x, _mm256_set1_ps(s_fastExp2Min));
+	__m256 i = _mm256_floor_ps(x), f = _mm256_sub_ps(x, i);
+	__m256 p = MulAdd8(f, _mm256_set1_ps(0.00133335581f), _mm256_set1_ps(0.00961812911f));
+	p = MulAdd8(f, p, _mm256_set1_ps(0.0555041087f));
+	p = MulAdd8(f, p, _mm256_set1_ps(0.240226507f));
+	p = MulAdd8(f, p, _mm256_set1_ps(0.693147182f));
+	p = MulAdd8(f, p, _mm256_set1_ps(1.f));
+	__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(i), _mm256_set1_epi32(127)), 23);
+	return _mm256_and_ps(_mm256_mul_ps(p, _mm256_castsi256_ps(exponent)), inRange);
+}
+
+inline __m256 FastLog2(__m256 x)
+{
+	const __m256i bits = _mm256_castps_si256(x);
+	__m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+	__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x7fffff)), _mm256_set1_epi32(0x3f800000)));
+	const __m256 fold = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+	m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), fold);
+	exponent = _mm256_add_ps(exponent, _mm256_and_ps(fold, _mm256_set1_ps(1.f)));
+	const __m256 s = _mm256_div_ps(_mm256_sub_ps(m, _mm256_set1_ps(1.f)), _mm256_add_ps(m, _mm256_set1_ps(1.f)));
+	const __m256 s2 = _mm256_mul_ps(s, s);
+	__m256 p = MulAdd8(s2, _mm256_set1_ps(0.320598898f), _mm256_set1_ps(0.412198583f));
+	p = MulAdd8(s2, p, _mm256_set1_ps(0.577078017f));
+	p = MulAdd8(s2, p, _mm256_set1_ps(0.961796694f));
+	p = MulAdd8(s2, p, _mm256_set1_ps(2.88539008f));
+	return MulAdd8(s, p, exponent);
+}
+#endif
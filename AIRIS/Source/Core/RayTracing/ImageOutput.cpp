@@ -0,0 +1,767 @@
+#include "ImageOutput.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cstring>
+#include <numeric>
+
+// Writes past the end of the file leave zeros behind, so tiles can land anywhere in formats with a fixed layout
+class ImageEncoder
+{
+public:
+	virtual ~ImageEncoder() = default;
+
+	virtual bool Begin(FILE* file, const ImageDesc& desc) = 0;
+	virtual bool WriteTile(FILE* file, const ImageTile& tile) = 0;
+	virtual bool End(FILE* file) = 0;
+
+	// Values are uint8_t for PNG and float for the others
+	virtual bool IsFloat() const = 0;
+};
+
+namespace
+{
+	bool SeekAndWrite(FILE* file, uint64_t offset, const void* data, size_t size)
+	{
+#ifdef _WIN32
+		const bool seeked = _fseeki64(file, static_cast<int64_t>(offset), SEEK_SET) == 0;
+#else
+		const bool seeked = fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+		return seeked && fwrite(data, 1, size, file) == size;
+	}
+
+	// Counts the pixels the tiles covered, to tell a complete file from one with holes. ImageOutput rejects overlapping tiles,
+	// so the count only reaches the image size once every pixel was written
+	class FixedLayoutEncoder : public ImageEncoder
+	{
+	public:
+		bool IsFloat() const override	{ return true; }
+		bool End(FILE* file) override	{ return m_writtenPixels == static_cast<uint64_t>(m_width) * m_height; }
+
+	protected:
+		uint32_t	m_width = 0,
+					m_height = 0,
+					m_channels = 0;
+		uint64_t	m_writtenPixels = 0;
+	};
+
+	////////////////////////
+	//                    //
+	//        PFM         //
+	//                    //
+	////////////////////////
+
+	// Little endian floats, the rows go bottom to top
+	class PFMEncoder : public FixedLayoutEncoder
+	{
+	public:
+		bool Begin(FILE* file, const ImageDesc& desc) override
+		{
+			if (desc.Channels != 1 && desc.Channels != 3)
+				return false;
+			m_width = desc.Width;
+			m_height = desc.Height;
+			m_channels = desc.Channels;
+			const int headerSize = fprintf(file, "%s\n%u %u\n-1.0\n", desc.Channels == 3 ? "PF" : "Pf", desc.Width, desc.Height);
+			m_headerSize = static_cast<uint64_t>(std::max(headerSize, 0));
+			return headerSize > 0;
+		}
+
+		bool WriteTile(FILE* file, const ImageTile& tile) override
+		{
+			const size_t rowBytes = static_cast<size_t>(tile.Width) * m_channels * sizeof(float);
+			for (uint32_t row = 0; row < tile.Height; ++row)
+			{
+				const uint64_t line = m_height - 1 - (tile.Y + row);
+				const uint64_t offset = m_headerSize + (line * m_width + tile.X) * m_channels * sizeof(float);
+				if (!SeekAndWrite(file, offset, tile.Data.data() + row * rowBytes, rowBytes))
+					return false;
+			}
+			m_writtenPixels += static_cast<uint64_t>(tile.Width) * tile.Height;
+			return true;
+		}
+
+	private:
+		uint64_t	m_headerSize = 0;
+	};
+
+	////////////////////////
+	//                    //
+	//        EXR         //
+	//                    //
+	////////////////////////
+
+	// One scanline per chunk without compression, so every chunk has the same size and the offset table is known up front
+	class EXREncoder : public FixedLayoutEncoder
+	{
+	public:
+		bool Begin(FILE* file, const ImageDesc& desc) override
+		{
+			if (desc.Channels == 0 || (!desc.ChannelNames.empty() && desc.ChannelNames.size() != desc.Channels))
+				return false;
+			m_width = desc.Width;
+			m_height = desc.Height;
+			m_channels = desc.Channels;
+
+			std::vector<std::string> names = desc.ChannelNames;
+			if (names.empty())
+			{
+				static const char* const s_defaultNames[] = { "R", "G", "B", "A" };
+				for (uint32_t c = 0; c < desc.Channels; ++c)
+					names.push_back(desc.Channels == 1 ? "Y" : c < 4 ? s_defaultNames[c] : "C" + std::to_string(c));
+			}
+			// Channels are stored in name order, each one as a run of Width floats per scanline
+			m_channelOrder.resize(desc.Channels);
+			std::iota(m_channelOrder.begin(), m_channelOrder.end(), 0u);
+			std::sort(m_channelOrder.begin(), m_channelOrder.end(), [&](uint32_t a, uint32_t b) { return names[a] < names[b]; });
+			m_channelSlot.resize(desc.Channels);
+			for (uint32_t slot = 0; slot < desc.Channels; ++slot)
+				m_channelSlot[m_channelOrder[slot]] = slot;
+
+			std::vector<uint8_t> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+			auto attribute = [&](const char* name, const char* type, const std::vector<uint8_t>& value)
+			{
+				header.insert(header.end(), name, name + strlen(name) + 1);
+				header.insert(header.end(), type, type + strlen(type) + 1);
+				AppendInt(header, static_cast<int32_t>(value.size()));
+				header.insert(header.end(), value.begin(), value.end());
+			};
+			std::vector<uint8_t> channels;
+			for (uint32_t channel : m_channelOrder)
+			{
+				channels.insert(channels.end(), names[channel].begin(), names[channel].end());
+				channels.push_back(0);
+				// FLOAT, not perceptually linear, x and y sampling of 1
+				AppendInt(channels, 2);
+				channels.insert(channels.end(), { 0, 0, 0, 0 });
+				AppendInt(channels, 1);
+				AppendInt(channels, 1);
+			}
+			channels.push_back(0);
+			std::vector<uint8_t> window;
+			for (int32_t value : { 0, 0, static_cast<int32_t>(desc.Width) - 1, static_cast<int32_t>(desc.Height) - 1 })
+				AppendInt(window, value);
+			std::vector<uint8_t> one, center;
+			AppendInt(one, std::bit_cast<int32_t>(1.f));
+			AppendInt(center, 0);
+			AppendInt(center, 0);
+
+			attribute("channels", "chlist", channels);
+			attribute("compression", "compression", { 0 });
+			attribute("dataWindow", "box2i", window);
+			attribute("displayWindow", "box2i", window);
+			attribute("lineOrder", "lineOrder", { 0 });
+			attribute("pixelAspectRatio", "float", one);
+			attribute("screenWindowCenter", "v2f", center);
+			attribute("screenWindowWidth", "float", one);
+			header.push_back(0);
+
+			// Offset table and the y and size of every chunk, the pixels fill in as tiles arrive
+			m_chunksOffset = header.size() + static_cast<uint64_t>(desc.Height) * sizeof(uint64_t);
+			const uint64_t chunkSize = GetChunkSize();
+			for (uint32_t y = 0; y < desc.Height; ++y)
+			{
+				const uint64_t offset = m_chunksOffset + y * chunkSize;
+				for (int i = 0; i < 8; ++i)
+					header.push_back(static_cast<uint8_t>(offset >> (8 * i)));
+			}
+			if (fwrite(header.data(), 1, header.size(), file) != header.size())
+				return false;
+			for (uint32_t y = 0; y < desc.Height; ++y)
+			{
+				std::vector<uint8_t> chunkHeader;
+				AppendInt(chunkHeader, static_cast<int32_t>(y));
+				AppendInt(chunkHeader, static_cast<int32_t>(chunkSize - 8));
+				if (!SeekAndWrite(file, m_chunksOffset + y * chunkSize, chunkHeader.data(), chunkHeader.size()))
+					return false;
+			}
+			return true;
+		}
+
+		bool WriteTile(FILE* file, const ImageTile& tile) override
+		{
+			const float* values = reinterpret_cast<const float*>(tile.Data.data());
+			m_scratch.resize(tile.Width);
+			for (uint32_t row = 0; row < tile.Height; ++row)
+			{
+				const uint64_t chunk = m_chunksOffset + (tile.Y + row) * GetChunkSize() + 8;
+				for (uint32_t c = 0; c < m_channels; ++c)
+				{
+					for (uint32_t x = 0; x < tile.Width; ++x)
+						m_scratch[x] = values[(static_cast<size_t>(row) * tile.Width + x) * m_channels + c];
+					const uint64_t offset = chunk + (static_cast<uint64_t>(m_channelSlot[c]) * m_width + tile.X) * sizeof(float);
+					if (!SeekAndWrite(file, offset, m_scratch.data(), tile.Width * sizeof(float)))
+						return false;
+				}
+			}
+			m_writtenPixels += static_cast<uint64_t>(tile.Width) * tile.Height;
+			return true;
+		}
+
+	private:
+		static void AppendInt(std::vector<uint8_t>& bytes, int32_t value)
+		{
+			for (int i = 0; i < 4; ++i)
+				bytes.push_back(static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i)));
+		}
+		inline uint64_t GetChunkSize() const { return 8 + static_cast<uint64_t>(m_width) * m_channels * sizeof(float); }
+
+	private:
+		uint64_t				m_chunksOffset = 0;
+		std::vector<uint32_t>	m_channelOrder,
+								m_channelSlot;
+		std::vector<float>		m_scratch;
+	};
+
+	////////////////////////
+	//                    //
+	//        PNG         //
+	//                    //
+	////////////////////////
+
+	struct CRCTable
+	{
+		CRCTable()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+				Table[i] = crc;
+			}
+		}
+		std::array<uint32_t, 256> Table;
+	};
+
+	uint32_t UpdateCRC(uint32_t crc, const uint8_t* data, size_t size)
+	{
+		static const CRCTable s_crc;
+		for (size_t i = 0; i < size; ++i)
+			crc = s_crc.Table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return crc;
+	}
+
+	// zlib stream of one deflate block with the fixed Huffman codes, matches come from hash chains over the last 32KB.
+	// Rendered images are noisy, dynamic codes would gain little over the fixed ones for their cost
+	class DeflateStream
+	{
+	public:
+		DeflateStream()
+		{
+			m_head.fill(-1);
+			m_prev.fill(-1);
+			// CMF/FLG: deflate with a 32KB window, fastest compression level
+			m_out = { 0x78, 0x01 };
+			// BFINAL and BTYPE 01, fixed Huffman codes
+			PutBits(0b011, 3);
+		}
+
+		void Write(const uint8_t* data, size_t size)
+		{
+			for (size_t i = 0; i < size; ++i)
+			{
+				m_adlerA = (m_adlerA + data[i]) % 65521;
+				m_adlerB = (m_adlerB + m_adlerA) % 65521;
+			}
+
+			m_history.insert(m_history.end(), data, data + size);
+			const int64_t end = m_historyBase + static_cast<int64_t>(m_history.size());
+			int64_t position = end - static_cast<int64_t>(size);
+			while (position < end)
+			{
+				uint32_t bestLength = 0, bestDistance = 0;
+				if (position + s_minMatch <= end)
+				{
+					const uint8_t* current = At(position);
+					const uint32_t hash = Hash(current);
+					const uint32_t maxLength = static_cast<uint32_t>(std::min<int64_t>(s_maxMatch, end - position));
+					int64_t candidate = m_head[hash];
+					for (uint32_t chain = 0; chain < s_maxChain && candidate >= 0 && position - candidate <= s_windowSize; ++chain)
+					{
+						const uint8_t* match = At(candidate);
+						uint32_t length = 0;
+						while (length < maxLength && match[length] == current[length])
+							++length;
+						if (length > bestLength)
+						{
+							bestLength = length;
+							bestDistance = static_cast<uint32_t>(position - candidate);
+							if (length == maxLength)
+								break;
+						}
+						candidate = m_prev[candidate & (s_windowSize - 1)];
+					}
+				}
+
+				if (bestLength >= s_minMatch)
+				{
+					PutLength(bestLength);
+					PutDistance(bestDistance);
+				}
+				else
+				{
+					bestLength = 1;
+					PutLiteral(*At(position));
+				}
+				for (uint32_t i = 0; i < bestLength; ++i, ++position)
+				{
+					if (position + s_minMatch <= end)
+						Insert(position);
+				}
+			}
+
+			// Keeps the window, and drops what is older in batches so the erase stays cheap
+			if (m_history.size() > 4 * s_windowSize)
+			{
+				const size_t drop = m_history.size() - s_windowSize;
+				m_history.erase(m_history.begin(), m_history.begin() + drop);
+				m_historyBase += static_cast<int64_t>(drop);
+			}
+		}
+
+		void Finish()
+		{
+			PutSymbol(256);
+			if (m_bitCount > 0)
+				m_out.push_back(static_cast<uint8_t>(m_bits));
+			m_bits = m_bitCount = 0;
+			const uint32_t adler = (m_adlerB << 16) | m_adlerA;
+			for (int i = 3; i >= 0; --i)
+				m_out.push_back(static_cast<uint8_t>(adler >> (8 * i)));
+		}
+
+		// Compressed bytes produced so far, the caller takes them out
+		inline std::vector<uint8_t>& GetOutput() { return m_out; }
+
+	private:
+		static constexpr uint32_t	s_windowSize = 1 << 15,
+									s_hashBits = 15,
+									s_minMatch = 3,
+									s_maxMatch = 258,
+									s_maxChain = 8;
+
+		inline const uint8_t* At(int64_t position) const { return m_history.data() + (position - m_historyBase); }
+		static inline uint32_t Hash(const uint8_t* p)
+		{
+			return ((static_cast<uint32_t>(p[0]) << 16 | static_cast<uint32_t>(p[1]) << 8 | p[2]) * 2654435761u) >> (32 - s_hashBits);
+		}
+		inline void Insert(int64_t position)
+		{
+			const uint32_t hash = Hash(At(position));
+			m_prev[position & (s_windowSize - 1)] = m_head[hash];
+			m_head[hash] = position;
+		}
+
+		inline void PutBits(uint32_t bits, uint32_t count)
+		{
+			m_bits |= static_cast<uint64_t>(bits) << m_bitCount;
+			m_bitCount += count;
+			while (m_bitCount >= 8)
+			{
+				m_out.push_back(static_cast<uint8_t>(m_bits));
+				m_bits >>= 8;
+				m_bitCount -= 8;
+			}
+		}
+		// The fixed codes, bit reversed since Huffman codes go most significant bit first
+		struct FixedCodes
+		{
+			FixedCodes()
+			{
+				for (uint32_t symbol = 0; symbol < 288; ++symbol)
+				{
+					if (symbol < 144)		Set(symbol, 0x30 + symbol, 8);
+					else if (symbol < 256)	Set(symbol, 0x190 + symbol - 144, 9);
+					else if (symbol < 280)	Set(symbol, symbol - 256, 7);
+					else					Set(symbol, 0xc0 + symbol - 280, 8);
+				}
+				for (uint32_t code = 0; code < 30; ++code)
+					Distance[code] = static_cast<uint16_t>(Reverse(code, 5));
+			}
+			static uint32_t Reverse(uint32_t code, uint32_t length)
+			{
+				uint32_t reversed = 0;
+				for (uint32_t bit = 0; bit < length; ++bit)
+					reversed |= (code >> bit & 1) << (length - 1 - bit);
+				return reversed;
+			}
+			void Set(uint32_t symbol, uint32_t code, uint32_t length)
+			{
+				Code[symbol] = static_cast<uint16_t>(Reverse(code, length));
+				Length[symbol] = static_cast<uint8_t>(length);
+			}
+			std::array<uint16_t, 288>	Code;
+			std::array<uint8_t, 288>	Length;
+			std::array<uint16_t, 30>	Distance;
+		};
+		static inline const FixedCodes s_codes;
+
+		inline void PutSymbol(uint32_t symbol) { PutBits(s_codes.Code[symbol], s_codes.Length[symbol]); }
+		inline void PutLiteral(uint8_t value) { PutSymbol(value); }
+		void PutLength(uint32_t length)
+		{
+			static constexpr uint16_t s_base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static constexpr uint8_t s_extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			const uint32_t code = static_cast<uint32_t>(std::upper_bound(std::begin(s_base), std::end(s_base), length) - std::begin(s_base)) - 1;
+			PutSymbol(257 + code);
+			PutBits(length - s_base[code], s_extra[code]);
+		}
+		void PutDistance(uint32_t distance)
+		{
+			static constexpr uint16_t s_base[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+			static constexpr uint8_t s_extra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+			const uint32_t code = static_cast<uint32_t>(std::upper_bound(std::begin(s_base), std::end(s_base), distance) - std::begin(s_base)) - 1;
+			PutBits(s_codes.Distance[code], 5);
+			PutBits(distance - s_base[code], s_extra[code]);
+		}
+
+	private:
+		std::vector<uint8_t>					m_history;
+		int64_t									m_historyBase = 0;
+		std::array<int64_t, 1 << s_hashBits>	m_head;
+		std::array<int64_t, s_windowSize>		m_prev;
+
+		std::vector<uint8_t>	m_out;
+		uint64_t				m_bits = 0;
+		uint32_t				m_bitCount = 0;
+		uint32_t				m_adlerA = 1,
+								m_adlerB = 0;
+	};
+
+	// Rows are filtered and deflated in order as soon as all their pixels arrived, the IDAT chunks go out as they fill
+	class PNGEncoder : public ImageEncoder
+	{
+	public:
+		bool IsFloat() const override { return false; }
+
+		bool Begin(FILE* file, const ImageDesc& desc) override
+		{
+			static constexpr uint8_t s_colorTypes[] = { 0, 4, 2, 6 };
+			if (desc.Channels == 0 || desc.Channels > 4)
+				return false;
+			m_width = desc.Width;
+			m_height = desc.Height;
+			m_channels = desc.Channels;
+			m_rows.resize(desc.Height);
+			m_rowPixels.assign(desc.Height, 0);
+			m_previousRow.assign(static_cast<size_t>(desc.Width) * desc.Channels, 0);
+
+			static constexpr uint8_t s_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+			if (fwrite(s_signature, 1, sizeof(s_signature), file) != sizeof(s_signature))
+				return false;
+			std::vector<uint8_t> header;
+			AppendBigEndian(header, desc.Width);
+			AppendBigEndian(header, desc.Height);
+			// 8 bits per channel, deflate, adaptive filters, no interlacing
+			header.insert(header.end(), { 8, s_colorTypes[desc.Channels - 1], 0, 0, 0 });
+			return WriteChunk(file, "IHDR", header.data(), header.size());
+		}
+
+		bool WriteTile(FILE* file, const ImageTile& tile) override
+		{
+			const size_t rowBytes = static_cast<size_t>(m_width) * m_channels, tileRowBytes = static_cast<size_t>(tile.Width) * m_channels;
+			for (uint32_t row = 0; row < tile.Height; ++row)
+			{
+				std::vector<uint8_t>& dest = m_rows[tile.Y + row];
+				if (dest.empty())
+					dest.resize(rowBytes);
+				memcpy(dest.data() + static_cast<size_t>(tile.X) * m_channels, tile.Data.data() + row * tileRowBytes, tileRowBytes);
+				m_rowPixels[tile.Y + row] += tile.Width;
+			}
+
+			while (m_nextRow < m_height && m_rowPixels[m_nextRow] >= m_width)
+			{
+				EncodeRow(m_rows[m_nextRow]);
+				std::swap(m_previousRow, m_rows[m_nextRow]);
+				std::vector<uint8_t>().swap(m_rows[m_nextRow]);
+				++m_nextRow;
+			}
+			return FlushIDAT(file, s_idatSize);
+		}
+
+		bool End(FILE* file) override
+		{
+			if (m_nextRow < m_height)
+				return false;
+			m_deflate.Finish();
+			return FlushIDAT(file, 1) && WriteChunk(file, "IEND", nullptr, 0);
+		}
+
+	private:
+		// Compressed bytes per IDAT chunk
+		static constexpr size_t s_idatSize = 1 << 16;
+
+		static void AppendBigEndian(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			for (int i = 3; i >= 0; --i)
+				bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+		}
+
+		static bool WriteChunk(FILE* file, const char* type, const uint8_t* data, size_t size)
+		{
+			std::vector<uint8_t> chunk;
+			chunk.reserve(size + 12);
+			AppendBigEndian(chunk, static_cast<uint32_t>(size));
+			chunk.insert(chunk.end(), type, type + 4);
+			if (size > 0)
+				chunk.insert(chunk.end(), data, data + size);
+			AppendBigEndian(chunk, ~UpdateCRC(0xffffffffu, chunk.data() + 4, size + 4));
+			return fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+		}
+
+		bool FlushIDAT(FILE* file, size_t minSize)
+		{
+			std::vector<uint8_t>& out = m_deflate.GetOutput();
+			if (out.size() < minSize)
+				return true;
+			const bool written = WriteChunk(file, "IDAT", out.data(), out.size());
+			out.clear();
+			return written;
+		}
+
+		// One filter over a row, returns the sum of absolute differences. A template so each loop compiles without the switch
+		template<uint8_t Filter>
+		static uint64_t FilterRow(const uint8_t* row, const uint8_t* previous, size_t size, size_t bpp, uint8_t* out)
+		{
+			uint64_t cost = 0;
+			out[0] = Filter;
+			for (size_t i = 0; i < size; ++i)
+			{
+				const int32_t a = i >= bpp ? row[i - bpp] : 0, b = previous[i], c = i >= bpp ? previous[i - bpp] : 0;
+				int32_t predicted = 0;
+				if constexpr (Filter == 1)
+					predicted = a;
+				else if constexpr (Filter == 2)
+					predicted = b;
+				else if constexpr (Filter == 3)
+					predicted = (a + b) / 2;
+				else if constexpr (Filter == 4)
+				{
+					const int32_t p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+					predicted = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+				}
+				const uint8_t value = static_cast<uint8_t>(row[i] - predicted);
+				out[i + 1] = value;
+				cost += static_cast<uint32_t>(std::abs(static_cast<int8_t>(value)));
+			}
+			return cost;
+		}
+
+		// Picks the filter with the smallest sum of absolute differences, the usual heuristic
+		void EncodeRow(const std::vector<uint8_t>& row)
+		{
+			using FilterFunc = uint64_t(*)(const uint8_t*, const uint8_t*, size_t, size_t, uint8_t*);
+			static constexpr FilterFunc s_filters[] = { FilterRow<0>, FilterRow<1>, FilterRow<2>, FilterRow<3>, FilterRow<4> };
+			uint64_t bestCost = UINT64_MAX;
+			m_candidate.resize(row.size() + 1);
+			m_filtered.resize(row.size() + 1);
+			for (FilterFunc filter : s_filters)
+			{
+				const uint64_t cost = filter(row.data(), m_previousRow.data(), row.size(), m_channels, m_candidate.data());
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					std::swap(m_candidate, m_filtered);
+				}
+			}
+			m_deflate.Write(m_filtered.data(), m_filtered.size());
+		}
+
+	private:
+		uint32_t							m_width = 0,
+											m_height = 0,
+											m_channels = 0,
+											m_nextRow = 0;
+		// Rows tiles landed in but that can't be encoded yet, freed once encoded
+		std::vector<std::vector<uint8_t>>	m_rows;
+		std::vector<uint32_t>				m_rowPixels;
+		std::vector<uint8_t>				m_previousRow,
+											m_candidate,
+											m_filtered;
+		DeflateStream						m_deflate;
+	};
+}
+
+bool GetImageFormat(const std::string& path, ImageFormat& format)
+{
+	const size_t dot = path.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string extension = path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+	if (extension == "png")			format = ImageFormat::PNG;
+	else if (extension == "pfm")	format = ImageFormat::PFM;
+	else if (extension == "exr")	format = ImageFormat::EXR;
+	else
+		return false;
+	return true;
+}
+
+ImageOutput::ImageOutput() = default;
+
+ImageOutput::~ImageOutput()
+{
+	Close();
+}
+
+bool ImageOutput::Open(const std::string& path, const ImageDesc& desc)
+{
+	Close();
+	if (desc.Width == 0 || desc.Height == 0)
+		return false;
+	switch (desc.Format)
+	{
+	case ImageFormat::PNG:	m_encoder = std::make_unique<PNGEncoder>(); break;
+	case ImageFormat::PFM:	m_encoder = std::make_unique<PFMEncoder>(); break;
+	case ImageFormat::EXR:	m_encoder = std::make_unique<EXREncoder>(); break;
+	}
+
+	m_file = fopen(path.c_str(), "wb");
+	if (!m_file)
+		return false;
+	m_desc = desc;
+	if (!m_encoder->Begin(m_file, desc))
+	{
+		fclose(m_file);
+		m_file = nullptr;
+		return false;
+	}
+	m_failed = false;
+	m_closing = false;
+	m_coveredRowWords = (desc.Width + 63) / 64;
+	m_covered.assign(static_cast<size_t>(m_coveredRowWords) * desc.Height, 0);
+	m_writer = std::thread(&ImageOutput::WriterLoop, this);
+	return true;
+}
+
+void ImageOutput::SubmitTile(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint8_t* pixels, uint32_t sourceChannels, size_t rowStride)
+{
+	Submit(x, y, width, height, pixels, sourceChannels, rowStride);
+}
+
+void ImageOutput::SubmitTile(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const float* pixels, uint32_t sourceChannels, size_t rowStride)
+{
+	Submit(x, y, width, height, pixels, sourceChannels, rowStride);
+}
+
+template<typename T>
+void ImageOutput::Submit(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const T* pixels, uint32_t sourceChannels, size_t rowStride)
+{
+	if (!m_file)
+		return;
+	if (m_encoder->IsFloat() != std::is_same_v<T, float> || sourceChannels < m_desc.Channels ||
+		x >= m_desc.Width || y >= m_desc.Height || width > m_desc.Width - x || height > m_desc.Height - y)
+	{
+		m_failed = true;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!Cover(x, y, width, height))
+		{
+			m_failed = true;
+			return;
+		}
+	}
+
+	ImageTile tile;
+	tile.X = x;
+	tile.Y = y;
+	tile.Width = width;
+	tile.Height = height;
+	tile.Data.resize(static_cast<size_t>(width) * height * m_desc.Channels * sizeof(T));
+	T* dest = reinterpret_cast<T*>(tile.Data.data());
+	for (uint32_t row = 0; row < height; ++row)
+	{
+		const T* source = pixels + row * rowStride;
+		if (sourceChannels == m_desc.Channels)
+		{
+			memcpy(dest, source, static_cast<size_t>(width) * m_desc.Channels * sizeof(T));
+			dest += static_cast<size_t>(width) * m_desc.Channels;
+			continue;
+		}
+		for (uint32_t pixel = 0; pixel < width; ++pixel, source += sourceChannels)
+		{
+			for (uint32_t c = 0; c < m_desc.Channels; ++c)
+				*dest++ = source[c];
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_spaceCV.wait(lock, [this] { return m_queue.size() < s_maxQueuedTiles; });
+	m_queue.push_back(std::move(tile));
+	lock.unlock();
+	m_queuedCV.notify_one();
+}
+
+bool ImageOutput::Cover(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	if (width == 0 || height == 0)
+		return true;
+	const uint32_t firstWord = x / 64, lastWord = (x + width - 1) / 64;
+	auto wordMask = [&](uint32_t word)
+	{
+		const uint32_t begin = std::max(x, word * 64) - word * 64, end = std::min(x + width, word * 64 + 64) - word * 64;
+		return (end - begin == 64 ? ~0ull : ((1ull << (end - begin)) - 1)) << begin;
+	};
+	for (uint32_t row = y; row < y + height; ++row)
+	{
+		const uint64_t* words = m_covered.data() + static_cast<size_t>(row) * m_coveredRowWords;
+		for (uint32_t word = firstWord; word <= lastWord; ++word)
+		{
+			if (words[word] & wordMask(word))
+				return false;
+		}
+	}
+	for (uint32_t row = y; row < y + height; ++row)
+	{
+		uint64_t* words = m_covered.data() + static_cast<size_t>(row) * m_coveredRowWords;
+		for (uint32_t word = firstWord; word <= lastWord; ++word)
+			words[word] |= wordMask(word);
+	}
+	return true;
+}
+
+bool ImageOutput::Close()
+{
+	if (!m_file)
+		return false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = true;
+	}
+	m_queuedCV.notify_one();
+	m_writer.join();
+
+	bool written = !m_failed && m_encoder->End(m_file);
+	written &= fclose(m_file) == 0;
+	m_file = nullptr;
+	m_encoder.reset();
+	std::vector<uint64_t>().swap(m_covered);
+	return written;
+}
+
+void ImageOutput::WriterLoop()
+{
+	bool failed = false;
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_queuedCV.wait(lock, [this] { return m_closing || !m_queue.empty(); });
+		if (m_queue.empty())
+			break;
+		ImageTile tile = std::move(m_queue.front());
+		m_queue.pop_front();
+		lock.unlock();
+		m_spaceCV.notify_one();
+
+		// After a failure the rest of the tiles are only drained
+		if (!failed)
+			failed = !m_encoder->WriteTile(m_file, tile);
+	}
+	if (failed)
+		m_failed = true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class ImageFormat
+{
+	// 8 bit, deflated with fixed Huffman codes
+	PNG,
+	// 32 bit float, 1 or 3 channels
+	PFM,
+	// 32 bit float scanlines, uncompressed
+	EXR,
+};
+
+// From the extension of path, false for anything else
+bool GetImageFormat(const std::string& path, ImageFormat& format);
+
+struct ImageDesc
+{
+	uint32_t					Width = 0,
+								Height = 0,
+								Channels = 3;
+	ImageFormat					Format = ImageFormat::PNG;
+	// EXR only, R G B A (Y for one channel) if empty
+	std::vector<std::string>	ChannelNames;
+};
+
+struct ImageTile
+{
+	uint32_t				X = 0,
+							Y = 0,
+							Width = 0,
+							Height = 0;
+	// Rows of Width * Channels values, uint8_t for PNG and float for PFM and EXR
+	std::vector<uint8_t>	Data;
+};
+
+class ImageEncoder;
+
+// Writes an image as the renderer finishes tiles of it, tiles are copied and encoded on a background thread.
+// PFM and EXR have a fixed layout, tiles go straight to their place in the file. PNG rows are encoded in order,
+// a row waits in memory until every tile covering it arrived, so row or tile order renders keep a few rows buffered.
+class ImageOutput
+{
+public:
+	ImageOutput();
+	~ImageOutput();
+
+	ImageOutput(const ImageOutput&) = delete;
+	ImageOutput& operator=(const ImageOutput&) = delete;
+
+	// Creates path and starts the writer thread, false if the file can't be created or the format can't hold the channels
+	bool Open(const std::string& path, const ImageDesc& desc);
+	inline bool				IsOpen() const	{ return m_file != nullptr; }
+	inline const ImageDesc&	GetDesc() const	{ return m_desc; }
+
+	// pixels points at the top left of the tile, rows are rowStride values apart and pixels sourceChannels values apart,
+	// the first Channels values of each pixel are written. Blocks while s_maxQueuedTiles tiles wait to be encoded.
+	// Every pixel is submitted once, a tile overlapping an earlier one fails the image
+	void SubmitTile(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint8_t* pixels, uint32_t sourceChannels, size_t rowStride);
+	void SubmitTile(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const float* pixels, uint32_t sourceChannels, size_t rowStride);
+
+	// Waits for the queued tiles and finishes the file, false if a write failed, a tile didn't fit the format or pixels are missing
+	bool Close();
+
+	// Tiles copied but not encoded yet are bounded by this, with the tile size it bounds the memory of the queue
+	static constexpr uint32_t s_maxQueuedTiles = 16;
+
+private:
+	template<typename T>
+	void Submit(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const T* pixels, uint32_t sourceChannels, size_t rowStride);
+	// Marks the tile's pixels as submitted, false if one of them already was
+	bool Cover(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+	void WriterLoop();
+
+private:
+	ImageDesc						m_desc;
+	FILE*							m_file = nullptr;
+	std::unique_ptr<ImageEncoder>	m_encoder;
+	// Set by submitting threads and the writer
+	std::atomic<bool>				m_failed = false;
+	// A bit per submitted pixel, rows start on a new word
+	std::vector<uint64_t>			m_covered;
+	uint32_t						m_coveredRowWords = 0;
+
+	std::thread						m_writer;
+	std::mutex						m_mutex;
+	std::condition_variable			m_queuedCV,
+									m_spaceCV;
+	std::deque<ImageTile>			m_queue;
+	bool							m_closing = false;
+};
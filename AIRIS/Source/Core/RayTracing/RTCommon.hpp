@@ -0,0 +1,56 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <cstdint>
+
+// CPU counterparts of the helpers in Assets/Shaders/RT.hlsl, kept as close to the shader as possible
+// so the CPU tracer converges to the same image as the compute shader.
+
+#define RT_FLOATMAX 3.402823466e+38f
+#define RT_UINTMAX 0xffffffff
+
+struct Ray
+{
+	glm::vec3 Origin;
+	glm::vec3 Direction;
+
+	inline glm::vec3 At(float t) const { return Origin + t * Direction; }
+};
+
+struct HitRecord
+{
+	glm::vec3	Pos;
+	glm::vec3	Normal;
+	float		T = RT_FLOATMAX;
+	bool		FrontFace = true;
+	uint32_t	MaterialIndex = 0;
+	// Sphere that was hit, in the order of RTScene::GetSpheres
+	uint32_t	PrimIndex = RT_UINTMAX;
+
+	inline void SetFaceNormal(const Ray& r, const glm::vec3& outwardNormal)
+	{
+		FrontFace = glm::dot(r.Direction, outwardNormal) < 0;
+		Normal = FrontFace ? outwardNormal : -outwardNormal;
+	}
+};
+
+// PCG hash stream, same constants and output permutation as rand_pcg in RT.hlsl
+struct PCGRandom
+{
+	uint32_t State = 0;
+
+	PCGRandom() = default;
+	explicit PCGRandom(uint32_t seed) : State(seed) {}
+
+	inline uint32_t Next()
+	{
+		uint32_t state = State;
+		State = State * 747796405u + 2891336453u;
+		uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	inline float GetFloat()			{ return Next() / float(RT_UINTMAX); }
+	inline float GetSFloat()		{ return (GetFloat() - 0.5f) * 2; }
+	inline glm::vec3 GetFloat3()	{ return { GetFloat(), GetFloat(), GetFloat() }; }
+	inline glm::vec3 GetSFloat3()	{ return { GetSFloat(), GetSFloat(), GetSFloat() }; }
+};
@@ -0,0 +1,425 @@
+#include "RTScene.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <random>
+
+RTScene::RTScene(std::vector<RTSphere> spheres, std::vector<RTMaterial> materials)
+	:m_spheres(std::move(spheres)), m_materials(std::move(materials))
+{
+	for (uint32_t i = 0; i < m_spheres.size(); ++i)
+	{
+		m_sphereSlots.push_back(i);
+		m_sphereIds.push_back(i);
+	}
+	GatherLights();
+}
+
+uint32_t RTScene::AddMaterial(const RTMaterial& material)
+{
+	m_materials.push_back(material);
+	return static_cast<uint32_t>(m_materials.size() - 1);
+}
+
+void RTScene::AddSphere(const RTSphere& sphere)
+{
+	m_sphereSlots.push_back(static_cast<uint32_t>(m_spheres.size()));
+	m_sphereIds.push_back(static_cast<uint32_t>(m_spheres.size()));
+	m_spheres.push_back(sphere);
+	m_rebuildJob.reset();
+	m_bvh.Clear();
+	m_sphereSoA = {};
+	if (m_materials[sphere.MaterialIndex].Type == MTType::Emissive)
+		m_lights.push_back(static_cast<uint32_t>(m_spheres.size() - 1));
+}
+
+void RTScene::AddMesh(TriangleBLAS mesh)
+{
+	m_meshes.push_back(std::move(mesh));
+}
+
+bool RTScene::UpdateInstances(ThreadPool* pool)
+{
+	return m_tlas.Update(InstanceBVHSettings(), 1.3f, pool);
+}
+
+void RTScene::Build(const BVHBuildSettings& settings, ThreadPool* pool)
+{
+	// A rebuild still running was started for the old tree
+	m_rebuildJob.reset();
+	m_bvh.Build(GetSphereBounds(), settings, pool);
+	ReorderSpheres(m_bvh.GetPrimIndices());
+	m_sahCost = m_builtSAHCost = m_bvh.SAHCost();
+	m_spheresMoved = false;
+	UpdateInstances(pool);
+}
+
+void RTScene::ReorderSpheres(const std::vector<uint32_t>& order)
+{
+	std::vector<RTSphere> ordered(m_spheres.size());
+	std::vector<uint32_t> ids(m_spheres.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		ordered[i] = m_spheres[order[i]];
+		ids[i] = m_sphereIds[order[i]];
+		m_sphereSlots[ids[i]] = static_cast<uint32_t>(i);
+	}
+	m_spheres = std::move(ordered);
+	m_sphereIds = std::move(ids);
+	m_sphereSoA.Build(m_spheres);
+	GatherLights();
+}
+
+std::vector<AABB> RTScene::GetSphereBounds() const
+{
+	std::vector<AABB> bounds(m_spheres.size());
+	for (size_t i = 0; i < m_spheres.size(); ++i)
+		bounds[i] = SphereBounds(m_spheres[i]);
+	return bounds;
+}
+
+void RTScene::MoveSphere(uint32_t id, const glm::vec3& position)
+{
+	const uint32_t slot = m_sphereSlots[id];
+	m_spheres[slot].Posiition = position;
+	if (m_sphereSoA.GetCount() > 0)
+		m_sphereSoA.Set(slot, m_spheres[slot]);
+	m_spheresMoved = true;
+}
+
+BVHUpdateStats RTScene::UpdateSpheres(const BVHUpdatePolicy& policy)
+{
+	BVHUpdateStats stats;
+	if (m_bvh.IsEmpty())
+		return stats;
+
+	if (m_rebuildJob && m_rebuildJob->IsDone())
+	{
+		// Built over the positions from when it started, the refit below catches up with the moves since.
+		// Nothing reordered the spheres meanwhile, so its leaves still refer to the current slots
+		m_builtSAHCost = m_rebuildJob->GetSAHCost();
+		m_bvh = m_rebuildJob->Take();
+		ReorderSpheres(m_bvh.GetPrimIndices());
+		m_spheresMoved = true;
+		stats.Rebuilt = true;
+	}
+
+	if (m_spheresMoved)
+	{
+		m_sahCost = m_bvh.Refit(GetSphereBounds());
+		m_spheresMoved = false;
+		stats.Refit = true;
+	}
+
+	const bool rebuilding = m_rebuildJob && m_rebuildJob->IsRunning();
+	if (!rebuilding && m_sahCost > policy.RebuildThreshold * m_builtSAHCost)
+	{
+		if (policy.BackgroundRebuild)
+		{
+			if (!m_rebuildJob)
+				m_rebuildJob = std::make_unique<BVHBuildJob>();
+			m_rebuildJob->Start(GetSphereBounds(), m_bvh.GetSettings());
+			stats.RebuildStarted = true;
+		}
+		else
+		{
+			Build(m_bvh.GetSettings());
+			stats.Rebuilt = true;
+		}
+	}
+
+	stats.SAHCost = m_sahCost;
+	stats.BuiltSAHCost = m_builtSAHCost;
+	return stats;
+}
+
+void RTScene::GatherLights()
+{
+	m_lights.clear();
+	for (size_t i = 0; i < m_spheres.size(); ++i)
+	{
+		if (m_materials[m_spheres[i].MaterialIndex].Type == MTType::Emissive)
+			m_lights.push_back(static_cast<uint32_t>(i));
+	}
+}
+
+bool RTScene::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+	bool hitSomething = HitSpheres(r, tMin, tMax, rec);
+	for (const TriangleBLAS& mesh : m_meshes)
+	{
+		if (mesh.Hit(r, tMin, hitSomething ? rec.T : tMax, rec))
+		{
+			hitSomething = true;
+			rec.PrimIndex = RT_UINTMAX;
+		}
+	}
+	if (!m_tlas.IsEmpty() && m_tlas.Hit(r, tMin, hitSomething ? rec.T : tMax, rec))
+	{
+		hitSomething = true;
+		rec.PrimIndex = RT_UINTMAX;
+	}
+	return hitSomething;
+}
+
+bool RTScene::HitSpheres(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+	if (!m_bvh.IsEmpty())
+	{
+		uint32_t closestSphere = RT_UINTMAX;
+		m_bvh.Traverse(r, tMin, tMax, [&](uint32_t first, uint32_t count, float& closest)
+		{
+			uint32_t sphere = m_sphereSoA.Intersect(r, first, count, tMin, closest);
+			if (sphere == RT_UINTMAX)
+				return false;
+			closestSphere = sphere;
+			return true;
+		});
+
+		if (closestSphere == RT_UINTMAX)
+			return false;
+		m_sphereSoA.GetHitRecord(r, closestSphere, tMax, rec);
+		return true;
+	}
+
+	bool hitSomething = false;
+	for (size_t i = 0; i < m_spheres.size(); ++i)
+	{
+		if (HitSphere(m_spheres[i], r, tMin, tMax, rec))
+		{
+			hitSomething = true;
+			tMax = rec.T;
+			rec.PrimIndex = static_cast<uint32_t>(i);
+		}
+	}
+	return hitSomething;
+}
+
+bool RTScene::Occluded(const Ray& r, float tMin, float tMax) const
+{
+	for (const TriangleBLAS& mesh : m_meshes)
+	{
+		if (mesh.Occluded(r, tMin, tMax))
+			return true;
+	}
+	if (!m_tlas.IsEmpty() && m_tlas.Occluded(r, tMin, tMax))
+		return true;
+	return OccludedSpheres(r, tMin, tMax);
+}
+
+bool RTScene::OccludedSpheres(const Ray& r, float tMin, float tMax) const
+{
+	if (!m_bvh.IsEmpty())
+	{
+		// Pulling tMax down to tMin culls every node left on the stack
+		return m_bvh.Traverse(r, tMin, tMax, [&](uint32_t first, uint32_t count, float& closest)
+		{
+			if (m_sphereSoA.Intersect(r, first, count, tMin, closest) == RT_UINTMAX)
+				return false;
+			closest = tMin;
+			return true;
+		});
+	}
+
+	HitRecord rec;
+	for (const RTSphere& sphere : m_spheres)
+	{
+		if (HitSphere(sphere, r, tMin, tMax, rec))
+			return true;
+	}
+	return false;
+}
+
+uint64_t RTScene::HitPacket(RayPacket& packet, HitRecord* recs) const
+{
+	static_assert(RT_PACKET_SIZE <= 64, "Hit masks are 64 bit");
+	uint64_t hitMask = 0;
+
+	// Divergent packets would make the intervals useless, fall back to single rays. Wide BVHs have no packet traversal either.
+	if (m_bvh.IsEmpty() || m_bvh.IsWide() || !packet.SameOctant)
+	{
+		for (uint32_t i = 0; i < packet.Count; ++i)
+		{
+			if (Hit(packet.GetRay(i), packet.TMin, packet.TMax[i], recs[i]))
+			{
+				hitMask |= 1ull << i;
+				packet.TMax[i] = recs[i].T;
+			}
+		}
+		return hitMask;
+	}
+
+	m_bvh.TraversePacket(packet, [&](const BVHNode& leaf, uint32_t firstRay)
+	{
+		for (uint32_t i = firstRay; i < packet.Count; ++i)
+		{
+			if (!packet.RayHitsAABB(i, leaf.Min, leaf.Max))
+				continue;
+			uint32_t sphere = m_sphereSoA.Intersect(packet.GetRay(i), leaf.LeftFirst, leaf.PrimCount, packet.TMin, packet.TMax[i]);
+			if (sphere != RT_UINTMAX)
+				packet.Prim[i] = sphere;
+		}
+	});
+
+	for (uint32_t i = 0; i < packet.Count; ++i)
+	{
+		if (packet.Prim[i] != RT_UINTMAX)
+		{
+			m_sphereSoA.GetHitRecord(packet.GetRay(i), packet.Prim[i], packet.TMax[i], recs[i]);
+			hitMask |= 1ull << i;
+		}
+
+		// Meshes one ray at a time, behind the closest sphere
+		for (const TriangleBLAS& mesh : m_meshes)
+		{
+			if (mesh.Hit(packet.GetRay(i), packet.TMin, packet.TMax[i], recs[i]))
+			{
+				hitMask |= 1ull << i;
+				packet.TMax[i] = recs[i].T;
+				recs[i].PrimIndex = RT_UINTMAX;
+			}
+		}
+		if (!m_tlas.IsEmpty() && m_tlas.Hit(packet.GetRay(i), packet.TMin, packet.TMax[i], recs[i]))
+		{
+			hitMask |= 1ull << i;
+			packet.TMax[i] = recs[i].T;
+			recs[i].PrimIndex = RT_UINTMAX;
+		}
+	}
+	return hitMask;
+}
+
+RTScene RTScene::CreateRTIAWFinal(uint32_t seed, int gridExtent)
+{
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	auto random = [&](float min = 0.f, float max = 1.f) { return min + (max - min) * dist(gen); };
+
+	RTScene scene;
+
+	// GROUND
+	uint32_t groundMat = scene.AddMaterial({ {0.5f, 0.5f, 0.5f}, MTType::Diffuse, 0.f });
+	scene.AddSphere({ {0.f, -1000.f, 0.f}, 1000.f, groundMat });
+
+	// SMALL RANDOM SPHERES
+	for (int a = -gridExtent; a < gridExtent; a++)
+	{
+		for (int b = -gridExtent; b < gridExtent; b++)
+		{
+			float chooseMat = random();
+			glm::vec3 center(a + 0.9f * random(), 0.2f, b + 0.9f * random());
+
+			if (glm::length(center - glm::vec3(4.f, 0.2f, 0.f)) <= 0.9f)
+				continue;
+
+			RTMaterial mat;
+			if (chooseMat < 0.8f)
+				mat = { glm::vec3(random(), random(), random()) * glm::vec3(random(), random(), random()), MTType::Diffuse, 0.f };
+			else if (chooseMat < 0.95f)
+				mat = { glm::vec3(random(0.5f, 1.f), random(0.5f, 1.f), random(0.5f, 1.f)), MTType::Metal, random(0.f, 0.5f) };
+			else
+				mat = { glm::vec3(1.f), MTType::Dielectric, 0.f };
+
+			scene.AddSphere({ center, 0.2f, scene.AddMaterial(mat) });
+		}
+	}
+
+	// BIG SPHERES
+	scene.AddSphere({ {0.f, 1.f, 0.f}, 1.f, scene.AddMaterial({ glm::vec3(1.f), MTType::Dielectric, 0.f }) });
+	scene.AddSphere({ {-4.f, 1.f, 0.f}, 1.f, scene.AddMaterial({ {0.4f, 0.2f, 0.1f}, MTType::Diffuse, 0.f }) });
+	scene.AddSphere({ {4.f, 1.f, 0.f}, 1.f, scene.AddMaterial({ {0.7f, 0.6f, 0.5f}, MTType::Metal, 0.f }) });
+
+	return scene;
+}
+
+void RTScene::AddCornellRoom()
+{
+	RTScene& scene = *this;
+
+	// WALLS, big enough that their curvature barely shows, small enough to stay precise in floats
+	const float wallRadius = 1e4f;
+	uint32_t	white = scene.AddMaterial({ {0.75f, 0.75f, 0.75f}, MTType::Diffuse, 0.f }),
+				red = scene.AddMaterial({ {0.75f, 0.25f, 0.25f}, MTType::Diffuse, 0.f }),
+				blue = scene.AddMaterial({ {0.25f, 0.25f, 0.75f}, MTType::Diffuse, 0.f });
+	scene.AddSphere({ {-wallRadius, 40.f, 85.f}, wallRadius, blue });
+	scene.AddSphere({ {100.f + wallRadius, 40.f, 85.f}, wallRadius, red });
+	scene.AddSphere({ {50.f, 40.f, -wallRadius}, wallRadius, white });
+	scene.AddSphere({ {50.f, 40.f, 170.f + wallRadius}, wallRadius, white });
+	scene.AddSphere({ {50.f, -wallRadius, 85.f}, wallRadius, white });
+	scene.AddSphere({ {50.f, 80.f + wallRadius, 85.f}, wallRadius, white });
+
+	// LIGHT
+	scene.AddSphere({ {50.f, 72.f, 81.6f}, 5.f, scene.AddMaterial({ glm::vec3(50.f), MTType::Emissive, 0.f }) });
+}
+
+RTScene RTScene::CreateCornellBox()
+{
+	RTScene scene;
+	scene.AddCornellRoom();
+	scene.AddSphere({ {27.f, 16.5f, 47.f}, 16.5f, scene.AddMaterial({ {0.95f, 0.95f, 0.95f}, MTType::Metal, 0.f }) });
+	scene.AddSphere({ {73.f, 16.5f, 78.f}, 16.5f, scene.AddMaterial({ glm::vec3(1.f), MTType::Dielectric, 0.f }) });
+	return scene;
+}
+
+RTScene RTScene::CreateCornellMeshes(uint32_t torusTriangles, ThreadPool* pool)
+{
+	RTScene scene;
+	scene.AddCornellRoom();
+
+	// Unit cube scaled and turned on the floor, the renderer's cube spans z in [0, 1]
+	TriangleMeshData cube = TriangleMeshData::CreateCube();
+	glm::mat4 cubeTransform = glm::translate(glm::mat4(1.f), glm::vec3(30.f, 15.f, 50.f));
+	cubeTransform = glm::rotate(cubeTransform, glm::radians(30.f), glm::vec3(0.f, 1.f, 0.f));
+	cubeTransform = glm::scale(cubeTransform, glm::vec3(30.f));
+	cubeTransform = glm::translate(cubeTransform, glm::vec3(0.f, 0.f, -0.5f));
+	TriangleBLAS cubeBLAS;
+	cubeBLAS.Build(cube.GetView(), scene.AddMaterial({ {0.75f, 0.75f, 0.75f}, MTType::Diffuse, 0.f }), cubeTransform, {}, pool);
+	scene.AddMesh(std::move(cubeBLAS));
+
+	// Torus standing up on the right
+	uint32_t rings = std::max(static_cast<uint32_t>(sqrtf(torusTriangles / 8.f)), 3u);
+	TriangleMeshData torus = TriangleMeshData::CreateTorus(14.f, 6.f, 4 * rings, rings);
+	glm::mat4 torusTransform = glm::translate(glm::mat4(1.f), glm::vec3(72.f, 20.f, 80.f));
+	torusTransform = glm::rotate(torusTransform, glm::radians(70.f), glm::vec3(1.f, 0.f, 0.f));
+	TriangleBLAS torusBLAS;
+	torusBLAS.Build(torus.GetView(), scene.AddMaterial({ {0.8f, 0.6f, 0.2f}, MTType::Metal, 0.f }), torusTransform, {}, pool);
+	scene.AddMesh(std::move(torusBLAS));
+
+	return scene;
+}
+
+RTScene RTScene::CreateCornellInstances(uint32_t instanceCount, uint32_t seed, ThreadPool* pool)
+{
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+	RTScene scene;
+	scene.AddCornellRoom();
+	const uint32_t materials[] =
+	{
+		scene.AddMaterial({ {0.75f, 0.75f, 0.75f}, MTType::Diffuse, 0.f }),
+		scene.AddMaterial({ {0.8f, 0.6f, 0.2f}, MTType::Metal, 0.f }),
+		scene.AddMaterial({ {0.2f, 0.6f, 0.3f}, MTType::Diffuse, 0.f }),
+	};
+
+	// Unit torus, outer radius 1
+	TriangleBLAS torus;
+	torus.Build(TriangleMeshData::CreateTorus(0.7f, 0.3f, 64, 16).GetView(), materials[0], glm::mat4(1.f), {}, pool);
+	const uint32_t blas = scene.GetTLAS().AddBLAS(std::move(torus));
+
+	// Square grid over the floor in front of the camera, one torus per cell
+	const uint32_t	side = std::max(static_cast<uint32_t>(ceilf(sqrtf(static_cast<float>(instanceCount)))), 1u);
+	const float		extentX = 90.f, extentZ = 120.f,
+					cell = std::min(extentX, extentZ) / side,
+					radius = 0.4f * cell;
+	for (uint32_t i = 0; i < instanceCount; ++i)
+	{
+		glm::vec3 center(5.f + extentX * ((i % side) + 0.5f) / side, radius, 20.f + extentZ * ((i / side) + 0.5f) / side);
+		glm::mat4 transform = glm::translate(glm::mat4(1.f), center);
+		transform = glm::rotate(transform, glm::radians(360.f * dist(gen)), glm::vec3(0.f, 1.f, 0.f));
+		transform = glm::rotate(transform, glm::radians(180.f * dist(gen)), glm::vec3(1.f, 0.f, 0.f));
+		transform = glm::scale(transform, glm::vec3(radius));
+		scene.GetTLAS().AddInstance(blas, transform, materials[std::min(static_cast<uint32_t>(dist(gen) * 3.f), 2u)]);
+	}
+
+	scene.UpdateInstances(pool);
+	return scene;
+}
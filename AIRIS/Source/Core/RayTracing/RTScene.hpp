@@ -0,0 +1,158 @@
+#pragma once
+#include "Core/Graphics/RTHelper.hpp"
+#include "RTCommon.hpp"
+#include "BVH.hpp"
+#include "SphereSoA.hpp"
+#include "TLAS.hpp"
+#include "TriangleBLAS.hpp"
+#include <memory>
+#include <vector>
+
+// Sphere::Hit from RT.hlsl, the ray direction is expected to be normalized
+inline bool HitSphere(const RTSphere& sphere, const Ray& r, float tMin, float tMax, HitRecord& rec)
+{
+	glm::vec3	oc = r.Origin - sphere.Posiition;
+	float		halfB = glm::dot(oc, r.Direction),
+				c = glm::dot(oc, oc) - sphere.Radius * sphere.Radius,
+				discriminant = halfB * halfB - c;
+
+	if (discriminant < 0)
+		return false;
+
+	float sqrtd = sqrtf(discriminant);
+
+	// Find the nearest root that lies in the acceptable range.
+	float t = -halfB - sqrtd;
+	if (t <= tMin || tMax <= t)
+	{
+		t = -halfB + sqrtd;
+		if (t <= tMin || tMax <= t)
+			return false;
+	}
+
+	rec.T = t;
+	rec.Pos = r.At(t);
+	rec.SetFaceNormal(r, (rec.Pos - sphere.Posiition) / sphere.Radius);
+	rec.MaterialIndex = sphere.MaterialIndex;
+	return true;
+}
+
+inline AABB SphereBounds(const RTSphere& sphere)
+{
+	return { sphere.Posiition - glm::vec3(sphere.Radius), sphere.Posiition + glm::vec3(sphere.Radius) };
+}
+
+// Leaves sized for the SIMD sphere kernel, a full register of spheres costs about as much as one
+inline BVHBuildSettings SphereBVHSettings()
+{
+	BVHBuildSettings settings;
+	settings.MaxLeafSize = std::max(4, RT_SPHERE_SIMD_WIDTH);
+	settings.LeafBatchSize = RT_SPHERE_SIMD_WIDTH;
+	return settings;
+}
+
+// How RTScene::UpdateSpheres keeps the BVH in shape while spheres move
+struct BVHUpdatePolicy
+{
+	// A rebuild starts once refitting made the SAH cost this many times the cost of the last build
+	float	RebuildThreshold = 1.3f;
+	// Build the replacement on a thread of its own and keep refitting until it is done, otherwise rebuild right away
+	bool	BackgroundRebuild = true;
+};
+
+// What one RTScene::UpdateSpheres call did
+struct BVHUpdateStats
+{
+	float	SAHCost = 0.f,
+			BuiltSAHCost = 0.f;
+	bool	Refit = false,
+			RebuildStarted = false,
+			Rebuilt = false;
+};
+
+// Geometry and materials consumed by the CPU tracer, same data the compute shader gets through its structured buffers
+class RTScene
+{
+public:
+	RTScene() = default;
+	RTScene(std::vector<RTSphere> spheres, std::vector<RTMaterial> materials);
+
+	uint32_t AddMaterial(const RTMaterial& material);
+	void AddSphere(const RTSphere& sphere);
+	// Meshes come with their BLAS already built and are tested after the spheres, hits on them leave HitRecord::PrimIndex at RT_UINTMAX
+	void AddMesh(TriangleBLAS mesh);
+	// Instanced meshes, tested after the meshes above. Call UpdateInstances (or Build) after adding or moving instances
+	inline TLAS&							GetTLAS()				{ return m_tlas; }
+	inline const TLAS&						GetTLAS() const			{ return m_tlas; }
+	bool UpdateInstances(ThreadPool* pool = nullptr);
+
+	// Builds the BVH and reorders the spheres so BVH leaves index them directly, then fills the SoA copy leaves are tested with.
+	// Until it is called (and after the spheres change) Hit falls back to testing every sphere. Also updates the TLAS.
+	// A pool builds the BVH in parallel.
+	void Build(const BVHBuildSettings& settings = SphereBVHSettings(), ThreadPool* pool = nullptr);
+
+	inline const std::vector<RTSphere>&		GetSpheres() const		{ return m_spheres; }
+	inline const std::vector<RTMaterial>&	GetMaterials() const	{ return m_materials; }
+	inline const std::vector<TriangleBLAS>&	GetMeshes() const		{ return m_meshes; }
+	inline const BVH&						GetBVH() const			{ return m_bvh; }
+	inline const SphereSoA&					GetSphereSoA() const	{ return m_sphereSoA; }
+	// Indices of the spheres with an Emissive material, sampled by next event estimation
+	inline const std::vector<uint32_t>&		GetLights() const		{ return m_lights; }
+
+	// ANIMATION
+	// Spheres keep the order they were added in as their id, while GetSpheres is in BVH leaf order
+	inline const RTSphere&					GetSphere(uint32_t id) const	{ return m_spheres[m_sphereSlots[id]]; }
+	void MoveSphere(uint32_t id, const glm::vec3& position);
+	// Brings the BVH up to date with the moved spheres, to be called between frames and never while tracing.
+	// Refits the BVH and starts a rebuild once the SAH cost degraded past the policy's threshold.
+	// A background rebuild is handed over through an atomic flag when it is done and swapped in by the next call.
+	BVHUpdateStats UpdateSpheres(const BVHUpdatePolicy& policy = {});
+
+	// HitHittableList, finds the closest sphere hit in (tMin, tMax)
+	bool Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+	// Closest hits for a whole packet, rays in [packet.TMin, packet.TMax[i]).
+	// Packets that don't share an octant are traced one ray at a time. Returns one bit per hit ray.
+	uint64_t HitPacket(RayPacket& packet, HitRecord* recs) const;
+	// Shadow ray query, true if anything is hit in (tMin, tMax). Stops at the first hit instead of looking for the closest one.
+	bool Occluded(const Ray& r, float tMin, float tMax) const;
+
+	// Final scene of Ray Tracing In One Weekend, a (2 * gridExtent)^2 grid of small random spheres around three big ones
+	static RTScene CreateRTIAWFinal(uint32_t seed = 0, int gridExtent = 11);
+	// Closed box of large spheres lit only by a small emissive sphere below the ceiling, a mirror and a glass ball on the floor.
+	// The box spans [0, 100] x [0, 80] x [0, 170] and is seen from z = 165.
+	static RTScene CreateCornellBox();
+	// Cornell box with the spheres swapped for a cube and a torus of roughly torusTriangles triangles.
+	// The scene factories build their BLASes and TLAS on pool if given
+	static RTScene CreateCornellMeshes(uint32_t torusTriangles = 1 << 20, ThreadPool* pool = nullptr);
+	// Cornell box with a grid of instanceCount small tori on the floor, all instances of one BLAS with randomly picked materials and rotations
+	static RTScene CreateCornellInstances(uint32_t instanceCount = 10000, uint32_t seed = 0, ThreadPool* pool = nullptr);
+
+private:
+	void GatherLights();
+	// Puts the spheres in leaf order, slot i takes the sphere in slot order[i]
+	void ReorderSpheres(const std::vector<uint32_t>& order);
+	std::vector<AABB> GetSphereBounds() const;
+	// Walls and light shared by the Cornell box scenes
+	void AddCornellRoom();
+
+	bool HitSpheres(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+	bool OccludedSpheres(const Ray& r, float tMin, float tMax) const;
+
+private:
+	std::vector<RTSphere>		m_spheres;
+	// Sphere id to its slot in m_spheres and back
+	std::vector<uint32_t>		m_sphereSlots,
+								m_sphereIds;
+	std::vector<RTMaterial>		m_materials;
+	std::vector<uint32_t>		m_lights;
+	std::vector<TriangleBLAS>	m_meshes;
+	TLAS						m_tlas;
+	BVH							m_bvh;
+	SphereSoA					m_sphereSoA;
+
+	// ANIMATION
+	float						m_sahCost = 0.f,
+								m_builtSAHCost = 0.f;
+	bool						m_spheresMoved = false;
+	std::unique_ptr<BVHBuildJob>	m_rebuildJob;
+};
@@ -0,0 +1,226 @@
+#pragma once
+#include "Core/Graphics/Camera.hpp"
+#include "Core/Graphics/RTHelper.hpp"
+#include "RTCommon.hpp"
+#include "RTScene.hpp"
+#include "Sampler.hpp"
+#include "Warp.hpp"
+#include <algorithm>
+
+// Camera ray generation, material scattering and light sampling of rtiaw.hlsl, shared by every CPU tracing mode
+
+// What a path carries from one bounce to the next
+struct PathState
+{
+	glm::vec3	Throughput = glm::vec3(1.f),
+				Radiance = glm::vec3(0.f);
+	// Solid angle pdf the current ray was scattered with, 0 for camera rays and specular bounces that light sampling can't reproduce
+	float		ScatterPdf = 0.f;
+};
+
+inline Ray GetRay(float u, float v, const RTCameraSD& cam, PathSampler& sampler)
+{
+	glm::vec2 jitter = sampler.Get2D() - 0.5f;
+	//				TL Pixel Center		Move to pixel for this thread		RANDOM OFFSET WITHIN THE PIXEL/NOT INTRUDING ON SURROUNDING PIXELS
+	glm::vec3 pixelLoc = cam.Pixel00Center + (u * cam.PixelDeltaX + v * cam.PixelDeltaY) + (cam.PixelDeltaX * jitter.x + cam.PixelDeltaY * jitter.y);
+
+	Ray r;
+	glm::vec2 randOffset = SampleConcentricDisk(sampler.Get2D());
+	r.Origin = cam.Position + (cam.LensDefocusX * randOffset.x) + (cam.LensDefocusY * randOffset.y);
+	r.Direction = glm::normalize(pixelLoc - r.Origin);
+
+	return r;
+}
+
+inline glm::vec3 SkyColor(const Ray& ray)
+{
+	float a = 0.5f * (ray.Direction.y + 1.f);
+	return (1.f - a) * glm::vec3(1.f, 1.f, 1.f) + a * glm::vec3(0.5f, 0.7f, 1.f);
+}
+
+inline float Reflectance(float cosine, float refIdx)
+{
+	// Use Schlick's approximation for reflectance.
+	float r0 = (1 - refIdx) / (1 + refIdx);
+	r0 = r0 * r0;
+	return r0 + (1 - r0) * powf((1 - cosine), 5);
+}
+
+// SCATTER FUNCTIONS, one per MTType. They update the ray direction and return the attenuation
+
+inline glm::vec3 ScatterDiffuse(Ray& ray, const HitRecord& hitRec, const RTMaterial& material, PathSampler& sampler)
+{
+	ray.Direction = SampleCosineHemisphere(sampler.Get2D(), hitRec.Normal);
+	return material.Albedo;
+}
+
+inline glm::vec3 ScatterMetal(Ray& ray, const HitRecord& hitRec, const RTMaterial& material, PathSampler& sampler)
+{
+	ray.Direction = glm::normalize(glm::reflect(ray.Direction, hitRec.Normal));
+	return material.Albedo;
+}
+
+inline glm::vec3 ScatterDielectric(Ray& ray, const HitRecord& hitRec, const RTMaterial& material, PathSampler& sampler)
+{
+	// Currently all objects will have the same IOR
+	float IOR = 1.33f;
+	float refractionRatio = hitRec.FrontFace ? (1.f / IOR) : IOR;
+
+	float cosTheta = glm::min(glm::dot(-ray.Direction, hitRec.Normal), 1.f);
+	float sinTheta = sqrtf(1.f - cosTheta * cosTheta);
+
+	bool cannotRefract = refractionRatio * sinTheta > 1.f;
+	if (cannotRefract || Reflectance(cosTheta, refractionRatio) > sampler.Get1D())
+		ray.Direction = glm::reflect(ray.Direction, hitRec.Normal);
+	else
+		ray.Direction = glm::refract(ray.Direction, hitRec.Normal, refractionRatio);
+
+	return glm::vec3(1.f);
+}
+
+// The shader has no branch for the remaining types, the ray keeps going in the same direction
+inline glm::vec3 ScatterPassThrough(Ray& ray, const HitRecord& hitRec, const RTMaterial& material, PathSampler& sampler)
+{
+	return material.Albedo;
+}
+
+inline glm::vec3 Scatter(Ray& ray, const HitRecord& hitRec, const RTMaterial& material, PathSampler& sampler)
+{
+	switch (material.Type)
+	{
+	case MTType::Diffuse:		return ScatterDiffuse(ray, hitRec, material, sampler);
+	case MTType::Metal:			return ScatterMetal(ray, hitRec, material, sampler);
+	case MTType::Dielectric:	return ScatterDielectric(ray, hitRec, material, sampler);
+	default:					return ScatterPassThrough(ray, hitRec, material, sampler);
+	}
+}
+
+// Solid angle pdf of the direction Scatter picked, 0 for delta distributions
+inline float ScatterPdf(const Ray& ray, const HitRecord& hitRec, const RTMaterial& material)
+{
+	return material.Type == MTType::Diffuse ? std::max(glm::dot(ray.Direction, hitRec.Normal), 0.f) / RT_PI : 0.f;
+}
+
+// LIGHT SAMPLING
+// Next event estimation picks an emissive sphere uniformly and a direction uniformly inside the cone it covers, seen from the shading point.
+// Light and BSDF samples are combined with the power heuristic, a light reached by a scattered ray is weighted by the same rule.
+
+inline float PowerHeuristic(float pdf, float otherPdf)
+{
+	pdf *= pdf;
+	return pdf / (pdf + otherPdf * otherPdf);
+}
+
+// 1 - cos of the half angle of the cone the light covers from pos, 0 from inside the light
+inline float LightConeOneMinusCos(const RTSphere& light, const glm::vec3& pos)
+{
+	glm::vec3 toLight = light.Posiition - pos;
+	float sinThetaMax2 = light.Radius * light.Radius / glm::dot(toLight, toLight);
+	if (sinThetaMax2 >= 1.f)
+		return 0.f;
+	return sinThetaMax2 / (1.f + sqrtf(1.f - sinThetaMax2));
+}
+
+// Solid angle pdf of light sampling picking this light from pos, including the choice of the light
+inline float LightPdf(const RTScene& scene, const RTConstants& constants, const RTSphere& light, const glm::vec3& pos)
+{
+	if (!constants.NextEventEstimation)
+		return 0.f;
+	float oneMinusCosMax = LightConeOneMinusCos(light, pos);
+	return oneMinusCosMax > 0.f ? 1.f / (2.f * RT_PI * oneMinusCosMax * scene.GetLights().size()) : 0.f;
+}
+
+// Shadow ray toward a light and what it adds to the path if nothing blocks it
+struct ShadowRay
+{
+	Ray			Segment;
+	float		TMax = 0.f;
+	glm::vec3	Radiance;
+};
+
+// Next event estimation at a diffuse hit. Returns false when there is nothing to trace (no lights, light below the surface)
+inline bool SampleDirectLight(const RTScene& scene, const RTConstants& constants, const HitRecord& hitRec, const RTMaterial& material, const glm::vec3& throughput, uint32_t bounce, PathSampler& sampler, ShadowRay& shadow)
+{
+	const std::vector<uint32_t>& lights = scene.GetLights();
+	if (!constants.NextEventEstimation || lights.empty())
+		return false;
+
+	sampler.StartBounce(bounce, RT_LIGHT_DIMENSION);
+	const uint32_t choice = std::min(static_cast<uint32_t>(sampler.Get1D() * lights.size()), static_cast<uint32_t>(lights.size() - 1));
+	const RTSphere& light = scene.GetSpheres()[lights[choice]];
+	float oneMinusCosMax = LightConeOneMinusCos(light, hitRec.Pos);
+	if (oneMinusCosMax <= 0.f)
+		return false;
+
+	Ray ray{ hitRec.Pos, SampleUniformCone(sampler.Get2D(), glm::normalize(light.Posiition - hitRec.Pos), oneMinusCosMax) };
+	float cosTheta = glm::dot(ray.Direction, hitRec.Normal);
+	HitRecord lightRec;
+	if (cosTheta <= 0.f || !HitSphere(light, ray, 0.f, RT_FLOATMAX, lightRec))
+		return false;
+
+	float lightPdf = 1.f / (2.f * RT_PI * oneMinusCosMax * lights.size()),
+		  bsdfPdf = cosTheta / RT_PI;
+	shadow.Segment = ray;
+	// Stop short of the light so it doesn't occlude itself
+	shadow.TMax = lightRec.T * 0.999f;
+	shadow.Radiance = throughput * material.Albedo * (cosTheta / (RT_PI * lightPdf) * PowerHeuristic(lightPdf, bsdfPdf)) * scene.GetMaterials()[light.MaterialIndex].Albedo;
+	return true;
+}
+
+// Radiance of a light reached by the path's current ray, call before the ray origin moves to the hit
+inline glm::vec3 HitEmission(const RTScene& scene, const RTConstants& constants, const Ray& ray, const HitRecord& hitRec, const RTMaterial& material, const PathState& path)
+{
+	if (!hitRec.FrontFace)
+		return glm::vec3(0.f);
+	// Emissive meshes aren't in the light list, only scattered rays find them
+	if (path.ScatterPdf <= 0.f || hitRec.PrimIndex == RT_UINTMAX)
+		return path.Throughput * material.Albedo;
+	float lightPdf = LightPdf(scene, constants, scene.GetSpheres()[hitRec.PrimIndex], ray.Origin);
+	return path.Throughput * material.Albedo * PowerHeuristic(path.ScatterPdf, lightPdf);
+}
+
+// Russian roulette after scattering at the given bounce, once MinRayBounces are done.
+// Paths survive with their throughput (capped so every path ends eventually) and are reweighted, which keeps the estimate unbiased.
+// Returns false when the path is terminated.
+inline bool RussianRoulette(glm::vec3& throughput, uint32_t bounce, const RTConstants& constants, PathSampler& sampler)
+{
+	if (bounce + 1 < constants.MinRayBounces)
+		return true;
+
+	float survival = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.95f);
+	sampler.StartBounce(bounce, RT_ROULETTE_DIMENSION);
+	if (sampler.Get1D() >= survival)
+		return false;
+
+	throughput /= survival;
+	return true;
+}
+
+// One bounce of a path at a surface hit: emission, next event estimation, scattering and Russian roulette.
+// Shadow rays are traced right away and counted in rayCount. Returns false when the path ends.
+inline bool ShadeHit(const RTScene& scene, const RTConstants& constants, uint32_t bounce, const HitRecord& hitRec, Ray& ray, PathState& path, PathSampler& sampler, uint64_t& rayCount)
+{
+	const RTMaterial& material = scene.GetMaterials()[hitRec.MaterialIndex];
+	if (material.Type == MTType::Emissive)
+	{
+		path.Radiance += HitEmission(scene, constants, ray, hitRec, material, path);
+		return false;
+	}
+	// A scattered ray would not be traced anymore, a light sample here would have no BSDF sample to be weighted against
+	if (bounce == constants.MaxRayBounces)
+		return false;
+
+	ShadowRay shadow;
+	if (material.Type == MTType::Diffuse && SampleDirectLight(scene, constants, hitRec, material, path.Throughput, bounce, sampler, shadow))
+	{
+		++rayCount;
+		if (!scene.Occluded(shadow.Segment, 0.01f, shadow.TMax))
+			path.Radiance += shadow.Radiance;
+	}
+
+	ray.Origin = hitRec.Pos;
+	sampler.StartBounce(bounce);
+	path.Throughput *= Scatter(ray, hitRec, material, sampler);
+	path.ScatterPdf = ScatterPdf(ray, hitRec, material);
+	return RussianRoulette(path.Throughput, bounce, constants, sampler);
+}
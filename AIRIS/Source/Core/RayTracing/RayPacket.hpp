@@ -0,0 +1,105 @@
+#pragma once
+#include "RTCommon.hpp"
+#include <algorithm>
+
+// 8x8 pixels worth of rays, traced through the BVH together
+#define RT_PACKET_DIM 8
+#define RT_PACKET_SIZE (RT_PACKET_DIM * RT_PACKET_DIM)
+
+// Structure of arrays ray packet with interval bounds over all of its rays.
+// The intervals let the traversal reject a node for the whole packet with one test (interval arithmetic culling).
+struct RayPacket
+{
+	alignas(64) float	OX[RT_PACKET_SIZE], OY[RT_PACKET_SIZE], OZ[RT_PACKET_SIZE];
+	alignas(64) float	DX[RT_PACKET_SIZE], DY[RT_PACKET_SIZE], DZ[RT_PACKET_SIZE];
+	alignas(64) float	IX[RT_PACKET_SIZE], IY[RT_PACKET_SIZE], IZ[RT_PACKET_SIZE];
+	alignas(64) float	TMax[RT_PACKET_SIZE];
+	// Primitive hit by each ray, RT_UINTMAX for misses
+	uint32_t			Prim[RT_PACKET_SIZE];
+	uint32_t			Count = 0;
+	float				TMin = 0.01f;
+
+	// INTERVALS
+	glm::vec3			OriginMin, OriginMax,
+						InvDirMin, InvDirMax;
+	// Every ray points into the same octant
+	bool				SameOctant = false;
+
+	inline void Clear() { Count = 0; }
+
+	inline void Add(const Ray& r, float tMax = RT_FLOATMAX)
+	{
+		uint32_t i = Count++;
+		OX[i] = r.Origin.x; OY[i] = r.Origin.y; OZ[i] = r.Origin.z;
+		DX[i] = r.Direction.x; DY[i] = r.Direction.y; DZ[i] = r.Direction.z;
+		TMax[i] = tMax;
+		Prim[i] = RT_UINTMAX;
+	}
+
+	inline Ray GetRay(uint32_t i) const { return { { OX[i], OY[i], OZ[i] }, { DX[i], DY[i], DZ[i] } }; }
+
+	// Reciprocal directions and the packet intervals, call once all rays are added
+	void Finalize()
+	{
+		OriginMin = InvDirMin = glm::vec3(RT_FLOATMAX);
+		OriginMax = InvDirMax = glm::vec3(-RT_FLOATMAX);
+		uint32_t negativeMask = 0, positiveMask = 0;
+		for (uint32_t i = 0; i < Count; ++i)
+		{
+			IX[i] = 1.f / DX[i]; IY[i] = 1.f / DY[i]; IZ[i] = 1.f / DZ[i];
+			glm::vec3 o(OX[i], OY[i], OZ[i]), inv(IX[i], IY[i], IZ[i]);
+			OriginMin = glm::min(OriginMin, o);
+			OriginMax = glm::max(OriginMax, o);
+			InvDirMin = glm::min(InvDirMin, inv);
+			InvDirMax = glm::max(InvDirMax, inv);
+			negativeMask |= (DX[i] < 0) | ((DY[i] < 0) << 1) | ((DZ[i] < 0) << 2);
+			positiveMask |= (DX[i] >= 0) | ((DY[i] >= 0) << 1) | ((DZ[i] >= 0) << 2);
+		}
+		SameOctant = (negativeMask & positiveMask) == 0;
+	}
+
+	inline float MaxTMax() const
+	{
+		float t = TMax[0];
+		for (uint32_t i = 1; i < Count; ++i)
+			t = std::max(t, TMax[i]);
+		return t;
+	}
+
+	// Conservative: false only if no ray of the packet can hit the box before maxT
+	bool IntervalHitsAABB(const glm::vec3& bMin, const glm::vec3& bMax, float maxT) const
+	{
+		float nearLow = TMin, farHigh = maxT;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			// Entry and exit planes swap with the direction sign, SameOctant guarantees one sign per axis
+			bool positive = InvDirMin[axis] >= 0.f;
+			float entryPlane = positive ? bMin[axis] : bMax[axis],
+				  exitPlane = positive ? bMax[axis] : bMin[axis];
+			nearLow = std::max(nearLow, IntervalMulLow(entryPlane - OriginMax[axis], entryPlane - OriginMin[axis], InvDirMin[axis], InvDirMax[axis]));
+			farHigh = std::min(farHigh, IntervalMulHigh(exitPlane - OriginMax[axis], exitPlane - OriginMin[axis], InvDirMin[axis], InvDirMax[axis]));
+		}
+		return nearLow <= farHigh;
+	}
+
+	inline bool RayHitsAABB(uint32_t i, const glm::vec3& bMin, const glm::vec3& bMax) const
+	{
+		float	tx1 = (bMin.x - OX[i]) * IX[i], tx2 = (bMax.x - OX[i]) * IX[i],
+				ty1 = (bMin.y - OY[i]) * IY[i], ty2 = (bMax.y - OY[i]) * IY[i],
+				tz1 = (bMin.z - OZ[i]) * IZ[i], tz2 = (bMax.z - OZ[i]) * IZ[i];
+		float	tNear = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), TMin)),
+				tFar = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), TMax[i]));
+		return tNear <= tFar;
+	}
+
+private:
+	// Bounds of [aLow, aHigh] * [bLow, bHigh]
+	static inline float IntervalMulLow(float aLow, float aHigh, float bLow, float bHigh)
+	{
+		return std::min(std::min(aLow * bLow, aLow * bHigh), std::min(aHigh * bLow, aHigh * bHigh));
+	}
+	static inline float IntervalMulHigh(float aLow, float aHigh, float bLow, float bHigh)
+	{
+		return std::max(std::max(aLow * bLow, aLow * bHigh), std::max(aHigh * bLow, aHigh * bHigh));
+	}
+};
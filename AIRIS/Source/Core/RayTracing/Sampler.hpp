@@ -0,0 +1,149 @@
+#pragma once
+#include "Core/Graphics/RTHelper.hpp"
+#include "RTCommon.hpp"
+
+// Sample generators of the CPU tracer. The hashes, sequences and dimension layout are mirrored by the sampler in RT.hlsl,
+// so both tracers draw the same samples.
+
+// DIMENSION LAYOUT
+// The camera ray takes the first dimensions (pixel jitter, lens), every bounce then starts at a fixed offset,
+// so a bounce always gets the same dimensions no matter how many the previous bounces used
+#define RT_CAMERA_DIMENSIONS 4
+#define RT_BOUNCE_DIMENSIONS 8
+// Fixed offsets inside a bounce, scattering starts at 0
+#define RT_ROULETTE_DIMENSION 3
+// Light choice, then the 2D direction sample toward it
+#define RT_LIGHT_DIMENSION 4
+
+// Output permutation of rand_pcg applied to a single value
+inline uint32_t PCGHash(uint32_t x)
+{
+	uint32_t state = x * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+inline uint32_t HashCombine(uint32_t seed, uint32_t value)
+{
+	return PCGHash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t ReverseBits(uint32_t x)
+{
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// Hash based Owen scrambling, every bit is flipped depending only on the bits above it (Laine-Karras style permutation on the reversed bits)
+inline uint32_t OwenScramble(uint32_t x, uint32_t seed)
+{
+	x = ReverseBits(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return ReverseBits(x);
+}
+
+// First two dimensions of the Sobol sequence: van der Corput and the Pascal matrix generator.
+// Bit i of the reversed second dimension is the parity of the index bits j with i a subset of j, a superset sum over the 5 bit positions.
+inline void Sobol2D(uint32_t index, uint32_t& x, uint32_t& y)
+{
+	x = ReverseBits(index);
+	index ^= (index >> 1) & 0x55555555u;
+	index ^= (index >> 2) & 0x33333333u;
+	index ^= (index >> 4) & 0x0f0f0f0fu;
+	index ^= (index >> 8) & 0x00ff00ffu;
+	index ^= (index >> 16) & 0x0000ffffu;
+	y = ReverseBits(index);
+}
+
+// [0, 1) from the top 24 bits
+inline float ToUnitFloat(uint32_t x)
+{
+	return (x >> 8) * (1.f / 16777216.f);
+}
+
+// Accumulated samples walk along the sequence, without accumulation every frame is a new sample chosen by the seed
+inline uint32_t GetSampleIndex(const RTConstants& constants)
+{
+	return constants.AccumlateSamples ? constants.AccumulatedSamples - 1 : constants.RandSeed;
+}
+
+// Samples of one path. Get1D/Get2D hand out consecutive dimensions, StartBounce jumps to the dimensions of a bounce.
+class PathSampler
+{
+public:
+	PathSampler() = default;
+	PathSampler(const RTConstants& constants, uint32_t x, uint32_t y, uint32_t width)
+		:m_type(constants.Sampler), m_x(x), m_y(y), m_sampleIndex(GetSampleIndex(constants)), m_dimension(0)
+	{
+		// Hashed so pixel (0, 0) and the first frame don't start from a zero state and neighbours aren't correlated
+		const uint32_t pixelIndex = y * width + x;
+		m_pixelSeed = PCGHash(pixelIndex);
+		m_rng = PCGRandom(PCGHash(pixelIndex + PCGHash(constants.RandSeed)));
+	}
+
+	inline void StartBounce(uint32_t bounce, uint32_t offset = 0) { m_dimension = RT_CAMERA_DIMENSIONS + bounce * RT_BOUNCE_DIMENSIONS + offset; }
+
+	float Get1D()
+	{
+		const uint32_t dimension = m_dimension++;
+		switch (m_type)
+		{
+		case SamplerType::Sobol:
+		{
+			uint32_t seed = HashCombine(m_pixelSeed, dimension);
+			return ToUnitFloat(OwenScramble(ReverseBits(OwenScramble(m_sampleIndex, seed)), HashCombine(seed, 1)));
+		}
+		case SamplerType::BlueNoise:
+			return ToUnitFloat(m_sampleIndex * 0x9e3779b9u + DitherMask(m_x, m_y) + PCGHash(dimension));
+		default:
+			return ToUnitFloat(m_rng.Next());
+		}
+	}
+
+	glm::vec2 Get2D()
+	{
+		const uint32_t dimension = m_dimension;
+		m_dimension += 2;
+		switch (m_type)
+		{
+		case SamplerType::Sobol:
+		{
+			// Shuffle the index, then scramble both coordinates, each dimension pair gets its own seed
+			uint32_t seed = HashCombine(m_pixelSeed, dimension), x, y;
+			Sobol2D(OwenScramble(m_sampleIndex, seed), x, y);
+			return { ToUnitFloat(OwenScramble(x, HashCombine(seed, 1))), ToUnitFloat(OwenScramble(y, HashCombine(seed, 2))) };
+		}
+		case SamplerType::BlueNoise:
+		{
+			// R2 sequence, the transposed mask keeps both coordinates from sharing one offset
+			return { ToUnitFloat(m_sampleIndex * 0xc13fa9a9u + DitherMask(m_x, m_y) + PCGHash(dimension)),
+					 ToUnitFloat(m_sampleIndex * 0x91e10da5u + DitherMask(m_y, m_x) + PCGHash(dimension + 1)) };
+		}
+		default:
+		{
+			float u = ToUnitFloat(m_rng.Next());
+			return { u, ToUnitFloat(m_rng.Next()) };
+		}
+		}
+	}
+
+private:
+	// R2 dither mask, neighbouring pixels get well separated offsets
+	static inline uint32_t DitherMask(uint32_t x, uint32_t y) { return x * 0xc13fa9a9u + y * 0x91e10da5u; }
+
+private:
+	SamplerType	m_type = SamplerType::PCG;
+	uint32_t	m_x = 0,
+				m_y = 0,
+				m_sampleIndex = 0,
+				m_dimension = 0,
+				m_pixelSeed = 0;
+	PCGRandom	m_rng;
+};
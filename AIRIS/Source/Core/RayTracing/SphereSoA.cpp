@@ -0,0 +1,179 @@
+#include "SphereSoA.hpp"
+#include <bit>
+#if RT_SPHERE_SIMD_WIDTH > 1
+#include <immintrin.h>
+#endif
+
+void SphereSoA::Build(const std::vector<RTSphere>& spheres)
+{
+	m_count = static_cast<uint32_t>(spheres.size());
+	size_t paddedCount = spheres.size() + RT_SPHERE_SIMD_WIDTH;
+	X.assign(paddedCount, 0.f);
+	Y.assign(paddedCount, 0.f);
+	Z.assign(paddedCount, 0.f);
+	R.assign(paddedCount, 0.f);
+	Mat.assign(paddedCount, 0);
+
+	for (size_t i = 0; i < spheres.size(); ++i)
+	{
+		X[i] = spheres[i].Posiition.x;
+		Y[i] = spheres[i].Posiition.y;
+		Z[i] = spheres[i].Posiition.z;
+		R[i] = spheres[i].Radius;
+		Mat[i] = spheres[i].MaterialIndex;
+	}
+}
+
+uint32_t SphereSoA::IntersectScalar(const Ray& r, uint32_t first, uint32_t count, float tMin, float& tMax) const
+{
+	uint32_t closest = RT_UINTMAX;
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		float	ocx = r.Origin.x - X[i],
+				ocy = r.Origin.y - Y[i],
+				ocz = r.Origin.z - Z[i],
+				halfB = ocx * r.Direction.x + ocy * r.Direction.y + ocz * r.Direction.z,
+				c = ocx * ocx + ocy * ocy + ocz * ocz - R[i] * R[i],
+				discriminant = halfB * halfB - c;
+		if (discriminant < 0)
+			continue;
+
+		float sqrtd = sqrtf(discriminant);
+		float t = -halfB - sqrtd;
+		if (t <= tMin)
+			t = -halfB + sqrtd;
+		if (t > tMin && t < tMax)
+		{
+			tMax = t;
+			closest = i;
+		}
+	}
+	return closest;
+}
+
+#if RT_SPHERE_SIMD_WIDTH == 16
+
+uint32_t SphereSoA::Intersect(const Ray& r, uint32_t first, uint32_t count, float tMin, float& tMax) const
+{
+	const __m512	ox = _mm512_set1_ps(r.Origin.x), oy = _mm512_set1_ps(r.Origin.y), oz = _mm512_set1_ps(r.Origin.z),
+					dx = _mm512_set1_ps(r.Direction.x), dy = _mm512_set1_ps(r.Direction.y), dz = _mm512_set1_ps(r.Direction.z),
+					vtMin = _mm512_set1_ps(tMin);
+	const __m512i	laneOffsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+	// Lane wise closest hit, reduced once at the end
+	__m512	bestT = _mm512_set1_ps(tMax);
+	__m512i	bestIndex = _mm512_set1_epi32(-1);
+
+	const uint32_t end = first + count;
+	for (uint32_t i = first; i < end; i += 16)
+	{
+		__m512	ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(&X[i])),
+				ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(&Y[i])),
+				ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(&Z[i])),
+				rad = _mm512_loadu_ps(&R[i]);
+		__m512	halfB = _mm512_fmadd_ps(ocz, dz, _mm512_fmadd_ps(ocy, dy, _mm512_mul_ps(ocx, dx))),
+				c = _mm512_fmadd_ps(ocz, ocz, _mm512_fmadd_ps(ocy, ocy, _mm512_fmsub_ps(ocx, ocx, _mm512_mul_ps(rad, rad)))),
+				discriminant = _mm512_fmsub_ps(halfB, halfB, c);
+
+		// Lanes past the end of the range read padding or the next leaf, mask them off
+		__mmask16 valid = _mm512_cmp_ps_mask(discriminant, _mm512_setzero_ps(), _CMP_GE_OQ) & static_cast<__mmask16>(end - i >= 16 ? 0xffff : (1u << (end - i)) - 1);
+		if (!valid)
+			continue;
+
+		__m512	sqrtd = _mm512_sqrt_ps(_mm512_max_ps(discriminant, _mm512_setzero_ps())),
+				negB = _mm512_sub_ps(_mm512_setzero_ps(), halfB),
+				tNear = _mm512_sub_ps(negB, sqrtd),
+				tFar = _mm512_add_ps(negB, sqrtd),
+				t = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(tNear, vtMin, _CMP_GT_OQ), tFar, tNear);
+
+		__mmask16 hit = valid & _mm512_cmp_ps_mask(t, vtMin, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, bestT, _CMP_LT_OQ);
+		bestT = _mm512_mask_blend_ps(hit, bestT, t);
+		bestIndex = _mm512_mask_blend_epi32(hit, bestIndex, _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)), laneOffsets));
+	}
+
+	float minT = _mm512_reduce_min_ps(bestT);
+	if (!(minT < tMax))
+		return RT_UINTMAX;
+
+	__mmask16 minLanes = _mm512_cmp_ps_mask(bestT, _mm512_set1_ps(minT), _CMP_EQ_OQ);
+	alignas(64) uint32_t indices[16];
+	_mm512_store_si512(indices, bestIndex);
+	tMax = minT;
+	return indices[std::countr_zero(static_cast<uint32_t>(minLanes))];
+}
+
+#elif RT_SPHERE_SIMD_WIDTH == 8
+
+uint32_t SphereSoA::Intersect(const Ray& r, uint32_t first, uint32_t count, float tMin, float& tMax) const
+{
+	const __m256	ox = _mm256_set1_ps(r.Origin.x), oy = _mm256_set1_ps(r.Origin.y), oz = _mm256_set1_ps(r.Origin.z),
+					dx = _mm256_set1_ps(r.Direction.x), dy = _mm256_set1_ps(r.Direction.y), dz = _mm256_set1_ps(r.Direction.z),
+					vtMin = _mm256_set1_ps(tMin),
+					zero = _mm256_setzero_ps();
+	const __m256i	laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	// Lane wise closest hit, reduced once at the end
+	__m256	bestT = _mm256_set1_ps(tMax);
+	__m256i	bestIndex = _mm256_set1_epi32(-1);
+
+	const uint32_t end = first + count;
+	for (uint32_t i = first; i < end; i += 8)
+	{
+		__m256	ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&X[i])),
+				ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&Y[i])),
+				ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&Z[i])),
+				rad = _mm256_loadu_ps(&R[i]);
+		__m256	halfB = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz)),
+				c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)), _mm256_mul_ps(rad, rad)),
+				discriminant = _mm256_sub_ps(_mm256_mul_ps(halfB, halfB), c);
+
+		// Lanes past the end of the range read padding or the next leaf, mask them off
+		__m256	inRange = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(end - i)), laneOffsets)),
+				valid = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ), inRange);
+		if (_mm256_testz_ps(valid, valid))
+			continue;
+
+		__m256	sqrtd = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero)),
+				negB = _mm256_sub_ps(zero, halfB),
+				tNear = _mm256_sub_ps(negB, sqrtd),
+				tFar = _mm256_add_ps(negB, sqrtd),
+				t = _mm256_blendv_ps(tFar, tNear, _mm256_cmp_ps(tNear, vtMin, _CMP_GT_OQ));
+
+		__m256 hit = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, vtMin, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+		bestT = _mm256_blendv_ps(bestT, t, hit);
+		bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(_mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), laneOffsets)), hit));
+	}
+
+	// Horizontal min
+	__m256 minT = _mm256_min_ps(bestT, _mm256_permute2f128_ps(bestT, bestT, 1));
+	minT = _mm256_min_ps(minT, _mm256_shuffle_ps(minT, minT, _MM_SHUFFLE(1, 0, 3, 2)));
+	minT = _mm256_min_ps(minT, _mm256_shuffle_ps(minT, minT, _MM_SHUFFLE(2, 3, 0, 1)));
+	float closestT = _mm256_cvtss_f32(minT);
+	if (!(closestT < tMax))
+		return RT_UINTMAX;
+
+	int minLanes = _mm256_movemask_ps(_mm256_cmp_ps(bestT, minT, _CMP_EQ_OQ));
+	alignas(32) uint32_t indices[8];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(indices), bestIndex);
+	tMax = closestT;
+	return indices[std::countr_zero(static_cast<uint32_t>(minLanes))];
+}
+
+#else
+
+uint32_t SphereSoA::Intersect(const Ray& r, uint32_t first, uint32_t count, float tMin, float& tMax) const
+{
+	return IntersectScalar(r, first, count, tMin, tMax);
+}
+
+#endif
+
+void SphereSoA::GetHitRecord(const Ray& r, uint32_t index, float t, HitRecord& rec) const
+{
+	glm::vec3 center(X[index], Y[index], Z[index]);
+	rec.T = t;
+	rec.Pos = r.At(t);
+	rec.SetFaceNormal(r, (rec.Pos - center) / R[index]);
+	rec.MaterialIndex = Mat[index];
+	rec.PrimIndex = index;
+}
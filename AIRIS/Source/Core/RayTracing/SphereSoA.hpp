@@ -0,0 +1,49 @@
+#pragma once
+#include "Core/Graphics/RTHelper.hpp"
+#include "RTCommon.hpp"
+#include <vector>
+
+// Width of the sphere intersection kernel, picked at compile time from the enabled instruction sets.
+// The AIRIS project enables AVX2, building with AVX-512 (e.g. -march=native on a capable machine) switches to 16 lanes.
+#if defined(__AVX512F__)
+#define RT_SPHERE_SIMD_WIDTH 16
+#elif defined(__AVX2__)
+#define RT_SPHERE_SIMD_WIDTH 8
+#else
+#define RT_SPHERE_SIMD_WIDTH 1
+#endif
+
+// Structure of arrays copy of the scene spheres, so one ray can be tested against a full register of spheres at once.
+// Arrays are padded by one SIMD width so the kernels can always load whole registers.
+class SphereSoA
+{
+public:
+	void Build(const std::vector<RTSphere>& spheres);
+
+	inline uint32_t GetCount() const { return m_count; }
+	// Overwrites one sphere in place, for spheres that moved
+	inline void Set(uint32_t index, const RTSphere& sphere)
+	{
+		X[index] = sphere.Posiition.x;
+		Y[index] = sphere.Posiition.y;
+		Z[index] = sphere.Posiition.z;
+		R[index] = sphere.Radius;
+		Mat[index] = sphere.MaterialIndex;
+	}
+
+	// Closest sphere in [first, first + count) hit in (tMin, tMax).
+	// Returns the sphere index and shrinks tMax to the hit distance, or returns RT_UINTMAX and leaves tMax alone.
+	uint32_t Intersect(const Ray& r, uint32_t first, uint32_t count, float tMin, float& tMax) const;
+	// Same as Intersect but one sphere at a time, kept as the fallback and as a reference for the SIMD kernels
+	uint32_t IntersectScalar(const Ray& r, uint32_t first, uint32_t count, float tMin, float& tMax) const;
+
+	// Fills the hit record for a sphere returned by Intersect
+	void GetHitRecord(const Ray& r, uint32_t index, float t, HitRecord& rec) const;
+
+public:
+	std::vector<float>		X, Y, Z, R;
+	std::vector<uint32_t>	Mat;
+
+private:
+	uint32_t				m_count = 0;
+};
@@ -0,0 +1,148 @@
+#include "TLAS.hpp"
+
+uint32_t TLAS::AddBLAS(TriangleBLAS blas)
+{
+	m_blases.push_back(std::move(blas));
+	return static_cast<uint32_t>(m_blases.size() - 1);
+}
+
+uint32_t TLAS::AddInstance(uint32_t blasIndex, const glm::mat4& objectToWorld, uint32_t materialIndex)
+{
+	TLASInstance instance;
+	instance.BLASIndex = blasIndex;
+	instance.MaterialIndex = materialIndex;
+	m_instances.push_back(instance);
+	m_instancesAdded = true;
+	SetTransform(static_cast<uint32_t>(m_instances.size() - 1), objectToWorld);
+	return static_cast<uint32_t>(m_instances.size() - 1);
+}
+
+void TLAS::SetTransform(uint32_t instance, const glm::mat4& objectToWorld)
+{
+	TLASInstance& inst = m_instances[instance];
+	inst.ObjectToWorld = objectToWorld;
+	inst.WorldToObject = glm::inverse(objectToWorld);
+	m_dirty = true;
+}
+
+bool TLAS::Update(const BVHBuildSettings& settings, float rebuildThreshold, ThreadPool* pool)
+{
+	if (!m_dirty)
+		return false;
+	m_dirty = false;
+
+	if (!m_instancesAdded && !m_bvh.IsEmpty())
+	{
+		// Instances keep their leaves, their bounds are looked up in leaf order
+		const std::vector<uint32_t>& instanceIndices = m_bvh.GetPrimIndices();
+		std::vector<AABB> slotBounds(m_instances.size());
+		for (size_t i = 0; i < m_instances.size(); ++i)
+			slotBounds[i] = WorldBounds(m_instances[instanceIndices[i]]);
+		++m_refitCount;
+		if (m_bvh.Refit(slotBounds) <= rebuildThreshold * m_builtSAHCost)
+			return false;
+	}
+
+	std::vector<AABB> bounds(m_instances.size());
+	for (size_t i = 0; i < m_instances.size(); ++i)
+		bounds[i] = WorldBounds(m_instances[i]);
+	m_bvh.Build(bounds, settings, pool);
+	m_builtSAHCost = m_bvh.SAHCost();
+	m_instancesAdded = false;
+	++m_rebuildCount;
+	return true;
+}
+
+AABB TLAS::WorldBounds(const TLASInstance& instance) const
+{
+	// Corners of the object space bounds, moved into the world
+	const AABB local = m_blases[instance.BLASIndex].GetBounds();
+	AABB bounds;
+	if (!local.IsValid())
+		return bounds;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 p((corner & 1) ? local.Max.x : local.Min.x, (corner & 2) ? local.Max.y : local.Min.y, (corner & 4) ? local.Max.z : local.Min.z);
+		bounds.Grow(glm::vec3(instance.ObjectToWorld * glm::vec4(p, 1.f)));
+	}
+	return bounds;
+}
+
+bool TLAS::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+	const std::vector<uint32_t>& instanceIndices = m_bvh.GetPrimIndices();
+	uint32_t closestInstance = RT_UINTMAX;
+	HitRecord objectRec;
+	m_bvh.Traverse(r, tMin, tMax, [&](uint32_t first, uint32_t count, float& closest)
+	{
+		bool hit = false;
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			const TLASInstance& instance = m_instances[instanceIndices[i]];
+			if (m_blases[instance.BLASIndex].Hit(ToObject(instance, r), tMin, closest, objectRec))
+			{
+				closest = objectRec.T;
+				closestInstance = instanceIndices[i];
+				hit = true;
+			}
+		}
+		return hit;
+	});
+
+	if (closestInstance == RT_UINTMAX)
+		return false;
+
+	// Normals go back with the inverse transpose, the side they face doesn't change
+	const TLASInstance& instance = m_instances[closestInstance];
+	rec.T = tMax;
+	rec.Pos = r.At(tMax);
+	rec.Normal = glm::normalize(glm::vec3(glm::transpose(instance.WorldToObject) * glm::vec4(objectRec.Normal, 0.f)));
+	rec.FrontFace = objectRec.FrontFace;
+	rec.MaterialIndex = instance.MaterialIndex == RT_UINTMAX ? objectRec.MaterialIndex : instance.MaterialIndex;
+	return true;
+}
+
+bool TLAS::Occluded(const Ray& r, float tMin, float tMax) const
+{
+	const std::vector<uint32_t>& instanceIndices = m_bvh.GetPrimIndices();
+	return m_bvh.Traverse(r, tMin, tMax, [&](uint32_t first, uint32_t count, float& closest)
+	{
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			const TLASInstance& instance = m_instances[instanceIndices[i]];
+			if (m_blases[instance.BLASIndex].Occluded(ToObject(instance, r), tMin, closest))
+			{
+				closest = tMin;
+				return true;
+			}
+		}
+		return false;
+	});
+}
+
+void TLAS::GetShaderData(std::vector<RTInstance>& instances, std::vector<RTTriangle>& triangles, std::vector<BVHNode>& blasNodes) const
+{
+	triangles.clear();
+	blasNodes.clear();
+	std::vector<uint32_t> nodeOffsets, triangleOffsets;
+	for (const TriangleBLAS& blas : m_blases)
+	{
+		nodeOffsets.push_back(static_cast<uint32_t>(blasNodes.size()));
+		triangleOffsets.push_back(static_cast<uint32_t>(triangles.size()));
+		blasNodes.insert(blasNodes.end(), blas.GetBVH().GetNodes().begin(), blas.GetBVH().GetNodes().end());
+		triangles.insert(triangles.end(), blas.GetTriangles().begin(), blas.GetTriangles().end());
+	}
+
+	// Leaf order, so the TLAS leaves index the instance buffer directly
+	instances.clear();
+	for (uint32_t index : m_bvh.GetPrimIndices())
+	{
+		const TLASInstance& instance = m_instances[index];
+		RTInstance gpuInstance;
+		gpuInstance.WorldToObject = instance.WorldToObject;
+		gpuInstance.NodeOffset = nodeOffsets[instance.BLASIndex];
+		gpuInstance.TriangleOffset = triangleOffsets[instance.BLASIndex];
+		gpuInstance.MaterialIndex = instance.MaterialIndex;
+		instances.push_back(gpuInstance);
+	}
+}
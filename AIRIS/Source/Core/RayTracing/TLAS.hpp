@@ -0,0 +1,78 @@
+#pragma once
+#include "Core/Graphics/RTHelper.hpp"
+#include "RTCommon.hpp"
+#include "BVH.hpp"
+#include "TriangleBLAS.hpp"
+#include <vector>
+
+// One placement of a BLAS in the scene
+struct TLASInstance
+{
+	glm::mat4	ObjectToWorld = glm::mat4(1.f),
+				WorldToObject = glm::mat4(1.f);
+	uint32_t	BLASIndex = 0;
+	// Replaces the materials of the BLAS triangles, RT_UINTMAX keeps them
+	uint32_t	MaterialIndex = RT_UINTMAX;
+};
+
+// Instance tests traverse a whole BLAS, so the SAH charges them accordingly and keeps leaves small
+inline BVHBuildSettings InstanceBVHSettings()
+{
+	BVHBuildSettings settings;
+	settings.MaxLeafSize = 2;
+	settings.IntersectionCost = 4.f;
+	return settings;
+}
+
+// Top level acceleration structure: a BVH over instances of shared triangle BLASes.
+// BLASes are built once in object space and never touched again, moving an instance only changes its record and the TLAS,
+// so N copies of a mesh cost one BLAS and N instance records.
+class TLAS
+{
+public:
+	// Returns the index instances reference the BLAS with
+	uint32_t AddBLAS(TriangleBLAS blas);
+	// Returns the instance index, stable for the lifetime of the TLAS
+	uint32_t AddInstance(uint32_t blasIndex, const glm::mat4& objectToWorld, uint32_t materialIndex = RT_UINTMAX);
+	void SetTransform(uint32_t instance, const glm::mat4& objectToWorld);
+
+	// Brings the instance BVH up to date, the BLASes are left alone. Must be called before tracing once instances changed.
+	// Added instances rebuild it, moved ones only refit it until the SAH cost reaches rebuildThreshold times the cost of the last build.
+	// Returns true if it rebuilt, pool builds in parallel if given.
+	bool Update(const BVHBuildSettings& settings = InstanceBVHSettings(), float rebuildThreshold = 1.3f, ThreadPool* pool = nullptr);
+
+	inline bool								IsEmpty() const				{ return m_instances.empty(); }
+	inline bool								IsDirty() const				{ return m_dirty; }
+	inline const std::vector<TriangleBLAS>&	GetBLASes() const			{ return m_blases; }
+	inline const std::vector<TLASInstance>&	GetInstances() const		{ return m_instances; }
+	inline const BVH&						GetBVH() const				{ return m_bvh; }
+	inline uint32_t							GetRebuildCount() const		{ return m_rebuildCount; }
+	inline uint32_t							GetRefitCount() const		{ return m_refitCount; }
+
+	// Closest hit in (tMin, tMax) over all instances, rec.PrimIndex is left alone like TriangleBLAS::Hit
+	bool Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+	bool Occluded(const Ray& r, float tMin, float tMax) const;
+
+	// Buffers of the TLAS in rtiaw.hlsl: instances in leaf order for t6, the node array for t7, and the BLASes packed back to back for t4/t5.
+	// The BLASes need binary BVHs, the shaders don't read BVH8Nodes.
+	void GetShaderData(std::vector<RTInstance>& instances, std::vector<RTTriangle>& triangles, std::vector<BVHNode>& blasNodes) const;
+
+private:
+	// The world ray in the instance's object space. The direction isn't normalized, so hit distances stay the same in both spaces
+	static inline Ray ToObject(const TLASInstance& instance, const Ray& r)
+	{
+		return { glm::vec3(instance.WorldToObject * glm::vec4(r.Origin, 1.f)), glm::vec3(instance.WorldToObject * glm::vec4(r.Direction, 0.f)) };
+	}
+
+	AABB WorldBounds(const TLASInstance& instance) const;
+
+private:
+	std::vector<TriangleBLAS>	m_blases;
+	std::vector<TLASInstance>	m_instances;
+	BVH							m_bvh;
+	bool						m_dirty = false,
+								m_instancesAdded = false;
+	float						m_builtSAHCost = 0.f;
+	uint32_t					m_rebuildCount = 0,
+								m_refitCount = 0;
+};
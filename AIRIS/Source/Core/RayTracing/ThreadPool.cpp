@@ -0,0 +1,73 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	// The thread calling ParallelFor is thread 0
+	for (uint32_t i = 1; i < threadCount; ++i)
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wakeCV.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const ParallelForFunc& func)
+{
+	if (count == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &func;
+		m_jobCount = count;
+		m_nextIndex.store(0, std::memory_order_relaxed);
+		m_busyWorkers = static_cast<uint32_t>(m_workers.size());
+		++m_generation;
+	}
+	m_wakeCV.notify_all();
+
+	RunJob(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCV.wait(lock, [this] { return m_busyWorkers == 0; });
+	m_job = nullptr;
+}
+
+void ThreadPool::WorkerLoop(uint32_t threadIndex)
+{
+	uint64_t lastGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeCV.wait(lock, [&] { return m_stop || m_generation != lastGeneration; });
+			if (m_stop)
+				return;
+			lastGeneration = m_generation;
+		}
+
+		RunJob(threadIndex);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_busyWorkers == 0)
+			m_doneCV.notify_one();
+	}
+}
+
+void ThreadPool::RunJob(uint32_t threadIndex)
+{
+	const ParallelForFunc& func = *m_job;
+	for (uint32_t i = m_nextIndex.fetch_add(1, std::memory_order_relaxed); i < m_jobCount; i = m_nextIndex.fetch_add(1, std::memory_order_relaxed))
+		func(i, threadIndex);
+}
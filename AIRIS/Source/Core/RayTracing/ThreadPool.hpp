@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for the CPU ray tracer.
+// ParallelFor hands out indices through a shared atomic counter, the calling thread works too.
+class ThreadPool
+{
+public:
+	using ParallelForFunc = std::function<void(uint32_t index, uint32_t threadIndex)>;
+
+	// threadCount of 0 uses every hardware thread
+	explicit ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Number of threads taking part in ParallelFor, including the calling thread
+	inline uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_workers.size()) + 1; }
+
+	// Calls func for every index in [0, count) and blocks until all of them are done
+	void ParallelFor(uint32_t count, const ParallelForFunc& func);
+
+private:
+	void WorkerLoop(uint32_t threadIndex);
+	void RunJob(uint32_t threadIndex);
+
+private:
+	std::vector<std::thread>	m_workers;
+
+	std::mutex					m_mutex;
+	std::condition_variable		m_wakeCV,
+								m_doneCV;
+	bool						m_stop = false;
+	uint64_t					m_generation = 0;
+	uint32_t					m_busyWorkers = 0;
+
+	// Current job
+	const ParallelForFunc*		m_job = nullptr;
+	uint32_t					m_jobCount = 0;
+	std::atomic<uint32_t>		m_nextIndex = 0;
+};
@@ -0,0 +1,200 @@
+#include "TileScheduler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+	// Position d along the Hilbert curve filling an n x n grid, n a power of two
+	void HilbertToXY(uint32_t n, uint32_t d, uint32_t& x, uint32_t& y)
+	{
+		x = y = 0;
+		for (uint32_t s = 1; s < n; s *= 2)
+		{
+			const uint32_t rx = 1 & (d / 2), ry = 1 & (d ^ rx);
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				std::swap(x, y);
+			}
+			x += s * rx;
+			y += s * ry;
+			d /= 4;
+		}
+	}
+}
+
+void TileScheduler::BuildTiles(uint32_t width, uint32_t height, uint32_t tileSize)
+{
+	if (width == m_width && height == m_height && tileSize == m_tileSize)
+		return;
+	m_width = width;
+	m_height = height;
+	m_tileSize = tileSize;
+
+	const uint32_t tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+	auto makeTile = [&](uint32_t tx, uint32_t ty)
+	{
+		return Tile{ tx * tileSize, ty * tileSize, std::min(tileSize, width - tx * tileSize), std::min(tileSize, height - ty * tileSize) };
+	};
+
+	m_tiles.clear();
+	m_tiles.reserve(static_cast<size_t>(tilesX) * tilesY);
+	switch (m_settings.Order)
+	{
+	case TileOrder::Hilbert:
+	{
+		// The curve of the smallest power of two grid around the tiles, skipping the cells outside
+		uint32_t n = 1;
+		while (n < std::max(tilesX, tilesY))
+			n *= 2;
+		for (uint32_t d = 0; d < n * n; ++d)
+		{
+			uint32_t tx, ty;
+			HilbertToXY(n, d, tx, ty);
+			if (tx < tilesX && ty < tilesY)
+				m_tiles.push_back(makeTile(tx, ty));
+		}
+		break;
+	}
+	case TileOrder::Spiral:
+	{
+		for (uint32_t ty = 0; ty < tilesY; ++ty)
+		{
+			for (uint32_t tx = 0; tx < tilesX; ++tx)
+				m_tiles.push_back(makeTile(tx, ty));
+		}
+		// Square rings of tiles around the image centre, each one walked by angle
+		auto ringAndAngle = [&](const Tile& tile)
+		{
+			const float dx = static_cast<float>(tile.X) + 0.5f * tile.Width - 0.5f * width,
+						dy = static_cast<float>(tile.Y) + 0.5f * tile.Height - 0.5f * height;
+			return std::make_pair(static_cast<uint32_t>(std::max(std::abs(dx), std::abs(dy)) / tileSize), std::atan2(dy, dx));
+		};
+		std::stable_sort(m_tiles.begin(), m_tiles.end(), [&](const Tile& a, const Tile& b) { return ringAndAngle(a) < ringAndAngle(b); });
+		break;
+	}
+	default:
+		for (uint32_t ty = 0; ty < tilesY; ++ty)
+		{
+			for (uint32_t tx = 0; tx < tilesX; ++tx)
+				m_tiles.push_back(makeTile(tx, ty));
+		}
+		break;
+	}
+}
+
+void TileScheduler::Run(ThreadPool& pool, uint32_t width, uint32_t height, uint32_t tileSize, const TileFunc& func)
+{
+	auto start = std::chrono::steady_clock::now();
+	BuildTiles(width, height, std::max(tileSize, 1u));
+	const uint32_t tileCount = static_cast<uint32_t>(m_tiles.size());
+	if (tileCount == 0)
+		return;
+
+	// Deal the tiles out
+	const uint32_t dequeCount = pool.GetThreadCount();
+	if (dequeCount != m_dequeCount)
+	{
+		m_deques = std::vector<Deque>(dequeCount);
+		m_dequeCount = dequeCount;
+	}
+	m_dequeCapacity = (tileCount + dequeCount - 1) / dequeCount;
+	m_dequeTiles.resize(static_cast<size_t>(m_dequeCapacity) * dequeCount);
+	for (uint32_t deque = 0; deque < dequeCount; ++deque)
+	{
+		uint32_t count = 0;
+		uint32_t* tiles = m_dequeTiles.data() + static_cast<size_t>(deque) * m_dequeCapacity;
+		if (m_settings.Order == TileOrder::Spiral)
+		{
+			for (uint32_t tile = deque; tile < tileCount; tile += dequeCount)
+				tiles[count++] = tile;
+		}
+		else
+		{
+			const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(tileCount) * deque / dequeCount),
+							end = static_cast<uint32_t>(static_cast<uint64_t>(tileCount) * (deque + 1) / dequeCount);
+			for (uint32_t tile = first; tile < end; ++tile)
+				tiles[count++] = tile;
+		}
+		m_deques[deque].Range.store(Pack(0, count), std::memory_order_relaxed);
+		m_deques[deque].Steals = 0;
+		m_deques[deque].BusySeconds = 0.;
+	}
+	m_completed.store(0, std::memory_order_relaxed);
+
+	// One item per deque, whichever thread picks it up works through that deque and then steals
+	pool.ParallelFor(dequeCount, [&](uint32_t deque, uint32_t threadIndex)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		uint32_t tile;
+		while (Pop(deque, tile) || (m_settings.WorkStealing && Steal(deque, tile)))
+		{
+			func(m_tiles[tile], threadIndex);
+			m_completed.fetch_add(1, std::memory_order_relaxed);
+		}
+		m_deques[deque].BusySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	});
+
+	m_stats = TileStats();
+	m_stats.Tiles = tileCount;
+	for (const Deque& deque : m_deques)
+	{
+		m_stats.Steals += deque.Steals;
+		m_stats.BusySeconds += deque.BusySeconds;
+	}
+	m_stats.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool TileScheduler::Pop(uint32_t deque, uint32_t& tile)
+{
+	std::atomic<uint64_t>& range = m_deques[deque].Range;
+	uint64_t current = range.load(std::memory_order_acquire);
+	while (true)
+	{
+		const uint32_t front = static_cast<uint32_t>(current), back = static_cast<uint32_t>(current >> 32);
+		if (front >= back)
+			return false;
+		if (range.compare_exchange_weak(current, Pack(front + 1, back), std::memory_order_acq_rel))
+		{
+			tile = m_dequeTiles[static_cast<size_t>(deque) * m_dequeCapacity + front];
+			return true;
+		}
+	}
+}
+
+bool TileScheduler::Steal(uint32_t thief, uint32_t& tile)
+{
+	// Nothing is pushed during a run, so once every deque looks empty the run is over
+	while (true)
+	{
+		uint32_t victim = thief, mostLeft = 0;
+		uint64_t victimRange = 0;
+		for (uint32_t i = 1; i < m_dequeCount; ++i)
+		{
+			const uint32_t deque = (thief + i) % m_dequeCount;
+			const uint64_t range = m_deques[deque].Range.load(std::memory_order_acquire);
+			const uint32_t front = static_cast<uint32_t>(range), back = static_cast<uint32_t>(range >> 32);
+			if (back > front && back - front > mostLeft)
+			{
+				mostLeft = back - front;
+				victim = deque;
+				victimRange = range;
+			}
+		}
+		if (mostLeft == 0)
+			return false;
+
+		const uint32_t front = static_cast<uint32_t>(victimRange), back = static_cast<uint32_t>(victimRange >> 32);
+		if (m_deques[victim].Range.compare_exchange_strong(victimRange, Pack(front, back - 1), std::memory_order_acq_rel))
+		{
+			tile = m_dequeTiles[static_cast<size_t>(victim) * m_dequeCapacity + back - 1];
+			++m_deques[thief].Steals;
+			return true;
+		}
+	}
+}
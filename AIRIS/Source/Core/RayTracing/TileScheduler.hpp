@@ -0,0 +1,97 @@
+#pragma once
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+enum class TileOrder
+{
+	// Left to right, top to bottom
+	Rows,
+	// Along a Hilbert curve, tiles handed out one after another stay close together on screen
+	Hilbert,
+	// Rings around the centre of the image, the centre converges first in previews
+	Spiral,
+};
+
+struct TileSettings
+{
+	// Pixels along each side, the packet trace mode rounds it up to a multiple of RT_PACKET_DIM
+	uint32_t	Size = 16;
+	TileOrder	Order = TileOrder::Hilbert;
+	// Idle threads take tiles from the back of the busiest deque, off leaves every thread with its own share only
+	bool		WorkStealing = true;
+};
+
+struct Tile
+{
+	uint32_t	X,
+				Y,
+				Width,
+				Height;
+};
+
+// Counters of the last Run
+struct TileStats
+{
+	uint32_t	Tiles = 0,
+				Steals = 0;
+	// Wall clock of the run, and the time threads spent on tiles summed over threads
+	double		Seconds = 0.,
+				BusySeconds = 0.;
+};
+
+// Tile scheduler of the CPU tracer.
+// The tiles of the image are sorted by the TileOrder once, and dealt out to one deque per thread: round robin for Spiral so
+// every thread starts at the centre, in contiguous runs for the other orders so each thread keeps a compact region.
+// Owners pop from the front of their deque and thieves from the back. Both ends of a deque live in one atomic word,
+// so popping, stealing and counting completed tiles never take a lock.
+class TileScheduler
+{
+public:
+	using TileFunc = std::function<void(const Tile& tile, uint32_t threadIndex)>;
+
+	inline void					SetSettings(const TileSettings& settings)	{ m_settings = settings; m_width = m_height = 0; }
+	inline const TileSettings&	GetSettings() const							{ return m_settings; }
+
+	// Calls func once for every tile of a width x height image and blocks until all of them are done
+	void Run(ThreadPool& pool, uint32_t width, uint32_t height, uint32_t tileSize, const TileFunc& func);
+
+	// Tiles done so far in the current run, safe to read from other threads for progress
+	inline uint32_t				GetCompletedTiles() const	{ return m_completed.load(std::memory_order_relaxed); }
+	inline const TileStats&		GetStats() const			{ return m_stats; }
+	// Tiles in the order they are handed out
+	inline const std::vector<Tile>&	GetTiles() const		{ return m_tiles; }
+
+private:
+	void BuildTiles(uint32_t width, uint32_t height, uint32_t tileSize);
+	bool Pop(uint32_t deque, uint32_t& tile);
+	bool Steal(uint32_t thief, uint32_t& tile);
+
+	// Front in the low 32 bits, back in the high ones, the deque is empty once they meet
+	static inline uint64_t Pack(uint32_t front, uint32_t back)	{ return static_cast<uint64_t>(back) << 32 | front; }
+
+private:
+	// Padded so threads popping their own deque don't share cache lines
+	struct alignas(64) Deque
+	{
+		std::atomic<uint64_t>	Range = 0;
+		uint32_t				Steals = 0;
+		double					BusySeconds = 0.;
+	};
+
+	TileSettings			m_settings;
+	uint32_t				m_width = 0,
+							m_height = 0,
+							m_tileSize = 0,
+							m_dequeCount = 0;
+	std::vector<Tile>		m_tiles;
+	// Tiles indices of every deque back to back, deque i owns [i * m_dequeCapacity, (i + 1) * m_dequeCapacity)
+	std::vector<uint32_t>	m_dequeTiles;
+	uint32_t				m_dequeCapacity = 0;
+	std::vector<Deque>		m_deques;
+
+	std::atomic<uint32_t>	m_completed = 0;
+	TileStats				m_stats;
+};
@@ -0,0 +1,222 @@
+#include "TriangleBLAS.hpp"
+#include <cmath>
+
+TriangleMeshView TriangleMeshData::GetView() const
+{
+	TriangleMeshView view;
+	view.Vertices = Positions.data();
+	view.VertexStride = sizeof(glm::vec3);
+	view.VertexCount = static_cast<uint32_t>(Positions.size());
+	view.Indices = Indices.data();
+	view.IndexSize = sizeof(uint32_t);
+	view.IndexCount = static_cast<uint32_t>(Indices.size());
+	return view;
+}
+
+TriangleMeshData TriangleMeshData::CreateCube()
+{
+	TriangleMeshData cube;
+	cube.Positions =
+	{
+		{-0.5f, -0.5f, 0.0f}, //FBL 0
+		{-0.5f, 0.5f, 0.0f},  //FTL 1
+		{0.5f, 0.5f, 0.0f},   //FTR 2
+		{0.5f, -0.5f, 0.0f},  //FBR 3
+		{-0.5f, -0.5f, 1.0f}, //BBL 4
+		{-0.5f, 0.5f, 1.0f},  //BTL 5
+		{0.5f, 0.5f, 1.0f},   //BTR 6
+		{0.5f, -0.5f, 1.0f},  //BBR 7
+	};
+	cube.Indices =
+	{
+		0,1,2, 2,3,0,	// Front
+		7,6,5, 5,4,7,	// Back
+		4,5,1, 1,0,4,	// Left
+		3,2,6, 6,7,3,	// Right
+		1,5,6, 6,2,1,	// Top
+		3,7,4, 4,0,3,	// Bottom
+	};
+	return cube;
+}
+
+TriangleMeshData TriangleMeshData::CreateTorus(float majorRadius, float minorRadius, uint32_t segments, uint32_t rings)
+{
+	TriangleMeshData torus;
+	segments = std::max(segments, 3u);
+	rings = std::max(rings, 3u);
+	torus.Positions.reserve(static_cast<size_t>(segments) * rings);
+	for (uint32_t s = 0; s < segments; ++s)
+	{
+		float phi = 2.f * 3.14159265358979f * s / segments;
+		for (uint32_t r = 0; r < rings; ++r)
+		{
+			float theta = 2.f * 3.14159265358979f * r / rings,
+				  radius = majorRadius + minorRadius * cosf(theta);
+			torus.Positions.push_back({ radius * cosf(phi), minorRadius * sinf(theta), radius * sinf(phi) });
+		}
+	}
+
+	// Two triangles per quad of the (segment, ring) grid, both directions wrap around
+	torus.Indices.reserve(static_cast<size_t>(segments) * rings * 6);
+	for (uint32_t s = 0; s < segments; ++s)
+	{
+		uint32_t sNext = (s + 1) % segments;
+		for (uint32_t r = 0; r < rings; ++r)
+		{
+			uint32_t	rNext = (r + 1) % rings,
+						i00 = s * rings + r, i01 = s * rings + rNext,
+						i10 = sNext * rings + r, i11 = sNext * rings + rNext;
+			torus.Indices.insert(torus.Indices.end(), { i00, i10, i11, i11, i01, i00 });
+		}
+	}
+	return torus;
+}
+
+WatertightRay::WatertightRay(const Ray& r)
+	:Origin(r.Origin)
+{
+	// Largest direction component becomes z, x and y are swapped for negative z to keep the winding
+	glm::vec3 absDir = glm::abs(r.Direction);
+	Kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+	Kx = (Kz + 1) % 3;
+	Ky = (Kx + 1) % 3;
+	if (r.Direction[Kz] < 0.f)
+		std::swap(Kx, Ky);
+
+	Sz = 1.f / r.Direction[Kz];
+	Sx = r.Direction[Kx] * Sz;
+	Sy = r.Direction[Ky] * Sz;
+}
+
+bool IntersectTriangle(const WatertightRay& ray, const RTTriangle& tri, float tMin, float tMax, float& t, float& u, float& v)
+{
+	const glm::vec3	a = tri.V0 - ray.Origin,
+					b = tri.V1 - ray.Origin,
+					c = tri.V2 - ray.Origin;
+
+	// Shear and scale the vertices into ray space
+	const float	ax = a[ray.Kx] - ray.Sx * a[ray.Kz], ay = a[ray.Ky] - ray.Sy * a[ray.Kz],
+				bx = b[ray.Kx] - ray.Sx * b[ray.Kz], by = b[ray.Ky] - ray.Sy * b[ray.Kz],
+				cx = c[ray.Kx] - ray.Sx * c[ray.Kz], cy = c[ray.Ky] - ray.Sy * c[ray.Kz];
+
+	// Scaled barycentrics, the edge functions
+	float	e0 = cx * by - cy * bx,
+			e1 = ax * cy - ay * cx,
+			e2 = bx * ay - by * ax;
+
+	// On an edge in float precision, redo it in double so the edge is assigned to exactly one of its triangles
+	if (e0 == 0.f || e1 == 0.f || e2 == 0.f)
+	{
+		e0 = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+		e1 = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+		e2 = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+	}
+
+	if ((e0 < 0.f || e1 < 0.f || e2 < 0.f) && (e0 > 0.f || e1 > 0.f || e2 > 0.f))
+		return false;
+	const float det = e0 + e1 + e2;
+	if (det == 0.f)
+		return false;
+
+	// Scaled distance, compared before the division
+	const float tScaled = ray.Sz * (e0 * a[ray.Kz] + e1 * b[ray.Kz] + e2 * c[ray.Kz]);
+	const float	detSign = std::copysign(1.f, det),
+				tSigned = tScaled * detSign,
+				detAbs = det * detSign;
+	if (tSigned <= tMin * detAbs || tSigned >= tMax * detAbs)
+		return false;
+
+	const float invDet = 1.f / det;
+	t = tScaled * invDet;
+	u = e1 * invDet;
+	v = e2 * invDet;
+	return true;
+}
+
+void TriangleBLAS::Build(const TriangleMeshView& mesh, uint32_t materialIndex, const glm::mat4& transform, const BVHBuildSettings& settings, ThreadPool* pool)
+{
+	const uint8_t* vertices = static_cast<const uint8_t*>(mesh.Vertices);
+	auto index = [&](uint32_t i) -> uint32_t
+	{
+		const uint32_t location = mesh.StartIndexLocation + i;
+		uint32_t value = mesh.IndexSize == sizeof(uint16_t) ? static_cast<const uint16_t*>(mesh.Indices)[location] : static_cast<const uint32_t*>(mesh.Indices)[location];
+		return static_cast<uint32_t>(static_cast<int32_t>(value) + mesh.BaseVertexLocation);
+	};
+	auto position = [&](uint32_t vertex)
+	{
+		const glm::vec3& p = *reinterpret_cast<const glm::vec3*>(vertices + static_cast<size_t>(vertex) * mesh.VertexStride);
+		return glm::vec3(transform * glm::vec4(p, 1.f));
+	};
+
+	const uint32_t triangleCount = mesh.IndexCount / 3;
+	std::vector<RTTriangle> triangles(triangleCount);
+	std::vector<AABB> bounds(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; ++i)
+	{
+		RTTriangle& tri = triangles[i];
+		tri.V0 = position(index(3 * i));
+		tri.V1 = position(index(3 * i + 1));
+		tri.V2 = position(index(3 * i + 2));
+		tri.MaterialIndex = materialIndex;
+		bounds[i].Grow(tri.V0);
+		bounds[i].Grow(tri.V1);
+		bounds[i].Grow(tri.V2);
+	}
+
+	m_bvh.Build(bounds, settings, pool);
+
+	// Store the triangles in leaf order
+	const std::vector<uint32_t>& primIndices = m_bvh.GetPrimIndices();
+	m_triangles.resize(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; ++i)
+		m_triangles[i] = triangles[primIndices[i]];
+}
+
+bool TriangleBLAS::Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+	const WatertightRay ray(r);
+	uint32_t closestTriangle = RT_UINTMAX;
+	m_bvh.Traverse(r, tMin, tMax, [&](uint32_t first, uint32_t count, float& closest)
+	{
+		bool hit = false;
+		float t, u, v;
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			if (IntersectTriangle(ray, m_triangles[i], tMin, closest, t, u, v))
+			{
+				closest = t;
+				closestTriangle = i;
+				hit = true;
+			}
+		}
+		return hit;
+	});
+
+	if (closestTriangle == RT_UINTMAX)
+		return false;
+
+	const RTTriangle& tri = m_triangles[closestTriangle];
+	rec.T = tMax;
+	rec.Pos = r.At(tMax);
+	rec.SetFaceNormal(r, glm::normalize(glm::cross(tri.V1 - tri.V0, tri.V2 - tri.V0)));
+	rec.MaterialIndex = tri.MaterialIndex;
+	return true;
+}
+
+bool TriangleBLAS::Occluded(const Ray& r, float tMin, float tMax) const
+{
+	const WatertightRay ray(r);
+	return m_bvh.Traverse(r, tMin, tMax, [&](uint32_t first, uint32_t count, float& closest)
+	{
+		float t, u, v;
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			if (IntersectTriangle(ray, m_triangles[i], tMin, closest, t, u, v))
+			{
+				closest = tMin;
+				return true;
+			}
+		}
+		return false;
+	});
+}
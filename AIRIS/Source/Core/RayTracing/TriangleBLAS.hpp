@@ -0,0 +1,70 @@
+#pragma once
+#include "Core/Graphics/RTHelper.hpp"
+#include "RTCommon.hpp"
+#include "BVH.hpp"
+#include <vector>
+
+// Vertex and index data a BLAS is built from, laid out like the CPU copies Mesh keeps of its buffers.
+// Positions are the first float3 of every vertex, indices are 16 or 32 bit, a range of them is read like a SubMesh draw.
+struct TriangleMeshView
+{
+	const void*	Vertices = nullptr;
+	uint32_t	VertexStride = sizeof(glm::vec3),
+				VertexCount = 0;
+	const void*	Indices = nullptr;
+	uint32_t	IndexSize = sizeof(uint32_t),
+				IndexCount = 0,
+				StartIndexLocation = 0;
+	int32_t		BaseVertexLocation = 0;
+};
+
+// Owning positions and 32 bit indices, for meshes generated on the CPU
+struct TriangleMeshData
+{
+	std::vector<glm::vec3>	Positions;
+	std::vector<uint32_t>	Indices;
+
+	TriangleMeshView GetView() const;
+
+	// Same 8 vertices and 36 indices as the cube of RRenderer::CreateObjects
+	static TriangleMeshData CreateCube();
+	// Torus around the y axis with 2 * segments * rings triangles
+	static TriangleMeshData CreateTorus(float majorRadius, float minorRadius, uint32_t segments, uint32_t rings);
+};
+
+// Per ray setup of the watertight ray/triangle test (Woop, Benthin and Wald 2013).
+// The ray is sheared so it runs along +z, triangles are then tested in 2D with edge functions evaluated
+// the same way for both triangles sharing an edge, so rays can't slip through between them.
+struct WatertightRay
+{
+	glm::vec3	Origin;
+	int			Kx, Ky, Kz;
+	float		Sx, Sy, Sz;
+
+	explicit WatertightRay(const Ray& r);
+};
+
+// Hit distance in (tMin, tMax) and the barycentrics of V1 and V2, false on a miss
+bool IntersectTriangle(const WatertightRay& ray, const RTTriangle& tri, float tMin, float tMax, float& t, float& u, float& v);
+
+// Bottom level acceleration structure of one triangle mesh: a binned SAH BVH and the triangles stored in leaf order
+class TriangleBLAS
+{
+public:
+	// transform places the mesh, positions are stored after it is applied. pool builds the BVH in parallel if given
+	void Build(const TriangleMeshView& mesh, uint32_t materialIndex, const glm::mat4& transform = glm::mat4(1.f), const BVHBuildSettings& settings = {}, ThreadPool* pool = nullptr);
+
+	inline bool								IsEmpty() const				{ return m_triangles.empty(); }
+	inline uint32_t							GetTriangleCount() const	{ return static_cast<uint32_t>(m_triangles.size()); }
+	inline const std::vector<RTTriangle>&	GetTriangles() const		{ return m_triangles; }
+	inline const BVH&						GetBVH() const				{ return m_bvh; }
+	inline AABB								GetBounds() const			{ return m_bvh.GetBounds(); }
+
+	// Closest hit in (tMin, tMax). rec.PrimIndex is left alone, only spheres are referenced by it
+	bool Hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const;
+	bool Occluded(const Ray& r, float tMin, float tMax) const;
+
+private:
+	std::vector<RTTriangle>	m_triangles;
+	BVH						m_bvh;
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <cmath>
+
+// Closed form warps from [0, 1)^2 samples. They take exactly two sample values and contain no loops or
+// data dependent branches (the conditionals are selects), so they keep the stratification of the sampler.
+// Same math as the WARPS section of RT.hlsl.
+
+#define RT_PI 3.14159265358979f
+
+inline glm::vec3 SampleUniformSphere(const glm::vec2& u)
+{
+	float z = 1.f - 2.f * u.x,
+		  r = sqrtf(std::fmax(0.f, 1.f - z * z)),
+		  phi = 2.f * RT_PI * u.y;
+	return { r * cosf(phi), r * sinf(phi), z };
+}
+
+// Shirley-Chiu concentric mapping, squares map to rings so neighbouring samples stay neighbours on the disk
+inline glm::vec2 SampleConcentricDisk(const glm::vec2& u)
+{
+	float a = 2.f * u.x - 1.f,
+		  b = 2.f * u.y - 1.f;
+	bool  xMajor = std::fabs(a) > std::fabs(b);
+	float r = xMajor ? a : b,
+		  denominator = r != 0.f ? r : 1.f,
+		  phi = xMajor ? (RT_PI / 4.f) * (b / denominator) : (RT_PI / 2.f) - (RT_PI / 4.f) * (a / denominator);
+	return { r * cosf(phi), r * sinf(phi) };
+}
+
+// Orthonormal basis around a unit vector without branching on its direction (Duff et al. 2017)
+inline void BuildONB(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+{
+	float signZ = n.z >= 0.f ? 1.f : -1.f,
+		  a = -1.f / (signZ + n.z),
+		  b = n.x * n.y * a;
+	tangent = { 1.f + signZ * n.x * n.x * a, signZ * b, -signZ * n.x };
+	bitangent = { b, signZ + n.y * n.y * a, -n.y };
+}
+
+// Cosine weighted direction around normal, pdf = cos(theta) / pi. A concentric disk sample lifted onto the hemisphere (Malley's method)
+inline glm::vec3 SampleCosineHemisphere(const glm::vec2& u, const glm::vec3& normal)
+{
+	glm::vec2 d = SampleConcentricDisk(u);
+	float z = sqrtf(std::fmax(0.f, 1.f - d.x * d.x - d.y * d.y));
+	glm::vec3 tangent, bitangent;
+	BuildONB(normal, tangent, bitangent);
+	return d.x * tangent + d.y * bitangent + z * normal;
+}
+
+// Uniform direction in the cone of half angle thetaMax around axis, pdf = 1 / (2 * pi * oneMinusCosMax).
+// Takes 1 - cos(thetaMax) so narrow cones of distant lights don't lose their precision
+inline glm::vec3 SampleUniformCone(const glm::vec2& u, const glm::vec3& axis, float oneMinusCosMax)
+{
+	float oneMinusCos = u.x * oneMinusCosMax,
+		  sinTheta = sqrtf(std::fmax(0.f, oneMinusCos * (2.f - oneMinusCos))),
+		  phi = 2.f * RT_PI * u.y;
+	glm::vec3 tangent, bitangent;
+	BuildONB(axis, tangent, bitangent);
+	return (sinTheta * cosf(phi)) * tangent + (sinTheta * sinf(phi)) * bitangent + (1.f - oneMinusCos) * axis;
+}
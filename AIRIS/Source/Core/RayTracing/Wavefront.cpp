@@ -0,0 +1,364 @@
+#include "Wavefront.hpp"
+#include <atomic>
+#include <chrono>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	double Seconds(Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+}
+
+WavefrontPipeline::WavefrontPipeline(uint32_t maxPathsInFlight)
+	:m_maxPaths(std::max(maxPathsInFlight, 1u))
+{
+}
+
+void WavefrontPipeline::TraceWave(ThreadPool& pool, const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants, uint32_t width, const uint32_t* pixels, uint32_t pathCount)
+{
+	if (m_paths.size() < pathCount)
+	{
+		m_rays.resize(pathCount);
+		m_paths.resize(pathCount);
+		m_hits.resize(pathCount);
+		m_pathQueue.resize(pathCount);
+		m_shadowRays.resize(pathCount);
+		m_active.resize(pathCount);
+		m_queue.resize(pathCount);
+		m_reorderKeys.resize(pathCount);
+		m_sortedKeys.resize(pathCount);
+	}
+
+	auto start = Clock::now();
+	Generate(pool, camera, constants, width, pixels, pathCount);
+	m_stats.Generate += Seconds(start);
+
+	uint32_t activeCount = pathCount;
+	for (uint32_t bounce = 0; bounce < constants.MaxRayBounces + 1 && activeCount > 0; ++bounce)
+	{
+		// Camera rays are already coherent in pixel order
+		if (m_reorderRays && bounce > 0)
+		{
+			start = Clock::now();
+			Reorder(pool, activeCount);
+			m_stats.Reorder += Seconds(start);
+		}
+
+		start = Clock::now();
+		Extend(pool, scene, activeCount, bounce == 0);
+		m_stats.Extend += Seconds(start);
+
+		start = Clock::now();
+		Sort(pool, activeCount);
+		m_stats.Sort += Seconds(start);
+		m_stats.Rays += m_queueBegin[s_terminatedQueue];
+
+		start = Clock::now();
+		Miss(pool);
+		m_stats.Miss += Seconds(start);
+
+		start = Clock::now();
+		Emit(pool, scene, constants);
+		m_stats.Emit += Seconds(start);
+
+		// Paths still going after the last bounce contribute nothing more, same as the shader
+		activeCount = m_queueBegin[s_emissiveQueue];
+		if (bounce == constants.MaxRayBounces)
+			break;
+
+		start = Clock::now();
+		Shade(pool, scene, constants, bounce);
+		m_stats.Shade += Seconds(start);
+
+		start = Clock::now();
+		Connect(pool, scene, constants);
+		m_stats.Connect += Seconds(start);
+
+		std::swap(m_active, m_queue);
+	}
+}
+
+void WavefrontPipeline::Generate(ThreadPool& pool, const RTCameraSD& camera, const RTConstants& constants, uint32_t width, const uint32_t* pixels, uint32_t pathCount)
+{
+	pool.ParallelFor(ChunkCount(pathCount), [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		const uint32_t end = std::min(pathCount, (chunk + 1) * s_chunkSize);
+		for (uint32_t p = chunk * s_chunkSize; p < end; ++p)
+		{
+			const uint32_t pixel = pixels[p], x = pixel % width, y = pixel / width;
+
+			// Initilize the sampler the same way the shader does
+			Path& path = m_paths[p];
+			path.Sampler = PathSampler(constants, x, y, width);
+			path.State = PathState();
+			path.Pixel = pixel;
+			if (m_recordFirstHit)
+				path.FirstHit = AOVSample();
+
+			m_rays[p] = GetRay(static_cast<float>(x), static_cast<float>(y), camera, path.Sampler);
+			m_pathQueue[p] = 0;
+			m_active[p] = p;
+		}
+	});
+}
+
+void WavefrontPipeline::Reorder(ThreadPool& pool, uint32_t activeCount)
+{
+	const uint32_t chunks = ChunkCount(activeCount);
+
+	// Origin cells span the bounds of the ray origins, the scene bounds are mostly empty space around the ground sphere
+	std::vector<glm::vec3> chunkMin(chunks, glm::vec3(RT_FLOATMAX)), chunkMax(chunks, glm::vec3(-RT_FLOATMAX));
+	pool.ParallelFor(chunks, [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		const uint32_t end = std::min(activeCount, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = chunk * s_chunkSize; i < end; ++i)
+		{
+			const uint32_t p = m_active[i];
+			if (m_pathQueue[p] == s_terminatedQueue)
+				continue;
+			chunkMin[chunk] = glm::min(chunkMin[chunk], m_rays[p].Origin);
+			chunkMax[chunk] = glm::max(chunkMax[chunk], m_rays[p].Origin);
+		}
+	});
+	glm::vec3 originMin(RT_FLOATMAX), originMax(-RT_FLOATMAX);
+	for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		originMin = glm::min(originMin, chunkMin[chunk]);
+		originMax = glm::max(originMax, chunkMax[chunk]);
+	}
+
+	// Key: Morton code of the origin cell above the direction octant, so rays leaving the same cell the same way end up together.
+	// Paths ended by Russian roulette sort behind everything
+	constexpr float cells = static_cast<float>(1 << s_reorderCellBits);
+	const glm::vec3 extent = originMax - originMin;
+	const glm::vec3 scale = glm::vec3(
+		extent.x > 0.f ? cells / extent.x : 0.f,
+		extent.y > 0.f ? cells / extent.y : 0.f,
+		extent.z > 0.f ? cells / extent.z : 0.f);
+	pool.ParallelFor(chunks, [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		const uint32_t end = std::min(activeCount, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = chunk * s_chunkSize; i < end; ++i)
+		{
+			const uint32_t p = m_active[i];
+			if (m_pathQueue[p] == s_terminatedQueue)
+			{
+				m_reorderKeys[i] = UINT16_MAX;
+				continue;
+			}
+			const Ray& ray = m_rays[p];
+			const glm::uvec3 cell = glm::min(glm::uvec3((ray.Origin - originMin) * scale), glm::uvec3(cells - 1.f));
+			uint32_t key = 0;
+			for (uint32_t bit = 0; bit < s_reorderCellBits; ++bit)
+				key |= ((cell.x >> bit & 1) << 2 | (cell.y >> bit & 1) << 1 | (cell.z >> bit & 1)) << (3 * bit);
+			const uint32_t octant = (ray.Direction.x < 0.f) << 2 | (ray.Direction.y < 0.f) << 1 | (ray.Direction.z < 0.f);
+			m_reorderKeys[i] = static_cast<uint16_t>(key << 3 | octant);
+		}
+	});
+
+	// Two stable counting sort passes over the key bytes, same chunked scheme as Sort. m_queue is free until Sort refills it
+	m_chunkOffsets.resize(static_cast<size_t>(chunks) * 256);
+	for (uint32_t shift = 0; shift < 16; shift += 8)
+	{
+		std::fill(m_chunkOffsets.begin(), m_chunkOffsets.end(), 0u);
+		pool.ParallelFor(chunks, [&](uint32_t chunk, uint32_t threadIndex)
+		{
+			uint32_t* counts = &m_chunkOffsets[static_cast<size_t>(chunk) * 256];
+			const uint32_t end = std::min(activeCount, (chunk + 1) * s_chunkSize);
+			for (uint32_t i = chunk * s_chunkSize; i < end; ++i)
+				++counts[m_reorderKeys[i] >> shift & 0xff];
+		});
+
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; ++digit)
+		{
+			for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+			{
+				uint32_t& count = m_chunkOffsets[static_cast<size_t>(chunk) * 256 + digit];
+				uint32_t chunkCount = count;
+				count = offset;
+				offset += chunkCount;
+			}
+		}
+
+		pool.ParallelFor(chunks, [&](uint32_t chunk, uint32_t threadIndex)
+		{
+			uint32_t* offsets = &m_chunkOffsets[static_cast<size_t>(chunk) * 256];
+			const uint32_t end = std::min(activeCount, (chunk + 1) * s_chunkSize);
+			for (uint32_t i = chunk * s_chunkSize; i < end; ++i)
+			{
+				const uint32_t dst = offsets[m_reorderKeys[i] >> shift & 0xff]++;
+				m_sortedKeys[dst] = m_reorderKeys[i];
+				m_queue[dst] = m_active[i];
+			}
+		});
+		std::swap(m_reorderKeys, m_sortedKeys);
+		std::swap(m_active, m_queue);
+	}
+}
+
+void WavefrontPipeline::Extend(ThreadPool& pool, const RTScene& scene, uint32_t activeCount, bool cameraRays)
+{
+	const std::vector<RTMaterial>& materials = scene.GetMaterials();
+	const bool recordFirstHit = cameraRays && m_recordFirstHit;
+	pool.ParallelFor(ChunkCount(activeCount), [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		const uint32_t end = std::min(activeCount, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = chunk * s_chunkSize; i < end; ++i)
+		{
+			const uint32_t p = m_active[i];
+			if (m_pathQueue[p] == s_terminatedQueue)
+				continue;
+			if (scene.Hit(m_rays[p], 0.01f, RT_FLOATMAX, m_hits[p]))
+			{
+				const MTType type = materials[m_hits[p].MaterialIndex].Type;
+				if (recordFirstHit)
+					m_paths[p].FirstHit = MakeAOVSample(m_hits[p], materials);
+				m_pathQueue[p] = static_cast<uint8_t>(type == MTType::Emissive ? s_emissiveQueue : std::min<uint32_t>(type, MTType::HollowGlass));
+			}
+			else
+				m_pathQueue[p] = s_missQueue;
+		}
+	});
+}
+
+void WavefrontPipeline::Sort(ThreadPool& pool, uint32_t activeCount)
+{
+	// Stable counting sort of the active list by queue: count per chunk, prefix sum over (queue, chunk), scatter
+	const uint32_t chunks = ChunkCount(activeCount);
+	m_chunkOffsets.assign(static_cast<size_t>(chunks) * s_queueCount, 0);
+
+	pool.ParallelFor(chunks, [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		uint32_t* counts = &m_chunkOffsets[static_cast<size_t>(chunk) * s_queueCount];
+		const uint32_t end = std::min(activeCount, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = chunk * s_chunkSize; i < end; ++i)
+			++counts[m_pathQueue[m_active[i]]];
+	});
+
+	uint32_t offset = 0;
+	for (uint32_t q = 0; q < s_queueCount; ++q)
+	{
+		m_queueBegin[q] = offset;
+		for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+		{
+			uint32_t& count = m_chunkOffsets[static_cast<size_t>(chunk) * s_queueCount + q];
+			uint32_t chunkCount = count;
+			count = offset;
+			offset += chunkCount;
+		}
+	}
+	m_queueBegin[s_queueCount] = offset;
+
+	pool.ParallelFor(chunks, [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		uint32_t* offsets = &m_chunkOffsets[static_cast<size_t>(chunk) * s_queueCount];
+		const uint32_t end = std::min(activeCount, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = chunk * s_chunkSize; i < end; ++i)
+		{
+			const uint32_t p = m_active[i];
+			m_queue[offsets[m_pathQueue[p]]++] = p;
+		}
+	});
+}
+
+void WavefrontPipeline::Miss(ThreadPool& pool)
+{
+	const uint32_t begin = m_queueBegin[s_missQueue], count = m_queueBegin[s_missQueue + 1] - begin;
+	pool.ParallelFor(ChunkCount(count), [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		const uint32_t end = begin + std::min(count, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = begin + chunk * s_chunkSize; i < end; ++i)
+		{
+			const uint32_t p = m_queue[i];
+			PathState& path = m_paths[p].State;
+			path.Radiance += path.Throughput * SkyColor(m_rays[p]);
+		}
+	});
+}
+
+void WavefrontPipeline::Emit(ThreadPool& pool, const RTScene& scene, const RTConstants& constants)
+{
+	const std::vector<RTMaterial>& materials = scene.GetMaterials();
+	const uint32_t begin = m_queueBegin[s_emissiveQueue], count = m_queueBegin[s_emissiveQueue + 1] - begin;
+	pool.ParallelFor(ChunkCount(count), [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		const uint32_t end = begin + std::min(count, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = begin + chunk * s_chunkSize; i < end; ++i)
+		{
+			const uint32_t p = m_queue[i];
+			const HitRecord& hitRec = m_hits[p];
+			PathState& path = m_paths[p].State;
+			path.Radiance += HitEmission(scene, constants, m_rays[p], hitRec, materials[hitRec.MaterialIndex], path);
+		}
+	});
+}
+
+void WavefrontPipeline::Shade(ThreadPool& pool, const RTScene& scene, const RTConstants& constants, uint32_t bounce)
+{
+	const std::vector<RTMaterial>& materials = scene.GetMaterials();
+
+	// Every queue holds a single material type, so each kernel runs one scatter function without branching on the type.
+	// Only the diffuse kernel samples lights, specular bounces can't be weighted against a light sample.
+	auto shadeQueue = [&](uint32_t queue, auto scatter, bool sampleLights)
+	{
+		const uint32_t begin = m_queueBegin[queue], count = m_queueBegin[queue + 1] - begin;
+		pool.ParallelFor(ChunkCount(count), [&](uint32_t chunk, uint32_t threadIndex)
+		{
+			const uint32_t end = begin + std::min(count, (chunk + 1) * s_chunkSize);
+			for (uint32_t i = begin + chunk * s_chunkSize; i < end; ++i)
+			{
+				const uint32_t p = m_queue[i];
+				const HitRecord& hitRec = m_hits[p];
+				const RTMaterial& material = materials[hitRec.MaterialIndex];
+				Path& path = m_paths[p];
+				Ray& ray = m_rays[p];
+
+				if (sampleLights && !SampleDirectLight(scene, constants, hitRec, material, path.State.Throughput, bounce, path.Sampler, m_shadowRays[p]))
+					m_shadowRays[p].TMax = 0.f;
+
+				ray.Origin = hitRec.Pos;
+				path.Sampler.StartBounce(bounce);
+				path.State.Throughput *= scatter(ray, hitRec, material, path.Sampler);
+				path.State.ScatterPdf = ScatterPdf(ray, hitRec, material);
+				if (!RussianRoulette(path.State.Throughput, bounce, constants, path.Sampler))
+					m_pathQueue[p] = s_terminatedQueue;
+			}
+		});
+	};
+
+	shadeQueue(MTType::Diffuse, ScatterDiffuse, constants.NextEventEstimation && !scene.GetLights().empty());
+	shadeQueue(MTType::Metal, ScatterMetal, false);
+	shadeQueue(MTType::Dielectric, ScatterDielectric, false);
+	shadeQueue(MTType::HollowGlass, ScatterPassThrough, false);
+}
+
+void WavefrontPipeline::Connect(ThreadPool& pool, const RTScene& scene, const RTConstants& constants)
+{
+	// Shadow rays only come from the diffuse queue, which stays in place until the next Sort
+	if (!constants.NextEventEstimation || scene.GetLights().empty())
+		return;
+
+	std::atomic<uint64_t> shadowRays = 0;
+	const uint32_t begin = m_queueBegin[MTType::Diffuse], count = m_queueBegin[MTType::Diffuse + 1] - begin;
+	pool.ParallelFor(ChunkCount(count), [&](uint32_t chunk, uint32_t threadIndex)
+	{
+		uint64_t traced = 0;
+		const uint32_t end = begin + std::min(count, (chunk + 1) * s_chunkSize);
+		for (uint32_t i = begin + chunk * s_chunkSize; i < end; ++i)
+		{
+			const uint32_t p = m_queue[i];
+			const ShadowRay& shadow = m_shadowRays[p];
+			if (shadow.TMax <= 0.f)
+				continue;
+			++traced;
+			if (!scene.Occluded(shadow.Segment, 0.01f, shadow.TMax))
+				m_paths[p].State.Radiance += shadow.Radiance;
+		}
+		shadowRays += traced;
+	});
+	m_stats.Rays += shadowRays;
+}
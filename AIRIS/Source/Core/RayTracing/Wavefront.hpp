@@ -0,0 +1,133 @@
+#pragma once
+#include "Core/Graphics/Camera.hpp"
+#include "Core/Graphics/RTHelper.hpp"
+#include "AOV.hpp"
+#include "RTCommon.hpp"
+#include "RTScene.hpp"
+#include "RTShading.hpp"
+#include "Sampler.hpp"
+#include "ThreadPool.hpp"
+
+// Time spent in each stage of the wavefront pipeline, in seconds
+struct WavefrontStats
+{
+	double		Generate = 0.,
+				Reorder = 0.,
+				Extend = 0.,
+				Sort = 0.,
+				Shade = 0.,
+				Miss = 0.,
+				Emit = 0.,
+				Connect = 0.;
+	uint64_t	Rays = 0;
+};
+
+// Wavefront path tracing: instead of one loop per path that branches on the material (the megakernel of rtiaw.hlsl),
+// every bounce runs as separate batched stages over all paths in flight:
+//		Generate	camera rays for a range of pixels
+//		Reorder		bins the scattered rays of the active list by origin cell and direction octant, so neighbouring rays walk the same BVH nodes
+//		Extend		closest hit of every active ray
+//		Sort		compacts the hits into one queue per MTType plus a miss queue
+//		Miss		sky contribution of the rays that left the scene
+//		Emit		contribution of the paths that reached a light
+//		Shade		one kernel per scattering material queue, scattered rays make up the next bounce, Russian roulette ends paths.
+//					The diffuse kernel also samples a light and leaves a shadow ray behind
+//		Connect		traces the shadow rays, unoccluded ones add their light
+// The scattering material queues sit in front of the emissive and miss queues, so they are the compacted active list of the next bounce.
+// Paths ended by Russian roulette are kept out of Extend and sorted into a queue of their own behind the miss queue.
+class WavefrontPipeline
+{
+public:
+	static constexpr uint32_t s_materialQueues = MTType::HollowGlass + 1;
+	static constexpr uint32_t s_emissiveQueue = s_materialQueues;
+	static constexpr uint32_t s_missQueue = s_emissiveQueue + 1;
+	static constexpr uint32_t s_terminatedQueue = s_missQueue + 1;
+	static constexpr uint32_t s_queueCount = s_terminatedQueue + 1;
+
+	// Pixels of one Trace call beyond maxPathsInFlight are traced in several waves
+	explicit WavefrontPipeline(uint32_t maxPathsInFlight = 1 << 20);
+
+	inline uint32_t GetMaxPathsInFlight() const { return m_maxPaths; }
+	// Reordering only changes the order rays are traced in, never the image
+	inline void		SetRayReordering(bool enabled)	{ m_reorderRays = enabled; }
+	inline bool		GetRayReordering() const		{ return m_reorderRays; }
+	// Keeps the AOVSample of every camera ray's first hit, Extend fills it on the first bounce
+	inline void		SetFirstHitRecording(bool enabled)	{ m_recordFirstHit = enabled; }
+
+	// One sample for each of the pixelCount pixel indices of a width wide image.
+	// onPixelDone(pixel, radiance, firstHit) is called once per pixel from the worker threads, never twice for the same pixel.
+	// firstHit holds the defaults of AOVSample unless first hit recording is on.
+	template<typename PixelFunc>
+	void Trace(ThreadPool& pool, const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants, uint32_t width, const uint32_t* pixels, uint32_t pixelCount, PixelFunc&& onPixelDone);
+
+	inline const WavefrontStats&	GetStats() const	{ return m_stats; }
+	inline void						ResetStats()		{ m_stats = WavefrontStats(); }
+
+private:
+	// Traces one wave, the path states hold the radiance of every path afterwards
+	void TraceWave(ThreadPool& pool, const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants, uint32_t width, const uint32_t* pixels, uint32_t pathCount);
+
+	// STAGES
+	void Generate(ThreadPool& pool, const RTCameraSD& camera, const RTConstants& constants, uint32_t width, const uint32_t* pixels, uint32_t pathCount);
+	void Reorder(ThreadPool& pool, uint32_t activeCount);
+	void Extend(ThreadPool& pool, const RTScene& scene, uint32_t activeCount, bool cameraRays);
+	void Sort(ThreadPool& pool, uint32_t activeCount);
+	void Miss(ThreadPool& pool);
+	void Emit(ThreadPool& pool, const RTScene& scene, const RTConstants& constants);
+	void Shade(ThreadPool& pool, const RTScene& scene, const RTConstants& constants, uint32_t bounce);
+	void Connect(ThreadPool& pool, const RTScene& scene, const RTConstants& constants);
+
+	inline uint32_t ChunkCount(uint32_t count) const { return (count + s_chunkSize - 1) / s_chunkSize; }
+
+private:
+	// Rays per ParallelFor item
+	static constexpr uint32_t s_chunkSize = 2048;
+	// Origin cells per axis of the reorder keys, as bits of a Morton code
+	static constexpr uint32_t s_reorderCellBits = 4;
+
+	struct Path
+	{
+		PathState	State;
+		PathSampler	Sampler;
+		uint32_t	Pixel;
+		AOVSample	FirstHit;
+	};
+
+	uint32_t				m_maxPaths;
+	bool					m_reorderRays = false,
+							m_recordFirstHit = false;
+	WavefrontStats			m_stats;
+
+	// PER PATH, indexed by path
+	std::vector<Ray>		m_rays;
+	std::vector<Path>		m_paths;
+	std::vector<HitRecord>	m_hits;
+	std::vector<uint8_t>	m_pathQueue;
+	std::vector<ShadowRay>	m_shadowRays;
+
+	// PATH LISTS
+	std::vector<uint32_t>	m_active;
+	std::vector<uint32_t>	m_queue;
+	std::vector<uint32_t>	m_chunkOffsets;
+	// Reorder keys of the active list and their sorted copy
+	std::vector<uint16_t>	m_reorderKeys;
+	std::vector<uint16_t>	m_sortedKeys;
+	uint32_t				m_queueBegin[s_queueCount + 1] = {};
+};
+
+template<typename PixelFunc>
+void WavefrontPipeline::Trace(ThreadPool& pool, const RTScene& scene, const RTCameraSD& camera, const RTConstants& constants, uint32_t width, const uint32_t* pixels, uint32_t pixelCount, PixelFunc&& onPixelDone)
+{
+	for (uint32_t waveBegin = 0; waveBegin < pixelCount; waveBegin += m_maxPaths)
+	{
+		const uint32_t pathCount = std::min(m_maxPaths, pixelCount - waveBegin);
+		TraceWave(pool, scene, camera, constants, width, pixels + waveBegin, pathCount);
+
+		pool.ParallelFor(ChunkCount(pathCount), [&](uint32_t chunk, uint32_t threadIndex)
+		{
+			const uint32_t end = std::min(pathCount, (chunk + 1) * s_chunkSize);
+			for (uint32_t p = chunk * s_chunkSize; p < end; ++p)
+				onPixelDone(m_paths[p].Pixel, m_paths[p].State.Radiance, m_paths[p].FirstHit);
+		});
+	}
+}
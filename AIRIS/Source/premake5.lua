@@ -3,6 +3,8 @@ project "AIRIS"
 	language "C++"
 	cppdialect "C++20"
 	staticruntime "on"
+	-- SIMD kernels of the CPU ray tracer, see RT_SPHERE_SIMD_WIDTH
+	vectorextensions "AVX2"
 
 	targetdir (BinDir  .. "/%{prj.name}")
 	objdir (IntDir .. "/%{prj.name}")
@@ -44,6 +46,25 @@ project "AIRIS"
 			"d3dcompiler",
 		}
 
+	filter "system:linux"
+		-- No window or D3D12 on linux, only the platform independent parts used by the CPU ray tracer are built
+		removefiles
+		{
+			"Core/API/**",
+			"Core/Events/**",
+			"Core/Input/**",
+			"Core/Application.*",
+			"Core/Window.*",
+			"Core/Time.*",
+			"Core/Graphics/CameraController.*",
+			"Core/Graphics/FrameResource.*",
+			"Core/Graphics/Mesh.*",
+			"Core/Graphics/Renderer.*",
+			"Core/Graphics/RenderItem.hpp",
+			"Core/Graphics/RenderItemInstances.*",
+			"Utils/**",
+		}
+
 
 	filter "configurations:Debug"
 		
@@ -36,7 +36,12 @@ group "IMPL"
 	include "AIRIS/Source"
 
 group "Apps"
-	include "AIRIS/Apps/ComputeRT"
+	if os.istarget("windows") then
+		include "AIRIS/Apps/ComputeRT"
+	end
+	include "AIRIS/Apps/CPURT"
+	include "AIRIS/Apps/BatchRT"
+	include "AIRIS/Apps/RTBench"
 
 
 